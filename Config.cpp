@@ -166,6 +166,21 @@ namespace config {
 	   "Enable or disable elgamal precomputation table")
 	  ;
 	
+	options_description threads("Threads options");
+	threads.add_options()
+	  ("threads.tunnels", value<uint16_t>()->default_value(1), "Number of threads handling tunnel data messages (default: 1)")
+	  ("threads.tunnelbuild", value<uint16_t>()->default_value(1), "Number of threads decrypting transit tunnel build requests (default: 1)")
+	  ("threads.ntcp", value<uint16_t>()->default_value(1), "Number of threads handling NTCP sessions (default: 1)")
+	  ("threads.ssu", value<uint16_t>()->default_value(1), "Number of threads handling SSU sessions (default: 1)")
+	  ("threads.dhkeys", value<uint16_t>()->default_value(2), "Number of threads pre-generating DH keys, up to 4 (default: 2)")
+	  ;
+
+	options_description ntcp2("NTCP2 Options");
+	ntcp2.add_options()
+	  ("ntcp2.enabled", value<bool>()->default_value(false), "Enable NTCP2 (default: disabled)")
+	  ("ntcp2.port", value<uint16_t>()->default_value(0), "Port to listen for incoming NTCP2 connections (default: SSU port + 1)")
+	  ;
+
 	options_description reseed("Reseed options");	
 	reseed.add_options()
 	  ("reseed.verify", value<bool>()->default_value(false), "Verify .su3 signature")
@@ -231,6 +246,8 @@ namespace config {
       .add(i2pcontrol)
       .add(upnp)
 	  .add(precomputation)
+	  .add(threads)
+	  .add(ntcp2)
 	  .add(reseed) 
       .add(addressbook)	
       .add(trust)
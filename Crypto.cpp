@@ -2,13 +2,21 @@
 #include <string>
 #include <vector>
 #include <mutex>
+#include <atomic>
 #include <memory>
 #include <openssl/dh.h>
 #include <openssl/md5.h>
 #include <openssl/crypto.h>
 #include "TunnelBase.h"
 #include <openssl/ssl.h>
+#ifdef AESNI
+#include <wmmintrin.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "Log.h"
+#include "I2PEndian.h"
 #include "Crypto.h"
 
 namespace i2p
@@ -221,6 +229,78 @@ namespace crypto
 	}	
 
 	static BIGNUM * (* g_ElggTable)[255] = nullptr; 
+
+	// 4 bits windows for DH keys, 2M instead of 16M of g_ElggTable, used if g_ElggTable is not precalculated
+#if defined(__x86_64__)
+	const int DH_TABLE_NUM_WINDOWS = ELGAMAL_FULL_EXPONENT_NUM_BYTES*2;
+#else
+	const int DH_TABLE_NUM_WINDOWS = ELGAMAL_SHORT_EXPONENT_NUM_BYTES*2;
+#endif
+	static BN_MONT_CTX * g_DHMontCtx = nullptr;
+	static std::atomic<BIGNUM * (*)[15]> g_DHTable (nullptr); // g_DHTable[i][j] = elgg^((j+1)*16^i) in Montgomery form
+	static std::mutex g_DHTableMutex;
+
+	void PrecalculateDHTable ()
+	{
+		std::unique_lock<std::mutex> l(g_DHTableMutex);
+		if (g_ElggTable || g_DHTable) return;
+		BN_CTX * ctx = BN_CTX_new ();
+		g_DHMontCtx = BN_MONT_CTX_new ();
+		BN_MONT_CTX_set (g_DHMontCtx, elgp, ctx);
+		auto table = new BIGNUM * [DH_TABLE_NUM_WINDOWS][15];
+		for (int i = 0; i < DH_TABLE_NUM_WINDOWS; i++)
+		{
+			table[i][0] = BN_new ();
+			if (!i)
+				BN_to_montgomery (table[0][0], elgg, g_DHMontCtx, ctx);
+			else
+				BN_mod_mul_montgomery (table[i][0], table[i-1][14], table[i-1][0], g_DHMontCtx, ctx);
+			for (int j = 1; j < 15; j++)
+			{
+				table[i][j] = BN_new ();
+				BN_mod_mul_montgomery (table[i][j], table[i][j-1], table[i][0], g_DHMontCtx, ctx);
+			}
+		}
+		BN_CTX_free (ctx);
+		g_DHTable = table;
+	}
+
+	static void DestroyDHTable ()
+	{
+		std::unique_lock<std::mutex> l(g_DHTableMutex);
+		auto table = g_DHTable.exchange (nullptr);
+		if (!table) return;
+		for (int i = 0; i < DH_TABLE_NUM_WINDOWS; i++)
+			for (int j = 0; j < 15; j++)
+				BN_free (table[i][j]);
+		delete[] table;
+		BN_MONT_CTX_free (g_DHMontCtx); g_DHMontCtx = nullptr;
+	}
+
+	static BIGNUM * DHPow (const BIGNUM * exp, BIGNUM * table[][15], BN_CTX * ctx)
+	{
+		int len = BN_num_bytes (exp);
+		if (len <= 0 || len*2 > DH_TABLE_NUM_WINDOWS) return nullptr;
+		uint8_t * buf = new uint8_t[len];
+		BN_bn2bin (exp, buf); // Big Endian
+		auto montCtx = BN_MONT_CTX_new ();
+		BN_MONT_CTX_copy (montCtx, g_DHMontCtx);
+		BIGNUM * res = nullptr;
+		for (int i = 0; i < len*2; i++) // from lowest window
+		{
+			int w = (buf[len - 1 - i/2] >> ((i & 1) ? 4 : 0)) & 0x0F;
+			if (!w) continue;
+			if (res)
+				BN_mod_mul_montgomery (res, res, table[i][w-1], montCtx, ctx);
+			else
+				res = BN_dup (table[i][w-1]);
+		}
+		if (res)
+			BN_from_montgomery (res, res, montCtx, ctx);
+		BN_MONT_CTX_free (montCtx);
+		delete[] buf;
+		return res;
+	}
 	
 // DH
 	
@@ -243,14 +323,15 @@ namespace crypto
 		priv_key = BN_new ();
 		BN_rand (priv_key, ELGAMAL_SHORT_EXPONENT_NUM_BITS, 0, 1);
 #endif		
-		if (g_ElggTable)
+		auto dhTable = g_DHTable.load ();
+		if (g_ElggTable || dhTable)
 		{	
 #if defined(__x86_64__)
 			priv_key = BN_new ();
 			BN_rand (priv_key, ELGAMAL_FULL_EXPONENT_NUM_BITS, 0, 1);
 #endif			
 			auto ctx = BN_CTX_new ();
-			pub_key = ElggPow (priv_key, g_ElggTable, ctx);
+			pub_key = g_ElggTable ? ElggPow (priv_key, g_ElggTable, ctx) : DHPow (priv_key, dhTable, ctx);
 			DH_set0_key (m_DH, pub_key, priv_key);
 			BN_CTX_free (ctx);
 		}	
@@ -271,6 +352,134 @@ namespace crypto
 		BN_free (pk);
 	}	
 	
+#ifdef OPENSSL_X25519
+// X25519
+
+	X25519Keys::X25519Keys (): m_Pkey (nullptr)
+	{
+		memset (m_PublicKey, 0, 32);
+	}
+
+	X25519Keys::X25519Keys (const uint8_t * priv)
+	{
+		m_Pkey = EVP_PKEY_new_raw_private_key (EVP_PKEY_X25519, NULL, priv, 32);
+		ExtractPublicKey ();
+	}
+
+	X25519Keys::~X25519Keys ()
+	{
+		EVP_PKEY_free (m_Pkey);
+	}
+
+	void X25519Keys::GenerateKeys ()
+	{
+		EVP_PKEY_free (m_Pkey); 
+		m_Pkey = nullptr;
+		auto ctx = EVP_PKEY_CTX_new_id (EVP_PKEY_X25519, NULL);
+		EVP_PKEY_keygen_init (ctx);
+		EVP_PKEY_keygen (ctx, &m_Pkey);
+		EVP_PKEY_CTX_free (ctx);
+		ExtractPublicKey ();
+	}
+
+	void X25519Keys::ExtractPublicKey ()
+	{
+		size_t len = 32;
+		if (!m_Pkey || !EVP_PKEY_get_raw_public_key (m_Pkey, m_PublicKey, &len))
+			memset (m_PublicKey, 0, 32);
+	}
+
+	void X25519Keys::GetPrivateKey (uint8_t * priv) const
+	{
+		size_t len = 32;
+		if (!m_Pkey || !EVP_PKEY_get_raw_private_key (m_Pkey, priv, &len))
+			memset (priv, 0, 32);
+	}
+
+	bool X25519Keys::Agree (const uint8_t * pub, uint8_t * shared) const
+	{
+		if (!m_Pkey) return false;
+		auto peer = EVP_PKEY_new_raw_public_key (EVP_PKEY_X25519, NULL, pub, 32);
+		if (!peer) return false;
+		auto ctx = EVP_PKEY_CTX_new (m_Pkey, NULL);
+		size_t len = 32;
+		// derive fails if result is all zeroes
+		bool ret = EVP_PKEY_derive_init (ctx) > 0 && EVP_PKEY_derive_set_peer (ctx, peer) > 0 && 
+			EVP_PKEY_derive (ctx, shared, &len) > 0;
+		EVP_PKEY_CTX_free (ctx);
+		EVP_PKEY_free (peer);
+		return ret;
+	}
+#endif
+
+#ifdef OPENSSL_AEAD_CHACHA20_POLY1305
+// ChaCha20-Poly1305
+
+	bool AEADChaCha20Poly1305 (const uint8_t * msg, size_t msgLen, const uint8_t * ad, size_t adLen, 
+		const uint8_t * key, const uint8_t * nonce, uint8_t * buf, size_t len, bool encrypt)
+	{
+		if (encrypt ? len < msgLen + 16 : (msgLen < 16 || len < msgLen - 16)) return false;
+		auto ctx = EVP_CIPHER_CTX_new ();
+		int outlen = 0;
+		bool ret = true;
+		if (encrypt)
+		{
+			EVP_EncryptInit_ex (ctx, EVP_chacha20_poly1305 (), NULL, NULL, NULL);
+			EVP_CIPHER_CTX_ctrl (ctx, EVP_CTRL_AEAD_SET_IVLEN, 12, NULL);
+			EVP_EncryptInit_ex (ctx, NULL, NULL, key, nonce);
+			if (adLen) EVP_EncryptUpdate (ctx, NULL, &outlen, ad, adLen);
+			EVP_EncryptUpdate (ctx, buf, &outlen, msg, msgLen);
+			EVP_EncryptFinal_ex (ctx, buf + outlen, &outlen);
+			EVP_CIPHER_CTX_ctrl (ctx, EVP_CTRL_AEAD_GET_TAG, 16, buf + msgLen);
+		}
+		else
+		{
+			msgLen -= 16; // tag
+			EVP_DecryptInit_ex (ctx, EVP_chacha20_poly1305 (), NULL, NULL, NULL);
+			EVP_CIPHER_CTX_ctrl (ctx, EVP_CTRL_AEAD_SET_IVLEN, 12, NULL);
+			EVP_CIPHER_CTX_ctrl (ctx, EVP_CTRL_AEAD_SET_TAG, 16, (uint8_t *)msg + msgLen);
+			EVP_DecryptInit_ex (ctx, NULL, NULL, key, nonce);
+			if (adLen) EVP_DecryptUpdate (ctx, NULL, &outlen, ad, adLen);
+			EVP_DecryptUpdate (ctx, buf, &outlen, msg, msgLen);
+			ret = EVP_DecryptFinal_ex (ctx, buf + outlen, &outlen) > 0;
+		}
+		EVP_CIPHER_CTX_free (ctx);
+		return ret;
+	}
+#endif
+
+// SipHash
+
+	#define SIPROUND \
+		do { \
+			v0 += v1; v1 = (v1 << 13) | (v1 >> 51); v1 ^= v0; v0 = (v0 << 32) | (v0 >> 32); \
+			v2 += v3; v3 = (v3 << 16) | (v3 >> 48); v3 ^= v2; \
+			v0 += v3; v3 = (v3 << 21) | (v3 >> 43); v3 ^= v0; \
+			v2 += v1; v1 = (v1 << 17) | (v1 >> 47); v1 ^= v2; v2 = (v2 << 32) | (v2 >> 32); \
+		} while (0)
+
+	void Siphash24 (uint8_t * h, const uint8_t * buf, size_t len, const uint8_t * key)
+	{
+		uint64_t k0 = bufle64toh (key), k1 = bufle64toh (key + 8);
+		uint64_t v0 = 0x736f6d6570736575ULL ^ k0, v1 = 0x646f72616e646f6dULL ^ k1,
+			v2 = 0x6c7967656e657261ULL ^ k0, v3 = 0x7465646279746573ULL ^ k1;
+		const uint8_t * end = buf + (len & ~7);
+		for (; buf < end; buf += 8)
+		{
+			uint64_t m = bufle64toh (buf);
+			v3 ^= m; SIPROUND; SIPROUND; v0 ^= m;
+		}
+		// last block with length
+		uint64_t b = ((uint64_t)len) << 56;
+		for (size_t i = 0; i < (len & 7); i++)
+			b |= ((uint64_t)buf[i]) << (8*i);
+		v3 ^= b; SIPROUND; SIPROUND; v0 ^= b;
+		v2 ^= 0xff;
+		SIPROUND; SIPROUND; SIPROUND; SIPROUND;
+		htole64buf (h, v0 ^ v1 ^ v2 ^ v3);
+	}
+	#undef SIPROUND
+
 // ElGamal
 	void ElGamalEncrypt (const uint8_t * key, const uint8_t * data, uint8_t * encrypted, BN_CTX * ctx, bool zeroPadding)
 	{
@@ -439,6 +648,275 @@ namespace crypto
 		MD5((uint8_t *)hash, 96, digest);
 	}
 
+// MD5 compression function for one (uint32_t) or several (SSE2 lanes) independent states
+	static const uint32_t MD5_K[64] =
+	{
+		0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+		0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+		0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+		0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+		0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+		0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+		0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+		0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+	};
+	static const uint32_t MD5_IV[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+
+	struct MD5Word
+	{
+		typedef uint32_t Word;
+		static Word Set1 (uint32_t x) { return x; };
+		static Word Add (Word a, Word b) { return a + b; };
+		static Word And (Word a, Word b) { return a & b; };
+		static Word AndNot (Word a, Word b) { return ~a & b; };
+		static Word Or (Word a, Word b) { return a | b; };
+		static Word Xor (Word a, Word b) { return a ^ b; };
+		static Word OrNot (Word a, Word b) { return a | ~b; };
+		static Word Rotl (Word a, int s) { return (a << s) | (a >> (32 - s)); };
+	};
+
+#ifdef __SSE2__
+	struct MD5WordSSE2 // HMAC_MD5_NUM_LANES words
+	{
+		typedef __m128i Word;
+		static Word Set1 (uint32_t x) { return _mm_set1_epi32 (x); };
+		static Word Add (Word a, Word b) { return _mm_add_epi32 (a, b); };
+		static Word And (Word a, Word b) { return _mm_and_si128 (a, b); };
+		static Word AndNot (Word a, Word b) { return _mm_andnot_si128 (a, b); };
+		static Word Or (Word a, Word b) { return _mm_or_si128 (a, b); };
+		static Word Xor (Word a, Word b) { return _mm_xor_si128 (a, b); };
+		static Word OrNot (Word a, Word b) { return _mm_or_si128 (a, _mm_xor_si128 (b, _mm_set1_epi32 (-1))); };
+		static Word Rotl (Word a, int s) { return _mm_or_si128 (_mm_slli_epi32 (a, s), _mm_srli_epi32 (a, 32 - s)); };
+	};
+#endif
+
+	template<typename W>
+	static void MD5Transform (typename W::Word * state, const typename W::Word * w)
+	{
+		typename W::Word a = state[0], b = state[1], c = state[2], d = state[3];
+		#define F(x, y, z) W::Or (W::And (x, y), W::AndNot (x, z))
+		#define G(x, y, z) W::Or (W::And (z, x), W::AndNot (z, y))
+		#define H(x, y, z) W::Xor (W::Xor (x, y), z)
+		#define I(x, y, z) W::Xor (y, W::OrNot (x, z))
+		#define MD5Step(f, a, b, c, d, i, g, s) \
+			a = W::Add (b, W::Rotl (W::Add (W::Add (a, f (b, c, d)), W::Add (W::Set1 (MD5_K[i]), w[g])), s));
+		MD5Step (F, a, b, c, d, 0, 0, 7)
+		MD5Step (F, d, a, b, c, 1, 1, 12)
+		MD5Step (F, c, d, a, b, 2, 2, 17)
+		MD5Step (F, b, c, d, a, 3, 3, 22)
+		MD5Step (F, a, b, c, d, 4, 4, 7)
+		MD5Step (F, d, a, b, c, 5, 5, 12)
+		MD5Step (F, c, d, a, b, 6, 6, 17)
+		MD5Step (F, b, c, d, a, 7, 7, 22)
+		MD5Step (F, a, b, c, d, 8, 8, 7)
+		MD5Step (F, d, a, b, c, 9, 9, 12)
+		MD5Step (F, c, d, a, b, 10, 10, 17)
+		MD5Step (F, b, c, d, a, 11, 11, 22)
+		MD5Step (F, a, b, c, d, 12, 12, 7)
+		MD5Step (F, d, a, b, c, 13, 13, 12)
+		MD5Step (F, c, d, a, b, 14, 14, 17)
+		MD5Step (F, b, c, d, a, 15, 15, 22)
+		MD5Step (G, a, b, c, d, 16, 1, 5)
+		MD5Step (G, d, a, b, c, 17, 6, 9)
+		MD5Step (G, c, d, a, b, 18, 11, 14)
+		MD5Step (G, b, c, d, a, 19, 0, 20)
+		MD5Step (G, a, b, c, d, 20, 5, 5)
+		MD5Step (G, d, a, b, c, 21, 10, 9)
+		MD5Step (G, c, d, a, b, 22, 15, 14)
+		MD5Step (G, b, c, d, a, 23, 4, 20)
+		MD5Step (G, a, b, c, d, 24, 9, 5)
+		MD5Step (G, d, a, b, c, 25, 14, 9)
+		MD5Step (G, c, d, a, b, 26, 3, 14)
+		MD5Step (G, b, c, d, a, 27, 8, 20)
+		MD5Step (G, a, b, c, d, 28, 13, 5)
+		MD5Step (G, d, a, b, c, 29, 2, 9)
+		MD5Step (G, c, d, a, b, 30, 7, 14)
+		MD5Step (G, b, c, d, a, 31, 12, 20)
+		MD5Step (H, a, b, c, d, 32, 5, 4)
+		MD5Step (H, d, a, b, c, 33, 8, 11)
+		MD5Step (H, c, d, a, b, 34, 11, 16)
+		MD5Step (H, b, c, d, a, 35, 14, 23)
+		MD5Step (H, a, b, c, d, 36, 1, 4)
+		MD5Step (H, d, a, b, c, 37, 4, 11)
+		MD5Step (H, c, d, a, b, 38, 7, 16)
+		MD5Step (H, b, c, d, a, 39, 10, 23)
+		MD5Step (H, a, b, c, d, 40, 13, 4)
+		MD5Step (H, d, a, b, c, 41, 0, 11)
+		MD5Step (H, c, d, a, b, 42, 3, 16)
+		MD5Step (H, b, c, d, a, 43, 6, 23)
+		MD5Step (H, a, b, c, d, 44, 9, 4)
+		MD5Step (H, d, a, b, c, 45, 12, 11)
+		MD5Step (H, c, d, a, b, 46, 15, 16)
+		MD5Step (H, b, c, d, a, 47, 2, 23)
+		MD5Step (I, a, b, c, d, 48, 0, 6)
+		MD5Step (I, d, a, b, c, 49, 7, 10)
+		MD5Step (I, c, d, a, b, 50, 14, 15)
+		MD5Step (I, b, c, d, a, 51, 5, 21)
+		MD5Step (I, a, b, c, d, 52, 12, 6)
+		MD5Step (I, d, a, b, c, 53, 3, 10)
+		MD5Step (I, c, d, a, b, 54, 10, 15)
+		MD5Step (I, b, c, d, a, 55, 1, 21)
+		MD5Step (I, a, b, c, d, 56, 8, 6)
+		MD5Step (I, d, a, b, c, 57, 15, 10)
+		MD5Step (I, c, d, a, b, 58, 6, 15)
+		MD5Step (I, b, c, d, a, 59, 13, 21)
+		MD5Step (I, a, b, c, d, 60, 4, 6)
+		MD5Step (I, d, a, b, c, 61, 11, 10)
+		MD5Step (I, c, d, a, b, 62, 2, 15)
+		MD5Step (I, b, c, d, a, 63, 9, 21)
+		#undef MD5Step
+		#undef F
+		#undef G
+		#undef H
+		#undef I
+		state[0] = W::Add (state[0], a); state[1] = W::Add (state[1], b);
+		state[2] = W::Add (state[2], c); state[3] = W::Add (state[3], d);
+	}
+
+	static void MD5Block (uint32_t * state, const uint8_t * block)
+	{
+		uint32_t w[16];
+		for (int i = 0; i < 16; i++) w[i] = le32toh (buf32toh (block + 4*i));
+		MD5Transform<MD5Word> (state, w);
+	}
+
+	// pads tail of message of totalLen bytes, returns number of 64 bytes blocks in buf (1 or 2)
+	static size_t MD5PadTail (const uint8_t * tail, size_t tailLen, uint64_t totalLen, uint8_t * buf)
+	{
+		memcpy (buf, tail, tailLen);
+		buf[tailLen] = 0x80;
+		size_t numBlocks = (tailLen + 9 > 64) ? 2 : 1;
+		memset (buf + tailLen + 1, 0, numBlocks*64 - tailLen - 9);
+		htole64buf (buf + numBlocks*64 - 8, totalLen << 3); // in bits
+		return numBlocks;
+	}
+
+	static void MD5Digest (const uint32_t * state, uint8_t * digest)
+	{
+		for (int i = 0; i < 4; i++) htobuf32 (digest + 4*i, htole32 (state[i]));
+	}
+
+	static void HMACMD5Pads (const MACKey& key, uint64_t pad, uint8_t * block)
+	{
+		uint64_t * b = (uint64_t *)block;
+		for (int i = 0; i < 4; i++) b[i] = key.GetLL ()[i] ^ pad;
+		for (int i = 4; i < 8; i++) b[i] = pad;
+	}
+
+	HMACMD5::HMACMD5 (const MACKey& key): m_Key (key), m_Len (64)
+	{
+		memcpy (m_State, MD5_IV, 16);
+		uint64_t ipad[8];
+		HMACMD5Pads (key, IPAD, (uint8_t *)ipad);
+		MD5Block (m_State, (uint8_t *)ipad);
+	}
+
+	void HMACMD5::Update (const uint8_t * blocks, size_t numBlocks)
+	{
+		for (size_t i = 0; i < numBlocks; i++)
+			MD5Block (m_State, blocks + i*64);
+		m_Len += numBlocks*64;
+	}
+
+	void HMACMD5::Final (const uint8_t * tail, size_t len, uint8_t * digest)
+	{
+		size_t numBlocks = len >> 6;
+		Update (tail, numBlocks);
+		uint64_t buf[16];
+		numBlocks = MD5PadTail (tail + numBlocks*64, len & 0x3F, m_Len + (len & 0x3F), (uint8_t *)buf);
+		for (size_t i = 0; i < numBlocks; i++)
+			MD5Block (m_State, (uint8_t *)(buf + i*8));
+		// outer hash of opad, first hash and 16 zero bytes, 96 bytes
+		uint64_t hash[12];
+		HMACMD5Pads (m_Key, OPAD, (uint8_t *)hash);
+		MD5Digest (m_State, (uint8_t *)(hash + 8));
+		memset (hash + 10, 0, 16);
+		uint32_t state[4];
+		memcpy (state, MD5_IV, 16);
+		MD5Block (state, (uint8_t *)hash);
+		numBlocks = MD5PadTail ((uint8_t *)(hash + 8), 32, 96, (uint8_t *)buf);
+		MD5Block (state, (uint8_t *)buf);
+		MD5Digest (state, digest);
+	}
+
+#ifdef __SSE2__
+	// MD5 of 64 bytes prefix block followed by message, for HMAC_MD5_NUM_LANES messages
+	static void MD5PrefixedX4 (const uint8_t * const * prefixes, const uint8_t * const * msgs, const size_t * lens, uint8_t * const * digests)
+	{
+		const int n = HMAC_MD5_NUM_LANES;
+		uint8_t tails[n][128];
+		size_t numMsgBlocks[n], numBlocks[n], maxNumBlocks = 0;
+		for (int j = 0; j < n; j++)
+		{
+			numMsgBlocks[j] = lens[j] >> 6;
+			numBlocks[j] = 1 + numMsgBlocks[j] + MD5PadTail (msgs[j] + numMsgBlocks[j]*64, lens[j] & 0x3F, 64 + lens[j], tails[j]);
+			if (numBlocks[j] > maxNumBlocks) maxNumBlocks = numBlocks[j];
+		}
+		__m128i state[4];
+		for (int i = 0; i < 4; i++) state[i] = _mm_set1_epi32 (MD5_IV[i]);
+		for (size_t k = 0; k < maxNumBlocks; k++)
+		{
+			const uint8_t * blocks[n];
+			for (int j = 0; j < n; j++)
+			{
+				if (k >= numBlocks[j]) blocks[j] = tails[j]; // lane is done, result is not used
+				else if (!k) blocks[j] = prefixes[j];
+				else if (k <= numMsgBlocks[j]) blocks[j] = msgs[j] + (k - 1)*64;
+				else blocks[j] = tails[j] + (k - 1 - numMsgBlocks[j])*64;
+			}
+			__m128i w[16];
+			for (int i = 0; i < 16; i++) // x86 is little endian
+				w[i] = _mm_set_epi32 (*(const int32_t *)(blocks[3] + 4*i), *(const int32_t *)(blocks[2] + 4*i),
+					*(const int32_t *)(blocks[1] + 4*i), *(const int32_t *)(blocks[0] + 4*i));
+			MD5Transform<MD5WordSSE2> (state, w);
+			for (int j = 0; j < n; j++)
+				if (k + 1 == numBlocks[j])
+				{
+					uint32_t s[4][n];
+					for (int i = 0; i < 4; i++) _mm_storeu_si128 ((__m128i *)s[i], state[i]);
+					for (int i = 0; i < 4; i++) memcpy (digests[j] + 4*i, &s[i][j], 4);
+				}
+		}
+	}
+#endif
+
+	void HMACMD5Digest (size_t num, const uint8_t * const * msgs, const size_t * lens, 
+		const MACKey * const * keys, uint8_t * const * digests)
+	{
+#ifdef __SSE2__
+		const size_t n = HMAC_MD5_NUM_LANES;
+		while (num >= 2) // unused lanes repeat first message
+		{
+			uint64_t ipads[n][8], hashes[n][12];
+			const uint8_t * prefixes[n], * inner[n], * laneMsgs[n];
+			size_t laneLens[n], innerLens[n];
+			uint8_t * firstDigests[n], * laneDigests[n];
+			for (size_t j = 0; j < n; j++)
+			{
+				size_t i = j < num ? j : 0;
+				HMACMD5Pads (*keys[i], IPAD, (uint8_t *)ipads[j]);
+				HMACMD5Pads (*keys[i], OPAD, (uint8_t *)hashes[j]); 
+				memset (hashes[j] + 10, 0, 16);
+				prefixes[j] = (uint8_t *)ipads[j];
+				laneMsgs[j] = msgs[i]; laneLens[j] = lens[i];
+				firstDigests[j] = (uint8_t *)(hashes[j] + 8);
+				inner[j] = (uint8_t *)(hashes[j] + 8); innerLens[j] = 32; // first hash and zeros
+				laneDigests[j] = j < num ? digests[j] : (uint8_t *)ipads[j]; // ipad is not needed anymore
+			}
+			MD5PrefixedX4 (prefixes, laneMsgs, laneLens, firstDigests);
+			for (size_t j = 0; j < n; j++) prefixes[j] = (uint8_t *)hashes[j];
+			MD5PrefixedX4 (prefixes, inner, innerLens, laneDigests);
+			size_t done = num < n ? num : n;
+			num -= done; msgs += done; lens += done; keys += done; digests += done;
+		}
+#endif
+		for (size_t i = 0; i < num; i++)
+		{
+			HMACMD5 hmac (*keys[i]);
+			hmac.Final (msgs[i], lens[i], digests[i]);
+		}
+	}
+
 // AES
 	#ifdef AESNI
 	
@@ -651,9 +1129,58 @@ namespace crypto
 #endif
 	}
 
+#ifdef AESNI
+	// multiple independent streams are interleaved, so AES-NI pipeline is busy while CBC chain waits
+	template<size_t num>
+	static inline void EncryptAES256xN (__m128i * blocks, const __m128i * const * scheds)
+	{
+		for (size_t j = 0; j < num; j++) blocks[j] = _mm_xor_si128 (blocks[j], scheds[j][0]);
+		for (int r = 1; r < 14; r++)
+			for (size_t j = 0; j < num; j++) blocks[j] = _mm_aesenc_si128 (blocks[j], scheds[j][r]);
+		for (size_t j = 0; j < num; j++) blocks[j] = _mm_aesenclast_si128 (blocks[j], scheds[j][14]);
+	}
+
+	template<size_t num>
+	static inline void DecryptAES256xN (__m128i * blocks, const __m128i * const * scheds)
+	{
+		for (size_t j = 0; j < num; j++) blocks[j] = _mm_xor_si128 (blocks[j], scheds[j][14]);
+		for (int r = 13; r > 0; r--)
+			for (size_t j = 0; j < num; j++) blocks[j] = _mm_aesdec_si128 (blocks[j], scheds[j][r]);
+		for (size_t j = 0; j < num; j++) blocks[j] = _mm_aesdeclast_si128 (blocks[j], scheds[j][0]);
+	}
+
+	template<size_t num>
+	static inline void DecryptAES256xN (__m128i * blocks, const __m128i * sched) // same key
+	{
+		for (size_t j = 0; j < num; j++) blocks[j] = _mm_xor_si128 (blocks[j], sched[14]);
+		for (int r = 13; r > 0; r--)
+			for (size_t j = 0; j < num; j++) blocks[j] = _mm_aesdec_si128 (blocks[j], sched[r]);
+		for (size_t j = 0; j < num; j++) blocks[j] = _mm_aesdeclast_si128 (blocks[j], sched[0]);
+	}
+#endif
+
 	void CBCDecryption::Decrypt (int numBlocks, const ChipherBlock * in, ChipherBlock * out)
 	{
 #ifdef AESNI
+		// blocks don't depend on each other, keep AES-NI pipeline full
+		const __m128i * sched = (const __m128i *)m_ECBDecryption.GetKeySchedule ();
+		__m128i iv = _mm_loadu_si128 ((const __m128i *)(uint8_t *)m_IV);
+		while (numBlocks >= (int)CBC_DECRYPTION_NUM_INTERLEAVED)
+		{
+			__m128i blocks[CBC_DECRYPTION_NUM_INTERLEAVED], encrypted[CBC_DECRYPTION_NUM_INTERLEAVED];
+			for (size_t j = 0; j < CBC_DECRYPTION_NUM_INTERLEAVED; j++) 
+				blocks[j] = encrypted[j] = _mm_loadu_si128 ((const __m128i *)(in + j));
+			DecryptAES256xN<CBC_DECRYPTION_NUM_INTERLEAVED> (blocks, sched);
+			_mm_storeu_si128 ((__m128i *)out, _mm_xor_si128 (blocks[0], iv));
+			for (size_t j = 1; j < CBC_DECRYPTION_NUM_INTERLEAVED; j++) 
+				_mm_storeu_si128 ((__m128i *)(out + j), _mm_xor_si128 (blocks[j], encrypted[j - 1]));
+			iv = encrypted[CBC_DECRYPTION_NUM_INTERLEAVED - 1];
+			in += CBC_DECRYPTION_NUM_INTERLEAVED; out += CBC_DECRYPTION_NUM_INTERLEAVED;
+			numBlocks -= CBC_DECRYPTION_NUM_INTERLEAVED;
+		}
+		_mm_storeu_si128 ((__m128i *)(uint8_t *)m_IV, iv);
+		if (!numBlocks) return;
+		// remaining
 		__asm__
 		(
 			"movups	(%[iv]), %%xmm1 \n"
@@ -713,6 +1240,35 @@ namespace crypto
 #endif
 	}
 
+	bool HMACMD5DecryptIfValid (uint8_t * buf, size_t len, size_t tailLen, const MACKey& macKey, const uint8_t * mac,
+		const uint8_t * iv, CBCDecryption& decryption, CBCEncryption& encryption)
+	{
+		// hash each chunk before it gets decrypted in place, while it's in cache
+		HMACMD5 hmac (macKey);
+		decryption.SetIV (iv);
+		const size_t chunkSize = CBC_DECRYPTION_NUM_INTERLEAVED*16; // multiple of 64
+		size_t offset = 0;
+		while (offset + chunkSize <= len)
+		{
+			hmac.Update (buf + offset, chunkSize/64);
+			decryption.Decrypt (buf + offset, chunkSize, buf + offset);
+			offset += chunkSize;
+		}
+		uint8_t digest[16];
+		hmac.Final (buf + offset, len - offset + tailLen, digest);
+		if (memcmp (mac, digest, 16))
+		{
+			if (offset) // restore for other keys
+			{
+				encryption.SetIV (iv);
+				encryption.Encrypt (buf, offset, buf);
+			}
+			return false;
+		}
+		decryption.Decrypt (buf + offset, len - offset, buf + offset);
+		return true;
+	}
+
 	void TunnelEncryption::Encrypt (const uint8_t * in, uint8_t * out)
 	{
 #ifdef AESNI
@@ -786,6 +1342,100 @@ namespace crypto
 #endif
 	}	
 
+#ifdef AESNI
+	template<size_t num>
+	static void TunnelEncryptxN (const uint8_t * const * in, uint8_t * const * out,
+		const __m128i * const * ivScheds, const __m128i * const * layerScheds)
+	{
+		__m128i blocks[num], ivs[num];
+		// encrypt IV
+		for (size_t j = 0; j < num; j++) blocks[j] = _mm_loadu_si128 ((const __m128i *)in[j]);
+		EncryptAES256xN<num> (blocks, ivScheds);
+		for (size_t j = 0; j < num; j++) ivs[j] = blocks[j];
+		// encrypt data, CBC chain per message
+		for (size_t i = 16; i < 16 + i2p::tunnel::TUNNEL_DATA_ENCRYPTED_SIZE; i += 16)
+		{
+			for (size_t j = 0; j < num; j++) 
+				blocks[j] = _mm_xor_si128 (_mm_loadu_si128 ((const __m128i *)(in[j] + i)), blocks[j]);
+			EncryptAES256xN<num> (blocks, layerScheds);
+			for (size_t j = 0; j < num; j++) _mm_storeu_si128 ((__m128i *)(out[j] + i), blocks[j]);
+		}
+		// double IV encryption
+		EncryptAES256xN<num> (ivs, ivScheds);
+		for (size_t j = 0; j < num; j++) _mm_storeu_si128 ((__m128i *)out[j], ivs[j]);
+	}
+
+	template<size_t num>
+	static void TunnelDecryptxN (const uint8_t * const * in, uint8_t * const * out,
+		const __m128i * const * ivScheds, const __m128i * const * layerScheds)
+	{
+		__m128i blocks[num], prev[num], ivs[num];
+		// decrypt IV
+		for (size_t j = 0; j < num; j++) ivs[j] = _mm_loadu_si128 ((const __m128i *)in[j]);
+		DecryptAES256xN<num> (ivs, ivScheds);
+		for (size_t j = 0; j < num; j++) prev[j] = ivs[j];
+		// decrypt data, CBC chain per message
+		for (size_t i = 16; i < 16 + i2p::tunnel::TUNNEL_DATA_ENCRYPTED_SIZE; i += 16)
+		{
+			__m128i encrypted[num];
+			for (size_t j = 0; j < num; j++) blocks[j] = encrypted[j] = _mm_loadu_si128 ((const __m128i *)(in[j] + i));
+			DecryptAES256xN<num> (blocks, layerScheds);
+			for (size_t j = 0; j < num; j++) 
+			{
+				_mm_storeu_si128 ((__m128i *)(out[j] + i), _mm_xor_si128 (blocks[j], prev[j]));
+				prev[j] = encrypted[j];
+			}	
+		}
+		// double IV decryption
+		DecryptAES256xN<num> (ivs, ivScheds);
+		for (size_t j = 0; j < num; j++) _mm_storeu_si128 ((__m128i *)out[j], ivs[j]);
+	}
+#endif
+
+	void TunnelEncryption::Encrypt (size_t num, TunnelEncryption * const * encryptions, const uint8_t * const * in, uint8_t * const * out)
+	{
+#ifdef AESNI
+		size_t i = 0;
+		for (; i + TUNNEL_CRYPTO_NUM_INTERLEAVED <= num; i += TUNNEL_CRYPTO_NUM_INTERLEAVED)
+		{
+			const __m128i * ivScheds[TUNNEL_CRYPTO_NUM_INTERLEAVED], * layerScheds[TUNNEL_CRYPTO_NUM_INTERLEAVED];
+			for (size_t j = 0; j < TUNNEL_CRYPTO_NUM_INTERLEAVED; j++)
+			{
+				ivScheds[j] = (const __m128i *)encryptions[i + j]->m_IVEncryption.GetKeySchedule ();
+				layerScheds[j] = (const __m128i *)encryptions[i + j]->m_LayerEncryption.GetKeySchedule ();
+			}
+			TunnelEncryptxN<TUNNEL_CRYPTO_NUM_INTERLEAVED> (in + i, out + i, ivScheds, layerScheds);
+		}
+		for (; i < num; i++) // remaining
+			encryptions[i]->Encrypt (in[i], out[i]);
+#else
+		for (size_t i = 0; i < num; i++)
+			encryptions[i]->Encrypt (in[i], out[i]);
+#endif
+	}
+
+	void TunnelDecryption::Decrypt (size_t num, TunnelDecryption * const * decryptions, const uint8_t * const * in, uint8_t * const * out)
+	{
+#ifdef AESNI
+		size_t i = 0;
+		for (; i + TUNNEL_CRYPTO_NUM_INTERLEAVED <= num; i += TUNNEL_CRYPTO_NUM_INTERLEAVED)
+		{
+			const __m128i * ivScheds[TUNNEL_CRYPTO_NUM_INTERLEAVED], * layerScheds[TUNNEL_CRYPTO_NUM_INTERLEAVED];
+			for (size_t j = 0; j < TUNNEL_CRYPTO_NUM_INTERLEAVED; j++)
+			{
+				ivScheds[j] = (const __m128i *)decryptions[i + j]->m_IVDecryption.GetKeySchedule ();
+				layerScheds[j] = (const __m128i *)decryptions[i + j]->m_LayerDecryption.GetKeySchedule ();
+			}
+			TunnelDecryptxN<TUNNEL_CRYPTO_NUM_INTERLEAVED> (in + i, out + i, ivScheds, layerScheds);
+		}
+		for (; i < num; i++) // remaining
+			decryptions[i]->Decrypt (in[i], out[i]);
+#else
+		for (size_t i = 0; i < num; i++)
+			decryptions[i]->Decrypt (in[i], out[i]);
+#endif
+	}
+
 /*	std::vector <std::unique_ptr<std::mutex> >  m_OpenSSLMutexes;
 	static void OpensslLockingCallback(int mode, int type, const char * file, int line)
 	{
@@ -831,6 +1481,7 @@ namespace crypto
 			);   
 			delete[] g_ElggTable; g_ElggTable = nullptr;
 		}	
+		DestroyDHTable ();
 /*		CRYPTO_set_locking_callback (nullptr);
 		m_OpenSSLMutexes.clear ();*/
 	}	
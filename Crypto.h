@@ -13,10 +13,16 @@
 #include <openssl/evp.h>
 #include <openssl/rand.h>
 #include <openssl/engine.h>
+#include <openssl/opensslv.h>
 
 #include "Base.h"
 #include "Tag.h"
 
+#if (OPENSSL_VERSION_NUMBER >= 0x010101000) && !defined(LIBRESSL_VERSION_NUMBER) // 1.1.1
+#	define OPENSSL_X25519 1
+#	define OPENSSL_AEAD_CHACHA20_POLY1305 1
+#endif
+
 namespace i2p
 {
 namespace crypto
@@ -46,6 +52,34 @@ namespace crypto
 			DH * m_DH;
 			uint8_t m_PublicKey[256];
 	};	
+
+#ifdef OPENSSL_X25519
+	// X25519
+	class X25519Keys
+	{
+		public:
+
+			X25519Keys ();
+			X25519Keys (const uint8_t * priv); // static keys
+			~X25519Keys ();
+
+			void GenerateKeys ();
+			const uint8_t * GetPublicKey () const { return m_PublicKey; };
+			void GetPrivateKey (uint8_t * priv) const;
+			bool Agree (const uint8_t * pub, uint8_t * shared) const; // false if shared secret is zero
+
+		private:
+
+			void ExtractPublicKey ();
+
+		private:
+
+			EVP_PKEY * m_Pkey;
+			uint8_t m_PublicKey[32];
+	};
+#else
+	class X25519Keys; // requires OpenSSL 1.1.1
+#endif
 	
 	// ElGamal
 	void ElGamalEncrypt (const uint8_t * key, const uint8_t * data, uint8_t * encrypted, BN_CTX * ctx, bool zeroPadding = false);
@@ -55,6 +89,36 @@ namespace crypto
 	// HMAC
 	typedef i2p::data::Tag<32> MACKey;		
 	void HMACMD5Digest (uint8_t * msg, size_t len, const MACKey& key, uint8_t * digest);
+	// num independent messages at once, multi-buffer MD5 with SSE2, keys might be different
+	const size_t HMAC_MD5_NUM_LANES = 4;
+	void HMACMD5Digest (size_t num, const uint8_t * const * msgs, const size_t * lens, 
+		const MACKey * const * keys, uint8_t * const * digests);
+
+	// same as HMACMD5Digest, but computed by 64 bytes blocks, caller can process data between them
+	class HMACMD5
+	{
+		public:
+
+			HMACMD5 (const MACKey& key);
+			void Update (const uint8_t * blocks, size_t numBlocks); // 64 bytes each
+			void Final (const uint8_t * tail, size_t len, uint8_t * digest); // the rest of message, any length
+
+		private:
+
+			const MACKey& m_Key;
+			uint32_t m_State[4];
+			uint64_t m_Len; // processed, including ipad block
+	};
+
+#ifdef OPENSSL_AEAD_CHACHA20_POLY1305
+	// ChaCha20-Poly1305 AEAD, RFC 7539
+	// encrypt: buf has len = msgLen + 16 bytes, decrypt: msgLen includes 16 bytes of tag 
+	bool AEADChaCha20Poly1305 (const uint8_t * msg, size_t msgLen, const uint8_t * ad, size_t adLen, 
+		const uint8_t * key, const uint8_t * nonce, uint8_t * buf, size_t len, bool encrypt);
+#endif
+
+	// SipHash-2-4, 8 bytes output, key is 16 bytes
+	void Siphash24 (uint8_t * h, const uint8_t * buf, size_t len, const uint8_t * key);
 
 	// AES
 	struct ChipherBlock	
@@ -235,6 +299,14 @@ namespace crypto
 			ECBDecryption m_ECBDecryption;
 	};	
 
+	const size_t TUNNEL_CRYPTO_NUM_INTERLEAVED = 4; // independent messages processed through AES rounds at once
+	const size_t CBC_DECRYPTION_NUM_INTERLEAVED = 8; // blocks of the same chain decrypted at once
+
+	// HMAC-MD5 of len + tailLen bytes is checked while first len bytes get decrypted in place, in one pass
+	// buf is unchanged if MAC doesn't match
+	bool HMACMD5DecryptIfValid (uint8_t * buf, size_t len, size_t tailLen, const MACKey& macKey, const uint8_t * mac,
+		const uint8_t * iv, CBCDecryption& decryption, CBCEncryption& encryption);
+
 	class TunnelEncryption // with double IV encryption
 	{
 		public:
@@ -246,6 +318,8 @@ namespace crypto
 			}	
 
 			void Encrypt (const uint8_t * in, uint8_t * out); // 1024 bytes (16 IV + 1008 data)		
+			// num messages, each with own encryption (might be the same), in and out might be the same
+			static void Encrypt (size_t num, TunnelEncryption * const * encryptions, const uint8_t * const * in, uint8_t * const * out);
 
 		private:
 
@@ -268,6 +342,8 @@ namespace crypto
 			}			
 
 			void Decrypt (const uint8_t * in, uint8_t * out); // 1024 bytes (16 IV + 1008 data)	
+			// num messages, each with own decryption (might be the same), in and out might be the same
+			static void Decrypt (size_t num, TunnelDecryption * const * decryptions, const uint8_t * const * in, uint8_t * const * out);
 
 		private:
 
@@ -281,6 +357,7 @@ namespace crypto
 	
 	void InitCrypto (bool precomputation);
 	void TerminateCrypto ();
+	void PrecalculateDHTable (); // for DHKeys, if not precalculated by InitCrypto
 }		
 }	
 
@@ -140,11 +140,37 @@ namespace i2p
 			}
 			i2p::context.SetSupportsV6		 (ipv6);
 			i2p::context.SetSupportsV4		 (ipv4);
+
+			bool ntcp2; i2p::config::GetOption("ntcp2.enabled", ntcp2);
+#ifndef NTCP2_SUPPORTED
+			if (ntcp2)
+			{
+				LogPrint(eLogError, "Daemon: NTCP2 requires OpenSSL 1.1.1, disabled");
+				ntcp2 = false;
+			}
+#endif
+			if (ntcp2)
+			{
+				uint16_t ntcp2port; i2p::config::GetOption("ntcp2.port", ntcp2port);
+				i2p::context.PublishNTCP2Address (ntcp2port);
+			}
+			else
+				i2p::context.RemoveNTCP2Address ();
 			
 			bool transit; i2p::config::GetOption("notransit", transit);
 			i2p::context.SetAcceptsTunnels (!transit);
 			uint16_t transitTunnels; i2p::config::GetOption("limits.transittunnels", transitTunnels);
 			SetMaxNumTransitTunnels (transitTunnels);
+			uint16_t tunnelsThreads; i2p::config::GetOption("threads.tunnels", tunnelsThreads);
+			i2p::tunnel::tunnels.SetNumShards (tunnelsThreads);
+			uint16_t tunnelBuildThreads; i2p::config::GetOption("threads.tunnelbuild", tunnelBuildThreads);
+			i2p::tunnel::tunnels.SetNumBuildWorkers (tunnelBuildThreads);
+			uint16_t ntcpThreads; i2p::config::GetOption("threads.ntcp", ntcpThreads);
+			i2p::transport::transports.SetNumNTCPThreads (ntcpThreads);
+			uint16_t ssuThreads; i2p::config::GetOption("threads.ssu", ssuThreads);
+			i2p::transport::transports.SetNumSSUThreads (ssuThreads);
+			uint16_t dhKeysThreads; i2p::config::GetOption("threads.dhkeys", dhKeysThreads);
+			i2p::transport::transports.SetNumDHKeysThreads (dhKeysThreads);
 
 			bool isFloodfill; i2p::config::GetOption("floodfill", isFloodfill);
 			if (isFloodfill) {
@@ -257,11 +283,16 @@ namespace i2p
 
 			bool ntcp; i2p::config::GetOption("ntcp", ntcp);
 			bool ssu; i2p::config::GetOption("ssu", ssu);
+			bool ntcp2; i2p::config::GetOption("ntcp2.enabled", ntcp2);
+#ifndef NTCP2_SUPPORTED
+			ntcp2 = false;
+#endif
 			LogPrint(eLogInfo, "Daemon: starting Transports");
 			if(!ssu) LogPrint(eLogInfo, "Daemon: ssu disabled");
 			if(!ntcp) LogPrint(eLogInfo, "Daemon: ntcp disabled");
-			i2p::transport::transports.Start(ntcp, ssu);
-			if (i2p::transport::transports.IsBoundNTCP() || i2p::transport::transports.IsBoundSSU()) {
+			if(ntcp2) LogPrint(eLogInfo, "Daemon: ntcp2 enabled");
+			i2p::transport::transports.Start(ntcp, ssu, ntcp2);
+			if (i2p::transport::transports.IsBoundNTCP() || i2p::transport::transports.IsBoundSSU() || i2p::transport::transports.IsBoundNTCP2()) {
 				LogPrint(eLogInfo, "Daemon: Transports started");
 			} else {
 				LogPrint(eLogError, "Daemon: failed to start Transports");
@@ -287,6 +287,24 @@ namespace client
 		}		
 	}	
 
+	void LeaseSetDestination::HandleI2NPMessage (std::shared_ptr<I2NPMessage> msg)
+	{
+		switch (msg->GetTypeID ())
+		{	
+			case eI2NPDeliveryStatus:
+				// we assume tunnel tests non-encrypted
+				HandleDeliveryStatusMessage (msg);
+			break;	
+			case eI2NPData:
+			case eI2NPDatabaseStore:
+			case eI2NPDatabaseSearchReply:
+				HandleI2NPMessage (msg->GetBuffer (), msg->GetLength (), msg->from);
+			break;	
+			default:
+				i2p::HandleI2NPMessage (msg);
+		}		
+	}	
+
 	void LeaseSetDestination::HandleDatabaseStoreMessage (const uint8_t * buf, size_t len)
 	{
 		uint32_t replyToken = bufbe32toh (buf + DATABASE_STORE_REPLY_TOKEN_OFFSET);
@@ -445,7 +445,7 @@ namespace garlic
 				SHA256(buf, 32, iv);
 				decryption->SetIV (iv);
 				decryption->Decrypt (buf + 32, length - 32, buf + 32);
-				HandleAESBlock (buf + 32, length - 32, decryption, msg->from);
+				HandleAESBlock (buf + 32, length - 32, decryption, msg);
 			}	
 			else
 				LogPrint (eLogWarning, "Garlic: message length ", length, " is less than 32 bytes");
@@ -461,7 +461,7 @@ namespace garlic
 				SHA256(elGamal.preIV, 32, iv); 
 				decryption->SetIV (iv);
 				decryption->Decrypt(buf + 514, length - 514, buf + 514);
-				HandleAESBlock (buf + 514, length - 514, decryption, msg->from);
+				HandleAESBlock (buf + 514, length - 514, decryption, msg);
 			}	
 			else
 				LogPrint (eLogError, "Garlic: Failed to decrypt message");
@@ -469,7 +469,7 @@ namespace garlic
 	}	
 
 	void GarlicDestination::HandleAESBlock (uint8_t * buf, size_t len, std::shared_ptr<AESDecryption> decryption,
-		std::shared_ptr<i2p::tunnel::InboundTunnel> from)
+		std::shared_ptr<I2NPMessage> msg)
 	{
 		uint16_t tagCount = bufbe16toh (buf);
 		buf += 2; len -= 2;	
@@ -507,17 +507,20 @@ namespace garlic
 			LogPrint (eLogError, "Garlic: wrong payload hash");
 			return;
 		}		    
-		HandleGarlicPayload (buf, payloadSize, from);
+		HandleGarlicPayload (buf, payloadSize, msg);
 	}	
 
-	void GarlicDestination::HandleGarlicPayload (uint8_t * buf, size_t len, std::shared_ptr<i2p::tunnel::InboundTunnel> from)
+	void GarlicDestination::HandleGarlicPayload (uint8_t * buf, size_t len, std::shared_ptr<I2NPMessage> msg)
 	{
+		auto from = msg->from;
 		const uint8_t * buf1 = buf;
 		int numCloves = buf[0];
 		LogPrint (eLogDebug, "Garlic: ", numCloves," cloves");
 		buf++;
 		for (int i = 0; i < numCloves; i++)
 		{
+			// previous cloves are processed or copied already, so the last one can use the rest of garlic buffer
+			bool isLastClove = (i == numCloves - 1);
 			// delivery instructions
 			uint8_t flag = buf[0];
 			buf++; // flag
@@ -532,12 +535,18 @@ namespace garlic
 			{
 				case eGarlicDeliveryTypeLocal:
 					LogPrint (eLogDebug, "Garlic: type local");
-					HandleI2NPMessage (buf, len, from);
+					if (isLastClove)
+						HandleI2NPMessage (CreateI2NPMessageView (msg, buf, GetI2NPMessageLength (buf), buf - msg->buf, from));
+					else
+						HandleI2NPMessage (buf, len, from);
 				break;	
 				case eGarlicDeliveryTypeDestination:	
 					LogPrint (eLogDebug, "Garlic: type destination");
 					buf += 32; // destination. check it later or for multiple destinations
-					HandleI2NPMessage (buf, len, from);
+					if (isLastClove)
+						HandleI2NPMessage (CreateI2NPMessageView (msg, buf, GetI2NPMessageLength (buf), buf - msg->buf, from));
+					else
+						HandleI2NPMessage (buf, len, from);
 				break;
 				case eGarlicDeliveryTypeTunnel:
 				{	
@@ -547,7 +556,9 @@ namespace garlic
 					buf += 32;
 					uint32_t gwTunnel = bufbe32toh (buf);
 					buf += 4;
-					auto msg = CreateI2NPMessage (buf, GetI2NPMessageLength (buf), from);
+					auto cloveMsg = isLastClove ? 
+						CreateI2NPMessageView (msg, buf, GetI2NPMessageLength (buf), buf - msg->buf, from) :
+						CreateI2NPMessage (buf, GetI2NPMessageLength (buf), from);
 					if (from) // received through an inbound tunnel
 					{
 						std::shared_ptr<i2p::tunnel::OutboundTunnel> tunnel;
@@ -556,12 +567,12 @@ namespace garlic
 						else
 							LogPrint (eLogError, "Garlic: Tunnel pool is not set for inbound tunnel");
 						if (tunnel) // we have send it through an outbound tunnel
-							tunnel->SendTunnelDataMsg (gwHash, gwTunnel, msg);
+							tunnel->SendTunnelDataMsg (gwHash, gwTunnel, cloveMsg);
 						else
 							LogPrint (eLogWarning, "Garlic: No outbound tunnels available for garlic clove");
 					}
 					else // received directly
-						i2p::transport::transports.SendMessage (gwHash, i2p::CreateTunnelGatewayMsg (gwTunnel, msg)); // send directly
+						i2p::transport::transports.SendMessage (gwHash, i2p::CreateTunnelGatewayMsg (gwTunnel, cloveMsg)); // send directly
 					break;
 				}
 				case eGarlicDeliveryTypeRouter:
@@ -569,7 +580,8 @@ namespace garlic
 					uint8_t * ident = buf;
 					buf += 32;
 					if (!from) // received directly
-						i2p::transport::transports.SendMessage (ident,
+						i2p::transport::transports.SendMessage (ident, isLastClove ?
+							CreateI2NPMessageView (msg, buf, GetI2NPMessageLength (buf), buf - msg->buf) : 
 							CreateI2NPMessage (buf, GetI2NPMessageLength (buf)));
 					else
 						LogPrint (eLogWarning, "Garlic: type router for inbound tunnels not supported");
@@ -191,6 +191,7 @@ namespace garlic
 			virtual std::shared_ptr<const i2p::data::LocalLeaseSet> GetLeaseSet () = 0; // TODO
 			virtual std::shared_ptr<i2p::tunnel::TunnelPool> GetTunnelPool () const = 0;
 			virtual void HandleI2NPMessage (const uint8_t * buf, size_t len, std::shared_ptr<i2p::tunnel::InboundTunnel> from) = 0;
+			virtual void HandleI2NPMessage (std::shared_ptr<I2NPMessage> msg) = 0; // view of garlic message, no copy needed
 			
 		protected:
 
@@ -203,8 +204,8 @@ namespace garlic
 		private:
 
 			void HandleAESBlock (uint8_t * buf, size_t len, std::shared_ptr<AESDecryption> decryption, 
-				std::shared_ptr<i2p::tunnel::InboundTunnel> from);
-			void HandleGarlicPayload (uint8_t * buf, size_t len, std::shared_ptr<i2p::tunnel::InboundTunnel> from);
+				std::shared_ptr<I2NPMessage> msg);
+			void HandleGarlicPayload (uint8_t * buf, size_t len, std::shared_ptr<I2NPMessage> msg);
 
 		private:
 
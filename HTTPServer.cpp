@@ -230,6 +230,9 @@ namespace http {
 		else
 			s << numKBytesSent / 1024 / 1024 << " GiB";
 		s << " (" << (double) i2p::transport::transports.GetOutBandwidth () / 1024 << " KiB/s)<br>\r\n";
+		auto& dhKeys = i2p::transport::transports.GetDHKeysPairSupplier ();
+		s << "<b>DH keys:</b> " << dhKeys.GetPoolSize () << "/" << dhKeys.GetTargetPoolSize () << " pooled, "
+			<< dhKeys.GetNumHits () << " hits, " << dhKeys.GetNumMisses () << " misses<br>\r\n";
 		s << "<b>Data path:</b> " << i2p::fs::GetDataDir() << "<br>\r\n";
 		s << "<div class='slide'\r\n><label for='slide1'>Hidden content. Press on text to see.</label>\r\n<input type='checkbox' id='slide1'/>\r\n<p class='content'>\r\n";
 		s << "<b>Router Ident:</b> " << i2p::context.GetRouterInfo().GetIdentHashBase64() << "<br>\r\n";
@@ -246,6 +249,12 @@ namespace http {
 					else
 						s << "NTCP&nbsp;&nbsp;";
 				break;
+				case i2p::data::RouterInfo::eTransportNTCP2:
+					if (address->host.is_v6 ())
+						s << "NTCP2_6&nbsp;&nbsp;";
+					else
+						s << "NTCP2&nbsp;&nbsp;";
+				break;
 				case i2p::data::RouterInfo::eTransportSSU:
 					if (address->host.is_v6 ())
 						s << "SSU6&nbsp;&nbsp;&nbsp;&nbsp;&nbsp;";
@@ -431,7 +440,21 @@ namespace http {
 
 	static void ShowTunnels (std::stringstream& s)
 	{
-		s << "<b>Queue size:</b> " << i2p::tunnel::tunnels.GetQueueSize () << "<br>\r\n";
+		s << "<b>Queue size:</b> " << i2p::tunnel::tunnels.GetQueueSize ();
+		size_t numShards = i2p::tunnel::tunnels.GetNumShards ();
+		for (size_t i = 0; i < numShards; i++)
+			s << (i ? ", " : " / ") << i2p::tunnel::tunnels.GetShardQueueSize (i);
+		s << "<br>\r\n";
+		s << "<b>Build requests backlog:</b> " << i2p::tunnel::tunnels.GetBuildBacklogSize ()
+		  << " (dropped " << i2p::tunnel::tunnels.GetNumDroppedBuildRequests () << ")<br>\r\n";
+		const char * sizeClasses[] = { "tunnel", "short", "full" };
+		s << "<b>I2NP buffers (live/peak/recycled):</b>";
+		for (int i = 0; i < i2p::eNumI2NPMessageSizeClasses; i++)
+		{
+			auto stats = i2p::GetI2NPMessagesPoolStats ((i2p::I2NPMessageSizeClass)i);
+			s << " " << sizeClasses[i] << " " << stats.live << "/" << stats.peak << "/" << stats.recycled;
+		}
+		s << "<br>\r\n";
 
 		s << "<b>Inbound tunnels:</b><br>\r\n";
 		for (auto & it : i2p::tunnel::tunnels.GetInboundTunnels ()) {
@@ -488,6 +511,22 @@ namespace http {
 		}
 	}
 
+	static void ShowSendQueue (std::stringstream& s, const i2p::transport::TransportSendQueue& queue)
+	{
+		uint64_t numDropped = 0;
+		for (int i = 0; i < i2p::transport::eNumSendQueueClasses; i++)
+			numDropped += queue.GetNumDropped ((i2p::transport::SendQueueClass)i);
+		if (queue.IsEmpty () && !numDropped) return;
+		// control/build/netdb/data
+		s << " [queue:";
+		for (int i = 0; i < i2p::transport::eNumSendQueueClasses; i++)
+			s << (i ? "/" : "") << queue.GetSize ((i2p::transport::SendQueueClass)i);
+		s << " dropped:";
+		for (int i = 0; i < i2p::transport::eNumSendQueueClasses; i++)
+			s << (i ? "/" : "") << queue.GetNumDropped ((i2p::transport::SendQueueClass)i);
+		s << "]";
+	}
+
 	static void ShowTransports (std::stringstream& s)
 	{
 		s << "<b>Transports:</b><br>\r\n<br>\r\n";
@@ -506,10 +545,33 @@ namespace http {
 						<< it.second->GetSocket ().remote_endpoint().address ().to_string ();
 					if (!it.second->IsOutgoing ()) s << " &#8658; ";
 					s << " [" << it.second->GetNumSentBytes () << ":" << it.second->GetNumReceivedBytes () << "]";
+					ShowSendQueue (s, it.second->GetSendQueue ());
+					s << "<br>\r\n" << std::endl;
+				}
+			}
+		}
+#ifdef NTCP2_SUPPORTED
+		auto ntcp2Server = i2p::transport::transports.GetNTCP2Server ();
+		if (ntcp2Server)
+		{
+			auto sessions = ntcp2Server->GetNTCP2Sessions ();
+			s << "<br>\r\n<b>NTCP2</b> ( " << (int) sessions.size() << " )<br>\r\n";
+			for (const auto& it: sessions )
+			{
+				if (it.second && it.second->IsEstablished ())
+				{
+					boost::system::error_code ec;
+					if (it.second->IsOutgoing ()) s << " &#8658; ";
+					s << i2p::data::GetIdentHashAbbreviation (it.second->GetRemoteIdentity ()->GetIdentHash ()) <<  ": "
+						<< it.second->GetSocket ().remote_endpoint(ec).address ().to_string ();
+					if (!it.second->IsOutgoing ()) s << " &#8658; ";
+					s << " [" << it.second->GetNumSentBytes () << ":" << it.second->GetNumReceivedBytes () << "]";
+					ShowSendQueue (s, it.second->GetSendQueue ());
 					s << "<br>\r\n" << std::endl;
 				}
 			}
 		}
+#endif
 		auto ssuServer = i2p::transport::transports.GetSSUServer ();
 		if (ssuServer)
 		{
@@ -524,6 +586,7 @@ namespace http {
 				s << " [" << it.second->GetNumSentBytes () << ":" << it.second->GetNumReceivedBytes () << "]";
 				if (it.second->GetRelayTag ())
 					s << " [itag:" << it.second->GetRelayTag () << "]";
+				ShowSendQueue (s, it.second->GetSendQueue ());
 				s << "<br>\r\n" << std::endl;
 			}
 			s << "<br>\r\n<b>SSU6</b><br>\r\n";
@@ -534,6 +597,7 @@ namespace http {
 				s << endpoint.address ().to_string () << ":" << endpoint.port ();
 				if (!it.second->IsOutgoing ()) s << " &#8658; ";
 				s << " [" << it.second->GetNumSentBytes () << ":" << it.second->GetNumReceivedBytes () << "]";
+				ShowSendQueue (s, it.second->GetSendQueue ());
 				s << "<br>\r\n" << std::endl;
 			}
 		}
@@ -17,21 +17,47 @@ using namespace i2p::transport;
 
 namespace i2p
 {
+	typedef I2NPMessageBuffer<i2p::tunnel::TUNNEL_DATA_MSG_SIZE + I2NP_HEADER_SIZE + 34> I2NPTunnelMessageBuffer; // reserved for alignment and NTCP 16 + 6 + 12
+	typedef I2NPMessageBuffer<I2NP_MAX_SHORT_MESSAGE_SIZE> I2NPShortMessageBuffer;
+	typedef I2NPMessageBuffer<I2NP_MAX_MESSAGE_SIZE> I2NPFullMessageBuffer;
+
+	// chunk holds shared_ptr's control block and message buffer together
+	template<class Buffer, size_t maxCached>
+	using I2NPMessagesAllocator = i2p::util::ThreadCachedAllocator<Buffer, sizeof (Buffer) + 64, maxCached, Buffer>;
+	typedef I2NPMessagesAllocator<I2NPTunnelMessageBuffer, 512> I2NPTunnelMessagesAllocator;
+	typedef I2NPMessagesAllocator<I2NPShortMessageBuffer, 128> I2NPShortMessagesAllocator;
+	typedef I2NPMessagesAllocator<I2NPFullMessageBuffer, 16> I2NPFullMessagesAllocator;
+
+	i2p::util::MemoryPoolStats GetI2NPMessagesPoolStats (I2NPMessageSizeClass sizeClass)
+	{
+		switch (sizeClass)
+		{
+			case eI2NPMessageSizeClassTunnel:
+				return I2NPTunnelMessagesAllocator::Pool::GetStats ();
+			case eI2NPMessageSizeClassShort:
+				return I2NPShortMessagesAllocator::Pool::GetStats ();
+			case eI2NPMessageSizeClassFull:
+				return I2NPFullMessagesAllocator::Pool::GetStats ();
+			default:
+				return { 0, 0, 0 };
+		}
+	}
+
 	std::shared_ptr<I2NPMessage> NewI2NPMessage ()
 	{
-		return std::make_shared<I2NPMessageBuffer<I2NP_MAX_MESSAGE_SIZE> >();
+		return std::allocate_shared<I2NPFullMessageBuffer> (I2NPFullMessagesAllocator ());
 	}
 	
 	std::shared_ptr<I2NPMessage> NewI2NPShortMessage ()
 	{
-		return std::make_shared<I2NPMessageBuffer<I2NP_MAX_SHORT_MESSAGE_SIZE> >();
+		return std::allocate_shared<I2NPShortMessageBuffer> (I2NPShortMessagesAllocator ());
 	}
 
 	std::shared_ptr<I2NPMessage> NewI2NPTunnelMessage ()
 	{
-		auto msg = new I2NPMessageBuffer<i2p::tunnel::TUNNEL_DATA_MSG_SIZE + I2NP_HEADER_SIZE + 34>(); // reserved for alignment and NTCP 16 + 6 + 12
+		auto msg = std::allocate_shared<I2NPTunnelMessageBuffer> (I2NPTunnelMessagesAllocator ());
 		msg->Align (12);
-		return std::shared_ptr<I2NPMessage>(msg);
+		return msg;
 	}	
 	
 	std::shared_ptr<I2NPMessage> NewI2NPMessage (size_t len)
@@ -75,7 +101,7 @@ namespace i2p
 
 	std::shared_ptr<I2NPMessage> CreateI2NPMessage (const uint8_t * buf, size_t len, std::shared_ptr<i2p::tunnel::InboundTunnel> from)
 	{
-		auto msg = NewI2NPMessage ();
+		auto msg = NewI2NPMessage (len);
 		if (msg->offset + len < msg->maxLen)
 		{
 			memcpy (msg->GetBuffer (), buf, len);
@@ -87,6 +113,22 @@ namespace i2p
 		return msg;
 	}	
 
+	std::shared_ptr<I2NPMessage> CreateI2NPMessageView (std::shared_ptr<I2NPMessage> parent, uint8_t * buf, size_t len, size_t headroom, 
+		std::shared_ptr<i2p::tunnel::InboundTunnel> from)
+	{
+		// we need at least 2 bytes for NTCP header, and message must fit parent's buffer
+		if (!parent || headroom < 2 || buf < parent->buf + headroom || buf + len > parent->buf + parent->maxLen)
+			return CreateI2NPMessage (buf, len, from);
+		auto view = std::make_shared<I2NPMessageView> ();
+		view->buf = buf - headroom;
+		view->offset = headroom;
+		view->len = headroom + len;
+		view->maxLen = parent->buf + parent->maxLen - view->buf; // parent's padding after maxLen is ours too
+		view->from = from;
+		view->parent = parent;
+		return view;
+	}	
+
 	std::shared_ptr<I2NPMessage> CopyI2NPMessage (std::shared_ptr<I2NPMessage> msg)
 	{
 		if (!msg) return nullptr;
@@ -318,7 +360,7 @@ namespace i2p
 		}
 	}
 
-	bool HandleBuildRequestRecords (int num, uint8_t * records, uint8_t * clearText)
+	bool HandleBuildRequestRecords (int num, uint8_t * records, uint8_t * clearText, BN_CTX * ctx, bool reject)
 	{
 		for (int i = 0; i < num; i++)
 		{	
@@ -326,12 +368,10 @@ namespace i2p
 			if (!memcmp (record + BUILD_REQUEST_RECORD_TO_PEER_OFFSET, (const uint8_t *)i2p::context.GetRouterInfo ().GetIdentHash (), 16))
 			{	
 				LogPrint (eLogDebug, "I2NP: Build request record ", i, " is ours");
-				BN_CTX * ctx = BN_CTX_new ();
 				i2p::crypto::ElGamalDecrypt (i2p::context.GetEncryptionPrivateKey (), record + BUILD_REQUEST_RECORD_ENCRYPTED_OFFSET, clearText, ctx);
-				BN_CTX_free (ctx);
 				// replace record to reply			
-				if (i2p::context.AcceptsTunnels () && 
-					i2p::tunnel::tunnels.GetTransitTunnels ().size () <= g_MaxNumTransitTunnels &&
+				if (!reject && i2p::context.AcceptsTunnels () && 
+					i2p::tunnel::tunnels.CountTransitTunnels () <= g_MaxNumTransitTunnels &&
 					!i2p::transport::transports.IsBandwidthExceeded ())
 				{	
 					auto transitTunnel = i2p::tunnel::CreateTransitTunnel (
@@ -366,6 +406,28 @@ namespace i2p
 		return false;
 	}
 
+	static void HandleTransitTunnelBuildMsg (bool isVariable, uint8_t * buf, size_t len, BN_CTX * ctx, bool reject)
+	{
+		int num = isVariable ? buf[0] : NUM_TUNNEL_BUILD_RECORDS;
+		uint8_t * records = isVariable ? buf + 1 : buf;
+		uint8_t clearText[BUILD_REQUEST_RECORD_CLEAR_TEXT_SIZE];	
+		if (HandleBuildRequestRecords (num, records, clearText, ctx, reject))
+		{
+			if (clearText[BUILD_REQUEST_RECORD_FLAG_OFFSET] & 0x40) // we are endpoint of outboud tunnel
+			{
+				// so we send it to reply tunnel 
+				transports.SendMessage (clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET, 
+					CreateTunnelGatewayMsg (bufbe32toh (clearText + BUILD_REQUEST_RECORD_NEXT_TUNNEL_OFFSET),
+						isVariable ? eI2NPVariableTunnelBuildReply : eI2NPTunnelBuildReply, buf, len, 
+					    bufbe32toh (clearText + BUILD_REQUEST_RECORD_SEND_MSG_ID_OFFSET)));                         
+			}	
+			else	
+				transports.SendMessage (clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET, 
+					CreateI2NPMessage (isVariable ? eI2NPVariableTunnelBuild : eI2NPTunnelBuild, buf, len, 
+						bufbe32toh (clearText + BUILD_REQUEST_RECORD_SEND_MSG_ID_OFFSET)));
+		}	
+	}
+
 	void HandleVariableTunnelBuildMsg (uint32_t replyMsgID, uint8_t * buf, size_t len)
 	{	
 		int num = buf[0];
@@ -395,22 +457,9 @@ namespace i2p
 		}
 		else
 		{
-			uint8_t clearText[BUILD_REQUEST_RECORD_CLEAR_TEXT_SIZE];	
-			if (HandleBuildRequestRecords (num, buf + 1, clearText))
-			{
-				if (clearText[BUILD_REQUEST_RECORD_FLAG_OFFSET] & 0x40) // we are endpoint of outboud tunnel
-				{
-					// so we send it to reply tunnel 
-					transports.SendMessage (clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET, 
-						CreateTunnelGatewayMsg (bufbe32toh (clearText + BUILD_REQUEST_RECORD_NEXT_TUNNEL_OFFSET),
-							eI2NPVariableTunnelBuildReply, buf, len, 
-						    bufbe32toh (clearText + BUILD_REQUEST_RECORD_SEND_MSG_ID_OFFSET)));                         
-				}	
-				else	
-					transports.SendMessage (clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET, 
-						CreateI2NPMessage (eI2NPVariableTunnelBuild, buf, len, 
-							bufbe32toh (clearText + BUILD_REQUEST_RECORD_SEND_MSG_ID_OFFSET)));
-			}	
+			BN_CTX * ctx = BN_CTX_new ();
+			HandleTransitTunnelBuildMsg (true, buf, len, ctx, false);
+			BN_CTX_free (ctx);
 		}	
 	}
 
@@ -421,22 +470,36 @@ namespace i2p
 			LogPrint (eLogError, "TunnelBuild message is too short ", len);
 			return;
 		}	
-		uint8_t clearText[BUILD_REQUEST_RECORD_CLEAR_TEXT_SIZE];	
-		if (HandleBuildRequestRecords (NUM_TUNNEL_BUILD_RECORDS, buf, clearText))
+		BN_CTX * ctx = BN_CTX_new ();
+		HandleTransitTunnelBuildMsg (false, buf, len, ctx, false);
+		BN_CTX_free (ctx);
+	}
+
+	void HandleTunnelBuildRequestMsg (std::shared_ptr<I2NPMessage> msg, BN_CTX * ctx, bool reject)
+	{
+		uint8_t * buf = msg->GetPayload ();
+		size_t len = msg->GetPayloadLength ();
+		switch (msg->GetTypeID ())
 		{
-			if (clearText[BUILD_REQUEST_RECORD_FLAG_OFFSET] & 0x40) // we are endpoint of outbound tunnel
-			{
-				// so we send it to reply tunnel 
-				transports.SendMessage (clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET, 
-					CreateTunnelGatewayMsg (bufbe32toh (clearText + BUILD_REQUEST_RECORD_NEXT_TUNNEL_OFFSET),
-						eI2NPTunnelBuildReply, buf, len, 
-					    bufbe32toh (clearText + BUILD_REQUEST_RECORD_SEND_MSG_ID_OFFSET)));                         
-			}	
-			else	
-				transports.SendMessage (clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET, 
-					CreateI2NPMessage (eI2NPTunnelBuild, buf, len, 
-						bufbe32toh (clearText + BUILD_REQUEST_RECORD_SEND_MSG_ID_OFFSET)));
-		} 
+			case eI2NPVariableTunnelBuild:
+				if (!len || len < buf[0]*TUNNEL_BUILD_RECORD_SIZE + 1)
+				{
+					LogPrint (eLogError, "VaribleTunnelBuild message is too short ", len);
+					return;
+				}
+				HandleTransitTunnelBuildMsg (true, buf, len, ctx, reject);
+			break;
+			case eI2NPTunnelBuild:
+				if (len < NUM_TUNNEL_BUILD_RECORDS*TUNNEL_BUILD_RECORD_SIZE)
+				{
+					LogPrint (eLogError, "TunnelBuild message is too short ", len);
+					return;
+				}	
+				HandleTransitTunnelBuildMsg (false, buf, len, ctx, reject);
+			break;
+			default:
+				LogPrint (eLogWarning, "I2NP: Unexpected tunnel build request type ", (int)msg->GetTypeID ());
+		}
 	}
 
 	void HandleVariableTunnelBuildReplyMsg (uint32_t replyMsgID, uint8_t * buf, size_t len)
@@ -494,6 +557,14 @@ namespace i2p
 		msg->len += i2p::tunnel::TUNNEL_DATA_MSG_SIZE; 
 		return msg;
 	}	
+
+	std::shared_ptr<I2NPMessage> GetWritableTunnelDataMsg (const std::shared_ptr<const I2NPMessage>& msg)
+	{
+		// nobody else holds this message, so we can re-encrypt it in place
+		if (msg.use_count () == 1 && msg->GetPayloadLength () == i2p::tunnel::TUNNEL_DATA_MSG_SIZE)
+			return std::const_pointer_cast<I2NPMessage>(msg); // I2NP messages are never created const
+		return CreateEmptyTunnelDataMsg ();
+	}	
 	
 	std::shared_ptr<I2NPMessage> CreateTunnelGatewayMsg (uint32_t tunnelID, const uint8_t * buf, size_t len)
 	{
@@ -510,15 +581,15 @@ namespace i2p
 
 	std::shared_ptr<I2NPMessage> CreateTunnelGatewayMsg (uint32_t tunnelID, std::shared_ptr<I2NPMessage> msg)
 	{
-		if (msg->offset >= I2NP_HEADER_SIZE + TUNNEL_GATEWAY_HEADER_SIZE)
+		if (msg->GetHeadroom () >= TUNNEL_GATEWAY_MSG_HEADROOM + 2) // keep 2 bytes for NTCP
 		{
 			// message is capable to be used without copying
 			uint8_t * payload = msg->GetBuffer () - TUNNEL_GATEWAY_HEADER_SIZE;
 			htobe32buf (payload + TUNNEL_GATEWAY_HEADER_TUNNELID_OFFSET, tunnelID);
 			int len = msg->GetLength ();
 			htobe16buf (payload + TUNNEL_GATEWAY_HEADER_LENGTH_OFFSET, len);
-			msg->offset -= (I2NP_HEADER_SIZE + TUNNEL_GATEWAY_HEADER_SIZE);
-			msg->len = msg->offset + I2NP_HEADER_SIZE + TUNNEL_GATEWAY_HEADER_SIZE +len;
+			msg->offset -= TUNNEL_GATEWAY_MSG_HEADROOM;
+			msg->len = msg->offset + TUNNEL_GATEWAY_MSG_HEADROOM + len;
 			msg->FillI2NPMessageHeader (eI2NPTunnelGateway); 
 			return msg;
 		}
@@ -530,7 +601,7 @@ namespace i2p
 		const uint8_t * buf, size_t len, uint32_t replyMsgID)
 	{
 		auto msg = NewI2NPMessage (len);
-		size_t gatewayMsgOffset = I2NP_HEADER_SIZE + TUNNEL_GATEWAY_HEADER_SIZE;
+		size_t gatewayMsgOffset = TUNNEL_GATEWAY_MSG_HEADROOM;
 		msg->offset += gatewayMsgOffset;
 		msg->len += gatewayMsgOffset;
 		if (msg->Concat (buf, len) < len)
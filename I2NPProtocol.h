@@ -7,6 +7,7 @@
 #include <memory>
 #include "Crypto.h"
 #include "I2PEndian.h"
+#include "util.h"
 #include "Identity.h"
 #include "RouterInfo.h"
 #include "LeaseSet.h"
@@ -25,11 +26,15 @@ namespace i2p
 	const size_t I2NP_SHORT_HEADER_TYPEID_OFFSET = 0;
 	const size_t I2NP_SHORT_HEADER_EXPIRATION_OFFSET = I2NP_SHORT_HEADER_TYPEID_OFFSET + 1;
 	const size_t I2NP_SHORT_HEADER_SIZE = I2NP_SHORT_HEADER_EXPIRATION_OFFSET + 4;
+
+	// I2NP NTCP2 header
+	const size_t I2NP_NTCP2_HEADER_SIZE = I2NP_HEADER_EXPIRATION_OFFSET + 4;
 	
 	// Tunnel Gateway header
 	const size_t TUNNEL_GATEWAY_HEADER_TUNNELID_OFFSET = 0;
 	const size_t TUNNEL_GATEWAY_HEADER_LENGTH_OFFSET = TUNNEL_GATEWAY_HEADER_TUNNELID_OFFSET + 4;
 	const size_t TUNNEL_GATEWAY_HEADER_SIZE = TUNNEL_GATEWAY_HEADER_LENGTH_OFFSET + 2;
+	const size_t TUNNEL_GATEWAY_MSG_HEADROOM = I2NP_HEADER_SIZE + TUNNEL_GATEWAY_HEADER_SIZE; // to wrap message into TunnelGateway in place
 
 	// DeliveryStatus	
 	const size_t DELIVERY_STATUS_MSGID_OFFSET = 0;
@@ -144,6 +149,8 @@ namespace tunnel
 		const uint8_t * GetBuffer () const { return buf + offset; };
 		size_t GetLength () const { return len - offset; };	
 		size_t GetPayloadLength () const { return GetLength () - I2NP_HEADER_SIZE; };	
+		size_t GetHeadroom () const { return offset; }; // can be used to prepend headers
+		size_t GetTailroom () const { return maxLen - len; };	
 			
 		void Align (size_t alignment) 
 		{
@@ -195,6 +202,24 @@ namespace tunnel
 			return bufbe32toh (header + I2NP_HEADER_MSGID_OFFSET);
 		}	
 
+		// for NTCP2 only
+		uint8_t * GetNTCP2Header () { return GetPayload () - I2NP_NTCP2_HEADER_SIZE; };
+		void FromNTCP2 () // we have received NTCP2 message and convert it to regular
+		{
+			const uint8_t * ntcp2 = GetNTCP2Header ();
+			memcpy (GetHeader () + I2NP_HEADER_TYPEID_OFFSET, ntcp2 + I2NP_HEADER_TYPEID_OFFSET, 5); // typeid + msgid
+			SetExpiration (bufbe32toh (ntcp2 + I2NP_HEADER_EXPIRATION_OFFSET)*1000LL);
+			SetSize (len - offset - I2NP_HEADER_SIZE);
+			SetChks (0);
+		}
+		size_t ToNTCP2 (uint8_t * buf) const // copy with NTCP2 header, return length
+		{
+			memcpy (buf + I2NP_HEADER_TYPEID_OFFSET, GetHeader () + I2NP_HEADER_TYPEID_OFFSET, 5); // typeid + msgid
+			htobe32buf (buf + I2NP_HEADER_EXPIRATION_OFFSET, GetExpiration ()/1000LL);
+			memcpy (buf + I2NP_NTCP2_HEADER_SIZE, GetPayload (), GetPayloadLength ());
+			return I2NP_NTCP2_HEADER_SIZE + GetPayloadLength ();
+		}
+
 		void FillI2NPMessageHeader (I2NPMessageType msgType, uint32_t replyMsgID = 0);
 		void RenewI2NPMessageHeader ();
 		bool IsExpired () const;
@@ -207,6 +232,20 @@ namespace tunnel
 		uint8_t m_Buffer[sz + 32]; // 16 alignment + 16 padding
 	};
 
+	struct I2NPMessageView: public I2NPMessage // message inside buffer of another message
+	{
+		std::shared_ptr<I2NPMessage> parent; // owns the buffer
+	};	
+
+	enum I2NPMessageSizeClass
+	{
+		eI2NPMessageSizeClassTunnel = 0, // TunnelData
+		eI2NPMessageSizeClassShort, // I2NP_MAX_SHORT_MESSAGE_SIZE
+		eI2NPMessageSizeClassFull, // I2NP_MAX_MESSAGE_SIZE
+		eNumI2NPMessageSizeClasses
+	};
+	i2p::util::MemoryPoolStats GetI2NPMessagesPoolStats (I2NPMessageSizeClass sizeClass);
+
 	std::shared_ptr<I2NPMessage> NewI2NPMessage ();
 	std::shared_ptr<I2NPMessage> NewI2NPShortMessage ();
 	std::shared_ptr<I2NPMessage> NewI2NPTunnelMessage ();
@@ -214,6 +253,9 @@ namespace tunnel
 	
 	std::shared_ptr<I2NPMessage> CreateI2NPMessage (I2NPMessageType msgType, const uint8_t * buf, size_t len, uint32_t replyMsgID = 0);	
 	std::shared_ptr<I2NPMessage> CreateI2NPMessage (const uint8_t * buf, size_t len, std::shared_ptr<i2p::tunnel::InboundTunnel> from = nullptr);
+	// headroom bytes before buf and everything after buf to the end of parent must not be used by anybody else. copy if headroom is too small
+	std::shared_ptr<I2NPMessage> CreateI2NPMessageView (std::shared_ptr<I2NPMessage> parent, uint8_t * buf, size_t len, size_t headroom, 
+		std::shared_ptr<i2p::tunnel::InboundTunnel> from = nullptr);
 	std::shared_ptr<I2NPMessage> CopyI2NPMessage (std::shared_ptr<I2NPMessage> msg);
 
 	std::shared_ptr<I2NPMessage> CreateDeliveryStatusMsg (uint32_t msgID);
@@ -229,14 +271,16 @@ namespace tunnel
 	std::shared_ptr<I2NPMessage> CreateDatabaseStoreMsg (std::shared_ptr<const i2p::data::LocalLeaseSet> leaseSet, uint32_t replyToken = 0, std::shared_ptr<const i2p::tunnel::InboundTunnel> replyTunnel = nullptr);		
 	bool IsRouterInfoMsg (std::shared_ptr<I2NPMessage> msg); 	
 
-	bool HandleBuildRequestRecords (int num, uint8_t * records, uint8_t * clearText);
+	bool HandleBuildRequestRecords (int num, uint8_t * records, uint8_t * clearText, BN_CTX * ctx, bool reject = false);
 	void HandleVariableTunnelBuildMsg (uint32_t replyMsgID, uint8_t * buf, size_t len);
 	void HandleVariableTunnelBuildReplyMsg (uint32_t replyMsgID, uint8_t * buf, size_t len);
 	void HandleTunnelBuildMsg (uint8_t * buf, size_t len);	
+	void HandleTunnelBuildRequestMsg (std::shared_ptr<I2NPMessage> msg, BN_CTX * ctx, bool reject = false); // transit part only, called by build workers
 
 	std::shared_ptr<I2NPMessage> CreateTunnelDataMsg (const uint8_t * buf);	
 	std::shared_ptr<I2NPMessage> CreateTunnelDataMsg (uint32_t tunnelID, const uint8_t * payload);		
 	std::shared_ptr<I2NPMessage> CreateEmptyTunnelDataMsg ();
+	std::shared_ptr<I2NPMessage> GetWritableTunnelDataMsg (const std::shared_ptr<const I2NPMessage>& msg); // msg itself if not shared, new empty otherwise
 	
 	std::shared_ptr<I2NPMessage> CreateTunnelGatewayMsg (uint32_t tunnelID, const uint8_t * buf, size_t len);
 	std::shared_ptr<I2NPMessage> CreateTunnelGatewayMsg (uint32_t tunnelID, I2NPMessageType msgType, 
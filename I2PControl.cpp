@@ -415,7 +415,7 @@ namespace client
 
 	void I2PControlService::NetDbActivePeersHandler (std::ostringstream& results)
 	{
-		InsertParam (results, "i2p.router.netdb.activepeers", (int)i2p::transport::transports.GetPeers ().size ());	
+		InsertParam (results, "i2p.router.netdb.activepeers", (int)i2p::transport::transports.GetNumPeers ());	
 	}
 
 	void I2PControlService::NetStatusHandler (std::ostringstream& results)
@@ -425,7 +425,7 @@ namespace client
 
 	void I2PControlService::TunnelsParticipatingHandler (std::ostringstream& results)
 	{
-		int transit = i2p::tunnel::tunnels.GetTransitTunnels ().size ();
+		int transit = i2p::tunnel::tunnels.CountTransitTunnels ();
 		InsertParam (results, "i2p.router.net.tunnels.participating", transit);
 	}
 
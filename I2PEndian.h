@@ -83,6 +83,16 @@ inline uint64_t bufbe64toh(const void *buf)
 	return be64toh(buf64toh(buf));
 }
 
+inline uint16_t bufle16toh(const void *buf)
+{
+	return le16toh(buf16toh(buf));
+}
+
+inline uint64_t bufle64toh(const void *buf)
+{
+	return le64toh(buf64toh(buf));
+}
+
 inline void htobuf16(void *buf, uint16_t b16)
 {
 	memcpy(buf, &b16, sizeof(uint16_t));
@@ -113,6 +123,11 @@ inline void htobe64buf(void *buf, uint64_t big64)
 	htobuf64(buf, htobe64(big64));
 }
 
+inline void htole64buf(void *buf, uint64_t little64)
+{
+	htobuf64(buf, htole64(little64));
+}
+
 
 
 #endif // I2PENDIAN_H__
@@ -56,7 +56,7 @@ namespace log {
 			std::string m_Logfile;
 			std::time_t m_LastTimestamp;
 			char m_LastDateTime[64];
-			i2p::util::Queue<std::shared_ptr<LogMsg> > m_Queue;
+			i2p::util::MPSCQueue<std::shared_ptr<LogMsg> > m_Queue;
 			bool m_HasColors;
 			volatile bool m_IsRunning;
 			std::thread * m_Thread;
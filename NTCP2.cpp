@@ -0,0 +1,857 @@
+#include <string.h>
+#include <stdlib.h>
+
+#include "I2PEndian.h"
+#include "Crypto.h"
+#include "Log.h"
+#include "Timestamp.h"
+#include "I2NPProtocol.h"
+#include "RouterContext.h"
+#include "Transports.h"
+#include "NetDb.h"
+#include "NTCP2.h"
+
+#ifdef NTCP2_SUPPORTED
+namespace i2p
+{
+namespace transport
+{
+	NTCP2Session::NTCP2Session (NTCP2Server& server, std::shared_ptr<const i2p::data::RouterInfo> in_RemoteRouter):
+		TransportSession (in_RemoteRouter, NTCP2_ESTABLISH_TIMEOUT),
+		m_Server (server), m_Socket (m_Server.GetService ()),
+		m_IsEstablished (false), m_IsTerminated (false),
+		m_NextReceivedLen (0),
+		m_NextReceivedBuffer (nullptr), m_NextReceivedBufferSize (0), m_SendBuffer (nullptr), m_SendBufferSize (0),
+		m_IsSending (false)
+	{
+		m_Establisher = new NTCP2Establisher (i2p::context.GetNTCP2StaticKeys (), i2p::context.GetIdentHash (), i2p::context.GetNetID ());
+		if (in_RemoteRouter) // Alice
+		{
+			m_Establisher->m_RemoteIdentHash = in_RemoteRouter->GetIdentHash ();
+			auto addr = in_RemoteRouter->GetNTCP2Address (true, false);
+			if (addr)
+			{
+				memcpy (m_Establisher->m_RemoteStaticKey, addr->ntcp2->staticKey, 32);
+				memcpy (m_Establisher->m_IV, addr->ntcp2->iv, 16);
+			}
+			else
+				LogPrint (eLogWarning, "NTCP2: Missing NTCP2 parameters");
+		}
+		else if (i2p::context.GetNTCP2IV ()) // Bob
+			memcpy (m_Establisher->m_IV, i2p::context.GetNTCP2IV (), 16);
+	}
+
+	NTCP2Session::~NTCP2Session ()
+	{
+		delete m_Establisher;
+		delete[] m_NextReceivedBuffer;
+		delete[] m_SendBuffer;
+	}
+
+	void NTCP2Session::Done ()
+	{
+		m_Server.GetService ().post (std::bind (&NTCP2Session::Terminate, shared_from_this ()));
+	}
+
+	void NTCP2Session::Terminate ()
+	{
+		if (!m_IsTerminated)
+		{
+			m_IsTerminated = true;
+			m_IsEstablished = false;
+			m_Socket.close ();
+			transports.PeerDisconnected (shared_from_this ());
+			m_Server.RemoveNTCP2Session (shared_from_this ());
+			m_SendQueue.Clear ();
+			LogPrint (eLogDebug, "NTCP2: session terminated");
+		}
+	}
+
+	void NTCP2Session::TerminateByTimeout ()
+	{
+		SendTermination (eNTCP2IdleTimeout);
+	}
+
+	void NTCP2Session::Established ()
+	{
+		m_IsEstablished = true;
+		delete m_Establisher;
+		m_Establisher = nullptr;
+
+		SetTerminationTimeout (NTCP2_TERMINATION_TIMEOUT);
+		m_LastActivityTimestamp = i2p::util::GetSecondsSinceEpoch ();
+		transports.PeerConnected (shared_from_this ());
+	}
+
+	void NTCP2Session::ClientLogin ()
+	{
+		SendSessionRequest ();
+	}
+
+	void NTCP2Session::ServerLogin ()
+	{
+		m_LastActivityTimestamp = i2p::util::GetSecondsSinceEpoch ();
+		boost::asio::async_read (m_Socket, boost::asio::buffer(m_Establisher->m_SessionRequestBuffer, 64), boost::asio::transfer_all (),
+			std::bind(&NTCP2Session::HandleSessionRequestReceived, shared_from_this (),
+				std::placeholders::_1, std::placeholders::_2));
+	}
+
+	void NTCP2Session::SendSessionRequest ()
+	{
+		m_Establisher->m_EphemeralKeys.GenerateKeys ();
+		auto& ri = i2p::context.GetRouterInfo ();
+		m_Establisher->CreateSessionRequestMessage (ri.GetBuffer (), ri.GetBufferLen ());
+		boost::asio::async_write (m_Socket, boost::asio::buffer (m_Establisher->m_SessionRequestBuffer, m_Establisher->m_SessionRequestBufferLen), boost::asio::transfer_all (),
+			std::bind(&NTCP2Session::HandleSessionRequestSent, shared_from_this (), std::placeholders::_1, std::placeholders::_2));
+	}
+
+	void NTCP2Session::HandleSessionRequestSent (const boost::system::error_code& ecode, std::size_t bytes_transferred)
+	{
+		(void) bytes_transferred;
+		if (ecode)
+		{
+			LogPrint (eLogInfo, "NTCP2: couldn't send SessionRequest message: ", ecode.message ());
+			if (ecode != boost::asio::error::operation_aborted)
+				Terminate ();
+		}
+		else
+		{
+			boost::asio::async_read (m_Socket, boost::asio::buffer(m_Establisher->m_SessionCreatedBuffer, 64), boost::asio::transfer_all (),
+				std::bind(&NTCP2Session::HandleSessionCreatedReceived, shared_from_this (), std::placeholders::_1, std::placeholders::_2));
+		}
+	}
+
+	void NTCP2Session::HandleSessionRequestReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred)
+	{
+		(void) bytes_transferred;
+		if (ecode)
+		{
+			LogPrint (eLogInfo, "NTCP2: SessionRequest read error: ", ecode.message ());
+			Terminate ();
+			return;
+		}
+		uint16_t paddingLen = 0;
+		if (!m_Establisher->ProcessSessionRequestMessage (paddingLen))
+		{
+			Terminate ();
+			return;
+		}
+		if (paddingLen > 0)
+		{
+			if (paddingLen <= NTCP2_SESSION_REQUEST_MAX_SIZE - 64) // session request is 287 bytes max
+				boost::asio::async_read (m_Socket, boost::asio::buffer(m_Establisher->m_SessionRequestBuffer + 64, paddingLen), boost::asio::transfer_all (),
+					std::bind(&NTCP2Session::HandleSessionRequestPaddingReceived, shared_from_this (), std::placeholders::_1, std::placeholders::_2));
+			else
+			{
+				LogPrint (eLogWarning, "NTCP2: SessionRequest padding length ", (int)paddingLen, " is too long");
+				Terminate ();
+			}
+		}
+		else
+			SendSessionCreated ();
+	}
+
+	void NTCP2Session::HandleSessionRequestPaddingReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred)
+	{
+		(void) bytes_transferred;
+		if (ecode)
+		{
+			LogPrint (eLogInfo, "NTCP2: SessionRequest padding read error: ", ecode.message ());
+			Terminate ();
+		}
+		else
+			SendSessionCreated ();
+	}
+
+	void NTCP2Session::SendSessionCreated ()
+	{
+		m_Establisher->m_EphemeralKeys.GenerateKeys ();
+		m_Establisher->CreateSessionCreatedMessage ();
+		boost::asio::async_write (m_Socket, boost::asio::buffer (m_Establisher->m_SessionCreatedBuffer, m_Establisher->m_SessionCreatedBufferLen), boost::asio::transfer_all (),
+			std::bind(&NTCP2Session::HandleSessionCreatedSent, shared_from_this (), std::placeholders::_1, std::placeholders::_2));
+	}
+
+	void NTCP2Session::HandleSessionCreatedSent (const boost::system::error_code& ecode, std::size_t bytes_transferred)
+	{
+		(void) bytes_transferred;
+		if (ecode)
+		{
+			LogPrint (eLogInfo, "NTCP2: couldn't send SessionCreated message: ", ecode.message ());
+			if (ecode != boost::asio::error::operation_aborted)
+				Terminate ();
+		}
+		else
+		{
+			m_Establisher->m_SessionConfirmedBuffer = new uint8_t[m_Establisher->m3p2Len + 48];
+			boost::asio::async_read (m_Socket, boost::asio::buffer(m_Establisher->m_SessionConfirmedBuffer, m_Establisher->m3p2Len + 48), boost::asio::transfer_all (),
+				std::bind(&NTCP2Session::HandleSessionConfirmedReceived, shared_from_this (), std::placeholders::_1, std::placeholders::_2));
+		}
+	}
+
+	void NTCP2Session::HandleSessionCreatedReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred)
+	{
+		(void) bytes_transferred;
+		if (ecode)
+		{
+			LogPrint (eLogInfo, "NTCP2: SessionCreated read error: ", ecode.message ());
+			Terminate ();
+			return;
+		}
+		uint16_t paddingLen = 0;
+		if (!m_Establisher->ProcessSessionCreatedMessage (paddingLen))
+		{
+			Terminate ();
+			return;
+		}
+		if (paddingLen > 0)
+		{
+			if (paddingLen <= NTCP2_SESSION_CREATED_MAX_SIZE - 64) // session created is 287 bytes max
+				boost::asio::async_read (m_Socket, boost::asio::buffer(m_Establisher->m_SessionCreatedBuffer + 64, paddingLen), boost::asio::transfer_all (),
+					std::bind(&NTCP2Session::HandleSessionCreatedPaddingReceived, shared_from_this (), std::placeholders::_1, std::placeholders::_2));
+			else
+			{
+				LogPrint (eLogWarning, "NTCP2: SessionCreated padding length ", (int)paddingLen, " is too long");
+				Terminate ();
+			}
+		}
+		else
+			SendSessionConfirmed ();
+	}
+
+	void NTCP2Session::HandleSessionCreatedPaddingReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred)
+	{
+		(void) bytes_transferred;
+		if (ecode)
+		{
+			LogPrint (eLogInfo, "NTCP2: SessionCreated padding read error: ", ecode.message ());
+			Terminate ();
+		}
+		else
+			SendSessionConfirmed ();
+	}
+
+	void NTCP2Session::SendSessionConfirmed ()
+	{
+		uint8_t nonce[12];
+		CreateNTCP2Nonce (1, nonce); // part 1 uses nonce 1
+		m_Establisher->CreateSessionConfirmedMessagePart1 (nonce);
+		memset (nonce, 0, 12); // part 2 uses nonce 0 with new key
+		m_Establisher->CreateSessionConfirmedMessagePart2 (nonce);
+		boost::asio::async_write (m_Socket, boost::asio::buffer (m_Establisher->m_SessionConfirmedBuffer, m_Establisher->m3p2Len + 48), boost::asio::transfer_all (),
+			std::bind(&NTCP2Session::HandleSessionConfirmedSent, shared_from_this (), std::placeholders::_1, std::placeholders::_2));
+	}
+
+	void NTCP2Session::HandleSessionConfirmedSent (const boost::system::error_code& ecode, std::size_t bytes_transferred)
+	{
+		(void) bytes_transferred;
+		if (ecode)
+		{
+			LogPrint (eLogInfo, "NTCP2: couldn't send SessionConfirmed message: ", ecode.message ());
+			if (ecode != boost::asio::error::operation_aborted)
+				Terminate ();
+		}
+		else
+		{
+			LogPrint (eLogDebug, "NTCP2: SessionConfirmed sent");
+			m_Establisher->KeyDerivationFunctionDataPhase (m_Kab, m_Kba, m_Sipkeysab, m_Sipkeysba);
+			// Alice sends with ab and receives with ba
+			m_SendCipher.SetKeys (m_Kab, m_Sipkeysab);
+			m_ReceiveCipher.SetKeys (m_Kba, m_Sipkeysba);
+			Established ();
+			ReceiveLength ();
+		}
+	}
+
+	void NTCP2Session::HandleSessionConfirmedReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred)
+	{
+		(void) bytes_transferred;
+		if (ecode)
+		{
+			LogPrint (eLogInfo, "NTCP2: SessionConfirmed read error: ", ecode.message ());
+			Terminate ();
+			return;
+		}
+		uint8_t nonce[12];
+		CreateNTCP2Nonce (1, nonce);
+		if (!m_Establisher->ProcessSessionConfirmedMessagePart1 (nonce))
+		{
+			Terminate ();
+			return;
+		}
+		std::vector<uint8_t> buf(m_Establisher->m3p2Len - 16); // decrypted part 2
+		memset (nonce, 0, 12);
+		if (!m_Establisher->ProcessSessionConfirmedMessagePart2 (nonce, buf.data ()))
+		{
+			Terminate ();
+			return;
+		}
+		// first block must be our RouterInfo
+		size_t size = bufbe16toh (buf.data () + 1);
+		if (buf[0] != eNTCP2BlkRouterInfo || size < 2 || size + 3 > buf.size ())
+		{
+			LogPrint (eLogWarning, "NTCP2: unexpected block ", (int)buf[0], " of size ", size, " in SessionConfirmed");
+			Terminate ();
+			return;
+		}
+		i2p::data::RouterInfo ri (buf.data () + 4, size - 1); // skip flag
+		if (ri.IsUnreachable ())
+		{
+			LogPrint (eLogError, "NTCP2: RouterInfo verification failed in SessionConfirmed");
+			Terminate ();
+			return;
+		}
+		auto addr = ri.GetNTCP2Address (false, false);
+		if (!addr || memcmp (addr->ntcp2->staticKey, m_Establisher->m_RemoteStaticKey, 32))
+		{
+			LogPrint (eLogError, "NTCP2: Static key mismatch or NTCP2 address is missing in SessionConfirmed");
+			Terminate ();
+			return;
+		}
+		i2p::data::netdb.AddRouterInfo (buf.data () + 4, size - 1);
+		SetRemoteIdentity (ri.GetRouterIdentity ());
+
+		m_Establisher->KeyDerivationFunctionDataPhase (m_Kab, m_Kba, m_Sipkeysab, m_Sipkeysba);
+		// Bob sends with ba and receives with ab
+		m_SendCipher.SetKeys (m_Kba, m_Sipkeysba);
+		m_ReceiveCipher.SetKeys (m_Kab, m_Sipkeysab);
+		if (m_Server.AddNTCP2Session (shared_from_this ()))
+		{
+			Established ();
+			ReceiveLength ();
+		}
+	}
+
+	void NTCP2Session::ReceiveLength ()
+	{
+		boost::asio::async_read (m_Socket, boost::asio::buffer(m_NextReceivedLenBuf, 2), boost::asio::transfer_all (),
+			std::bind(&NTCP2Session::HandleReceivedLength, shared_from_this (), std::placeholders::_1, std::placeholders::_2));
+	}
+
+	void NTCP2Session::HandleReceivedLength (const boost::system::error_code& ecode, std::size_t bytes_transferred)
+	{
+		(void) bytes_transferred;
+		if (ecode)
+		{
+			if (ecode != boost::asio::error::operation_aborted)
+				LogPrint (eLogDebug, "NTCP2: receive length read error: ", ecode.message ());
+			Terminate ();
+			return;
+		}
+		m_NextReceivedLen = m_ReceiveCipher.DecryptLength (m_NextReceivedLenBuf);
+		if (m_NextReceivedLen < 16)
+		{
+			LogPrint (eLogWarning, "NTCP2: received frame length ", m_NextReceivedLen, " is too short");
+			Terminate ();
+			return;
+		}
+		if (m_NextReceivedLen > m_NextReceivedBufferSize)
+		{
+			delete[] m_NextReceivedBuffer;
+			m_NextReceivedBuffer = new uint8_t[m_NextReceivedLen];
+			m_NextReceivedBufferSize = m_NextReceivedLen;
+		}
+		Receive ();
+	}
+
+	void NTCP2Session::Receive ()
+	{
+		boost::asio::async_read (m_Socket, boost::asio::buffer(m_NextReceivedBuffer, m_NextReceivedLen), boost::asio::transfer_all (),
+			std::bind(&NTCP2Session::HandleReceived, shared_from_this (), std::placeholders::_1, std::placeholders::_2));
+	}
+
+	void NTCP2Session::HandleReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred)
+	{
+		if (ecode)
+		{
+			if (ecode != boost::asio::error::operation_aborted)
+				LogPrint (eLogDebug, "NTCP2: Read error: ", ecode.message ());
+			Terminate ();
+			return;
+		}
+		m_LastActivityTimestamp = i2p::util::GetSecondsSinceEpoch ();
+		m_NumReceivedBytes += bytes_transferred + 2; // + length
+		i2p::transport::transports.UpdateReceivedBytes (bytes_transferred + 2);
+		if (!m_ReceiveCipher.Decrypt (m_NextReceivedBuffer, m_NextReceivedLen))
+		{
+			LogPrint (eLogWarning, "NTCP2: received frame AEAD verification failed");
+			SendTermination (eNTCP2DataPhaseAEADFailure);
+			return;
+		}
+		if (ProcessNextFrame (m_NextReceivedBuffer, m_NextReceivedLen - 16))
+			ReceiveLength ();
+		else
+			Terminate ();
+	}
+
+	bool NTCP2Session::ProcessNextFrame (const uint8_t * frame, size_t len)
+	{
+		size_t offset = 0;
+		while (offset < len)
+		{
+			if (offset + 3 > len)
+			{
+				LogPrint (eLogWarning, "NTCP2: truncated block header");
+				return false;
+			}
+			uint8_t blk = frame[offset];
+			size_t size = bufbe16toh (frame + offset + 1);
+			offset += 3;
+			if (offset + size > len)
+			{
+				LogPrint (eLogWarning, "NTCP2: unexpected block length ", size);
+				return false;
+			}
+			switch (blk)
+			{
+				case eNTCP2BlkDateTime:
+				case eNTCP2BlkOptions:
+				case eNTCP2BlkPadding:
+				break;
+				case eNTCP2BlkRouterInfo:
+					if (size > 1)
+						i2p::data::netdb.AddRouterInfo (frame + offset + 1, size - 1); // skip flag
+				break;
+				case eNTCP2BlkI2NPMessage:
+				{
+					if (size < I2NP_NTCP2_HEADER_SIZE)
+					{
+						LogPrint (eLogWarning, "NTCP2: I2NP block is too short ", size);
+						break;
+					}
+					auto nextMsg = NewI2NPMessage (size);
+					if (nextMsg->offset + size + I2NP_HEADER_SIZE - I2NP_NTCP2_HEADER_SIZE > nextMsg->maxLen)
+					{
+						LogPrint (eLogWarning, "NTCP2: I2NP block is too long ", size);
+						break;
+					}
+					nextMsg->len = nextMsg->offset + size + I2NP_HEADER_SIZE - I2NP_NTCP2_HEADER_SIZE; // full header
+					memcpy (nextMsg->GetNTCP2Header (), frame + offset, size);
+					nextMsg->FromNTCP2 ();
+					if (!nextMsg->IsExpired ())
+						m_Handler.PutNextMessage (nextMsg);
+					else
+						LogPrint (eLogInfo, "NTCP2: message expired");
+					break;
+				}
+				case eNTCP2BlkTermination:
+					LogPrint (eLogDebug, "NTCP2: termination received, reason=", size >= 9 ? (int)frame[offset + 8] : -1);
+					m_Handler.Flush ();
+				return false;
+				default:
+					LogPrint (eLogWarning, "NTCP2: unknown block type ", (int)blk);
+			}
+			offset += size;
+		}
+		m_Handler.Flush ();
+		return true;
+	}
+
+	void NTCP2Session::ExpandSendBuffer (size_t size)
+	{
+		if (size > m_SendBufferSize)
+		{
+			delete[] m_SendBuffer;
+			m_SendBuffer = new uint8_t[size];
+			m_SendBufferSize = size;
+		}
+	}
+
+	void NTCP2Session::SendFrame (size_t len)
+	{
+		// encrypt blocks in place, MAC follows
+		m_SendCipher.Encrypt (m_SendBuffer, len);
+		m_IsSending = true;
+		boost::asio::async_write (m_Socket, boost::asio::buffer ((const uint8_t *)m_SendBuffer, len + 18), boost::asio::transfer_all (),
+			std::bind(&NTCP2Session::HandleSent, shared_from_this (), std::placeholders::_1, std::placeholders::_2));
+	}
+
+	void NTCP2Session::SendQueuedMessages ()
+	{
+		// in priority order, as many I2NP blocks as fit into one frame
+		std::vector<std::shared_ptr<I2NPMessage> > msgs;
+		size_t len = 0;
+		while (auto msg = m_SendQueue.Peek ())
+		{
+			size_t blockLen = msg->GetPayloadLength () + I2NP_NTCP2_HEADER_SIZE + 3;
+			if (blockLen > NTCP2_UNENCRYPTED_FRAME_MAX_SIZE)
+			{
+				LogPrint (eLogWarning, "NTCP2: I2NP message of ", blockLen, " bytes is too long, dropped");
+				m_SendQueue.Pop ();
+				continue;
+			}
+			if (!msgs.empty () && len + blockLen > NTCP2_MAX_SEND_FRAME_SIZE) break;
+			msgs.push_back (m_SendQueue.Pop ());
+			len += blockLen;
+		}
+		if (msgs.empty ()) return;
+		ExpandSendBuffer (len + 18); // length and MAC
+		uint8_t * buf = m_SendBuffer + 2;
+		for (const auto& it: msgs)
+		{
+			buf[0] = eNTCP2BlkI2NPMessage;
+			size_t size = it->ToNTCP2 (buf + 3);
+			htobe16buf (buf + 1, size);
+			buf += size + 3;
+		}
+		SendFrame (len);
+	}
+
+	void NTCP2Session::SendTermination (NTCP2TerminationReason reason)
+	{
+		if (!m_IsEstablished || m_IsSending)
+		{
+			Terminate ();
+			return;
+		}
+		ExpandSendBuffer (12 + 18);
+		uint8_t * buf = m_SendBuffer + 2;
+		buf[0] = eNTCP2BlkTermination;
+		htobe16buf (buf + 1, 9);
+		htobe64buf (buf + 3, m_ReceiveCipher.GetSequenceNumber ()); // valid frames received
+		buf[11] = (uint8_t)reason;
+		m_SendCipher.Encrypt (m_SendBuffer, 12);
+		m_IsSending = true; // nothing is sent after termination
+		boost::asio::async_write (m_Socket, boost::asio::buffer ((const uint8_t *)m_SendBuffer, 12 + 18), boost::asio::transfer_all (),
+			std::bind(&NTCP2Session::HandleTerminationSent, shared_from_this (), std::placeholders::_1, std::placeholders::_2));
+	}
+
+	void NTCP2Session::HandleSent (const boost::system::error_code& ecode, std::size_t bytes_transferred)
+	{
+		m_IsSending = false;
+		if (ecode)
+		{
+			LogPrint (eLogWarning, "NTCP2: Couldn't send frame: ", ecode.message ());
+			// HandleReceived takes care
+		}
+		else
+		{
+			m_LastActivityTimestamp = i2p::util::GetSecondsSinceEpoch ();
+			m_NumSentBytes += bytes_transferred;
+			i2p::transport::transports.UpdateSentBytes (bytes_transferred);
+			if (UpdateStats ())
+			{
+#ifdef __linux__
+				UpdateTCPRTT (m_Socket.native_handle ());
+#endif
+			}
+			if (!m_SendQueue.IsEmpty ())
+				SendQueuedMessages ();
+		}
+	}
+
+	void NTCP2Session::HandleTerminationSent (const boost::system::error_code& ecode, std::size_t bytes_transferred)
+	{
+		(void) ecode; (void) bytes_transferred;
+		Terminate ();
+	}
+
+	void NTCP2Session::SendI2NPMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs)
+	{
+		if (PostMessages (msgs)) // otherwise session's thread is woken up already
+			m_Server.GetService ().post (std::bind (&NTCP2Session::HandlePostedMessages, shared_from_this ()));
+	}
+
+	void NTCP2Session::HandlePostedMessages ()
+	{
+		if (TakePostedMessages (m_TakenMessages)) // more were posted while we were taking
+			m_Server.GetService ().post (std::bind (&NTCP2Session::HandlePostedMessages, shared_from_this ()));
+		PostI2NPMessages (m_TakenMessages);
+		m_TakenMessages.clear ();
+	}
+
+	void NTCP2Session::PostI2NPMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs)
+	{
+		if (m_IsTerminated) return;
+		for (const auto& it: msgs)
+			if (it && !m_SendQueue.Push (it))
+			{
+				LogPrint (eLogWarning, "NTCP2: outgoing messages queue size exceeds ", SEND_QUEUE_MAX_TOTAL_SIZE);
+				Terminate ();
+				return;
+			}
+		if (m_IsEstablished && !m_IsSending)
+			SendQueuedMessages ();
+	}
+
+//-----------------------------------------
+	NTCP2Server::NTCP2Server ():
+		m_IsRunning (false), m_Thread (nullptr), m_Work (m_Service), m_TerminationTimer (m_Service),
+		m_NTCP2Acceptor (nullptr), m_NTCP2V6Acceptor (nullptr)
+	{
+	}
+
+	NTCP2Server::~NTCP2Server ()
+	{
+		Stop ();
+	}
+
+	void NTCP2Server::Start ()
+	{
+		if (!m_IsRunning)
+		{
+			m_IsRunning = true;
+			m_Thread = new std::thread (std::bind (&NTCP2Server::Run, this));
+			// create acceptors
+			auto& addresses = context.GetRouterInfo ().GetAddresses ();
+			for (const auto& address: addresses)
+			{
+				if (!address || address->transportStyle != i2p::data::RouterInfo::eTransportNTCP2 || !address->port) continue;
+				if (address->host.is_v4 () && !m_NTCP2Acceptor)
+				{
+					try
+					{
+						m_NTCP2Acceptor = new boost::asio::ip::tcp::acceptor (m_Service,
+							boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), address->port));
+					} catch ( std::exception & ex ) {
+						LogPrint(eLogError, "NTCP2: Failed to bind to ip4 port ", address->port, ex.what());
+						continue;
+					}
+
+					LogPrint (eLogInfo, "NTCP2: Start listening TCP port ", address->port);
+					auto conn = std::make_shared<NTCP2Session>(*this);
+					m_NTCP2Acceptor->async_accept(conn->GetSocket (), std::bind (&NTCP2Server::HandleAccept, this,
+						conn, std::placeholders::_1));
+				}
+				else if (address->host.is_v6 () && context.SupportsV6 () && !m_NTCP2V6Acceptor)
+				{
+					m_NTCP2V6Acceptor = new boost::asio::ip::tcp::acceptor (m_Service);
+					try
+					{
+						m_NTCP2V6Acceptor->open (boost::asio::ip::tcp::v6());
+						m_NTCP2V6Acceptor->set_option (boost::asio::ip::v6_only (true));
+						m_NTCP2V6Acceptor->bind (boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v6(), address->port));
+						m_NTCP2V6Acceptor->listen ();
+
+						LogPrint (eLogInfo, "NTCP2: Start listening V6 TCP port ", address->port);
+						auto conn = std::make_shared<NTCP2Session> (*this);
+						m_NTCP2V6Acceptor->async_accept(conn->GetSocket (), std::bind (&NTCP2Server::HandleAcceptV6,
+							this, conn, std::placeholders::_1));
+					} catch ( std::exception & ex ) {
+						LogPrint(eLogError, "NTCP2: failed to bind to ip6 port ", address->port);
+						delete m_NTCP2V6Acceptor;
+						m_NTCP2V6Acceptor = nullptr;
+						continue;
+					}
+				}
+			}
+			ScheduleTermination ();
+		}
+	}
+
+	void NTCP2Server::Stop ()
+	{
+		{
+			// we have to copy it because Terminate changes m_NTCP2Sessions
+			auto ntcpSessions = GetNTCP2Sessions ();
+			for (auto& it: ntcpSessions)
+				it.second->Terminate ();
+			for (auto& it: m_PendingIncomingSessions)
+				it->Terminate ();
+		}
+		{
+			std::unique_lock<std::mutex> l(m_NTCP2SessionsMutex);
+			m_NTCP2Sessions.clear ();
+		}
+		m_PendingIncomingSessions.clear ();
+
+		if (m_IsRunning)
+		{
+			m_IsRunning = false;
+			m_TerminationTimer.cancel ();
+			if (m_NTCP2Acceptor)
+			{
+				delete m_NTCP2Acceptor;
+				m_NTCP2Acceptor = nullptr;
+			}
+			if (m_NTCP2V6Acceptor)
+			{
+				delete m_NTCP2V6Acceptor;
+				m_NTCP2V6Acceptor = nullptr;
+			}
+			m_Service.stop ();
+			if (m_Thread)
+			{
+				m_Thread->join ();
+				delete m_Thread;
+				m_Thread = nullptr;
+			}
+		}
+	}
+
+	void NTCP2Server::Run ()
+	{
+		while (m_IsRunning)
+		{
+			try
+			{
+				m_Service.run ();
+			}
+			catch (std::exception& ex)
+			{
+				LogPrint (eLogError, "NTCP2: runtime exception: ", ex.what ());
+			}
+		}
+	}
+
+	bool NTCP2Server::AddNTCP2Session (std::shared_ptr<NTCP2Session> session)
+	{
+		if (!session || !session->GetRemoteIdentity ()) return false;
+		auto& ident = session->GetRemoteIdentity ()->GetIdentHash ();
+		{
+			std::unique_lock<std::mutex> l(m_NTCP2SessionsMutex);
+			if (m_NTCP2Sessions.insert (std::make_pair (ident, session)).second)
+				return true;
+		}
+		LogPrint (eLogWarning, "NTCP2: session to ", ident.ToBase64 (), " already exists");
+		session->Terminate (); // outside of lock, removes itself
+		return false;
+	}
+
+	void NTCP2Server::RemoveNTCP2Session (std::shared_ptr<NTCP2Session> session)
+	{
+		if (session && session->GetRemoteIdentity ())
+		{
+			std::unique_lock<std::mutex> l(m_NTCP2SessionsMutex);
+			auto it = m_NTCP2Sessions.find (session->GetRemoteIdentity ()->GetIdentHash ());
+			if (it != m_NTCP2Sessions.end () && it->second == session) // don't remove other session to same peer
+				m_NTCP2Sessions.erase (it);
+		}
+	}
+
+	std::shared_ptr<NTCP2Session> NTCP2Server::FindNTCP2Session (const i2p::data::IdentHash& ident)
+	{
+		std::unique_lock<std::mutex> l(m_NTCP2SessionsMutex);
+		auto it = m_NTCP2Sessions.find (ident);
+		if (it != m_NTCP2Sessions.end ())
+			return it->second;
+		return nullptr;
+	}
+
+	void NTCP2Server::HandleAccept (std::shared_ptr<NTCP2Session> conn, const boost::system::error_code& error)
+	{
+		if (!error)
+		{
+			boost::system::error_code ec;
+			auto ep = conn->GetSocket ().remote_endpoint(ec);
+			if (!ec)
+			{
+				LogPrint (eLogDebug, "NTCP2: Connected from ", ep);
+				conn->ServerLogin ();
+				m_PendingIncomingSessions.push_back (conn);
+			}
+			else
+				LogPrint (eLogError, "NTCP2: Connected from error ", ec.message ());
+		}
+
+		if (error != boost::asio::error::operation_aborted)
+		{
+			conn = std::make_shared<NTCP2Session> (*this);
+			m_NTCP2Acceptor->async_accept(conn->GetSocket (), std::bind (&NTCP2Server::HandleAccept, this,
+				conn, std::placeholders::_1));
+		}
+	}
+
+	void NTCP2Server::HandleAcceptV6 (std::shared_ptr<NTCP2Session> conn, const boost::system::error_code& error)
+	{
+		if (!error)
+		{
+			boost::system::error_code ec;
+			auto ep = conn->GetSocket ().remote_endpoint(ec);
+			if (!ec)
+			{
+				LogPrint (eLogDebug, "NTCP2: Connected from ", ep);
+				conn->ServerLogin ();
+				m_PendingIncomingSessions.push_back (conn);
+			}
+			else
+				LogPrint (eLogError, "NTCP2: Connected from error ", ec.message ());
+		}
+
+		if (error != boost::asio::error::operation_aborted)
+		{
+			conn = std::make_shared<NTCP2Session> (*this);
+			m_NTCP2V6Acceptor->async_accept(conn->GetSocket (), std::bind (&NTCP2Server::HandleAcceptV6, this,
+				conn, std::placeholders::_1));
+		}
+	}
+
+	void NTCP2Server::Connect (const boost::asio::ip::address& address, int port, std::shared_ptr<NTCP2Session> conn)
+	{
+		LogPrint (eLogDebug, "NTCP2: Connecting to ", address ,":",  port);
+		m_Service.post([this, address, port, conn]()
+		{
+			if (this->AddNTCP2Session (conn))
+			{
+				auto timer = std::make_shared<boost::asio::deadline_timer>(m_Service);
+				timer->expires_from_now (boost::posix_time::seconds(NTCP2_CONNECT_TIMEOUT));
+				timer->async_wait ([conn](const boost::system::error_code& ecode)
+					{
+						if (ecode != boost::asio::error::operation_aborted)
+						{
+							LogPrint (eLogInfo, "NTCP2: Not connected in ", NTCP2_CONNECT_TIMEOUT, " seconds");
+							conn->Terminate ();
+						}
+					});
+				conn->GetSocket ().async_connect (boost::asio::ip::tcp::endpoint (address, port),
+					std::bind (&NTCP2Server::HandleConnect, this, std::placeholders::_1, conn, timer));
+			}
+		});
+	}
+
+	void NTCP2Server::HandleConnect (const boost::system::error_code& ecode, std::shared_ptr<NTCP2Session> conn, std::shared_ptr<boost::asio::deadline_timer> timer)
+	{
+		timer->cancel ();
+		if (ecode)
+		{
+			LogPrint (eLogInfo, "NTCP2: Connect error ", ecode.message ());
+			conn->Terminate (); // transports fall back to NTCP or SSU
+		}
+		else
+		{
+			LogPrint (eLogDebug, "NTCP2: Connected to ", conn->GetSocket ().remote_endpoint ());
+			conn->ClientLogin ();
+		}
+	}
+
+	void NTCP2Server::ScheduleTermination ()
+	{
+		m_TerminationTimer.expires_from_now (boost::posix_time::seconds(NTCP2_TERMINATION_CHECK_TIMEOUT));
+		m_TerminationTimer.async_wait (std::bind (&NTCP2Server::HandleTerminationTimer,
+			this, std::placeholders::_1));
+	}
+
+	void NTCP2Server::HandleTerminationTimer (const boost::system::error_code& ecode)
+	{
+		if (ecode != boost::asio::error::operation_aborted)
+		{
+			auto ts = i2p::util::GetSecondsSinceEpoch ();
+			// established
+			for (auto& it: GetNTCP2Sessions ())
+				if (it.second->IsTerminationTimeoutExpired (ts))
+				{
+					LogPrint (eLogDebug, "NTCP2: No activity for ", it.second->GetTerminationTimeout (), " seconds");
+					if (it.second->IsEstablished ())
+						it.second->TerminateByTimeout (); // tell the peer
+					else
+						it.second->Terminate ();
+				}
+			// pending
+			for (auto it = m_PendingIncomingSessions.begin (); it != m_PendingIncomingSessions.end ();)
+			{
+				if ((*it)->IsEstablished () || (*it)->IsTerminated ())
+					it = m_PendingIncomingSessions.erase (it); // established or terminated
+				else if ((*it)->IsTerminationTimeoutExpired (ts))
+				{
+					(*it)->Terminate ();
+					it = m_PendingIncomingSessions.erase (it); // expired
+				}
+				else
+					it++;
+			}
+
+			ScheduleTermination ();
+		}
+	}
+}
+}
+#endif
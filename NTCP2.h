@@ -0,0 +1,187 @@
+#ifndef NTCP2_H__
+#define NTCP2_H__
+
+#include <inttypes.h>
+#include <map>
+#include <list>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <boost/asio.hpp>
+#include "Crypto.h"
+#include "Identity.h"
+#include "RouterInfo.h"
+#include "I2NPProtocol.h"
+#include "TransportSession.h"
+#include "NTCP2Establisher.h"
+
+namespace i2p
+{
+namespace transport
+{
+	const size_t NTCP2_MAX_SEND_FRAME_SIZE = 32768; // blocks of one frame, at least one message
+	const int NTCP2_CONNECT_TIMEOUT = 5; // 5 seconds
+	const int NTCP2_ESTABLISH_TIMEOUT = 10; // 10 seconds
+	const int NTCP2_TERMINATION_TIMEOUT = 120; // 2 minutes
+	const int NTCP2_TERMINATION_CHECK_TIMEOUT = 30; // 30 seconds
+
+	enum NTCP2TerminationReason
+	{
+		eNTCP2NormalClose = 0,
+		eNTCP2TerminationReceived, // 1
+		eNTCP2IdleTimeout, // 2
+		eNTCP2RouterShutdown, // 3
+		eNTCP2DataPhaseAEADFailure, // 4
+		eNTCP2IncompatibleOptions, // 5
+		eNTCP2IncompatibleSignatureType, // 6
+		eNTCP2ClockSkew, // 7
+		eNTCP2PaddingViolation, // 8
+		eNTCP2AEADFramingError, // 9
+		eNTCP2PayloadFormatError, // 10
+		eNTCP2Message1Error, // 11
+		eNTCP2Message2Error, // 12
+		eNTCP2Message3Error, // 13
+		eNTCP2IntraFrameReadTimeout, // 14
+		eNTCP2RouterInfoSignatureVerificationFail, // 15
+		eNTCP2IncorrectSParameter, // 16
+		eNTCP2Banned // 17
+	};
+
+#ifdef NTCP2_SUPPORTED
+	class NTCP2Server;
+	class NTCP2Session: public TransportSession, public std::enable_shared_from_this<NTCP2Session>
+	{
+		public:
+
+			NTCP2Session (NTCP2Server& server, std::shared_ptr<const i2p::data::RouterInfo> in_RemoteRouter = nullptr);
+			~NTCP2Session ();
+			void Terminate ();
+			void TerminateByTimeout ();
+			void Done ();
+
+			boost::asio::ip::tcp::socket& GetSocket () { return m_Socket; };
+			bool IsEstablished () const { return m_IsEstablished; };
+			bool IsTerminated () const { return m_IsTerminated; };
+
+			void ClientLogin (); // Alice
+			void ServerLogin (); // Bob
+			void SendI2NPMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs);
+			TransportType GetTransportType () const { return eTransportNTCP2; };
+
+		private:
+
+			void HandlePostedMessages ();
+			void PostI2NPMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs);
+			void Established ();
+
+			// establish
+			void SendSessionRequest ();
+			void SendSessionCreated ();
+			void SendSessionConfirmed ();
+
+			void HandleSessionRequestSent (const boost::system::error_code& ecode, std::size_t bytes_transferred);
+			void HandleSessionRequestReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred);
+			void HandleSessionRequestPaddingReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred);
+			void HandleSessionCreatedSent (const boost::system::error_code& ecode, std::size_t bytes_transferred);
+			void HandleSessionCreatedReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred);
+			void HandleSessionCreatedPaddingReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred);
+			void HandleSessionConfirmedSent (const boost::system::error_code& ecode, std::size_t bytes_transferred);
+			void HandleSessionConfirmedReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred);
+
+			// data
+			void ReceiveLength ();
+			void HandleReceivedLength (const boost::system::error_code& ecode, std::size_t bytes_transferred);
+			void Receive ();
+			void HandleReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred);
+			bool ProcessNextFrame (const uint8_t * frame, size_t len); // false if session must be closed
+
+			void ExpandSendBuffer (size_t size);
+			void SendFrame (size_t len); // blocks are in m_SendBuffer after length
+			void SendQueuedMessages ();
+			void SendTermination (NTCP2TerminationReason reason);
+			void HandleSent (const boost::system::error_code& ecode, std::size_t bytes_transferred);
+			void HandleTerminationSent (const boost::system::error_code& ecode, std::size_t bytes_transferred);
+
+		private:
+
+			NTCP2Server& m_Server;
+			boost::asio::ip::tcp::socket m_Socket;
+			bool m_IsEstablished, m_IsTerminated;
+
+			NTCP2Establisher * m_Establisher;
+			// data phase
+			uint8_t m_Kab[33], m_Kba[32], m_Sipkeysab[33], m_Sipkeysba[32];
+			NTCP2FrameCipher m_SendCipher, m_ReceiveCipher;
+
+			uint8_t m_NextReceivedLenBuf[2];
+			uint16_t m_NextReceivedLen;
+			uint8_t * m_NextReceivedBuffer;
+			size_t m_NextReceivedBufferSize;
+			uint8_t * m_SendBuffer;
+			size_t m_SendBufferSize;
+
+			i2p::I2NPMessagesHandler m_Handler;
+			bool m_IsSending;
+	};
+
+	class NTCP2Server
+	{
+		public:
+
+			NTCP2Server ();
+			~NTCP2Server ();
+
+			void Start ();
+			void Stop ();
+
+			bool AddNTCP2Session (std::shared_ptr<NTCP2Session> session);
+			void RemoveNTCP2Session (std::shared_ptr<NTCP2Session> session);
+			std::shared_ptr<NTCP2Session> FindNTCP2Session (const i2p::data::IdentHash& ident);
+			void Connect (const boost::asio::ip::address& address, int port, std::shared_ptr<NTCP2Session> conn);
+
+			bool IsBoundV4 () const { return m_NTCP2Acceptor != nullptr; };
+			bool IsBoundV6 () const { return m_NTCP2V6Acceptor != nullptr; };
+
+			boost::asio::io_service& GetService () { return m_Service; };
+
+		private:
+
+			void Run ();
+			void HandleAccept (std::shared_ptr<NTCP2Session> conn, const boost::system::error_code& error);
+			void HandleAcceptV6 (std::shared_ptr<NTCP2Session> conn, const boost::system::error_code& error);
+
+			void HandleConnect (const boost::system::error_code& ecode, std::shared_ptr<NTCP2Session> conn, std::shared_ptr<boost::asio::deadline_timer> timer);
+
+			// timer
+			void ScheduleTermination ();
+			void HandleTerminationTimer (const boost::system::error_code& ecode);
+
+		private:
+
+			bool m_IsRunning;
+			std::thread * m_Thread;
+			boost::asio::io_service m_Service;
+			boost::asio::io_service::work m_Work;
+			boost::asio::deadline_timer m_TerminationTimer;
+			boost::asio::ip::tcp::acceptor * m_NTCP2Acceptor, * m_NTCP2V6Acceptor;
+			mutable std::mutex m_NTCP2SessionsMutex;
+			std::map<i2p::data::IdentHash, std::shared_ptr<NTCP2Session> > m_NTCP2Sessions;
+			std::list<std::shared_ptr<NTCP2Session> > m_PendingIncomingSessions;
+
+		public:
+
+			// for HTTP/I2PControl
+			decltype(m_NTCP2Sessions) GetNTCP2Sessions () const
+			{
+				std::unique_lock<std::mutex> l(m_NTCP2SessionsMutex);
+				return m_NTCP2Sessions;
+			};
+	};
+#else
+	class NTCP2Server; // requires OpenSSL 1.1.1
+#endif
+}
+}
+
+#endif
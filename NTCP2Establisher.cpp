@@ -0,0 +1,357 @@
+#include <string.h>
+#include <stdlib.h>
+#include <openssl/sha.h>
+#include <openssl/hmac.h>
+
+#include "Log.h"
+#include "Timestamp.h"
+#include "NTCP2Establisher.h"
+
+#ifdef NTCP2_SUPPORTED
+namespace i2p
+{
+namespace transport
+{
+	NTCP2Establisher::NTCP2Establisher (std::shared_ptr<const i2p::crypto::X25519Keys> staticKeys, const i2p::data::IdentHash& identHash, int netID):
+		m_StaticKeys (staticKeys), m_IdentHash (identHash), m_NetID (netID), m3p2Len (0),
+		m_SessionConfirmedBuffer (nullptr), m_SessionRequestBufferLen (0), m_SessionCreatedBufferLen (0)
+	{
+		memset (m_RemoteStaticKey, 0, 32);
+		memset (m_IV, 0, 16);
+	}
+
+	NTCP2Establisher::~NTCP2Establisher ()
+	{
+		delete[] m_SessionConfirmedBuffer;
+	}
+
+	void NTCP2Establisher::MixKey (const uint8_t * inputKeyMaterial)
+	{
+		// temp_key = HMAC-SHA256(ck, input_key_material)
+		uint8_t tempKey[32]; unsigned int len;
+		HMAC(EVP_sha256(), m_CK, 32, inputKeyMaterial, 32, tempKey, &len);
+		// ck = HMAC-SHA256(temp_key, byte(0x01))
+		static uint8_t one[1] = { 1 };
+		HMAC(EVP_sha256(), tempKey, 32, one, 1, m_CK, &len);
+		// k = HMAC-SHA256(temp_key, ck || byte(0x02))
+		m_CK[32] = 2;
+		HMAC(EVP_sha256(), tempKey, 32, m_CK, 33, m_K, &len);
+	}
+
+	void NTCP2Establisher::MixHash (const uint8_t * buf, size_t len)
+	{
+		// h = SHA256(h || buf)
+		SHA256_CTX ctx;
+		SHA256_Init (&ctx);
+		SHA256_Update (&ctx, m_H, 32);
+		SHA256_Update (&ctx, buf, len);
+		SHA256_Final (m_H, &ctx);
+	}
+
+	void NTCP2Establisher::KeyDerivationFunction1 (const uint8_t * pub, const i2p::crypto::X25519Keys& priv, const uint8_t * rs, const uint8_t * epub)
+	{
+		static const char protocolName[] = "Noise_XKaesobfse+hs2+hs3_25519_ChaChaPoly_SHA256";
+		SHA256 ((const uint8_t *)protocolName, strlen (protocolName), m_CK); // ck = h = SHA256(protocol_name)
+		SHA256 (m_CK, 32, m_H); // h = SHA256(h), empty prologue
+		MixHash (rs, 32); // h = SHA256(h || rs)
+		MixHash (epub, 32); // h = SHA256(h || epub)
+		// x25519 between pub and priv
+		uint8_t inputKeyMaterial[32];
+		if (!priv.Agree (pub, inputKeyMaterial))
+			memset (inputKeyMaterial, 0, 32); // AEAD will fail
+		MixKey (inputKeyMaterial);
+	}
+
+	void NTCP2Establisher::KDF1Alice ()
+	{
+		KeyDerivationFunction1 (m_RemoteStaticKey, m_EphemeralKeys, m_RemoteStaticKey, GetPub ());
+	}
+
+	void NTCP2Establisher::KDF1Bob ()
+	{
+		KeyDerivationFunction1 (GetRemotePub (), *m_StaticKeys, m_StaticKeys->GetPublicKey (), GetRemotePub ());
+	}
+
+	void NTCP2Establisher::KeyDerivationFunction2 (const uint8_t * epub)
+	{
+		MixHash (m_SessionRequestBuffer + 32, 32); // encrypted options
+		size_t paddingLength = m_SessionRequestBufferLen - 64;
+		if (paddingLength > 0)
+			MixHash (m_SessionRequestBuffer + 64, paddingLength);
+		MixHash (epub, 32);
+		// x25519 between remote pub and ephemeral priv
+		uint8_t inputKeyMaterial[32];
+		if (!m_EphemeralKeys.Agree (GetRemotePub (), inputKeyMaterial))
+			memset (inputKeyMaterial, 0, 32);
+		MixKey (inputKeyMaterial);
+	}
+
+	void NTCP2Establisher::KDF2Alice ()
+	{
+		KeyDerivationFunction2 (GetRemotePub ());
+	}
+
+	void NTCP2Establisher::KDF2Bob ()
+	{
+		KeyDerivationFunction2 (GetPub ());
+	}
+
+	void NTCP2Establisher::KDF3Alice ()
+	{
+		// our static and Bob's ephemeral
+		uint8_t inputKeyMaterial[32];
+		if (!m_StaticKeys->Agree (GetRemotePub (), inputKeyMaterial))
+			memset (inputKeyMaterial, 0, 32);
+		MixKey (inputKeyMaterial);
+	}
+
+	void NTCP2Establisher::KDF3Bob ()
+	{
+		// our ephemeral and Alice's static
+		uint8_t inputKeyMaterial[32];
+		if (!m_EphemeralKeys.Agree (m_RemoteStaticKey, inputKeyMaterial))
+			memset (inputKeyMaterial, 0, 32);
+		MixKey (inputKeyMaterial);
+	}
+
+	void NTCP2Establisher::CreateSessionRequestMessage (const uint8_t * ri, size_t riLen)
+	{
+		// random padding
+		size_t paddingLength = rand () % (NTCP2_SESSION_REQUEST_MAX_SIZE - 64);
+		m_SessionRequestBufferLen = paddingLength + 64;
+		RAND_bytes (m_SessionRequestBuffer + 64, paddingLength);
+		// encrypt X with Bob's router hash and published iv
+		i2p::crypto::CBCEncryption encryption;
+		encryption.SetKey (m_RemoteIdentHash);
+		encryption.SetIV (m_IV);
+		encryption.Encrypt (GetPub (), 32, m_SessionRequestBuffer);
+		memcpy (m_IV, m_SessionRequestBuffer + 16, 16); // CBC state for SessionCreated
+		KDF1Alice ();
+		// SessionConfirmed part 2 is our RouterInfo block, take it now to know its length
+		m3p2Len = riLen + 4 + 16; // block header, flag and MAC
+		m_SessionConfirmedBuffer = new uint8_t[m3p2Len + 48];
+		uint8_t * m3p2 = m_SessionConfirmedBuffer + 48;
+		m3p2[0] = eNTCP2BlkRouterInfo;
+		htobe16buf (m3p2 + 1, riLen + 1);
+		m3p2[3] = 0; // flag
+		memcpy (m3p2 + 4, ri, riLen);
+		// options
+		uint8_t options[16];
+		memset (options, 0, 16);
+		options[0] = m_NetID; // network ID
+		options[1] = 2; // ver
+		htobe16buf (options + 2, paddingLength); // padLen
+		htobe16buf (options + 4, m3p2Len); // m3p2len
+		htobe32buf (options + 8, i2p::util::GetSecondsSinceEpoch ()); // tsA
+		// encrypt options with h as AD
+		uint8_t nonce[12];
+		memset (nonce, 0, 12);
+		i2p::crypto::AEADChaCha20Poly1305 (options, 16, m_H, 32, m_K, nonce, m_SessionRequestBuffer + 32, 32, true);
+	}
+
+	void NTCP2Establisher::CreateSessionCreatedMessage ()
+	{
+		// random padding
+		size_t paddingLength = rand () % (NTCP2_SESSION_CREATED_MAX_SIZE - 64);
+		m_SessionCreatedBufferLen = paddingLength + 64;
+		RAND_bytes (m_SessionCreatedBuffer + 64, paddingLength);
+		// encrypt Y, continue CBC from SessionRequest
+		i2p::crypto::CBCEncryption encryption;
+		encryption.SetKey (m_IdentHash);
+		encryption.SetIV (m_IV);
+		encryption.Encrypt (GetPub (), 32, m_SessionCreatedBuffer);
+		KDF2Bob ();
+		// options
+		uint8_t options[16];
+		memset (options, 0, 16);
+		htobe16buf (options + 2, paddingLength); // padLen
+		htobe32buf (options + 8, i2p::util::GetSecondsSinceEpoch ()); // tsB
+		uint8_t nonce[12];
+		memset (nonce, 0, 12);
+		i2p::crypto::AEADChaCha20Poly1305 (options, 16, m_H, 32, m_K, nonce, m_SessionCreatedBuffer + 32, 32, true);
+	}
+
+	void NTCP2Establisher::CreateSessionConfirmedMessagePart1 (const uint8_t * nonce)
+	{
+		MixHash (m_SessionCreatedBuffer + 32, 32); // encrypted options
+		size_t paddingLength = m_SessionCreatedBufferLen - 64;
+		if (paddingLength > 0)
+			MixHash (m_SessionCreatedBuffer + 64, paddingLength);
+		// our static key, 48 bytes with MAC
+		i2p::crypto::AEADChaCha20Poly1305 (m_StaticKeys->GetPublicKey (), 32, m_H, 32, m_K, nonce, m_SessionConfirmedBuffer, 48, true);
+	}
+
+	void NTCP2Establisher::CreateSessionConfirmedMessagePart2 (const uint8_t * nonce)
+	{
+		MixHash (m_SessionConfirmedBuffer, 48);
+		KDF3Alice ();
+		uint8_t * m3p2 = m_SessionConfirmedBuffer + 48;
+		i2p::crypto::AEADChaCha20Poly1305 (m3p2, m3p2Len - 16, m_H, 32, m_K, nonce, m3p2, m3p2Len, true);
+		MixHash (m3p2, m3p2Len); // h for data phase
+	}
+
+	bool NTCP2Establisher::ProcessSessionRequestMessage (uint16_t& paddingLen)
+	{
+		// decrypt X
+		i2p::crypto::CBCDecryption decryption;
+		decryption.SetKey (m_IdentHash);
+		decryption.SetIV (m_IV);
+		decryption.Decrypt (m_SessionRequestBuffer, 32, m_RemoteEphemeralPublicKey);
+		memcpy (m_IV, m_SessionRequestBuffer + 16, 16); // CBC state for SessionCreated
+		KDF1Bob ();
+		// verify MAC and decrypt options
+		uint8_t nonce[12], options[16];
+		memset (nonce, 0, 12);
+		if (!i2p::crypto::AEADChaCha20Poly1305 (m_SessionRequestBuffer + 32, 32, m_H, 32, m_K, nonce, options, 16, false))
+		{
+			LogPrint (eLogWarning, "NTCP2: SessionRequest AEAD verification failed");
+			return false;
+		}
+		if (options[0] && options[0] != m_NetID)
+		{
+			LogPrint (eLogWarning, "NTCP2: SessionRequest networkID ", (int)options[0], " mismatch");
+			return false;
+		}
+		if (options[1] != 2)
+		{
+			LogPrint (eLogWarning, "NTCP2: SessionRequest version ", (int)options[1], " is not supported");
+			return false;
+		}
+		paddingLen = bufbe16toh (options + 2);
+		m_SessionRequestBufferLen = paddingLen + 64;
+		m3p2Len = bufbe16toh (options + 4);
+		if (m3p2Len <= 16 + 4)
+		{
+			LogPrint (eLogWarning, "NTCP2: SessionRequest m3p2len ", m3p2Len, " is too short");
+			return false;
+		}
+		// check timestamp
+		auto ts = i2p::util::GetSecondsSinceEpoch ();
+		uint32_t tsA = bufbe32toh (options + 8);
+		if (tsA < ts - NTCP2_CLOCK_SKEW || tsA > ts + NTCP2_CLOCK_SKEW)
+		{
+			LogPrint (eLogWarning, "NTCP2: SessionRequest time difference ", (int)(ts - tsA), " exceeds clock skew");
+			return false;
+		}
+		return true;
+	}
+
+	bool NTCP2Establisher::ProcessSessionCreatedMessage (uint16_t& paddingLen)
+	{
+		// decrypt Y, continue CBC from SessionRequest
+		i2p::crypto::CBCDecryption decryption;
+		decryption.SetKey (m_RemoteIdentHash);
+		decryption.SetIV (m_IV);
+		decryption.Decrypt (m_SessionCreatedBuffer, 32, m_RemoteEphemeralPublicKey);
+		KDF2Alice ();
+		// verify MAC and decrypt options
+		uint8_t nonce[12], options[16];
+		memset (nonce, 0, 12);
+		if (!i2p::crypto::AEADChaCha20Poly1305 (m_SessionCreatedBuffer + 32, 32, m_H, 32, m_K, nonce, options, 16, false))
+		{
+			LogPrint (eLogWarning, "NTCP2: SessionCreated AEAD verification failed");
+			return false;
+		}
+		paddingLen = bufbe16toh (options + 2);
+		m_SessionCreatedBufferLen = paddingLen + 64;
+		// check timestamp
+		auto ts = i2p::util::GetSecondsSinceEpoch ();
+		uint32_t tsB = bufbe32toh (options + 8);
+		if (tsB < ts - NTCP2_CLOCK_SKEW || tsB > ts + NTCP2_CLOCK_SKEW)
+		{
+			LogPrint (eLogWarning, "NTCP2: SessionCreated time difference ", (int)(ts - tsB), " exceeds clock skew");
+			return false;
+		}
+		return true;
+	}
+
+	bool NTCP2Establisher::ProcessSessionConfirmedMessagePart1 (const uint8_t * nonce)
+	{
+		MixHash (m_SessionCreatedBuffer + 32, 32); // encrypted options
+		size_t paddingLength = m_SessionCreatedBufferLen - 64;
+		if (paddingLength > 0)
+			MixHash (m_SessionCreatedBuffer + 64, paddingLength);
+		if (!i2p::crypto::AEADChaCha20Poly1305 (m_SessionConfirmedBuffer, 48, m_H, 32, m_K, nonce, m_RemoteStaticKey, 32, false))
+		{
+			LogPrint (eLogWarning, "NTCP2: SessionConfirmed Part1 AEAD verification failed");
+			return false;
+		}
+		return true;
+	}
+
+	bool NTCP2Establisher::ProcessSessionConfirmedMessagePart2 (const uint8_t * nonce, uint8_t * m3p2Buf)
+	{
+		MixHash (m_SessionConfirmedBuffer, 48);
+		KDF3Bob ();
+		uint8_t * m3p2 = m_SessionConfirmedBuffer + 48;
+		if (!i2p::crypto::AEADChaCha20Poly1305 (m3p2, m3p2Len, m_H, 32, m_K, nonce, m3p2Buf, m3p2Len - 16, false))
+		{
+			LogPrint (eLogWarning, "NTCP2: SessionConfirmed Part2 AEAD verification failed");
+			return false;
+		}
+		MixHash (m3p2, m3p2Len); // h for data phase
+		return true;
+	}
+
+	void NTCP2Establisher::KeyDerivationFunctionDataPhase (uint8_t * kab, uint8_t * kba, uint8_t * sipkeysab, uint8_t * sipkeysba) const
+	{
+		// temp_key = HMAC-SHA256(ck, zerolen)
+		uint8_t tempKey[32]; unsigned int len;
+		HMAC(EVP_sha256(), m_CK, 32, nullptr, 0, tempKey, &len);
+		// k_ab = HMAC-SHA256(temp_key, byte(0x01)), k_ba = HMAC-SHA256(temp_key, k_ab || byte(0x02))
+		static uint8_t one[1] = { 1 };
+		HMAC(EVP_sha256(), tempKey, 32, one, 1, kab, &len);
+		kab[32] = 2;
+		HMAC(EVP_sha256(), tempKey, 32, kab, 33, kba, &len);
+		// ask_master = HMAC-SHA256(temp_key, "ask" || byte(0x01))
+		static uint8_t ask[4] = { 'a', 's', 'k', 1 };
+		uint8_t master[32];
+		HMAC(EVP_sha256(), tempKey, 32, ask, 4, master, &len);
+		// temp_key = HMAC-SHA256(ask_master, h || "siphash")
+		uint8_t h[39];
+		memcpy (h, m_H, 32);
+		memcpy (h + 32, "siphash", 7);
+		HMAC(EVP_sha256(), master, 32, h, 39, tempKey, &len);
+		// sip_master = HMAC-SHA256(temp_key, byte(0x01))
+		HMAC(EVP_sha256(), tempKey, 32, one, 1, master, &len);
+		// temp_key = HMAC-SHA256(sip_master, zerolen)
+		HMAC(EVP_sha256(), master, 32, nullptr, 0, tempKey, &len);
+		// sipkeys_ab = HMAC-SHA256(temp_key, byte(0x01)), sipkeys_ba = HMAC-SHA256(temp_key, sipkeys_ab || byte(0x02))
+		HMAC(EVP_sha256(), tempKey, 32, one, 1, sipkeysab, &len);
+		sipkeysab[32] = 2;
+		HMAC(EVP_sha256(), tempKey, 32, sipkeysab, 33, sipkeysba, &len);
+	}
+
+	void NTCP2FrameCipher::SetKeys (const uint8_t * key, const uint8_t * sipKeys)
+	{
+		m_Key = key;
+		m_SipKey = sipKeys;
+		memcpy (m_IV, sipKeys + 16, 8);
+	}
+
+	void NTCP2FrameCipher::Encrypt (uint8_t * buf, size_t len)
+	{
+		uint8_t nonce[12];
+		CreateNTCP2Nonce (m_SequenceNumber, nonce); m_SequenceNumber++;
+		i2p::crypto::AEADChaCha20Poly1305 (buf + 2, len, nullptr, 0, m_Key, nonce, buf + 2, len + 16, true);
+		// obfuscate length with next SipHash IV
+		i2p::crypto::Siphash24 (m_IV, m_IV, 8, m_SipKey);
+		htobe16buf (buf, (len + 16) ^ bufle16toh (m_IV));
+	}
+
+	uint16_t NTCP2FrameCipher::DecryptLength (const uint8_t * lengthBuf)
+	{
+		// deobfuscate length with next SipHash IV
+		i2p::crypto::Siphash24 (m_IV, m_IV, 8, m_SipKey);
+		return bufbe16toh (lengthBuf) ^ bufle16toh (m_IV);
+	}
+
+	bool NTCP2FrameCipher::Decrypt (uint8_t * frame, size_t len)
+	{
+		uint8_t nonce[12];
+		CreateNTCP2Nonce (m_SequenceNumber, nonce); m_SequenceNumber++;
+		return i2p::crypto::AEADChaCha20Poly1305 (frame, len, nullptr, 0, m_Key, nonce, frame, len, false);
+	}
+}
+}
+#endif
@@ -0,0 +1,112 @@
+#ifndef NTCP2_ESTABLISHER_H__
+#define NTCP2_ESTABLISHER_H__
+
+#include <inttypes.h>
+#include <string.h>
+#include <memory>
+#include "I2PEndian.h"
+#include "Crypto.h"
+#include "Identity.h"
+
+#if defined(OPENSSL_X25519) && defined(OPENSSL_AEAD_CHACHA20_POLY1305)
+#define NTCP2_SUPPORTED 1 // NTCP2 is compiled out otherwise
+#endif
+
+namespace i2p
+{
+namespace transport
+{
+	const size_t NTCP2_UNENCRYPTED_FRAME_MAX_SIZE = 65519; // 65535 - 16 bytes of MAC
+	const size_t NTCP2_SESSION_REQUEST_MAX_SIZE = 287;
+	const size_t NTCP2_SESSION_CREATED_MAX_SIZE = 287;
+	const int NTCP2_CLOCK_SKEW = 60; // in seconds
+
+	enum NTCP2BlockType
+	{
+		eNTCP2BlkDateTime = 0,
+		eNTCP2BlkOptions, // 1
+		eNTCP2BlkRouterInfo, // 2
+		eNTCP2BlkI2NPMessage, // 3
+		eNTCP2BlkTermination, // 4
+		eNTCP2BlkPadding = 254
+	};
+
+#ifdef NTCP2_SUPPORTED
+	inline void CreateNTCP2Nonce (uint64_t seqn, uint8_t * nonce)
+	{
+		memset (nonce, 0, 4);
+		htole64buf (nonce + 4, seqn);
+	}
+
+	// Noise_XK handshake state
+	struct NTCP2Establisher
+	{
+		NTCP2Establisher (std::shared_ptr<const i2p::crypto::X25519Keys> staticKeys, const i2p::data::IdentHash& identHash, int netID); // ours
+		~NTCP2Establisher ();
+
+		const uint8_t * GetPub () const { return m_EphemeralKeys.GetPublicKey (); };
+		const uint8_t * GetRemotePub () const { return m_RemoteEphemeralPublicKey; };
+		const uint8_t * GetK () const { return m_K; };
+		const uint8_t * GetCK () const { return m_CK; };
+		const uint8_t * GetH () const { return m_H; };
+
+		void MixKey (const uint8_t * inputKeyMaterial);
+		void MixHash (const uint8_t * buf, size_t len);
+		void KeyDerivationFunction1 (const uint8_t * pub, const i2p::crypto::X25519Keys& priv, const uint8_t * rs, const uint8_t * epub); // for SessionRequest
+		void KeyDerivationFunction2 (const uint8_t * epub); // for SessionCreate
+		void KDF1Alice ();
+		void KDF1Bob ();
+		void KDF2Alice ();
+		void KDF2Bob ();
+		void KDF3Alice (); // for SessionConfirmed part 2
+		void KDF3Bob ();
+		void KeyDerivationFunctionDataPhase (uint8_t * kab, uint8_t * kba, uint8_t * sipkeysab, uint8_t * sipkeysba) const; // kab and sipkeysab are 33 bytes
+
+		void CreateSessionRequestMessage (const uint8_t * ri, size_t riLen); // our RouterInfo goes to SessionConfirmed part 2
+		void CreateSessionCreatedMessage ();
+		void CreateSessionConfirmedMessagePart1 (const uint8_t * nonce);
+		void CreateSessionConfirmedMessagePart2 (const uint8_t * nonce);
+
+		bool ProcessSessionRequestMessage (uint16_t& paddingLen);
+		bool ProcessSessionCreatedMessage (uint16_t& paddingLen);
+		bool ProcessSessionConfirmedMessagePart1 (const uint8_t * nonce);
+		bool ProcessSessionConfirmedMessagePart2 (const uint8_t * nonce, uint8_t * m3p2Buf);
+
+		i2p::crypto::X25519Keys m_EphemeralKeys;
+		std::shared_ptr<const i2p::crypto::X25519Keys> m_StaticKeys; // ours
+		i2p::data::IdentHash m_IdentHash; // ours
+		int m_NetID;
+		uint8_t m_RemoteEphemeralPublicKey[32]; // x25519
+		uint8_t m_RemoteStaticKey[32], m_IV[16] /*Bob's published, then CBC state*/, m_H[32] /*h*/, m_CK[33] /*ck*/, m_K[32] /*k*/;
+		i2p::data::IdentHash m_RemoteIdentHash;
+		uint16_t m3p2Len;
+
+		uint8_t m_SessionRequestBuffer[NTCP2_SESSION_REQUEST_MAX_SIZE], m_SessionCreatedBuffer[NTCP2_SESSION_CREATED_MAX_SIZE];
+		uint8_t * m_SessionConfirmedBuffer;
+		size_t m_SessionRequestBufferLen, m_SessionCreatedBufferLen;
+	};
+
+	// data phase frames of one direction, sequence number is nonce, length is obfuscated by SipHash
+	class NTCP2FrameCipher
+	{
+		public:
+
+			NTCP2FrameCipher (): m_Key (nullptr), m_SipKey (nullptr), m_SequenceNumber (0) {};
+			void SetKeys (const uint8_t * key, const uint8_t * sipKeys); // 32 bytes, 16 bytes of SipHash key and 8 bytes of IV
+			uint64_t GetSequenceNumber () const { return m_SequenceNumber; };
+
+			void Encrypt (uint8_t * buf, size_t len); // in place, 2 bytes of length and len bytes of frame, 16 bytes of MAC follow
+			uint16_t DecryptLength (const uint8_t * lengthBuf); // of next frame with MAC
+			bool Decrypt (uint8_t * frame, size_t len); // in place, len includes MAC
+
+		private:
+
+			const uint8_t * m_Key, * m_SipKey;
+			uint8_t m_IV[8];
+			uint64_t m_SequenceNumber;
+	};
+#endif
+}
+}
+
+#endif
@@ -1,6 +1,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <future>
+#include <algorithm>
 
 #include "I2PEndian.h"
 #include "Base.h"
@@ -24,16 +25,22 @@ namespace transport
 {
 	NTCPSession::NTCPSession (NTCPServer& server, std::shared_ptr<const i2p::data::RouterInfo> in_RemoteRouter): 
 		TransportSession (in_RemoteRouter, NTCP_ESTABLISH_TIMEOUT),	
-		m_Server (server), m_Socket (m_Server.GetService ()), 
+		m_Server (server), m_Service (in_RemoteRouter ? server.GetSessionService (in_RemoteRouter->GetIdentHash ()) :
+			server.GetNextSessionService ()), m_Socket (m_Service), 
 		m_IsEstablished (false), m_IsTerminated (false),
-		m_ReceiveBufferOffset (0), m_NextMessage (nullptr), m_IsSending (false)
+		m_ReceiveBufferSize (NTCP_BUFFER_SIZE + 16), m_ReceiveBufferOffset (0), 
+		m_SendBuffer (nullptr), m_SendBufferSize (0), m_PaddingPoolOffset (NTCP_PADDING_POOL_SIZE),
+		m_NextMessage (nullptr), m_IsSending (false)
 	{		
 		m_Establisher = new Establisher;
+		m_ReceiveBuffer = new uint8_t[m_ReceiveBufferSize];
 	}
 	
 	NTCPSession::~NTCPSession ()
 	{
 		delete m_Establisher;
+		delete[] m_ReceiveBuffer;
+		delete[] m_SendBuffer;
 	}
 
 	void NTCPSession::CreateAESKey (uint8_t * pubKey)
@@ -71,7 +78,7 @@ namespace transport
 
 	void NTCPSession::Done ()
 	{
-		m_Server.GetService ().post (std::bind (&NTCPSession::Terminate, shared_from_this ()));  
+		m_Service.post (std::bind (&NTCPSession::Terminate, shared_from_this ()));  
 	}	
 		
 	void NTCPSession::Terminate ()
@@ -83,7 +90,7 @@ namespace transport
 			m_Socket.close ();
 			transports.PeerDisconnected (shared_from_this ());
 			m_Server.RemoveNTCPSession (shared_from_this ());
-			m_SendQueue.clear ();
+			m_SendQueue.Clear ();
 			m_NextMessage = nullptr;
 			LogPrint (eLogDebug, "NTCP: session terminated");
 		}	
@@ -184,7 +191,7 @@ namespace transport
 						s->m_DHKeysPair = transports.GetNextDHKeysPair ();
 					s->CreateAESKey (s->m_Establisher->phase1.pubKey);
 				}).share (); 						 
-			m_Server.GetService ().post ([s, keyCreated]()
+			m_Service.post ([s, keyCreated]()
 				{  
 					keyCreated.get (); 
 					s->SendPhase2 ();
@@ -260,7 +267,7 @@ namespace transport
 					s->CreateAESKey (s->m_Establisher->phase2.pubKey);
 				}).share (); // TODO: use move capture in C++ 14 instead shared_future							 
 			// let other operations execute while a key gets created
-			m_Server.GetService ().post ([s, keyCreated]()
+			m_Service.post ([s, keyCreated]()
 				{  
 					keyCreated.get (); // we might wait if no more pending operations
 					s->HandlePhase2 ();
@@ -375,6 +382,12 @@ namespace transport
 			if (paddingLen) paddingLen = (16 - paddingLen);	
 			if (expectedSize > NTCP_DEFAULT_PHASE3_SIZE)
 			{
+				if (expectedSize + paddingLen > m_ReceiveBufferSize)
+				{
+					LogPrint (eLogError, "NTCP: Phase 3 size ", expectedSize, " exceeds buffer size");
+					Terminate ();
+					return;
+				}	
 				// we need more bytes for Phase3
 				expectedSize += paddingLen;	
 				boost::asio::async_read (m_Socket, boost::asio::buffer(m_ReceiveBuffer + NTCP_DEFAULT_PHASE3_SIZE, expectedSize - NTCP_DEFAULT_PHASE3_SIZE), boost::asio::transfer_all (),                   
@@ -526,7 +539,7 @@ namespace transport
 
 	void NTCPSession::Receive ()
 	{
-		m_Socket.async_read_some (boost::asio::buffer(m_ReceiveBuffer + m_ReceiveBufferOffset, NTCP_BUFFER_SIZE - m_ReceiveBufferOffset),                
+		m_Socket.async_read_some (boost::asio::buffer(m_ReceiveBuffer + m_ReceiveBufferOffset, m_ReceiveBufferSize - m_ReceiveBufferOffset),                
 			std::bind(&NTCPSession::HandleReceived, shared_from_this (), 
 			std::placeholders::_1, std::placeholders::_2));
 	}	
@@ -542,71 +555,47 @@ namespace transport
 		}
 		else
 		{
-			m_NumReceivedBytes += bytes_transferred;
-			i2p::transport::transports.UpdateReceivedBytes (bytes_transferred);
 			m_ReceiveBufferOffset += bytes_transferred;
-
-			if (m_ReceiveBufferOffset >= 16)
-			{	
-				// process received data
-				uint8_t * nextBlock = m_ReceiveBuffer;
-				while (m_ReceiveBufferOffset >= 16)
-				{
-					if (!DecryptNextBlock (nextBlock)) // 16 bytes
-					{
-						Terminate ();
-						return; 
-					}	
-					nextBlock += 16;
-					m_ReceiveBufferOffset -= 16;
-				}	
-				if (m_ReceiveBufferOffset > 0) 
-					memcpy (m_ReceiveBuffer, nextBlock, m_ReceiveBufferOffset);		
-			}		
-
-			// read and process more is available
+			// read more if available
 			boost::system::error_code ec;
 			size_t moreBytes = m_Socket.available(ec);
 			if (moreBytes && !ec)
 			{
-				uint8_t * buf = nullptr, * moreBuf = m_ReceiveBuffer;
-				if (moreBytes + m_ReceiveBufferOffset > NTCP_BUFFER_SIZE)
-				{
-					buf = new uint8_t[moreBytes + m_ReceiveBufferOffset + 16];
-					moreBuf = buf;
-					uint8_t rem = ((size_t)buf) & 0x0f;
-					if (rem) moreBuf += (16 - rem); // align 16
-					if (m_ReceiveBufferOffset)
-						memcpy (moreBuf, m_ReceiveBuffer, m_ReceiveBufferOffset);
-				}
-				moreBytes = m_Socket.read_some (boost::asio::buffer (moreBuf + m_ReceiveBufferOffset, moreBytes), ec);
-				if (ec)
-				{
-					LogPrint (eLogInfo, "NTCP: Read more bytes error: ", ec.message ());
-					delete[] buf;
-					Terminate ();
-					return;
-				} 
-				m_ReceiveBufferOffset += moreBytes;	
-				m_NumReceivedBytes += moreBytes;
-				i2p::transport::transports.UpdateReceivedBytes (moreBytes);
-				// process more data				
-				uint8_t * nextBlock = moreBuf;
-				while (m_ReceiveBufferOffset >= 16)
-				{
-					if (!DecryptNextBlock (nextBlock)) // 16 bytes
+				if (m_ReceiveBufferOffset + moreBytes > m_ReceiveBufferSize)
+					ExpandReceiveBuffer (m_ReceiveBufferOffset + moreBytes);
+				moreBytes = std::min (moreBytes, m_ReceiveBufferSize - m_ReceiveBufferOffset);
+				if (moreBytes)
+				{	
+					moreBytes = m_Socket.read_some (boost::asio::buffer (m_ReceiveBuffer + m_ReceiveBufferOffset, moreBytes), ec);
+					if (ec)
 					{
-						delete[] buf;
+						LogPrint (eLogInfo, "NTCP: Read more bytes error: ", ec.message ());
 						Terminate ();
-						return; 
-					}	
-					nextBlock += 16;
-					m_ReceiveBufferOffset -= 16;
+						return;
+					} 
+					bytes_transferred += moreBytes;
+					m_ReceiveBufferOffset += moreBytes;	
+				}	
+			}	
+			m_NumReceivedBytes += bytes_transferred;
+			i2p::transport::transports.UpdateReceivedBytes (bytes_transferred);
+
+			// decrypt all complete blocks at once, CBC decryption doesn't have to wait for previous block
+			size_t len = m_ReceiveBufferOffset & ~0x0F;
+			if (len > 0)
+			{	
+				m_Decryption.Decrypt (m_ReceiveBuffer, len, m_ReceiveBuffer);
+				if (!HandleReceivedBlocks (m_ReceiveBuffer, len)) 
+				{
+					Terminate ();
+					return; 
 				}	
+				m_ReceiveBufferOffset -= len;
 				if (m_ReceiveBufferOffset > 0) 
-					memcpy (m_ReceiveBuffer, nextBlock, m_ReceiveBufferOffset); // nextBlock points to memory inside buf
-				delete[] buf;
-			}			
+					memcpy (m_ReceiveBuffer, m_ReceiveBuffer + len, m_ReceiveBufferOffset);		
+			}		
+			if (!m_ReceiveBufferOffset && len < m_ReceiveBufferSize/4)
+				ShrinkReceiveBuffer (); // burst is over
 			m_Handler.Flush ();	
 			
 			m_LastActivityTimestamp = i2p::util::GetSecondsSinceEpoch ();
@@ -614,120 +603,160 @@ namespace transport
 		}	
 	}	
 
-	bool NTCPSession::DecryptNextBlock (const uint8_t * encrypted) // 16 bytes
+	void NTCPSession::ExpandReceiveBuffer (size_t size)
+	{
+		if (m_ReceiveBufferSize >= NTCP_MAX_RECEIVE_BUFFER_SIZE) return;
+		size = std::min (std::max (size, 2*m_ReceiveBufferSize), NTCP_MAX_RECEIVE_BUFFER_SIZE);
+		auto buf = new uint8_t[size];
+		if (m_ReceiveBufferOffset)
+			memcpy (buf, m_ReceiveBuffer, m_ReceiveBufferOffset);
+		delete[] m_ReceiveBuffer;
+		m_ReceiveBuffer = buf;
+		m_ReceiveBufferSize = size;
+	}	
+
+	void NTCPSession::ShrinkReceiveBuffer ()
+	{
+		if (m_ReceiveBufferSize <= NTCP_BUFFER_SIZE + 16) return;
+		delete[] m_ReceiveBuffer;
+		m_ReceiveBufferSize = NTCP_BUFFER_SIZE + 16;
+		m_ReceiveBuffer = new uint8_t[m_ReceiveBufferSize];
+	}	
+
+	bool NTCPSession::HandleReceivedBlocks (const uint8_t * buf, size_t len) 
 	{
-		if (!m_NextMessage) // new message, header expected
+		while (len > 0)
 		{	
-			// decrypt header and extract length
-			uint8_t buf[16];
-			m_Decryption.Decrypt (encrypted, buf);
-			uint16_t dataSize = bufbe16toh (buf);
-			if (dataSize)
-			{
-				// new message
-				if (dataSize + 16U + 15U > NTCP_MAX_MESSAGE_SIZE - 2) // + 6 + padding
+			if (!m_NextMessage) // new message, header expected
+			{	
+				uint16_t dataSize = bufbe16toh (buf);
+				if (dataSize)
 				{
-					LogPrint (eLogError, "NTCP: data size ", dataSize, " exceeds max size");
-					return false;
-				}
-				m_NextMessage = (dataSize + 16U + 15U) <= I2NP_MAX_SHORT_MESSAGE_SIZE - 2 ? NewI2NPShortMessage () : NewI2NPMessage ();
-				m_NextMessage->Align (16);
-				m_NextMessage->offset += 2; // size field
-				m_NextMessage->len = m_NextMessage->offset + dataSize; 
-				memcpy (m_NextMessage->GetBuffer () - 2, buf, 16);
-				m_NextMessageOffset = 16;
+					// new message
+					if (dataSize + 16U + 15U > NTCP_MAX_MESSAGE_SIZE - 2) // + 6 + padding
+					{
+						LogPrint (eLogError, "NTCP: data size ", dataSize, " exceeds max size");
+						return false;
+					}
+					m_NextMessage = (dataSize + 16U + 15U) <= I2NP_MAX_SHORT_MESSAGE_SIZE - 2 ? NewI2NPShortMessage () : NewI2NPMessage ();
+					m_NextMessage->Align (16);
+					m_NextMessage->offset += 2; // size field
+					m_NextMessage->len = m_NextMessage->offset + dataSize; 
+					m_NextMessageOffset = 0;
+				}	
+				else
+				{	
+					// timestamp
+					int diff = (int)bufbe32toh (buf + 2) - (int)i2p::util::GetSecondsSinceEpoch ();
+					LogPrint (eLogInfo, "NTCP: Timestamp. Time difference ", diff, " seconds");
+					buf += 16; len -= 16;
+					continue;
+				}	
 			}	
-			else
+
+			// copy up to the end of the message, including padding and checksum
+			size_t messageSize = (m_NextMessage->GetLength () + 2 + 4 + 15) & ~0x0F;
+			size_t size = std::min (len, messageSize - m_NextMessageOffset);
+			memcpy (m_NextMessage->GetBuffer () - 2 + m_NextMessageOffset, buf, size);
+			m_NextMessageOffset += size;
+			buf += size; len -= size;
+			
+			if (m_NextMessageOffset >= messageSize) 
 			{	
-				// timestamp
-				int diff = (int)bufbe32toh (buf + 2) - (int)i2p::util::GetSecondsSinceEpoch ();
-				LogPrint (eLogInfo, "NTCP: Timestamp. Time difference ", diff, " seconds");
-				return true;
-			}	
-		}	
-		else // message continues
-		{	
-			m_Decryption.Decrypt (encrypted, m_NextMessage->GetBuffer () - 2 + m_NextMessageOffset);
-			m_NextMessageOffset += 16;
-		}		
-		
-		if (m_NextMessageOffset >= m_NextMessage->GetLength () + 2 + 4) // +checksum
-		{	
-			// we have a complete I2NP message
-			uint8_t checksum[4];
-			htobe32buf (checksum, adler32 (adler32 (0, Z_NULL, 0), m_NextMessage->GetBuffer () - 2, m_NextMessageOffset - 4));
-			if (!memcmp (m_NextMessage->GetBuffer () - 2 + m_NextMessageOffset - 4, checksum, 4))
-			{
-				if (!m_NextMessage->IsExpired ())
+				// we have a complete I2NP message
+				uint8_t checksum[4];
+				htobe32buf (checksum, adler32 (adler32 (0, Z_NULL, 0), m_NextMessage->GetBuffer () - 2, m_NextMessageOffset - 4));
+				if (!memcmp (m_NextMessage->GetBuffer () - 2 + m_NextMessageOffset - 4, checksum, 4))
 				{
+					if (!m_NextMessage->IsExpired ())
+					{
 #ifdef WITH_EVENTS
-					QueueIntEvent("transport.recvmsg", GetIdentHashBase64(), 1);
+						QueueIntEvent("transport.recvmsg", GetIdentHashBase64(), 1);
 #endif
-					m_Handler.PutNextMessage (m_NextMessage);
-				}
+						m_Handler.PutNextMessage (m_NextMessage);
+					}
+					else
+						LogPrint (eLogInfo, "NTCP: message expired");
+				}	
 				else
-					LogPrint (eLogInfo, "NTCP: message expired");
-			}	
-			else
-				LogPrint (eLogWarning, "NTCP: Incorrect adler checksum of message, dropped");
-			m_NextMessage = nullptr;
-		}
+					LogPrint (eLogWarning, "NTCP: Incorrect adler checksum of message, dropped");
+				m_NextMessage = nullptr;
+			}
+		}	
 		return true;	
  	}	
 
-	void NTCPSession::Send (std::shared_ptr<i2p::I2NPMessage> msg)
+	void NTCPSession::Send (const std::vector<std::shared_ptr<I2NPMessage> >& msgs)
 	{
+		// frames of the batch are laid out in one buffer, encrypted at once and written by one call
+		size_t len = 0;
+		for (const auto& it: msgs)
+			len += GetFrameLength (it);
+		if (len > m_SendBufferSize)
+		{
+			delete[] m_SendBuffer;
+			m_SendBuffer = new uint8_t[len];
+			m_SendBufferSize = len;
+		}	
+		uint8_t * buf = m_SendBuffer;
+		for (const auto& it: msgs)
+			buf += EncodeFrame (it, buf);
+		m_Encryption.Encrypt (m_SendBuffer, len, m_SendBuffer);
+
 		m_IsSending = true;
-		boost::asio::async_write (m_Socket, CreateMsgBuffer (msg), boost::asio::transfer_all (),                      
-        	std::bind(&NTCPSession::HandleSent, shared_from_this (), std::placeholders::_1, std::placeholders::_2, std::vector<std::shared_ptr<I2NPMessage> >{ msg }));	
+		boost::asio::async_write (m_Socket, boost::asio::buffer ((const uint8_t *)m_SendBuffer, len), boost::asio::transfer_all (),                      
+        	std::bind(&NTCPSession::HandleSent, shared_from_this (), std::placeholders::_1, std::placeholders::_2, msgs));
 	}
 
-	boost::asio::const_buffers_1 NTCPSession::CreateMsgBuffer (std::shared_ptr<I2NPMessage> msg)
+	void NTCPSession::SendQueuedMessages ()
 	{
-		uint8_t * sendBuffer;
-		int len;
+		// in priority order, as many as fit into one write
+		std::vector<std::shared_ptr<I2NPMessage> > msgs;
+		size_t len = 0;
+		while (auto msg = m_SendQueue.Peek ())
+		{
+			size_t frameLen = GetFrameLength (msg);
+			if (!msgs.empty () && len + frameLen > NTCP_MAX_SEND_BUFFER_SIZE) break;
+			msgs.push_back (m_SendQueue.Pop ());
+			len += frameLen;
+		}
+		if (!msgs.empty ())
+			Send (msgs);
+	}
 
+	size_t NTCPSession::EncodeFrame (std::shared_ptr<I2NPMessage> msg, uint8_t * buf)
+	{
+		size_t len;
 		if (msg)
 		{	
 			// regular I2NP
-			if (msg->offset < 2)
-				LogPrint (eLogError, "NTCP: Malformed I2NP message"); // TODO:
-			sendBuffer = msg->GetBuffer () - 2; 
 			len = msg->GetLength ();
-			htobe16buf (sendBuffer, len);
+			htobe16buf (buf, len);
+			memcpy (buf + 2, msg->GetBuffer (), len);
 		}	
 		else
 		{
-			// prepare timestamp
-			sendBuffer = m_TimeSyncBuffer;
+			// timestamp
 			len = 4;
-			htobuf16(sendBuffer, 0);
-			htobe32buf (sendBuffer + 2, i2p::util::GetSecondsSinceEpoch ());
+			htobuf16 (buf, 0);
+			htobe32buf (buf + 2, i2p::util::GetSecondsSinceEpoch ());
 		}	
-		int rem = (len + 6) & 0x0F; // %16
-		int padding = 0;
-		if (rem > 0) {
-			padding = 16 - rem;
-			// fill with random padding
-			RAND_bytes(sendBuffer + len + 2, padding);
-		}
-		htobe32buf (sendBuffer + len + 2 + padding, adler32 (adler32 (0, Z_NULL, 0), sendBuffer, len + 2+ padding));
-
-		int l = len + padding + 6;
-		m_Encryption.Encrypt(sendBuffer, l, sendBuffer);	
-		return boost::asio::buffer ((const uint8_t *)sendBuffer, l);
+		size_t padding = (16 - ((len + 6) & 0x0F)) & 0x0F;
+		if (padding) FillPadding (buf + len + 2, padding);
+		htobe32buf (buf + len + 2 + padding, adler32 (adler32 (0, Z_NULL, 0), buf, len + 2 + padding));
+		return len + padding + 6;
 	}	
 
-
-	void NTCPSession::Send (const std::vector<std::shared_ptr<I2NPMessage> >& msgs)
+	void NTCPSession::FillPadding (uint8_t * buf, size_t len)
 	{
-		m_IsSending = true;
-		std::vector<boost::asio::const_buffer> bufs;
-		for (const auto& it: msgs)
-			bufs.push_back (CreateMsgBuffer (it));
-		boost::asio::async_write (m_Socket, bufs, boost::asio::transfer_all (),                      
-        	std::bind(&NTCPSession::HandleSent, shared_from_this (), std::placeholders::_1, std::placeholders::_2, msgs));
-	}
+		if (m_PaddingPoolOffset + len > NTCP_PADDING_POOL_SIZE)
+		{
+			RAND_bytes (m_PaddingPool, NTCP_PADDING_POOL_SIZE);
+			m_PaddingPoolOffset = 0;
+		}	
+		memcpy (buf, m_PaddingPool + m_PaddingPoolOffset, len);
+		m_PaddingPoolOffset += len;
+	}	
 		
 	void NTCPSession::HandleSent (const boost::system::error_code& ecode, std::size_t bytes_transferred, std::vector<std::shared_ptr<I2NPMessage> > msgs)
 	{
@@ -745,51 +774,67 @@ namespace transport
 			m_LastActivityTimestamp = i2p::util::GetSecondsSinceEpoch ();
 			m_NumSentBytes += bytes_transferred;
 			i2p::transport::transports.UpdateSentBytes (bytes_transferred);
-			if (!m_SendQueue.empty())
+			if (UpdateStats ())
 			{
-				Send (m_SendQueue);
-				m_SendQueue.clear ();
-			}	
+#ifdef __linux__
+				UpdateTCPRTT (m_Socket.native_handle ());
+#endif
+			}
+			if (!m_SendQueue.IsEmpty ())
+				SendQueuedMessages ();
 		}	
 	}	
 
 		
 	void NTCPSession::SendTimeSyncMessage ()
 	{
-		Send (nullptr);
+		Send (std::vector<std::shared_ptr<I2NPMessage> >{ nullptr }); // null means timestamp
 	}	
 
 
 	void NTCPSession::SendI2NPMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs)
 	{
-		m_Server.GetService ().post (std::bind (&NTCPSession::PostI2NPMessages, shared_from_this (), msgs));  
-	}	
+		if (PostMessages (msgs)) // otherwise session's thread is woken up already
+			m_Service.post (std::bind (&NTCPSession::HandlePostedMessages, shared_from_this ()));
+	}
 
-	void NTCPSession::PostI2NPMessages (std::vector<std::shared_ptr<I2NPMessage> > msgs)
+	void NTCPSession::HandlePostedMessages ()
+	{
+		if (TakePostedMessages (m_TakenMessages)) // more were posted while we were taking
+			m_Service.post (std::bind (&NTCPSession::HandlePostedMessages, shared_from_this ()));
+		PostI2NPMessages (m_TakenMessages);
+		m_TakenMessages.clear ();
+	}
+
+	void NTCPSession::PostI2NPMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs)
 	{
 		if (m_IsTerminated) return;
-		if (m_IsSending)
-		{
-			if (m_SendQueue.size () < NTCP_MAX_OUTGOING_QUEUE_SIZE)	
-			{
-				for (const auto& it: msgs)
-					m_SendQueue.push_back (it);
-			}
-			else
+		for (const auto& it: msgs)
+			if (it && !m_SendQueue.Push (it))
 			{
-				LogPrint (eLogWarning, "NTCP: outgoing messages queue size exceeds ", NTCP_MAX_OUTGOING_QUEUE_SIZE);
+				LogPrint (eLogWarning, "NTCP: outgoing messages queue size exceeds ", SEND_QUEUE_MAX_TOTAL_SIZE);
 				Terminate ();
+				return;
 			}	
-		}	
-		else	
-			Send (msgs);
+		if (!m_IsSending)
+			SendQueuedMessages ();
 	}	
 
 //-----------------------------------------
-	NTCPServer::NTCPServer ():
-		m_IsRunning (false), m_Thread (nullptr), m_Work (m_Service), 
+	NTCPServer::NTCPServer (int numThreads):
+		m_IsRunning (false), m_Work (m_Service), m_NextService (0),
 		m_TerminationTimer (m_Service), m_NTCPAcceptor (nullptr), m_NTCPV6Acceptor (nullptr)
 	{
+		if (numThreads < 1) numThreads = 1;
+		if (numThreads > NTCP_MAX_NUM_THREADS) numThreads = NTCP_MAX_NUM_THREADS;
+		m_Services.push_back (&m_Service);
+		for (int i = 1; i < numThreads; i++)
+		{
+			auto service = new boost::asio::io_service ();
+			m_ExtraServices.emplace_back (service);
+			m_ExtraWorks.emplace_back (new boost::asio::io_service::work (*service));
+			m_Services.push_back (service);
+		}
 	}
 		
 	NTCPServer::~NTCPServer ()
@@ -797,12 +842,25 @@ namespace transport
 		Stop ();
 	}	
 
+	boost::asio::io_service& NTCPServer::GetSessionService (const i2p::data::IdentHash& ident)
+	{
+		return *m_Services[ident.GetLL ()[0] % m_Services.size ()];
+	}
+
+	boost::asio::io_service& NTCPServer::GetNextSessionService ()
+	{
+		return *m_Services[m_NextService++ % m_Services.size ()];
+	}
+
 	void NTCPServer::Start ()
 	{
 		if (!m_IsRunning)
 		{	
 			m_IsRunning = true;
-			m_Thread = new std::thread (std::bind (&NTCPServer::Run, this));
+			for (auto service: m_Services)
+				m_Threads.push_back (new std::thread (std::bind (&NTCPServer::Run, this, service)));
+			if (m_Services.size () > 1)
+				LogPrint (eLogInfo, "NTCP: Running ", m_Services.size (), " threads");
 			// create acceptors
 			auto& addresses = context.GetRouterInfo ().GetAddresses ();
 			for (const auto& address: addresses)
@@ -857,13 +915,16 @@ namespace transport
 	{	
 		{
 			// we have to copy it because Terminate changes m_NTCPSessions
-			auto ntcpSessions = m_NTCPSessions; 
+			auto ntcpSessions = GetNTCPSessions (); 
 			for (auto& it: ntcpSessions)
 				it.second->Terminate ();
 			for (auto& it: m_PendingIncomingSessions)
 				it->Terminate ();
 		}	 
-		m_NTCPSessions.clear ();
+		{
+			std::unique_lock<std::mutex> l(m_NTCPSessionsMutex);
+			m_NTCPSessions.clear ();
+		}
 
 		if (m_IsRunning)
 		{	
@@ -879,24 +940,25 @@ namespace transport
 		    	delete m_NTCPV6Acceptor;
 				m_NTCPV6Acceptor = nullptr;
 			}
-			m_Service.stop ();
-			if (m_Thread)
+			for (auto service: m_Services)
+				service->stop ();
+			for (auto thread: m_Threads)
 			{	
-				m_Thread->join (); 
-				delete m_Thread;
-				m_Thread = nullptr;
+				thread->join (); 
+				delete thread;
 			}	
+			m_Threads.clear ();
 		}	
 	}	
 
 		
-	void NTCPServer::Run () 
+	void NTCPServer::Run (boost::asio::io_service * service) 
 	{ 
 		while (m_IsRunning)
 		{
 			try
 			{	
-				m_Service.run ();
+				service->run ();
 			}
 			catch (std::exception& ex)
 			{
@@ -909,25 +971,30 @@ namespace transport
 	{
 		if (!session || !session->GetRemoteIdentity ()) return false;
 		auto& ident = session->GetRemoteIdentity ()->GetIdentHash ();
-		auto it = m_NTCPSessions.find (ident);
-		if (it != m_NTCPSessions.end ())
 		{
-			LogPrint (eLogWarning, "NTCP: session to ", ident.ToBase64 (), " already exists");
-			session->Terminate();
-			return false;
+			std::unique_lock<std::mutex> l(m_NTCPSessionsMutex);
+			if (m_NTCPSessions.insert (std::pair<i2p::data::IdentHash, std::shared_ptr<NTCPSession> >(ident, session)).second)
+				return true;
 		}
-		m_NTCPSessions.insert (std::pair<i2p::data::IdentHash, std::shared_ptr<NTCPSession> >(ident, session));
-		return true;
+		LogPrint (eLogWarning, "NTCP: session to ", ident.ToBase64 (), " already exists");
+		session->Terminate(); // outside of lock, removes itself
+		return false;
 	}	
 
 	void NTCPServer::RemoveNTCPSession (std::shared_ptr<NTCPSession> session)
 	{
 		if (session && session->GetRemoteIdentity ())
-			m_NTCPSessions.erase (session->GetRemoteIdentity ()->GetIdentHash ());
+		{
+			std::unique_lock<std::mutex> l(m_NTCPSessionsMutex);
+			auto it = m_NTCPSessions.find (session->GetRemoteIdentity ()->GetIdentHash ());
+			if (it != m_NTCPSessions.end () && it->second == session) // don't remove other session to same peer
+				m_NTCPSessions.erase (it);
+		}
 	}	
 
 	std::shared_ptr<NTCPSession> NTCPServer::FindNTCPSession (const i2p::data::IdentHash& ident)
 	{
+		std::unique_lock<std::mutex> l(m_NTCPSessionsMutex);
 		auto it = m_NTCPSessions.find (ident);
 		if (it != m_NTCPSessions.end ())
 			return it->second;
@@ -945,7 +1012,7 @@ namespace transport
 				LogPrint (eLogDebug, "NTCP: Connected from ", ep);
 				if (conn)
 				{
-					conn->ServerLogin ();
+					conn->GetService ().post (std::bind (&NTCPSession::ServerLogin, conn));
 					m_PendingIncomingSessions.push_back (conn);
 				}	
 			}
@@ -973,7 +1040,7 @@ namespace transport
 				LogPrint (eLogDebug, "NTCP: Connected from ", ep);
 				if (conn)
 				{	
-					conn->ServerLogin ();
+					conn->GetService ().post (std::bind (&NTCPSession::ServerLogin, conn));
 					m_PendingIncomingSessions.push_back (conn);
 				}	
 			}
@@ -992,11 +1059,11 @@ namespace transport
 	void NTCPServer::Connect (const boost::asio::ip::address& address, int port, std::shared_ptr<NTCPSession> conn)
 	{
 		LogPrint (eLogDebug, "NTCP: Connecting to ", address ,":",  port);
-		m_Service.post([=]()
+		conn->GetService ().post([=]()
 		{       
 			if (this->AddNTCPSession (conn))
 			{
-				auto timer = std::make_shared<boost::asio::deadline_timer>(m_Service);
+				auto timer = std::make_shared<boost::asio::deadline_timer>(conn->GetService ());
 				timer->expires_from_now (boost::posix_time::seconds(NTCP_CONNECT_TIMEOUT)); 
 				timer->async_wait ([conn](const boost::system::error_code& ecode)
 					{
@@ -1044,12 +1111,12 @@ namespace transport
 		{	
 			auto ts = i2p::util::GetSecondsSinceEpoch ();
 			// established
-			for (auto& it: m_NTCPSessions)
+			for (auto& it: GetNTCPSessions ())
  				if (it.second->IsTerminationTimeoutExpired (ts))
 				{
 					auto session = it.second;
-					// Termniate modifies m_NTCPSession, so we postpone it
-					m_Service.post ([session] 
+					// terminate in session's thread
+					session->GetService ().post ([session] 
 						{ 
 							LogPrint (eLogDebug, "NTCP: No activity for ", session->GetTerminationTimeout (), " seconds");
 							session->Terminate ();
@@ -1062,7 +1129,7 @@ namespace transport
 					it = m_PendingIncomingSessions.erase (it); // established or terminated
 				else if ((*it)->IsTerminationTimeoutExpired (ts))
 				{
-					(*it)->Terminate (); 
+					(*it)->GetService ().post (std::bind (&NTCPSession::Terminate, *it)); 
 					it = m_PendingIncomingSessions.erase (it); // expired
 				}	
 				else
@@ -3,7 +3,9 @@
 
 #include <inttypes.h>
 #include <map>
+#include <vector>
 #include <memory>
+#include <atomic>
 #include <thread>
 #include <mutex>
 #include <boost/asio.hpp>
@@ -36,13 +38,16 @@ namespace transport
 
 	const size_t NTCP_MAX_MESSAGE_SIZE = 16384; 
 	const size_t NTCP_BUFFER_SIZE = 1028; // fits 1 tunnel data message
+	const size_t NTCP_MAX_RECEIVE_BUFFER_SIZE = 32768; // receive buffer grows up to if more data is available
+	const size_t NTCP_MAX_SEND_BUFFER_SIZE = 32768; // frames of one write, at least one message
+	const size_t NTCP_PADDING_POOL_SIZE = 256; // pre-generated random padding
 	const int NTCP_CONNECT_TIMEOUT = 5; // 5 seconds
 	const int NTCP_ESTABLISH_TIMEOUT = 10; // 10 seconds
 	const int NTCP_TERMINATION_TIMEOUT = 120; // 2 minutes
 	const int NTCP_TERMINATION_CHECK_TIMEOUT = 30; // 30 seconds	
 	const size_t NTCP_DEFAULT_PHASE3_SIZE = 2/*size*/ + i2p::data::DEFAULT_IDENTITY_SIZE/*387*/ + 4/*ts*/ + 15/*padding*/ + 40/*signature*/; // 448 	
 	const int NTCP_CLOCK_SKEW = 60; // in seconds 
-	const int NTCP_MAX_OUTGOING_QUEUE_SIZE = 200; // how many messages we can queue up
+	const int NTCP_MAX_NUM_THREADS = 16;
 
 	class NTCPServer;
 	class NTCPSession: public TransportSession, public std::enable_shared_from_this<NTCPSession>
@@ -54,6 +59,7 @@ namespace transport
 			void Terminate ();
 			void Done ();
 
+			boost::asio::io_service& GetService () { return m_Service; };
 			boost::asio::ip::tcp::socket& GetSocket () { return m_Socket; };
 			bool IsEstablished () const { return m_IsEstablished; };	
 			bool IsTerminated () const { return m_IsTerminated; };
@@ -61,10 +67,12 @@ namespace transport
 			void ClientLogin ();
 			void ServerLogin ();
 			void SendI2NPMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs);
+			TransportType GetTransportType () const { return eTransportNTCP; };
 			
 		private:
 
-			void PostI2NPMessages (std::vector<std::shared_ptr<I2NPMessage> > msgs);
+			void HandlePostedMessages ();
+			void PostI2NPMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs);
 			void Connected ();
 			void SendTimeSyncMessage ();
 			void SetIsEstablished (bool isEstablished) { m_IsEstablished = isEstablished; }
@@ -92,16 +100,22 @@ namespace transport
 			// common
 			void Receive ();
 			void HandleReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred);
-			bool DecryptNextBlock (const uint8_t * encrypted);	
+			bool HandleReceivedBlocks (const uint8_t * buf, size_t len); // decrypted, multiple of 16
+			void ExpandReceiveBuffer (size_t size);
+			void ShrinkReceiveBuffer ();
 		
-			void Send (std::shared_ptr<i2p::I2NPMessage> msg);
-			boost::asio::const_buffers_1 CreateMsgBuffer (std::shared_ptr<I2NPMessage> msg);
 			void Send (const std::vector<std::shared_ptr<I2NPMessage> >& msgs);
+			void SendQueuedMessages ();
+			size_t GetFrameLength (std::shared_ptr<I2NPMessage> msg) const 
+			{ return ((msg ? msg->GetLength () : 4) + 6 + 15) & ~0x0F; }; // size + data + checksum, padded
+			size_t EncodeFrame (std::shared_ptr<I2NPMessage> msg, uint8_t * buf); // returns frame length, timestamp if msg is null
+			void FillPadding (uint8_t * buf, size_t len);
 			void HandleSent (const boost::system::error_code& ecode, std::size_t bytes_transferred, std::vector<std::shared_ptr<I2NPMessage> > msgs);
 			
 		private:
 
 			NTCPServer& m_Server;
+			boost::asio::io_service& m_Service; // all handlers of the session run here
 			boost::asio::ip::tcp::socket m_Socket;
 			bool m_IsEstablished, m_IsTerminated;
 			
@@ -114,16 +128,18 @@ namespace transport
 				NTCPPhase2 phase2;
 			} * m_Establisher;	
 			
-			i2p::crypto::AESAlignedBuffer<NTCP_BUFFER_SIZE + 16> m_ReceiveBuffer;
-			i2p::crypto::AESAlignedBuffer<16> m_TimeSyncBuffer;
-			int m_ReceiveBufferOffset; 
+			uint8_t * m_ReceiveBuffer;
+			size_t m_ReceiveBufferSize, m_ReceiveBufferOffset; 
+			uint8_t * m_SendBuffer;
+			size_t m_SendBufferSize;
+			uint8_t m_PaddingPool[NTCP_PADDING_POOL_SIZE];
+			size_t m_PaddingPoolOffset;
 
 			std::shared_ptr<I2NPMessage> m_NextMessage;
 			size_t m_NextMessageOffset;
 			i2p::I2NPMessagesHandler m_Handler;
 
 			bool m_IsSending;
-			std::vector<std::shared_ptr<I2NPMessage> > m_SendQueue;
 	};	
 
 	// TODO: move to NTCP.h/.cpp
@@ -131,7 +147,7 @@ namespace transport
 	{
 		public:
 
-			NTCPServer ();
+			NTCPServer (int numThreads = 1);
 			~NTCPServer ();
 
 			void Start ();
@@ -145,11 +161,14 @@ namespace transport
       		bool IsBoundV4() const { return m_NTCPAcceptor != nullptr; };
       		bool IsBoundV6() const { return m_NTCPV6Acceptor != nullptr; };
       
-			boost::asio::io_service& GetService () { return m_Service; };	
+			boost::asio::io_service& GetService () { return m_Service; };	// acceptors and timer
+			boost::asio::io_service& GetSessionService (const i2p::data::IdentHash& ident); // outgoing, by ident
+			boost::asio::io_service& GetNextSessionService (); // incoming, round robin
+			size_t GetNumThreads () const { return m_Services.size (); };
 
 		private:
 
-			void Run ();
+			void Run (boost::asio::io_service * service);
 			void HandleAccept (std::shared_ptr<NTCPSession> conn, const boost::system::error_code& error);
 			void HandleAcceptV6 (std::shared_ptr<NTCPSession> conn, const boost::system::error_code& error);
 
@@ -162,18 +181,27 @@ namespace transport
 		private:	
 
 			bool m_IsRunning;
-			std::thread * m_Thread;	
+			std::vector<std::thread *> m_Threads;
 			boost::asio::io_service m_Service;
 			boost::asio::io_service::work m_Work;
+			std::vector<std::unique_ptr<boost::asio::io_service> > m_ExtraServices;
+			std::vector<std::unique_ptr<boost::asio::io_service::work> > m_ExtraWorks;
+			std::vector<boost::asio::io_service *> m_Services; // m_Service first, one thread per service
+			std::atomic<size_t> m_NextService;
 			boost::asio::deadline_timer m_TerminationTimer;
 			boost::asio::ip::tcp::acceptor * m_NTCPAcceptor, * m_NTCPV6Acceptor;
-			std::map<i2p::data::IdentHash, std::shared_ptr<NTCPSession> > m_NTCPSessions; // access from m_Thread only
-			std::list<std::shared_ptr<NTCPSession> > m_PendingIncomingSessions;
+			mutable std::mutex m_NTCPSessionsMutex;
+			std::map<i2p::data::IdentHash, std::shared_ptr<NTCPSession> > m_NTCPSessions;
+			std::list<std::shared_ptr<NTCPSession> > m_PendingIncomingSessions; // access from m_Service only
 
 		public:
 
 			// for HTTP/I2PControl
-			const decltype(m_NTCPSessions)& GetNTCPSessions () const { return m_NTCPSessions; };
+			decltype(m_NTCPSessions) GetNTCPSessions () const
+			{
+				std::unique_lock<std::mutex> l(m_NTCPSessionsMutex);
+				return m_NTCPSessions;
+			};
 	};	
 }	
 }	
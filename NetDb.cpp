@@ -107,6 +107,13 @@ namespace data
 					}	
 				}			
 				if (!m_IsRunning) break;
+				std::vector<std::function<void ()> > tasks;
+				{
+					std::unique_lock<std::mutex> l(m_TasksMutex);
+					tasks.swap (m_Tasks);
+				}
+				for (auto& it: tasks)
+					it ();
 
 				uint64_t ts = i2p::util::GetSecondsSinceEpoch ();
 				if (ts - lastManageRequest >= 15) // manage requests every 15 seconds
@@ -1047,6 +1054,15 @@ namespace data
 		if (msg) m_Queue.Put (msg);	
 	}	
 
+	void NetDb::PostTask (std::function<void ()> task)
+	{
+		{
+			std::unique_lock<std::mutex> l(m_TasksMutex);
+			m_Tasks.push_back (task);
+		}
+		m_Queue.WakeUp ();
+	}
+
 	std::shared_ptr<const RouterInfo> NetDb::GetClosestFloodfill (const IdentHash& destination, 
 		const std::set<IdentHash>& excluded, bool closeThanUsOnly) const
 	{
@@ -8,6 +8,8 @@
 #include <string>
 #include <thread>
 #include <mutex>
+#include <vector>
+#include <functional>
 
 #include "Base.h"
 #include "Gzip.h"
@@ -79,6 +81,7 @@ namespace data
 			void SetUnreachable (const IdentHash& ident, bool unreachable);			
 
 			void PostI2NPMsg (std::shared_ptr<const I2NPMessage> msg);
+			void PostTask (std::function<void ()> task); // runs in netdb's thread, might wait for next message or timeout
 
       /** set hidden mode, aka don't publish our RI to netdb and don't explore */
       void SetHidden(bool hide); 
@@ -130,7 +133,9 @@ namespace data
 			bool m_IsRunning;
 			uint64_t m_LastLoad;
 			std::thread * m_Thread;	
-			i2p::util::Queue<std::shared_ptr<const I2NPMessage> > m_Queue; // of I2NPDatabaseStoreMsg
+			i2p::util::MPSCQueue<std::shared_ptr<const I2NPMessage> > m_Queue; // of I2NPDatabaseStoreMsg
+			std::mutex m_TasksMutex;
+			std::vector<std::function<void ()> > m_Tasks;
 
 			GzipInflator m_Inflator;
 			Reseeder * m_Reseeder;
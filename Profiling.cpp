@@ -17,6 +17,8 @@ namespace data
 		m_NumTunnelsAgreed (0), m_NumTunnelsDeclined (0), m_NumTunnelsNonReplied (0),
 		m_NumTimesTaken (0), m_NumTimesRejected (0) 
 	{
+		for (int i = 0; i < PEER_PROFILE_NUM_TRANSPORTS; i++)
+			m_TransportsRTT[i] = 0;
 	}
 
 	boost::posix_time::ptime RouterProfile::GetTime () const
@@ -39,11 +41,15 @@ namespace data
 		boost::property_tree::ptree usage;
 		usage.put (PEER_PROFILE_USAGE_TAKEN, m_NumTimesTaken);
 		usage.put (PEER_PROFILE_USAGE_REJECTED, m_NumTimesRejected);
+		boost::property_tree::ptree transports;
+		for (int i = 0; i < PEER_PROFILE_NUM_TRANSPORTS; i++)
+			transports.put (PEER_PROFILE_TRANSPORTS_RTT[i], m_TransportsRTT[i]);
 		// fill property tree
 		boost::property_tree::ptree pt;
 		pt.put (PEER_PROFILE_LAST_UPDATE_TIME, boost::posix_time::to_simple_string (m_LastUpdateTime));
 		pt.put_child (PEER_PROFILE_SECTION_PARTICIPATION, participation);
 		pt.put_child (PEER_PROFILE_SECTION_USAGE, usage);
+		pt.put_child (PEER_PROFILE_SECTION_TRANSPORTS, transports);
 
 		// save to file
 		std::string ident = identHash.ToBase64 ();
@@ -109,6 +115,13 @@ namespace data
 				{
 					LogPrint (eLogWarning, "Missing section ", PEER_PROFILE_SECTION_USAGE, " in profile for ", ident);
 				}
+				// read transports, optional
+				auto transports = pt.get_child_optional (PEER_PROFILE_SECTION_TRANSPORTS);
+				if (transports)
+				{
+					for (int i = 0; i < PEER_PROFILE_NUM_TRANSPORTS; i++)
+						m_TransportsRTT[i] = transports->get (PEER_PROFILE_TRANSPORTS_RTT[i], 0);
+				}
 			} 
 			else 
 				*this = RouterProfile ();
@@ -134,6 +147,20 @@ namespace data
 		UpdateTime ();
 	}	
 
+	void RouterProfile::TransportSessionClosed (int transport, int rtt)
+	{
+		if (transport < 0 || transport >= PEER_PROFILE_NUM_TRANSPORTS || rtt <= 0) return;
+		auto& r = m_TransportsRTT[transport];
+		r = r ? (r + rtt)/2 : rtt;
+		UpdateTime ();
+	}
+
+	int RouterProfile::GetTransportRTT (int transport) const
+	{
+		if (transport < 0 || transport >= PEER_PROFILE_NUM_TRANSPORTS) return 0;
+		return m_TransportsRTT[transport];
+	}
+
 	bool RouterProfile::IsLowPartcipationRate () const
 	{
 		return 4*m_NumTunnelsAgreed < m_NumTunnelsDeclined; // < 20% rate
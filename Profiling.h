@@ -12,6 +12,7 @@ namespace data
 	// sections
 	const char PEER_PROFILE_SECTION_PARTICIPATION[] = "participation";
 	const char PEER_PROFILE_SECTION_USAGE[] = "usage";
+	const char PEER_PROFILE_SECTION_TRANSPORTS[] = "transports";
 	// params	
 	const char PEER_PROFILE_LAST_UPDATE_TIME[] = "lastupdatetime";
 	const char PEER_PROFILE_PARTICIPATION_AGREED[] = "agreed";
@@ -19,6 +20,8 @@ namespace data
 	const char PEER_PROFILE_PARTICIPATION_NON_REPLIED[] = "nonreplied";	
 	const char PEER_PROFILE_USAGE_TAKEN[] = "taken";
 	const char PEER_PROFILE_USAGE_REJECTED[] = "rejected";
+	const int PEER_PROFILE_NUM_TRANSPORTS = 3; // in order of i2p::transport::TransportType
+	const char * const PEER_PROFILE_TRANSPORTS_RTT[PEER_PROFILE_NUM_TRANSPORTS] = { "ntcp2rtt", "ntcprtt", "ssurtt" };
 
 	const int PEER_PROFILE_EXPIRATION_TIMEOUT = 72; // in hours (3 days)
 	
@@ -37,6 +40,9 @@ namespace data
 			void TunnelBuildResponse (uint8_t ret);
 			void TunnelNonReplied ();
 
+			void TransportSessionClosed (int transport, int rtt);
+			int GetTransportRTT (int transport) const; // 0 if not used yet
+
 		private:
 
 			boost::posix_time::ptime GetTime () const;
@@ -56,6 +62,8 @@ namespace data
 			// usage
 			uint32_t m_NumTimesTaken;
 			uint32_t m_NumTimesRejected;	
+			// transports, smoothed over sessions
+			int m_TransportsRTT[PEER_PROFILE_NUM_TRANSPORTS]; // in milliseconds
 	};	
 
 	std::shared_ptr<RouterProfile> GetRouterProfile (const IdentHash& identHash); 
@@ -2,7 +2,11 @@
 #define QUEUE_H__
 
 #include <queue>
+#include <deque>
 #include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
 #include <mutex>
 #include <thread>
 #include <condition_variable>
@@ -119,6 +123,225 @@ namespace util
 			std::mutex m_QueueMutex;
 			std::condition_variable m_NonEmpty;
 	};	
+
+	const size_t QUEUE_CACHE_LINE_SIZE = 64;
+	const size_t MPSC_QUEUE_DEFAULT_CAPACITY = 4096; // must be power of 2
+
+	/**
+	 * Multiple producers, single consumer queue with the same API as Queue.
+	 * Producers take a slot in a bounded lock-free ring, if the ring is full elements
+	 * go to overflow list under mutex, so Put never blocks or drops.
+	 * Consumer is woken up only if the queue becomes non-empty, Put returns true then.
+	 * Get, GetNext, GetNextWithTimeout, GetAll and Peek must be called from one thread only.
+	 */
+	template<typename Element, size_t Capacity = MPSC_QUEUE_DEFAULT_CAPACITY>
+	class MPSCQueue
+	{
+		static_assert (Capacity && !(Capacity & (Capacity - 1)), "MPSCQueue capacity must be power of 2");
+
+		struct Cell
+		{
+			std::atomic<size_t> seq;
+			Element el;
+		};
+
+		public:
+
+			MPSCQueue (): m_Cells (new Cell[Capacity]), m_Tail (0), m_Size (0), 
+				m_IsOverflown (false), m_Head (0)
+			{
+				for (size_t i = 0; i < Capacity; i++)
+					m_Cells[i].seq.store (i, std::memory_order_relaxed);
+			}
+
+			bool Put (Element e)
+			{
+				Push (std::move (e));
+				return Added (1);
+			}
+
+			template<template<typename, typename...>class Container, typename... R>
+			bool Put (const Container<Element, R...>& vec)
+			{
+				if (vec.empty ()) return false;
+				for (const auto& it: vec)
+					Push (it);
+				return Added (vec.size ());
+			}
+
+			Element GetNext ()
+			{
+				auto el = Get ();
+				if (!el)
+				{
+					Wait ();
+					el = Get ();
+				}
+				return el;
+			}
+
+			Element GetNextWithTimeout (int usec)
+			{
+				auto el = Get ();
+				if (!el)
+				{
+					Wait (0, usec);
+					el = Get ();
+				}
+				return el;
+			}
+
+			void Wait ()
+			{
+				std::unique_lock<std::mutex> l(m_WaitMutex);
+				if (m_Size.load () <= 0)
+					m_NonEmpty.wait (l);
+			}
+
+			bool Wait (int sec, int usec)
+			{
+				std::unique_lock<std::mutex> l(m_WaitMutex);
+				if (m_Size.load () > 0) return true;
+				return m_NonEmpty.wait_for (l, std::chrono::seconds (sec) + std::chrono::milliseconds (usec)) != std::cv_status::timeout;
+			}
+
+			bool IsEmpty () const { return m_Size.load () <= 0; };
+			int GetSize () const { auto size = m_Size.load (); return size > 0 ? size : 0; };
+
+			void WakeUp ()
+			{
+				std::unique_lock<std::mutex> l(m_WaitMutex);
+				m_NonEmpty.notify_all ();
+			}
+
+			Element Get ()
+			{
+				Element el = nullptr;
+				if (Pop (el))
+					m_Size.fetch_sub (1);
+				return el;
+			}
+
+			size_t GetAll (std::vector<Element>& els) // drain all available elements, returns number of them
+			{
+				size_t num = 0;
+				Element el = nullptr;
+				while (Pop (el))
+				{
+					els.push_back (std::move (el));
+					el = nullptr;
+					num++;
+				}
+				if (num) m_Size.fetch_sub (num);
+				return num;
+			}
+
+			Element Peek ()
+			{
+				Element el = nullptr;
+				Pop (el, true);
+				return el;
+			}
+
+		private:
+
+			void Push (Element e)
+			{
+				if (!m_IsOverflown.load (std::memory_order_acquire))
+				{
+					auto pos = m_Tail.load (std::memory_order_relaxed);
+					for (;;)
+					{
+						auto& cell = m_Cells[pos & (Capacity - 1)];
+						auto diff = (intptr_t)cell.seq.load (std::memory_order_acquire) - (intptr_t)pos;
+						if (!diff)
+						{
+							if (m_Tail.compare_exchange_weak (pos, pos + 1, std::memory_order_relaxed))
+							{
+								cell.el = std::move (e);
+								cell.seq.store (pos + 1, std::memory_order_release);
+								return;
+							}
+						}
+						else if (diff < 0)
+							break; // full
+						else
+							pos = m_Tail.load (std::memory_order_relaxed);
+					}
+				}
+				// ring is full or not empty overflow list, keep order
+				std::unique_lock<std::mutex> l(m_OverflowMutex);
+				m_Overflow.push_back (std::move (e));
+				m_IsOverflown.store (true, std::memory_order_release);
+			}
+
+			bool Added (int num)
+			{
+				auto size = m_Size.fetch_add (num);
+				if (size <= 0 && size + num > 0)
+				{
+					// became non-empty, consumer might wait
+					std::unique_lock<std::mutex> l(m_WaitMutex);
+					m_NonEmpty.notify_one ();
+					return true;
+				}
+				return false;
+			}
+
+			bool Pop (Element& el, bool peek = false)
+			{
+				if (m_Spilled.empty ())
+				{
+					auto& cell = m_Cells[m_Head & (Capacity - 1)];
+					if (cell.seq.load (std::memory_order_acquire) == m_Head + 1)
+					{
+						if (peek)
+							el = cell.el;
+						else
+						{
+							el = std::move (cell.el);
+							cell.el = nullptr;
+							cell.seq.store (m_Head + Capacity, std::memory_order_release);
+							m_Head++;
+						}
+						return true;
+					}
+					// take overflow list only if ring is empty and nothing is being written to it
+					if (m_Head != m_Tail.load (std::memory_order_acquire) || !m_IsOverflown.load (std::memory_order_acquire))
+						return false;
+					std::unique_lock<std::mutex> l(m_OverflowMutex);
+					m_Spilled.swap (m_Overflow);
+					m_IsOverflown.store (false, std::memory_order_release);
+				}
+				if (m_Spilled.empty ()) return false;
+				if (peek)
+					el = m_Spilled.front ();
+				else
+				{
+					el = std::move (m_Spilled.front ());
+					m_Spilled.pop_front ();
+				}
+				return true;
+			}
+
+		private:
+
+			std::unique_ptr<Cell[]> m_Cells;
+			// producers
+			std::atomic<size_t> m_Tail;
+			char m_TailPadding[QUEUE_CACHE_LINE_SIZE - sizeof (std::atomic<size_t>)];
+			std::atomic<int> m_Size;
+			char m_SizePadding[QUEUE_CACHE_LINE_SIZE - sizeof (std::atomic<int>)];
+			std::atomic<bool> m_IsOverflown;
+			std::mutex m_OverflowMutex;
+			std::deque<Element> m_Overflow;
+			std::mutex m_WaitMutex;
+			std::condition_variable m_NonEmpty;
+			char m_ProducersPadding[QUEUE_CACHE_LINE_SIZE];
+			// consumer
+			size_t m_Head;
+			std::deque<Element> m_Spilled; // taken from overflow list
+	};
 }		
 }	
 
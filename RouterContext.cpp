@@ -126,6 +126,7 @@ namespace i2p
 		bool updated = false;
 		for (auto& address : m_RouterInfo.GetAddresses ())
 		{
+			if (address->transportStyle == i2p::data::RouterInfo::eTransportNTCP2) continue; // has own port
 			if (address->port != port)
 			{	
 				address->port = port;
@@ -271,6 +272,10 @@ namespace i2p
 				break;
 			}
 		}	
+		// don't publish NTCP2 host and port
+		for (auto& addr : addresses)
+			if (addr->transportStyle == i2p::data::RouterInfo::eTransportNTCP2 && addr->host.is_v4 ())
+				addr->ntcp2->isPublished = false;
 		// delete previous introducers
 		for (auto& addr : addresses)	
 			if (addr->ssu)
@@ -303,6 +308,10 @@ namespace i2p
 				break;
 			}
 		}		
+		// publish NTCP2 back
+		for (auto& addr : addresses)
+			if (addr->transportStyle == i2p::data::RouterInfo::eTransportNTCP2 && addr->port)
+				addr->ntcp2->isPublished = !addr->host.is_unspecified ();
 		// delete previous introducers
 		for (auto& addr : addresses)
 			if (addr->ssu)
@@ -347,7 +356,7 @@ namespace i2p
 				}
 				found = true;	
 			}	
-			else
+			else if (addr->transportStyle != i2p::data::RouterInfo::eTransportNTCP2)
 				port = addr->port;	
 		}	
 		if (!found)
@@ -370,6 +379,53 @@ namespace i2p
 			UpdateRouterInfo ();
 	}
 
+	void RouterContext::PublishNTCP2Address (int port)
+	{
+#ifndef OPENSSL_X25519
+		LogPrint (eLogError, "Router: NTCP2 requires OpenSSL 1.1.1, not published");
+		(void) port;
+#else
+		if (!m_NTCP2Keys && !LoadNTCP2Keys ())
+			NewNTCP2Keys ();
+		if (!port)
+		{
+			// next to SSU port
+			auto ssu = m_RouterInfo.GetSSUAddress (false);
+			port = ssu ? ssu->port + 1 : 0;
+		}
+		// host of each SSU address
+		std::vector<boost::asio::ip::address> hosts;
+		for (const auto& addr: m_RouterInfo.GetAddresses ())
+			if (addr->transportStyle == i2p::data::RouterInfo::eTransportSSU)
+				hosts.push_back (addr->host);
+		for (const auto& host: hosts)
+			m_RouterInfo.AddNTCP2Address (m_NTCP2StaticKeys->GetPublicKey (), m_NTCP2Keys->iv, host, port);
+		if (IsUnreachable ())
+			for (auto& addr : m_RouterInfo.GetAddresses ())
+				if (addr->transportStyle == i2p::data::RouterInfo::eTransportNTCP2 && addr->host.is_v4 ())
+					addr->ntcp2->isPublished = false;
+		UpdateRouterInfo ();
+#endif
+	}
+
+	void RouterContext::RemoveNTCP2Address ()
+	{
+		bool updated = false;
+		auto& addresses = m_RouterInfo.GetAddresses ();
+		for (auto it = addresses.begin (); it != addresses.end ();)
+		{
+			if ((*it)->transportStyle == i2p::data::RouterInfo::eTransportNTCP2)
+			{
+				it = addresses.erase (it);
+				updated = true;
+			}
+			else
+				++it;
+		}
+		if (updated)
+			UpdateRouterInfo ();
+	}
+
 	void RouterContext::UpdateStats ()
 	{
 		if (m_IsFloodfill)
@@ -427,6 +483,38 @@ namespace i2p
 		return true;
 	}
 
+#ifdef OPENSSL_X25519
+	bool RouterContext::LoadNTCP2Keys ()
+	{
+		std::ifstream fk (i2p::fs::DataDirPath (NTCP2_KEYS), std::ifstream::in | std::ifstream::binary);
+		if (!fk.is_open ()) return false;
+		fk.seekg (0, std::ios::end);
+		size_t len = fk.tellg();
+		fk.seekg (0, std::ios::beg);
+		if (len != sizeof (NTCP2PrivateKeys))
+		{
+			LogPrint (eLogError, NTCP2_KEYS, " is malformed. Creating new");
+			return false;
+		}
+		m_NTCP2Keys.reset (new NTCP2PrivateKeys ());
+		fk.read ((char *)m_NTCP2Keys.get (), len);
+		m_NTCP2StaticKeys = std::make_shared<i2p::crypto::X25519Keys> (m_NTCP2Keys->staticPrivateKey);
+		return true;
+	}
+
+	void RouterContext::NewNTCP2Keys ()
+	{
+		m_NTCP2StaticKeys = std::make_shared<i2p::crypto::X25519Keys> ();
+		m_NTCP2StaticKeys->GenerateKeys ();
+		m_NTCP2Keys.reset (new NTCP2PrivateKeys ());
+		m_NTCP2StaticKeys->GetPrivateKey (m_NTCP2Keys->staticPrivateKey);
+		RAND_bytes (m_NTCP2Keys->iv, 16);
+		// private key and iv
+		std::ofstream fk (i2p::fs::DataDirPath (NTCP2_KEYS), std::ofstream::binary | std::ofstream::out);
+		fk.write ((char *)m_NTCP2Keys.get (), sizeof (NTCP2PrivateKeys));
+	}
+#endif
+
 	void RouterContext::SaveKeys ()
 	{	
 		// save in the same format as .dat files
@@ -448,6 +536,11 @@ namespace i2p
 		i2p::HandleI2NPMessage (CreateI2NPMessage (buf, GetI2NPMessageLength (buf), from));
 	}
 
+	void RouterContext::HandleI2NPMessage (std::shared_ptr<I2NPMessage> msg)
+	{
+		i2p::HandleI2NPMessage (msg);
+	}
+
 	void RouterContext::ProcessGarlicMessage (std::shared_ptr<I2NPMessage> msg)
 	{
 		std::unique_lock<std::mutex> l(m_GarlicMutex);
@@ -6,6 +6,7 @@
 #include <memory>
 #include <mutex>
 #include <boost/asio.hpp>
+#include "Crypto.h"
 #include "Identity.h"
 #include "RouterInfo.h"
 #include "Garlic.h"
@@ -14,6 +15,7 @@ namespace i2p
 {
 	const char ROUTER_INFO[] = "router.info";
 	const char ROUTER_KEYS[] = "router.keys";	
+	const char NTCP2_KEYS[] = "ntcp2.keys";
 	const int ROUTER_INFO_UPDATE_INTERVAL = 1800; // 30 minutes
 
 	enum RouterStatus
@@ -32,6 +34,14 @@ namespace i2p
 	
 	class RouterContext: public i2p::garlic::GarlicDestination 
 	{
+		private:
+
+			struct NTCP2PrivateKeys
+			{
+				uint8_t staticPrivateKey[32];
+				uint8_t iv[16];
+			};
+
 		public:
 
 			RouterContext ();
@@ -82,6 +92,10 @@ namespace i2p
 			void SetSupportsV4 (bool supportsV4);
 
 			void UpdateNTCPV6Address (const boost::asio::ip::address& host); // called from NTCP session		
+			void PublishNTCP2Address (int port); // called from Daemon
+			void RemoveNTCP2Address ();
+			std::shared_ptr<const i2p::crypto::X25519Keys> GetNTCP2StaticKeys () const { return m_NTCP2StaticKeys; };
+			const uint8_t * GetNTCP2IV () const { return m_NTCP2Keys ? m_NTCP2Keys->iv : nullptr; };
 			void UpdateStats ();	
 			void CleanupDestination ();	// garlic destination
 
@@ -96,6 +110,7 @@ namespace i2p
 			std::shared_ptr<const i2p::data::LocalLeaseSet> GetLeaseSet () { return nullptr; };
 			std::shared_ptr<i2p::tunnel::TunnelPool> GetTunnelPool () const;
 			void HandleI2NPMessage (const uint8_t * buf, size_t len, std::shared_ptr<i2p::tunnel::InboundTunnel> from);
+			void HandleI2NPMessage (std::shared_ptr<I2NPMessage> msg);
 
 			// override GarlicDestination
 			void ProcessGarlicMessage (std::shared_ptr<I2NPMessage> msg);
@@ -108,11 +123,17 @@ namespace i2p
 			void UpdateRouterInfo ();
 			bool Load ();
 			void SaveKeys ();
+#ifdef OPENSSL_X25519
+			bool LoadNTCP2Keys ();
+			void NewNTCP2Keys ();
+#endif
 			
 		private:
 
 			i2p::data::RouterInfo m_RouterInfo;
 			i2p::data::PrivateKeys m_Keys; 
+			std::unique_ptr<NTCP2PrivateKeys> m_NTCP2Keys;
+			std::shared_ptr<i2p::crypto::X25519Keys> m_NTCP2StaticKeys;
 			uint64_t m_LastUpdateTime;
 			bool m_AcceptsTunnels, m_IsFloodfill;
 			uint64_t m_StartupTime; // in seconds since epoch
@@ -170,10 +170,15 @@ namespace data
 			auto address = std::make_shared<Address>();
 			s.read ((char *)&address->cost, sizeof (address->cost));
 			s.read ((char *)&address->date, sizeof (address->date));
-			char transportStyle[5];
-			ReadString (transportStyle, 5, s);
+			char transportStyle[6];
+			ReadString (transportStyle, 6, s);
 			if (!strcmp (transportStyle, "NTCP"))
 				address->transportStyle = eTransportNTCP;
+			else if (!strcmp (transportStyle, "NTCP2"))
+			{
+				address->transportStyle = eTransportNTCP2;
+				address->ntcp2.reset (new NTCP2Ext ());
+			}
 			else if (!strcmp (transportStyle, "SSU"))
 			{	
 				address->transportStyle = eTransportSSU;
@@ -198,7 +203,11 @@ namespace data
 				{	
 					boost::system::error_code ecode;
 					address->host = boost::asio::ip::address::from_string (value, ecode);
-					if (ecode)
+					if (address->transportStyle == eTransportNTCP2)
+					{
+						if (ecode) address->addressString = value;
+					}
+					else if (ecode)
 					{	
 						if (address->transportStyle == eTransportNTCP)
 						{
@@ -238,6 +247,19 @@ namespace data
 				}	
 				else if (!strcmp (key, "caps"))
 					ExtractCaps (value);
+				else if (!strcmp (key, "s") || !strcmp (key, "i") || !strcmp (key, "v"))
+				{
+					// NTCP2 in NTCP2 or NTCP address
+					if (address->transportStyle == eTransportNTCP && !address->ntcp2)
+						address->ntcp2.reset (new NTCP2Ext ());
+					if (address->ntcp2)
+					{
+						if (key[0] == 's')
+							Base64ToByteStream (value, strlen (value), address->ntcp2->staticKey, 32);
+						else if (key[0] == 'i')
+							Base64ToByteStream (value, strlen (value), address->ntcp2->iv, 16);
+					}
+				}
 				else if (key[0] == 'i')
 				{	
 					// introducers
@@ -267,6 +289,19 @@ namespace data
 				}
 				if (!s) return;
 			}	
+			if (address->ntcp2)
+			{
+				// both keys present and version 2 supported, otherwise ignore NTCP2
+				if (address->ntcp2->staticKey.IsZero () || 
+					(address->transportStyle == eTransportNTCP && address->ntcp2->iv.IsZero ()))
+				{
+					if (address->transportStyle == eTransportNTCP2) isValidAddress = false;
+					address->ntcp2 = nullptr;
+				}
+				else
+					address->ntcp2->isPublished = address->port && !address->ntcp2->iv.IsZero () &&
+						(!address->host.is_unspecified () || !address->addressString.empty ());
+			}
 			if (isValidAddress)
 			{
 				addresses->push_back(address);
@@ -415,6 +450,42 @@ namespace data
 			std::stringstream properties;
 			if (address.transportStyle == eTransportNTCP)
 				WriteString ("NTCP", s);
+			else if (address.transportStyle == eTransportNTCP2)
+			{
+				WriteString ("NTCP2", s);
+				// host, i, port, s, v
+				if (address.ntcp2->isPublished)
+				{
+					WriteString ("host", properties);
+					properties << '=';
+					WriteString (address.host.to_string (), properties);
+					properties << ';';
+				}
+				WriteString ("i", properties);
+				properties << '=';
+				WriteString (address.ntcp2->iv.ToBase64 (), properties);
+				properties << ';';
+				if (address.ntcp2->isPublished)
+				{
+					WriteString ("port", properties);
+					properties << '=';
+					WriteString (boost::lexical_cast<std::string>(address.port), properties);
+					properties << ';';
+				}
+				WriteString ("s", properties);
+				properties << '=';
+				WriteString (address.ntcp2->staticKey.ToBase64 (), properties);
+				properties << ';';
+				WriteString ("v", properties);
+				properties << '=';
+				WriteString ("2", properties);
+				properties << ';';
+
+				uint16_t size = htobe16 (properties.str ().size ());
+				s.write ((char *)&size, sizeof (size));
+				s.write (properties.str ().c_str (), properties.str ().size ());
+				continue;
+			}
 			else if (address.transportStyle == eTransportSSU)
 			{	
 				WriteString ("SSU", s);
@@ -615,6 +686,31 @@ namespace data
 		m_Addresses->push_back(std::move(addr));
 	}	
 
+	void RouterInfo::AddNTCP2Address (const uint8_t * staticKey, const uint8_t * iv, const boost::asio::ip::address& host, int port)
+	{
+		for (auto& it: *m_Addresses) // update existing
+			if (it->transportStyle == eTransportNTCP2 && it->host.is_v4 () == host.is_v4 ())
+			{
+				it->host = host;
+				it->port = port;
+				it->ntcp2->staticKey = staticKey;
+				it->ntcp2->iv = iv;
+				it->ntcp2->isPublished = port && !host.is_unspecified ();
+				return;
+			}
+		auto addr = std::make_shared<Address>();
+		addr->host = host;
+		addr->port = port;
+		addr->transportStyle = eTransportNTCP2;
+		addr->cost = port ? 3 : 14; // NTCP has priority until NTCP2 is common
+		addr->date = 0;
+		addr->ntcp2.reset (new NTCP2Ext ());
+		addr->ntcp2->staticKey = staticKey;
+		addr->ntcp2->iv = iv;
+		addr->ntcp2->isPublished = port && !host.is_unspecified ();
+		m_Addresses->push_back(std::move(addr));
+	}
+
 	void RouterInfo::AddSSUAddress (const char * host, int port, const uint8_t * key, int mtu)
 	{
 		auto addr = std::make_shared<Address>();
@@ -790,6 +886,22 @@ namespace data
 		return GetAddress (eTransportSSU, false, true);
 	}	
 		
+	std::shared_ptr<const RouterInfo::Address> RouterInfo::GetNTCP2Address (bool publishedOnly, bool v4only) const
+	{
+#if (BOOST_VERSION >= 105300)
+		auto addresses = boost::atomic_load (&m_Addresses);
+#else		
+		auto addresses = m_Addresses;
+#endif		
+		for (const auto& address : *addresses)
+		{
+			if (address->ntcp2 && (!publishedOnly || address->ntcp2->isPublished) && 
+				(!v4only || !address->ntcp2->isPublished || address->host.is_v4 ()))
+				return address;
+		}	
+		return nullptr;
+	}
+
 	std::shared_ptr<const RouterInfo::Address> RouterInfo::GetAddress (TransportStyle s, bool v4only, bool v6only) const
 	{
 #if (BOOST_VERSION >= 105300)
@@ -810,9 +922,15 @@ namespace data
 
 	std::shared_ptr<RouterProfile> RouterInfo::GetProfile () const 
 	{
-		if (!m_Profile)
-			m_Profile = GetRouterProfile (GetIdentHash ());
-		return m_Profile;
+		auto profile = std::atomic_load (&m_Profile);
+		if (!profile)
+		{
+			profile = GetRouterProfile (GetIdentHash ());
+			std::shared_ptr<RouterProfile> loaded;
+			if (!std::atomic_compare_exchange_strong (&m_Profile, &loaded, profile))
+				profile = loaded; // by another thread
+		}
+		return profile;
 	}	
 }
 }
@@ -6,6 +6,7 @@
 #include <map>
 #include <vector>
 #include <list>
+#include <memory>
 #include <iostream>
 #include <boost/asio.hpp>
 #include <boost/shared_ptr.hpp> 
@@ -67,7 +68,8 @@ namespace data
 			{
 				eTransportUnknown = 0,
 				eTransportNTCP,
-				eTransportSSU
+				eTransportSSU,
+				eTransportNTCP2
 			};
 
 			typedef Tag<32> IntroKey; // should be castable to MacKey and AESKey
@@ -85,6 +87,13 @@ namespace data
 				IntroKey key; // intro key for SSU
 				std::vector<Introducer> introducers;		
 			};
+
+			struct NTCP2Ext
+			{
+				Tag<32> staticKey;
+				Tag<16> iv;
+				bool isPublished; // has host and port
+			};
 			
 			struct Address
 			{
@@ -95,6 +104,7 @@ namespace data
 				uint64_t date;
 				uint8_t cost;
 				std::unique_ptr<SSUExt> ssu; // not null for SSU
+				std::unique_ptr<NTCP2Ext> ntcp2; // not null for NTCP2 or NTCP with v=2
 
 				bool IsCompatible (const boost::asio::ip::address& other) const 
 				{
@@ -129,8 +139,10 @@ namespace data
 			std::shared_ptr<const Address> GetNTCPAddress (bool v4only = true) const;
 			std::shared_ptr<const Address> GetSSUAddress (bool v4only = true) const;
 			std::shared_ptr<const Address> GetSSUV6Address () const;
+			std::shared_ptr<const Address> GetNTCP2Address (bool publishedOnly, bool v4only = true) const;
 			
 			void AddNTCPAddress (const char * host, int port);
+			void AddNTCP2Address (const uint8_t * staticKey, const uint8_t * iv, const boost::asio::ip::address& host, int port);
 			void AddSSUAddress (const char * host, int port, const uint8_t * key, int mtu = 0);
 			bool AddIntroducer (const Introducer& introducer);
 			bool RemoveIntroducer (const boost::asio::ip::udp::endpoint& e);
@@ -142,6 +154,7 @@ namespace data
 			bool IsReachable () const { return m_Caps & Caps::eReachable; };
 			bool IsNTCP (bool v4only = true) const;
 			bool IsSSU (bool v4only = true) const;
+			bool IsNTCP2 (bool v4only = true) const { return GetNTCP2Address (true, v4only) != nullptr; };
 			bool IsV6 () const;
 			bool IsV4 () const;
 			void EnableV6 ();
@@ -172,8 +185,9 @@ namespace data
 			void SetUpdated (bool updated) { m_IsUpdated = updated; }; 
 			bool SaveToFile (const std::string& fullPath);
 
-			std::shared_ptr<RouterProfile> GetProfile () const;
-			void SaveProfile () { if (m_Profile) m_Profile->Save (GetIdentHash ()); };
+			std::shared_ptr<RouterProfile> GetProfile () const; // loads from disk first time
+			std::shared_ptr<RouterProfile> GetLoadedProfile () const { return std::atomic_load (&m_Profile); }; // nullptr if not loaded yet
+			void SaveProfile () { auto profile = GetLoadedProfile (); if (profile) profile->Save (GetIdentHash ()); };
 			
 			void Update (const uint8_t * buf, int len);
 			void DeleteBuffer () { delete[] m_Buffer; m_Buffer = nullptr; };
@@ -1,5 +1,14 @@
 #include <string.h>
+#include <algorithm>
 #include <boost/bind.hpp>
+#ifdef __linux__
+#include <errno.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+#endif
 #include "Log.h"
 #include "Timestamp.h"
 #include "RouterContext.h"
@@ -10,187 +19,243 @@ namespace i2p
 {
 namespace transport
 {
+	SSUWorker::SSUWorker (i2p::util::MemoryPoolMt<SSUPacket>& packetsPool):
+		work (service), thread (nullptr), socket (service), socketV6 (service),
+#ifdef __linux__
+		batch (socket, packetsPool), batchV6 (socketV6, packetsPool),
+#endif
+		terminationTimer (service)
+	{
+	}
 
-	SSUServer::SSUServer (const boost::asio::ip::address & addr, int port):
-		m_OnlyV6(true), m_IsRunning(false),
-		m_Thread (nullptr), m_ThreadV6 (nullptr), m_ReceiversThread (nullptr), 
-		m_ReceiversThreadV6 (nullptr), m_Work (m_Service), m_WorkV6 (m_ServiceV6), 
-		m_ReceiversWork (m_ReceiversService), m_ReceiversWorkV6 (m_ReceiversServiceV6),
-		m_EndpointV6 (addr, port), m_Socket (m_ReceiversService, m_Endpoint), 
-		m_SocketV6 (m_ReceiversServiceV6), m_IntroducersUpdateTimer (m_Service), 
-		m_PeerTestsCleanupTimer (m_Service), m_TerminationTimer (m_Service), 
-		m_TerminationTimerV6 (m_ServiceV6)	
+	SSUServer::SSUServer (const boost::asio::ip::address & addr, int port, int numThreads):
+		m_OnlyV6(true), m_IsRunning(false), m_EndpointV6 (addr, port), 
+		m_Workers (CreateWorkers (numThreads)),
+		m_IntroducersUpdateTimer (GetService ()), m_PeerTestsCleanupTimer (GetService ())
 	{
-		OpenSocketV6 ();
+		OpenSockets (false, true);
 	}
 	
-	SSUServer::SSUServer (int port):
+	SSUServer::SSUServer (int port, int numThreads):
 		m_OnlyV6(false), m_IsRunning(false),
-		m_Thread (nullptr), m_ThreadV6 (nullptr), m_ReceiversThread (nullptr),
-		m_ReceiversThreadV6 (nullptr), 	m_Work (m_Service), m_WorkV6 (m_ServiceV6), 
-		m_ReceiversWork (m_ReceiversService), m_ReceiversWorkV6 (m_ReceiversServiceV6),
 		m_Endpoint (boost::asio::ip::udp::v4 (), port), m_EndpointV6 (boost::asio::ip::udp::v6 (), port), 
-		m_Socket (m_ReceiversService), m_SocketV6 (m_ReceiversServiceV6), 
-		m_IntroducersUpdateTimer (m_Service), m_PeerTestsCleanupTimer (m_Service),
-		m_TerminationTimer (m_Service), m_TerminationTimerV6 (m_ServiceV6)	
+		m_Workers (CreateWorkers (numThreads)),
+		m_IntroducersUpdateTimer (GetService ()), m_PeerTestsCleanupTimer (GetService ())
 	{
-		OpenSocket ();
-		if (context.SupportsV6 ())
-			OpenSocketV6 ();
+		OpenSockets (true, context.SupportsV6 ());
 	}
 	
 	SSUServer::~SSUServer ()
 	{
 	}
 
-	void SSUServer::OpenSocket ()
-	{
-		m_Socket.open (boost::asio::ip::udp::v4());
-		m_Socket.set_option (boost::asio::socket_base::receive_buffer_size (SSU_SOCKET_RECEIVE_BUFFER_SIZE)); 
-		m_Socket.set_option (boost::asio::socket_base::send_buffer_size (SSU_SOCKET_SEND_BUFFER_SIZE));
-		m_Socket.bind (m_Endpoint);
+	std::vector<std::unique_ptr<SSUWorker> > SSUServer::CreateWorkers (int numThreads)
+	{
+#ifdef __linux__
+		if (numThreads < 1) numThreads = 1;
+		if (numThreads > SSU_MAX_NUM_THREADS) numThreads = SSU_MAX_NUM_THREADS;
+#else
+		numThreads = 1; // no way to steer peers to sockets
+#endif
+		std::vector<std::unique_ptr<SSUWorker> > workers;
+		for (int i = 0; i < numThreads; i++)
+			workers.emplace_back (new SSUWorker (m_PacketsPool));
+		return workers;
 	}
-		
-	void SSUServer::OpenSocketV6 ()
+
+	SSUWorker& SSUServer::GetWorker (const boost::asio::ip::udp::endpoint& ep) const
 	{
-		m_SocketV6.open (boost::asio::ip::udp::v6());
-		m_SocketV6.set_option (boost::asio::ip::v6_only (true));
-		m_SocketV6.set_option (boost::asio::socket_base::receive_buffer_size (SSU_SOCKET_RECEIVE_BUFFER_SIZE));
-		m_SocketV6.set_option (boost::asio::socket_base::send_buffer_size (SSU_SOCKET_SEND_BUFFER_SIZE));
-		m_SocketV6.bind (m_EndpointV6);
-	}	
-		
-	void SSUServer::Start ()
+		auto num = m_Workers.size ();
+		if (num == 1) return *m_Workers[0];
+		// must match AttachSteeringFilter
+		uint32_t h;
+		if (ep.address ().is_v4 ())
+			h = ep.address ().to_v4 ().to_ulong ();
+		else
+		{
+			auto bytes = ep.address ().to_v6 ().to_bytes ();
+			h = bufbe32toh (bytes.data () + 8) ^ bufbe32toh (bytes.data () + 12);
+		}
+		return *m_Workers[h % num];
+	}
+
+	void SSUServer::OpenSockets (bool v4, bool v6)
 	{
-		m_IsRunning = true;
-		if (!m_OnlyV6)
+		for (auto& worker: m_Workers)
 		{
-			m_ReceiversThread = new std::thread (std::bind (&SSUServer::RunReceivers, this));
-			m_Thread = new std::thread (std::bind (&SSUServer::Run, this));
-			m_ReceiversService.post (std::bind (&SSUServer::Receive, this));
-			ScheduleTermination ();		
+			if (v4) OpenSocket (*worker);
+			if (v6) OpenSocketV6 (*worker);
 		}
-		if (context.SupportsV6 ())
-		{	
-			m_ReceiversThreadV6 = new std::thread (std::bind (&SSUServer::RunReceiversV6, this));
-			m_ThreadV6 = new std::thread (std::bind (&SSUServer::RunV6, this));
-			m_ReceiversServiceV6.post (std::bind (&SSUServer::ReceiveV6, this));	
-			ScheduleTerminationV6 ();	
+#ifdef __linux__
+		if (m_Workers.size () > 1)
+		{
+			// kernel picks socket by peer's address, so a peer always lands on the same thread
+			if ((!v4 || AttachSteeringFilter (m_Workers[0]->socket, false)) &&
+				(!v6 || AttachSteeringFilter (m_Workers[0]->socketV6, true)))
+				LogPrint (eLogInfo, "SSU: Running ", m_Workers.size (), " threads");
+			else
+			{
+				LogPrint (eLogWarning, "SSU: Can't attach reuseport filter, running one thread");
+				m_Workers.resize (1);
+			}
 		}
-		SchedulePeerTestsCleanupTimer ();	
-		ScheduleIntroducersUpdateTimer (); // wait for 30 seconds and decide if we need introducers
+#endif
 	}
 
-	void SSUServer::Stop ()
+	void SSUServer::OpenSocket (SSUWorker& worker)
 	{
-		DeleteAllSessions ();
-		m_IsRunning = false;
-		m_TerminationTimer.cancel ();
- 		m_TerminationTimerV6.cancel ();
-		m_Service.stop ();
-		m_Socket.close ();
-		m_ServiceV6.stop ();
-		m_SocketV6.close ();
-		m_ReceiversService.stop ();
-		m_ReceiversServiceV6.stop ();
-		if (m_ReceiversThread)
-		{	
-			m_ReceiversThread->join (); 
-			delete m_ReceiversThread;
-			m_ReceiversThread = nullptr;
+		worker.socket.open (boost::asio::ip::udp::v4());
+		worker.socket.set_option (boost::asio::socket_base::receive_buffer_size (SSU_SOCKET_RECEIVE_BUFFER_SIZE)); 
+		worker.socket.set_option (boost::asio::socket_base::send_buffer_size (SSU_SOCKET_SEND_BUFFER_SIZE));
+#ifdef __linux__
+		if (m_Workers.size () > 1)
+		{
+			int reuse = 1;
+			setsockopt (worker.socket.native_handle (), SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof (reuse));
 		}
-		if (m_Thread)
-		{	
-			m_Thread->join (); 
-			delete m_Thread;
-			m_Thread = nullptr;
+#endif
+		worker.socket.bind (m_Endpoint);
+#ifdef __linux__
+		worker.batch.Init ();
+#endif
+	}
+		
+	void SSUServer::OpenSocketV6 (SSUWorker& worker)
+	{
+		worker.socketV6.open (boost::asio::ip::udp::v6());
+		worker.socketV6.set_option (boost::asio::ip::v6_only (true));
+		worker.socketV6.set_option (boost::asio::socket_base::receive_buffer_size (SSU_SOCKET_RECEIVE_BUFFER_SIZE));
+		worker.socketV6.set_option (boost::asio::socket_base::send_buffer_size (SSU_SOCKET_SEND_BUFFER_SIZE));
+#ifdef __linux__
+		if (m_Workers.size () > 1)
+		{
+			int reuse = 1;
+			setsockopt (worker.socketV6.native_handle (), SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof (reuse));
 		}
-		if (m_ReceiversThreadV6)
-		{	
-			m_ReceiversThreadV6->join (); 
-			delete m_ReceiversThreadV6;
-			m_ReceiversThreadV6 = nullptr;
+#endif
+		worker.socketV6.bind (m_EndpointV6);
+#ifdef __linux__
+		worker.batchV6.Init ();
+#endif
+	}	
+
+	void SSUServer::ReopenSocket (SSUWorker& worker, bool v6)
+	{
+		// reopened socket would change its index in reuseport group
+		if (m_Workers.size () > 1) return;
+		if (v6)
+		{
+			worker.socketV6.close ();
+			OpenSocketV6 (worker);
 		}
-		if (m_ThreadV6)
-		{	
-			m_ThreadV6->join (); 
-			delete m_ThreadV6;
-			m_ThreadV6 = nullptr;
+		else
+		{
+			worker.socket.close ();
+			OpenSocket (worker);
 		}
 	}
 
-	void SSUServer::Run () 
-	{ 
-		while (m_IsRunning)
+#ifdef __linux__
+	bool SSUServer::AttachSteeringFilter (boost::asio::ip::udp::socket& socket, bool v6)
+	{
+		// returns index of socket in group, the same as GetWorker
+		uint32_t num = m_Workers.size ();
+		sock_filter v4Code[] =
 		{
-			try
-			{	
-				m_Service.run ();
-			}
-			catch (std::exception& ex)
-			{
-				LogPrint (eLogError, "SSU: server runtime exception: ", ex.what ());
-			}	
-		}	
+			{ BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t)SKF_NET_OFF + 12 }, // source address
+			{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, num },
+			{ BPF_RET | BPF_A, 0, 0, 0 }
+		};
+		sock_filter v6Code[] =
+		{
+			{ BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t)SKF_NET_OFF + 16 }, // source address, bytes 8-11
+			{ BPF_MISC | BPF_TAX, 0, 0, 0 },
+			{ BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t)SKF_NET_OFF + 20 }, // bytes 12-15
+			{ BPF_ALU | BPF_XOR | BPF_X, 0, 0, 0 },
+			{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, num },
+			{ BPF_RET | BPF_A, 0, 0, 0 }
+		};
+		sock_fprog prog;
+		prog.len = v6 ? sizeof (v6Code)/sizeof (sock_filter) : sizeof (v4Code)/sizeof (sock_filter);
+		prog.filter = v6 ? v6Code : v4Code;
+		if (setsockopt (socket.native_handle (), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof (prog)) < 0)
+		{
+			LogPrint (eLogError, "SSU: SO_ATTACH_REUSEPORT_CBPF failed: ", strerror (errno));
+			return false;
+		}
+		return true;
 	}
+#endif
 
-	void SSUServer::RunV6 () 
-	{ 
-		while (m_IsRunning)
+	void SSUServer::Start ()
+	{
+		m_IsRunning = true;
+		for (auto& it: m_Workers)
 		{
-			try
-			{	
-				m_ServiceV6.run ();
-			}
-			catch (std::exception& ex)
-			{
-				LogPrint (eLogError, "SSU: v6 server runtime exception: ", ex.what ());
-			}	
-		}	
-	}	
+			auto worker = it.get ();
+			worker->thread = new std::thread (std::bind (&SSUServer::Run, this, worker));
+			if (!m_OnlyV6)
+				worker->service.post (std::bind (&SSUServer::Receive, this, worker, false));
+			if (context.SupportsV6 ())
+				worker->service.post (std::bind (&SSUServer::Receive, this, worker, true));
+			ScheduleTermination (worker);
+		}
+		SchedulePeerTestsCleanupTimer ();	
+		ScheduleIntroducersUpdateTimer (); // wait for 30 seconds and decide if we need introducers
+	}
 
-	void SSUServer::RunReceivers () 
-	{ 
-		while (m_IsRunning)
+	void SSUServer::Stop ()
+	{
+		DeleteAllSessions ();
+		m_IsRunning = false;
+		for (auto& worker: m_Workers)
 		{
-			try
+			worker->terminationTimer.cancel ();
+			worker->service.stop ();
+			worker->socket.close ();
+			worker->socketV6.close ();
+		}
+		for (auto& worker: m_Workers)
+		{
+			if (worker->thread)
 			{	
-				m_ReceiversService.run ();
+				worker->thread->join (); 
+				delete worker->thread;
+				worker->thread = nullptr;
 			}
-			catch (std::exception& ex)
-			{
-				LogPrint (eLogError, "SSU: receivers runtime exception: ", ex.what ());
-			}	
-		}	
-	}	
-	
-	void SSUServer::RunReceiversV6 () 
+		}
+	}
+
+	void SSUServer::Run (SSUWorker * worker) 
 	{ 
 		while (m_IsRunning)
 		{
 			try
 			{	
-				m_ReceiversServiceV6.run ();
+				worker->service.run ();
 			}
 			catch (std::exception& ex)
 			{
-				LogPrint (eLogError, "SSU: v6 receivers runtime exception: ", ex.what ());
+				LogPrint (eLogError, "SSU: server runtime exception: ", ex.what ());
 			}	
 		}	
-	}	
+	}
 
 	void SSUServer::AddRelay (uint32_t tag, std::shared_ptr<SSUSession> relay)
 	{
+		std::unique_lock<std::mutex> l(m_RelaysMutex);
 		m_Relays[tag] = relay;
 	}	
 
 	void SSUServer::RemoveRelay (uint32_t tag)
 	{
+		std::unique_lock<std::mutex> l(m_RelaysMutex);
 		m_Relays.erase (tag);
 	}	
 		
 	std::shared_ptr<SSUSession> SSUServer::FindRelaySession (uint32_t tag)
 	{
+		std::unique_lock<std::mutex> l(m_RelaysMutex);
 		auto it = m_Relays.find (tag);
 		if (it != m_Relays.end ())
 		{	
@@ -204,75 +269,63 @@ namespace transport
 
 	void SSUServer::Send (const uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& to)
 	{
+		auto& worker = GetWorker (to);
+#ifdef __linux__
+		// queued and sent by sendmmsg after current handler
+		auto& batch = to.protocol () == boost::asio::ip::udp::v4() ? worker.batch : worker.batchV6;
+		if (batch.Send (buf, len, to))
+			worker.service.post ([&batch](void) { batch.Flush (); });
+#else
 		if (to.protocol () == boost::asio::ip::udp::v4()) 
-			m_Socket.send_to (boost::asio::buffer (buf, len), to);
+			worker.socket.send_to (boost::asio::buffer (buf, len), to);
 		else
-			m_SocketV6.send_to (boost::asio::buffer (buf, len), to);
+			worker.socketV6.send_to (boost::asio::buffer (buf, len), to);
+#endif
 	}	
 
-	void SSUServer::Receive ()
-	{
-		SSUPacket * packet = new SSUPacket ();
-		m_Socket.async_receive_from (boost::asio::buffer (packet->buf, SSU_MTU_V4), packet->from,
-			std::bind (&SSUServer::HandleReceivedFrom, this, std::placeholders::_1, std::placeholders::_2, packet)); 
+	void SSUServer::Receive (SSUWorker * worker, bool v6)
+	{
+		auto& socket = v6 ? worker->socketV6 : worker->socket;
+#ifdef __linux__
+#if BOOST_VERSION >= 106600
+		socket.async_wait (boost::asio::socket_base::wait_read,
+#else
+		socket.async_receive (boost::asio::null_buffers (),
+#endif
+			std::bind (&SSUServer::HandleReceiveReady, this, std::placeholders::_1, worker, v6));
+#else
+		SSUPacket * packet = m_PacketsPool.AcquireMt ();
+		socket.async_receive_from (boost::asio::buffer (packet->buf, v6 ? SSU_MTU_V6 : SSU_MTU_V4), packet->from,
+			std::bind (&SSUServer::HandleReceivedFrom, this, std::placeholders::_1, std::placeholders::_2, packet, worker, v6)); 
+#endif
 	}
 
-	void SSUServer::ReceiveV6 ()
+#ifdef __linux__
+	void SSUServer::HandleReceiveReady (const boost::system::error_code& ecode, SSUWorker * worker, bool v6)
 	{
-		SSUPacket * packet = new SSUPacket ();
-		m_SocketV6.async_receive_from (boost::asio::buffer (packet->buf, SSU_MTU_V6), packet->from,
-			std::bind (&SSUServer::HandleReceivedFromV6, this, std::placeholders::_1, std::placeholders::_2, packet)); 
-	}	
-
-	void SSUServer::HandleReceivedFrom (const boost::system::error_code& ecode, std::size_t bytes_transferred, SSUPacket * packet)
-	{
-		if (!ecode)
+		boost::system::error_code ec = ecode;
+		if (!ec)
 		{
-			packet->len = bytes_transferred;
 			std::vector<SSUPacket *> packets;
-			packets.push_back (packet);
-
-			boost::system::error_code ec;
-			size_t moreBytes = m_Socket.available(ec);
-			if (!ec)
-			{	
-				while (moreBytes && packets.size () < 25)
-				{
-					packet = new SSUPacket ();
-					packet->len = m_Socket.receive_from (boost::asio::buffer (packet->buf, SSU_MTU_V4), packet->from, 0, ec);
-					if (!ec)
-					{	
-						packets.push_back (packet);
-						moreBytes = m_Socket.available(ec);
-						if (ec) break;
-					}
-					else
-					{
-						LogPrint (eLogError, "SSU: receive_from error: ", ec.message ());
-						delete packet;
-						break;
-					}	
-				}
-			}	
-
-			m_Service.post (std::bind (&SSUServer::HandleReceivedPackets, this, packets, &m_Sessions));
-			Receive ();
+			auto& batch = v6 ? worker->batchV6 : worker->batch;
+			if (batch.Receive (packets, v6 ? SSU_MTU_V6 : SSU_MTU_V4, ec))
+				HandleReceivedPackets (std::move (packets), worker); // in the same thread
+		}
+		if (!ec)
+			Receive (worker, v6);
+		else if (ec != boost::asio::error::operation_aborted)
+		{
+			LogPrint (eLogError, "SSU: ", v6 ? "v6 " : "", "receive error: ", ec.message ());
+			ReopenSocket (*worker, v6);
+			Receive (worker, v6);
 		}
-		else
-		{	
-			delete packet;
-			if (ecode != boost::asio::error::operation_aborted)
-			{
-				LogPrint (eLogError, "SSU: receive error: ", ecode.message ());
-				m_Socket.close ();
-				OpenSocket ();
-				Receive ();
-			}
-		}	
 	}
+#endif
 
-	void SSUServer::HandleReceivedFromV6 (const boost::system::error_code& ecode, std::size_t bytes_transferred, SSUPacket * packet)
+	void SSUServer::HandleReceivedFrom (const boost::system::error_code& ecode, std::size_t bytes_transferred, 
+		SSUPacket * packet, SSUWorker * worker, bool v6)
 	{
+		auto& socket = v6 ? worker->socketV6 : worker->socket;
 		if (!ecode)
 		{
 			packet->len = bytes_transferred;
@@ -280,48 +333,50 @@ namespace transport
 			packets.push_back (packet);
 
 			boost::system::error_code ec;
-			size_t moreBytes = m_SocketV6.available (ec);
+			size_t moreBytes = socket.available(ec);
 			if (!ec)
-			{
+			{	
 				while (moreBytes && packets.size () < 25)
 				{
-					packet = new SSUPacket ();
-					packet->len = m_SocketV6.receive_from (boost::asio::buffer (packet->buf, SSU_MTU_V6), packet->from, 0, ec);
+					packet = m_PacketsPool.AcquireMt ();
+					packet->len = socket.receive_from (boost::asio::buffer (packet->buf, v6 ? SSU_MTU_V6 : SSU_MTU_V4), packet->from, 0, ec);
 					if (!ec)
-					{
+					{	
 						packets.push_back (packet);
-						moreBytes = m_SocketV6.available(ec);
+						moreBytes = socket.available(ec);
 						if (ec) break;
 					}
 					else
 					{
-						LogPrint (eLogError, "SSU: v6 receive_from error: ", ec.message ());
-						delete packet;
+						LogPrint (eLogError, "SSU: ", v6 ? "v6 " : "", "receive_from error: ", ec.message ());
+						m_PacketsPool.ReleaseMt (packet);
 						break;
 					}	
 				}
-			}
-			
-			m_ServiceV6.post (std::bind (&SSUServer::HandleReceivedPackets, this, packets, &m_SessionsV6));
-			ReceiveV6 ();
+			}	
+
+			HandleReceivedPackets (std::move (packets), worker); // in the same thread
+			Receive (worker, v6);
 		}
 		else
 		{	
-			delete packet;
+			m_PacketsPool.ReleaseMt (packet);
 			if (ecode != boost::asio::error::operation_aborted)
 			{
-				LogPrint (eLogError, "SSU: v6 receive error: ", ecode.message ());
-				m_SocketV6.close ();
-				OpenSocketV6 ();
-				ReceiveV6 ();
+				LogPrint (eLogError, "SSU: ", v6 ? "v6 " : "", "receive error: ", ecode.message ());
+				ReopenSocket (*worker, v6);
+				Receive (worker, v6);
 			}
 		}	
 	}
 
-	void SSUServer::HandleReceivedPackets (std::vector<SSUPacket *> packets, 
-		std::map<boost::asio::ip::udp::endpoint, std::shared_ptr<SSUSession> > * sessions)
+	void SSUServer::HandleReceivedPackets (std::vector<SSUPacket *> packets, SSUWorker * worker)
 	{
-		std::shared_ptr<SSUSession> session;	
+		auto session = worker->lastSession; // from previous batch, reset by DeleteSession
+		if (packets.size () > 1)
+			VerifyMACs (packets, worker, session);
+		else if (!packets.empty ())
+			packets[0]->isMACVerified = false; // verified and decrypted in one pass
 		for (auto& packet: packets)
 		{
 			try
@@ -329,30 +384,79 @@ namespace transport
 				if (!session || session->GetRemoteEndpoint () != packet->from) // we received packet for other session than previous
 				{
 					if (session) session->FlushData ();
-					auto it = sessions->find (packet->from);
-					if (it != sessions->end ())
+					auto it = worker->sessions.find (packet->from);
+					if (it != worker->sessions.end ())
 						session = it->second;
+					else
+						session = nullptr;
 					if (!session)
 					{
 						session = std::make_shared<SSUSession> (*this, packet->from);
 						session->WaitForConnect ();
-						(*sessions)[packet->from] = session;
+						{
+							std::unique_lock<std::mutex> l(worker->sessionsMutex);
+							worker->sessions[packet->from] = session;
+						}
 						LogPrint (eLogDebug, "SSU: new session from ", packet->from.address ().to_string (), ":", packet->from.port (), " created");
 					}
+					worker->lastSession = session;
 				}
-				session->ProcessNextMessage (packet->buf, packet->len, packet->from);
+				session->ProcessNextMessage (packet->buf, packet->len, packet->from, packet->isMACVerified);
 			}	
 			catch (std::exception& ex)
 			{
 				LogPrint (eLogError, "SSU: HandleReceivedPackets ", ex.what ());
 				if (session) session->FlushData ();
 				session = nullptr;
+				worker->lastSession = nullptr;
 			}	
-			delete packet;
 		}
+		m_PacketsPool.ReleaseMt (packets);
 		if (session) session->FlushData ();
 	}
 
+	void SSUServer::VerifyMACs (const std::vector<SSUPacket *>& packets, SSUWorker * worker, std::shared_ptr<SSUSession> session)
+	{
+		// HMAC-MD5 of packets to sessions with session key at once
+		const size_t n = i2p::crypto::HMAC_MD5_NUM_LANES;
+		SSUPacket * batch[n];
+		const uint8_t * msgs[n];
+		size_t lens[n];
+		const i2p::crypto::MACKey * keys[n];
+		uint8_t digests[n][16], * digestPtrs[n];
+		size_t num = 0;
+		for (size_t i = 0; i < packets.size (); i++)
+		{
+			auto packet = packets[i];
+			packet->isMACVerified = false;
+			if (!session || session->GetRemoteEndpoint () != packet->from)
+			{
+				auto it = worker->sessions.find (packet->from);
+				session = it != worker->sessions.end () ? it->second : nullptr;
+			}
+			if (session && session->IsSessionKey () && packet->len >= sizeof (SSUHeader))
+			{
+				SSUHeader * header = (SSUHeader *)(uint8_t *)packet->buf;
+				uint8_t * encrypted = &header->flag;
+				uint16_t encryptedLen = packet->len - (encrypted - (uint8_t *)header);
+				// buffer has 18 bytes more for iv and size
+				uint8_t * tail = (uint8_t *)packet->buf + packet->len;
+				memcpy (tail, header->iv, 16);
+				htobe16buf (tail + 16, encryptedLen);
+				batch[num] = packet; msgs[num] = encrypted; lens[num] = encryptedLen + 18;
+				keys[num] = &session->GetMacKey (); digestPtrs[num] = digests[num];
+				num++;
+			}
+			if (num == n || (num > 0 && i + 1 == packets.size ()))
+			{
+				i2p::crypto::HMACMD5Digest (num, msgs, lens, keys, digestPtrs);
+				for (size_t j = 0; j < num; j++)
+					batch[j]->isMACVerified = !memcmp (((SSUHeader *)(uint8_t *)batch[j]->buf)->mac, digests[j], 16);
+				num = 0;
+			}
+		}
+	}
+
 	std::shared_ptr<SSUSession> SSUServer::FindSession (std::shared_ptr<const i2p::data::RouterInfo> router) const
 	{
 		if (!router) return nullptr;
@@ -369,9 +473,10 @@ namespace transport
 
 	std::shared_ptr<SSUSession> SSUServer::FindSession (const boost::asio::ip::udp::endpoint& e) const
 	{
-		auto& sessions = e.address ().is_v6 () ?  m_SessionsV6 : m_Sessions; 
-		auto it = sessions.find (e);
-		if (it != sessions.end ())
+		auto& worker = GetWorker (e);
+		std::unique_lock<std::mutex> l(worker.sessionsMutex);
+		auto it = worker.sessions.find (e);
+		if (it != worker.sessions.end ())
 			return it->second;
 		else
 			return nullptr;
@@ -392,21 +497,27 @@ namespace transport
 		if (router)
 		{
 			if (router->UsesIntroducer ())
-				m_Service.post (std::bind (&SSUServer::CreateSessionThroughIntroducer, this, router, peerTest)); // always V4 thread
-			else
 			{
-				boost::asio::ip::udp::endpoint remoteEndpoint (addr, port);
-				auto& s = addr.is_v6 () ? m_ServiceV6 : m_Service;
-				s.post (std::bind (&SSUServer::CreateDirectSession, this, router, remoteEndpoint, peerTest));
+				// in thread of session's endpoint
+				auto address = router->GetSSUAddress (true); // v4 only for now
+				auto& s = address ? GetSessionService (boost::asio::ip::udp::endpoint (address->host, address->port)) : GetService ();
+				s.post (std::bind (&SSUServer::CreateSessionThroughIntroducer, this, router, peerTest));
 			}
+			else
+				CreateDirectSession (router, boost::asio::ip::udp::endpoint (addr, port), peerTest);
 		}
 	}
 
 	void SSUServer::CreateDirectSession (std::shared_ptr<const i2p::data::RouterInfo> router, boost::asio::ip::udp::endpoint remoteEndpoint, bool peerTest)
+	{
+		GetSessionService (remoteEndpoint).dispatch (std::bind (&SSUServer::PostCreateDirectSession, this, router, remoteEndpoint, peerTest));
+	}
+
+	void SSUServer::PostCreateDirectSession (std::shared_ptr<const i2p::data::RouterInfo> router, boost::asio::ip::udp::endpoint remoteEndpoint, bool peerTest)
 	{	
-		auto& sessions = remoteEndpoint.address ().is_v6 () ? m_SessionsV6 : m_Sessions;	
-		auto it = sessions.find (remoteEndpoint);
-		if (it != sessions.end ())
+		auto& worker = GetWorker (remoteEndpoint);
+		auto it = worker.sessions.find (remoteEndpoint);
+		if (it != worker.sessions.end ())
 		{	
 			auto session = it->second;
 			if (peerTest && session->GetState () == eSessionStateEstablished)
@@ -416,7 +527,10 @@ namespace transport
 		{
 			// otherwise create new session					
 			auto session = std::make_shared<SSUSession> (*this, remoteEndpoint, router, peerTest);
-			sessions[remoteEndpoint] = session;
+			{
+				std::unique_lock<std::mutex> l(worker.sessionsMutex);
+				worker.sessions[remoteEndpoint] = session;
+			}
 			// connect 					
 			LogPrint (eLogDebug, "SSU: Creating new session to [", i2p::data::GetIdentHashAbbreviation (router->GetIdentHash ()), "] ",
 				remoteEndpoint.address ().to_string (), ":", remoteEndpoint.port ());
@@ -432,9 +546,10 @@ namespace transport
 			if (address)
 			{
 				boost::asio::ip::udp::endpoint remoteEndpoint (address->host, address->port);
-				auto it = m_Sessions.find (remoteEndpoint);
+				auto& worker = GetWorker (remoteEndpoint);
+				auto it = worker.sessions.find (remoteEndpoint);
 				// check if session if presented alredy
-				if (it != m_Sessions.end ())
+				if (it != worker.sessions.end ())
 				{	
 					auto session = it->second;
 					if (peerTest && session->GetState () == eSessionStateEstablished)
@@ -445,7 +560,6 @@ namespace transport
 				int numIntroducers = address->ssu->introducers.size ();
 				if (numIntroducers > 0)
 				{
-					std::shared_ptr<SSUSession> introducerSession;
 					const i2p::data::RouterInfo::Introducer * introducer = nullptr;
 					// we might have a session to introducer already
 					for (int i = 0; i < numIntroducers; i++)
@@ -455,10 +569,9 @@ namespace transport
 						if (ep.address ().is_v4 ()) // ipv4 only
 						{	
 							if (!introducer) introducer = intr; // we pick first one for now
-							it = m_Sessions.find (ep); 
-							if (it != m_Sessions.end ())
+							if (FindSession (ep))
 							{
-								introducerSession = it->second;
+								introducer = intr;
 								break; 
 							}	
 						}
@@ -469,18 +582,12 @@ namespace transport
 						return;
 					}				
 
-					if (introducerSession) // session found 
-						LogPrint (eLogWarning, "SSU: Session to introducer already exists");
-					else // create new
-					{
-						LogPrint (eLogDebug, "SSU: Creating new session to introducer ", introducer->iHost);
-						boost::asio::ip::udp::endpoint introducerEndpoint (introducer->iHost, introducer->iPort);
-						introducerSession = std::make_shared<SSUSession> (*this, introducerEndpoint, router);
-						m_Sessions[introducerEndpoint] = introducerSession;													
-					}
 					// create session	
 					auto session = std::make_shared<SSUSession> (*this, remoteEndpoint, router, peerTest);
-					m_Sessions[remoteEndpoint] = session;
+					{
+						std::unique_lock<std::mutex> l(worker.sessionsMutex);
+						worker.sessions[remoteEndpoint] = session;
+					}
 					// introduce
 					LogPrint (eLogInfo, "SSU: Introduce new session to [", i2p::data::GetIdentHashAbbreviation (router->GetIdentHash ()),
 							"] through introducer ", introducer->iHost, ":", introducer->iPort);
@@ -490,7 +597,9 @@ namespace transport
 						uint8_t buf[1];
 						Send (buf, 0, remoteEndpoint); // send HolePunch
 					}	
-					introducerSession->Introduce (*introducer, router);
+					// in thread of introducer's session
+					GetSessionService (boost::asio::ip::udp::endpoint (introducer->iHost, introducer->iPort)).dispatch (
+						std::bind (&SSUServer::Introduce, this, *introducer, router));
 				}
 				else	
 					LogPrint (eLogWarning, "SSU: Can't connect to unreachable router and no introducers present");
@@ -500,36 +609,69 @@ namespace transport
 		}
 	}
 
+	void SSUServer::Introduce (i2p::data::RouterInfo::Introducer introducer, std::shared_ptr<const i2p::data::RouterInfo> router)
+	{
+		boost::asio::ip::udp::endpoint introducerEndpoint (introducer.iHost, introducer.iPort);
+		auto& worker = GetWorker (introducerEndpoint);
+		std::shared_ptr<SSUSession> introducerSession;
+		auto it = worker.sessions.find (introducerEndpoint);
+		if (it != worker.sessions.end ()) // session found 
+		{
+			introducerSession = it->second;
+			LogPrint (eLogWarning, "SSU: Session to introducer already exists");
+		}
+		else // create new
+		{
+			LogPrint (eLogDebug, "SSU: Creating new session to introducer ", introducer.iHost);
+			introducerSession = std::make_shared<SSUSession> (*this, introducerEndpoint, router);
+			std::unique_lock<std::mutex> l(worker.sessionsMutex);
+			worker.sessions[introducerEndpoint] = introducerSession;
+		}
+		introducerSession->Introduce (introducer, router);
+	}
+
 	void SSUServer::DeleteSession (std::shared_ptr<SSUSession> session)
 	{
 		if (session)
 		{
-			session->Close ();
-			auto& ep = session->GetRemoteEndpoint ();
-			if (ep.address ().is_v6 ())
-				m_SessionsV6.erase (ep);
-			else
-				m_Sessions.erase (ep);
+			// in session's thread
+			auto worker = &GetWorker (session->GetRemoteEndpoint ());
+			worker->service.dispatch ([session, worker]()
+				{
+					session->Close ();
+					if (worker->lastSession == session) worker->lastSession = nullptr;
+					std::unique_lock<std::mutex> l(worker->sessionsMutex);
+					worker->sessions.erase (session->GetRemoteEndpoint ());
+				});
 		}	
 	}	
 
 	void SSUServer::DeleteAllSessions ()
 	{
-		for (auto& it: m_Sessions)
-			it.second->Close ();
-		m_Sessions.clear ();
-
-		for (auto& it: m_SessionsV6)
-			it.second->Close ();
-		m_SessionsV6.clear ();
+		for (auto& worker: m_Workers)
+		{
+			auto w = worker.get ();
+			w->service.dispatch ([w]() { w->lastSession = nullptr; }); // in worker's thread
+			SSUSessions sessions;
+			{
+				std::unique_lock<std::mutex> l(worker->sessionsMutex);
+				sessions.swap (worker->sessions);
+			}
+			for (auto& it: sessions)
+				it.second->Close ();
+		}
 	}
 
 	template<typename Filter>
-	std::shared_ptr<SSUSession> SSUServer::GetRandomV4Session (Filter filter) // v4 only
+	std::shared_ptr<SSUSession> SSUServer::GetRandomSession (Filter filter)
 	{
 		std::vector<std::shared_ptr<SSUSession> > filteredSessions;
-		for (const auto& s :m_Sessions)
-			if (filter (s.second)) filteredSessions.push_back (s.second);
+		for (const auto& worker: m_Workers)
+		{
+			std::unique_lock<std::mutex> l(worker->sessionsMutex);
+			for (const auto& s: worker->sessions)
+				if (filter (s.second)) filteredSessions.push_back (s.second);
+		}
 		if (filteredSessions.size () > 0)
 		{
 			auto ind = rand () % filteredSessions.size ();
@@ -538,6 +680,17 @@ namespace transport
 		return nullptr;	
 	}
 
+	template<typename Filter>
+	std::shared_ptr<SSUSession> SSUServer::GetRandomV4Session (Filter filter) // v4 only
+	{
+		return GetRandomSession (
+			[filter](std::shared_ptr<SSUSession> session)->bool 
+			{ 
+				return !session->IsV6 () && filter (session);
+			}
+								);
+	}
+
 	std::shared_ptr<SSUSession> SSUServer::GetRandomEstablishedV4Session (std::shared_ptr<const SSUSession> excluded) // v4 only
 	{
 		return GetRandomV4Session (
@@ -551,15 +704,12 @@ namespace transport
 	template<typename Filter>
 	std::shared_ptr<SSUSession> SSUServer::GetRandomV6Session (Filter filter) // v6 only
 	{
-		std::vector<std::shared_ptr<SSUSession> > filteredSessions;
-		for (const auto& s :m_SessionsV6)
-			if (filter (s.second)) filteredSessions.push_back (s.second);
-		if (filteredSessions.size () > 0)
-		{
-			auto ind = rand () % filteredSessions.size ();
-			return filteredSessions[ind];
-		}
-		return nullptr;	
+		return GetRandomSession (
+			[filter](std::shared_ptr<SSUSession> session)->bool 
+			{ 
+				return session->IsV6 () && filter (session);
+			}
+								);
 	}
 
 	std::shared_ptr<SSUSession> SSUServer::GetRandomEstablishedV6Session (std::shared_ptr<const SSUSession> excluded) // v6 only
@@ -624,7 +774,7 @@ namespace transport
 				auto session = FindSession (it);
 				if (session && ts < session->GetCreationTime () + SSU_TO_INTRODUCER_SESSION_DURATION)
 				{
-					session->SendKeepAlive ();
+					GetSessionService (it).post (std::bind (&SSUSession::SendKeepAlive, session));
 					newList.push_back (it);
 					numIntroducers++;
 				}
@@ -664,11 +814,13 @@ namespace transport
 
 	void SSUServer::NewPeerTest (uint32_t nonce, PeerTestParticipant role, std::shared_ptr<SSUSession> session)
 	{
+		std::unique_lock<std::mutex> l(m_PeerTestsMutex);
 		m_PeerTests[nonce] = { i2p::util::GetMillisecondsSinceEpoch (), role, session };
 	}
 
 	PeerTestParticipant SSUServer::GetPeerTestParticipant (uint32_t nonce)
 	{
+		std::unique_lock<std::mutex> l(m_PeerTestsMutex);
 		auto it = m_PeerTests.find (nonce);
 		if (it != m_PeerTests.end ())
 			return it->second.role;
@@ -678,6 +830,7 @@ namespace transport
 
 	std::shared_ptr<SSUSession> SSUServer::GetPeerTestSession (uint32_t nonce)
 	{
+		std::unique_lock<std::mutex> l(m_PeerTestsMutex);
 		auto it = m_PeerTests.find (nonce);
 		if (it != m_PeerTests.end ())
 			return it->second.session;
@@ -687,6 +840,7 @@ namespace transport
 
 	void SSUServer::UpdatePeerTest (uint32_t nonce, PeerTestParticipant role)
 	{
+		std::unique_lock<std::mutex> l(m_PeerTestsMutex);
 		auto it = m_PeerTests.find (nonce);
 		if (it != m_PeerTests.end ())
 			it->second.role = role;
@@ -694,9 +848,32 @@ namespace transport
 	
 	void SSUServer::RemovePeerTest (uint32_t nonce)
 	{
+		std::unique_lock<std::mutex> l(m_PeerTestsMutex);
 		m_PeerTests.erase (nonce);
 	}	
 
+	int SSUServer::FindPathPacketSize (const boost::asio::ip::address& addr)
+	{
+		std::unique_lock<std::mutex> l(m_PathPacketSizesMutex);
+		auto it = m_PathPacketSizes.find (addr);
+		if (it != m_PathPacketSizes.end ())
+		{
+			if (i2p::util::GetSecondsSinceEpoch () < it->second.second + SSU_PATH_PACKET_SIZE_EXPIRATION)
+				return it->second.first;
+			m_PathPacketSizes.erase (it);
+		}
+		return 0;
+	}
+
+	void SSUServer::UpdatePathPacketSize (const boost::asio::ip::address& addr, int packetSize)
+	{
+		std::unique_lock<std::mutex> l(m_PathPacketSizesMutex);
+		if (packetSize)
+			m_PathPacketSizes[addr] = std::make_pair (packetSize, i2p::util::GetSecondsSinceEpoch ());
+		else
+			m_PathPacketSizes.erase (addr);
+	}
+
 	void SSUServer::SchedulePeerTestsCleanupTimer ()
 	{
 		m_PeerTestsCleanupTimer.expires_from_now (boost::posix_time::seconds(SSU_PEER_TEST_TIMEOUT));
@@ -710,73 +887,85 @@ namespace transport
 		{
 			int numDeleted = 0;	
 			uint64_t ts = i2p::util::GetMillisecondsSinceEpoch ();	
-			for (auto it = m_PeerTests.begin (); it != m_PeerTests.end ();)
 			{
-				if (ts > it->second.creationTime + SSU_PEER_TEST_TIMEOUT*1000LL)
+				std::unique_lock<std::mutex> l(m_PeerTestsMutex);
+				for (auto it = m_PeerTests.begin (); it != m_PeerTests.end ();)
 				{
-					numDeleted++;
-					it = m_PeerTests.erase (it);
+					if (ts > it->second.creationTime + SSU_PEER_TEST_TIMEOUT*1000LL)
+					{
+						numDeleted++;
+						it = m_PeerTests.erase (it);
+					}
+					else
+						++it;
 				}
-				else
-					++it;
 			}
 			if (numDeleted > 0)
 				LogPrint (eLogDebug, "SSU: ", numDeleted, " peer tests have been expired");
+			// expire probed path packet sizes too
+			{
+				std::unique_lock<std::mutex> l(m_PathPacketSizesMutex);
+				for (auto it = m_PathPacketSizes.begin (); it != m_PathPacketSizes.end ();)
+				{
+					if (ts >= (it->second.second + SSU_PATH_PACKET_SIZE_EXPIRATION)*1000LL)
+						it = m_PathPacketSizes.erase (it);
+					else
+						++it;
+				}
+			}
 			SchedulePeerTestsCleanupTimer ();
 		}
 	}
 
-	void SSUServer::ScheduleTermination ()
+	void SSUServer::ScheduleTermination (SSUWorker * worker)
 	{
-		m_TerminationTimer.expires_from_now (boost::posix_time::seconds(SSU_TERMINATION_CHECK_TIMEOUT));
-		m_TerminationTimer.async_wait (std::bind (&SSUServer::HandleTerminationTimer,
-			this, std::placeholders::_1));
+		worker->terminationTimer.expires_from_now (boost::posix_time::seconds(SSU_TERMINATION_CHECK_TIMEOUT));
+		worker->terminationTimer.async_wait (std::bind (&SSUServer::HandleTerminationTimer,
+			this, std::placeholders::_1, worker));
 	}
 
-	void SSUServer::HandleTerminationTimer (const boost::system::error_code& ecode)
+	void SSUServer::HandleTerminationTimer (const boost::system::error_code& ecode, SSUWorker * worker)
 	{
 		if (ecode != boost::asio::error::operation_aborted)
 		{	
 			auto ts = i2p::util::GetSecondsSinceEpoch ();
-			for (auto& it: m_Sessions)
+			for (auto& it: worker->sessions)
  				if (it.second->IsTerminationTimeoutExpired (ts))
 				{
 					auto session = it.second;
-					m_Service.post ([session] 
+					worker->service.post ([session] 
 						{ 
 							LogPrint (eLogWarning, "SSU: no activity with ", session->GetRemoteEndpoint (), " for ", session->GetTerminationTimeout (), " seconds");
 							session->Failed ();
 						});	
 				}
-			ScheduleTermination ();	
+			ScheduleTermination (worker);	
 		}	
 	}	
 
-	void SSUServer::ScheduleTerminationV6 ()
+	SSUSessions SSUServer::GetSessions () const
 	{
-		m_TerminationTimerV6.expires_from_now (boost::posix_time::seconds(SSU_TERMINATION_CHECK_TIMEOUT));
-		m_TerminationTimerV6.async_wait (std::bind (&SSUServer::HandleTerminationTimerV6,
-			this, std::placeholders::_1));
+		SSUSessions sessions;
+		for (const auto& worker: m_Workers)
+		{
+			std::unique_lock<std::mutex> l(worker->sessionsMutex);
+			for (const auto& it: worker->sessions)
+				if (!it.second->IsV6 ()) sessions.insert (it);
+		}
+		return sessions;
 	}
 
-	void SSUServer::HandleTerminationTimerV6 (const boost::system::error_code& ecode)
+	SSUSessions SSUServer::GetSessionsV6 () const
 	{
-		if (ecode != boost::asio::error::operation_aborted)
-		{	
-			auto ts = i2p::util::GetSecondsSinceEpoch ();
-			for (auto& it: m_SessionsV6)
- 				if (it.second->IsTerminationTimeoutExpired (ts))
-				{
-					auto session = it.second;
-					m_ServiceV6.post ([session] 
-						{ 
-							LogPrint (eLogWarning, "SSU: no activity with ", session->GetRemoteEndpoint (), " for ", session->GetTerminationTimeout (), " seconds");
-							session->Failed ();
-						});	
-				}
-			ScheduleTerminationV6 ();	
-		}	
-	}	
+		SSUSessions sessions;
+		for (const auto& worker: m_Workers)
+		{
+			std::unique_lock<std::mutex> l(worker->sessionsMutex);
+			for (const auto& it: worker->sessions)
+				if (it.second->IsV6 ()) sessions.insert (it);
+		}
+		return sessions;
+	}
 }
 }
 
@@ -4,17 +4,22 @@
 #include <inttypes.h>
 #include <string.h>
 #include <map>
+#include <unordered_map>
 #include <list>
 #include <set>
 #include <thread>
 #include <mutex>
+#include <vector>
+#include <memory>
 #include <boost/asio.hpp>
 #include "Crypto.h"
 #include "I2PEndian.h"
 #include "Identity.h"
 #include "RouterInfo.h"
 #include "I2NPProtocol.h"
+#include "util.h"
 #include "SSUSession.h"
+#include "SSUSocket.h"
 
 namespace i2p
 {
@@ -27,20 +32,53 @@ namespace transport
 	const size_t SSU_MAX_NUM_INTRODUCERS = 3;
 	const size_t SSU_SOCKET_RECEIVE_BUFFER_SIZE = 0x1FFFF; // 128K
 	const size_t SSU_SOCKET_SEND_BUFFER_SIZE = 0x1FFFF; // 128K
+	const int SSU_MAX_NUM_THREADS = 16;
+	const int SSU_PATH_PACKET_SIZE_EXPIRATION = 3600; // 1 hour
 
-	struct SSUPacket
+	struct SSUEndpointHash
 	{
-		i2p::crypto::AESAlignedBuffer<SSU_MTU_V6 + 18> buf; // max MTU + iv + size
-		boost::asio::ip::udp::endpoint from;
-		size_t len;
-	};	
-	
+		size_t operator() (const boost::asio::ip::udp::endpoint& ep) const
+		{
+			uint64_t h = ep.port ();
+			if (ep.address ().is_v4 ())
+				h |= (uint64_t)ep.address ().to_v4 ().to_ulong () << 16;
+			else
+			{
+				auto bytes = ep.address ().to_v6 ().to_bytes ();
+				uint64_t prefix, suffix;
+				memcpy (&prefix, bytes.data (), 8);
+				memcpy (&suffix, bytes.data () + 8, 8);
+				h ^= prefix ^ (suffix * 0x9E3779B97F4A7C15ULL); // mix both halves
+			}
+			return std::hash<uint64_t>()(h);
+		}
+	};
+	typedef std::unordered_map<boost::asio::ip::udp::endpoint, std::shared_ptr<SSUSession>, SSUEndpointHash> SSUSessions;
+
+	// thread with own sockets bound to server's port, handles sessions of peers steered to it
+	struct SSUWorker
+	{
+		SSUWorker (i2p::util::MemoryPoolMt<SSUPacket>& packetsPool);
+
+		boost::asio::io_service service;
+		boost::asio::io_service::work work;
+		std::thread * thread;
+		boost::asio::ip::udp::socket socket, socketV6;
+#ifdef __linux__
+		SSUSocketBatch batch, batchV6;
+#endif
+		mutable std::mutex sessionsMutex; // for changes and access from other threads
+		SSUSessions sessions; // v4 and v6
+		std::shared_ptr<SSUSession> lastSession; // received from, for bursts
+		boost::asio::deadline_timer terminationTimer;
+	};
+
 	class SSUServer
 	{
 		public:
 
-			SSUServer (int port);
-			SSUServer (const boost::asio::ip::address & addr, int port);			// ipv6 only constructor
+			SSUServer (int port, int numThreads = 1);
+			SSUServer (const boost::asio::ip::address & addr, int port, int numThreads = 1); // ipv6 only constructor
 			~SSUServer ();
 			void Start ();
 			void Stop ();
@@ -55,8 +93,9 @@ namespace transport
 			void DeleteSession (std::shared_ptr<SSUSession> session);
 			void DeleteAllSessions ();			
 
-			boost::asio::io_service& GetService () { return m_Service; };
-			boost::asio::io_service& GetServiceV6 () { return m_ServiceV6; };
+			boost::asio::io_service& GetService () { return m_Workers[0]->service; }; // server's timers
+			boost::asio::io_service& GetSessionService (const boost::asio::ip::udp::endpoint& ep) { return GetWorker (ep).service; };
+			size_t GetNumThreads () const { return m_Workers.size (); };
 			const boost::asio::ip::udp::endpoint& GetEndpoint () const { return m_Endpoint; };			
 			void Send (const uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& to);
 			void AddRelay (uint32_t tag, std::shared_ptr<SSUSession> relay);
@@ -68,23 +107,36 @@ namespace transport
 			std::shared_ptr<SSUSession> GetPeerTestSession (uint32_t nonce);
 			void UpdatePeerTest (uint32_t nonce, PeerTestParticipant role);
 			void RemovePeerTest (uint32_t nonce);
+
+			int FindPathPacketSize (const boost::asio::ip::address& addr); // probed before, 0 if unknown
+			void UpdatePathPacketSize (const boost::asio::ip::address& addr, int packetSize); // 0 removes
       
 		private:
 
-			void OpenSocket ();
-			void OpenSocketV6 ();
-			void Run ();
-			void RunV6 ();
-			void RunReceivers ();
-			void RunReceiversV6 ();
-			void Receive ();
-			void ReceiveV6 ();
-			void HandleReceivedFrom (const boost::system::error_code& ecode, std::size_t bytes_transferred, SSUPacket * packet);
-			void HandleReceivedFromV6 (const boost::system::error_code& ecode, std::size_t bytes_transferred, SSUPacket * packet);
-			void HandleReceivedPackets (std::vector<SSUPacket *> packets,
-				std::map<boost::asio::ip::udp::endpoint, std::shared_ptr<SSUSession> >* sessions);
+			std::vector<std::unique_ptr<SSUWorker> > CreateWorkers (int numThreads);
+			SSUWorker& GetWorker (const boost::asio::ip::udp::endpoint& ep) const; // steered by peer's address
+			void OpenSockets (bool v4, bool v6);
+			void OpenSocket (SSUWorker& worker);
+			void OpenSocketV6 (SSUWorker& worker);
+			void ReopenSocket (SSUWorker& worker, bool v6);
+#ifdef __linux__
+			bool AttachSteeringFilter (boost::asio::ip::udp::socket& socket, bool v6);
+#endif
+			void Run (SSUWorker * worker);
+			void Receive (SSUWorker * worker, bool v6);
+			void HandleReceivedFrom (const boost::system::error_code& ecode, std::size_t bytes_transferred, 
+				SSUPacket * packet, SSUWorker * worker, bool v6);
+#ifdef __linux__
+			void HandleReceiveReady (const boost::system::error_code& ecode, SSUWorker * worker, bool v6);
+#endif
+			void HandleReceivedPackets (std::vector<SSUPacket *> packets, SSUWorker * worker);
+			void VerifyMACs (const std::vector<SSUPacket *>& packets, SSUWorker * worker, std::shared_ptr<SSUSession> session);
 
+			void PostCreateDirectSession (std::shared_ptr<const i2p::data::RouterInfo> router, boost::asio::ip::udp::endpoint remoteEndpoint, bool peerTest);
 			void CreateSessionThroughIntroducer (std::shared_ptr<const i2p::data::RouterInfo> router, bool peerTest = false);			
+			void Introduce (i2p::data::RouterInfo::Introducer introducer, std::shared_ptr<const i2p::data::RouterInfo> router);
+			template<typename Filter>
+			std::shared_ptr<SSUSession> GetRandomSession (Filter filter);
 			template<typename Filter>
 			std::shared_ptr<SSUSession> GetRandomV4Session (Filter filter);
 			template<typename Filter>
@@ -98,10 +150,8 @@ namespace transport
 			void HandlePeerTestsCleanupTimer (const boost::system::error_code& ecode);
 
 			// timer
-			void ScheduleTermination ();
-			void HandleTerminationTimer (const boost::system::error_code& ecode);
-			void ScheduleTerminationV6 ();
-			void HandleTerminationTimerV6 (const boost::system::error_code& ecode);
+			void ScheduleTermination (SSUWorker * worker);
+			void HandleTerminationTimer (const boost::system::error_code& ecode, SSUWorker * worker);
 
 		private:
 
@@ -114,22 +164,22 @@ namespace transport
 			
 			bool m_OnlyV6;			
 			bool m_IsRunning;
-			std::thread * m_Thread, * m_ThreadV6, * m_ReceiversThread, * m_ReceiversThreadV6;	
-			boost::asio::io_service m_Service, m_ServiceV6, m_ReceiversService, m_ReceiversServiceV6;
-			boost::asio::io_service::work m_Work, m_WorkV6, m_ReceiversWork, m_ReceiversWorkV6;
 			boost::asio::ip::udp::endpoint m_Endpoint, m_EndpointV6;
-			boost::asio::ip::udp::socket m_Socket, m_SocketV6;
-			boost::asio::deadline_timer m_IntroducersUpdateTimer, m_PeerTestsCleanupTimer,
-				m_TerminationTimer, m_TerminationTimerV6;
+			i2p::util::MemoryPoolMt<SSUPacket> m_PacketsPool; // shared by all workers
+			std::vector<std::unique_ptr<SSUWorker> > m_Workers; // one thread each, first runs server's timers
+			boost::asio::deadline_timer m_IntroducersUpdateTimer, m_PeerTestsCleanupTimer;
 			std::list<boost::asio::ip::udp::endpoint> m_Introducers; // introducers we are connected to
-			std::map<boost::asio::ip::udp::endpoint, std::shared_ptr<SSUSession> > m_Sessions, m_SessionsV6;
+			std::mutex m_RelaysMutex;
 			std::map<uint32_t, std::shared_ptr<SSUSession> > m_Relays; // we are introducer
+			std::mutex m_PeerTestsMutex;
 			std::map<uint32_t, PeerTest> m_PeerTests; // nonce -> creation time in milliseconds
+			std::mutex m_PathPacketSizesMutex;
+			std::map<boost::asio::ip::address, std::pair<int, uint32_t> > m_PathPacketSizes; // peer's address -> packet size, time in seconds
 			
 		public:
 			// for HTTP only
-			const decltype(m_Sessions)& GetSessions () const { return m_Sessions; };
-			const decltype(m_SessionsV6)& GetSessionsV6 () const { return m_SessionsV6; };
+			SSUSessions GetSessions () const;
+			SSUSessions GetSessionsV6 () const;
 	};
 }
 }
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <algorithm>
 #include <boost/bind.hpp>
 #include "Log.h"
 #include "Timestamp.h"
@@ -28,10 +29,18 @@ namespace transport
 	}
 
 	SSUData::SSUData (SSUSession& session):
-		m_Session (session), m_ResendTimer (session.GetService ()), 
-		m_IncompleteMessagesCleanupTimer (session.GetService ()), 
+		m_Session (session), m_SentMessages (SSU_SENT_MESSAGES_RING_SIZE),
+		m_SentMessagesHead (0), m_SentMessagesTail (0), m_NumSentMessages (0),
+		m_ResendTimer (session.GetService ()), 
+		m_IncompleteMessagesCleanupTimer (session.GetService ()), m_DelayedAckTimer (session.GetService ()),
+		m_ProbeTimer (session.GetService ()),
+		m_IsDelayedAckScheduled (false), m_NextResendTime (0),
+		m_SRTT (0), m_RTTVar (0), m_RTO (SSU_INITIAL_RTO), m_WindowSize (SSU_INITIAL_WINDOW_SIZE),
+		m_SlowStartThreshold (MAX_OUTGOING_WINDOW_SIZE), m_NumAckedInWindow (0), m_LastWindowDecreaseTime (0),
+		m_MinPacketSize (session.IsV6 () ? SSU_V6_MIN_PACKET_SIZE : SSU_V4_MIN_PACKET_SIZE),
 		m_MaxPacketSize (session.IsV6 () ? SSU_V6_MAX_PACKET_SIZE : SSU_V4_MAX_PACKET_SIZE), 
-		m_PacketSize (m_MaxPacketSize), m_LastMessageReceivedTime (0)
+		m_PacketSize (m_MaxPacketSize), m_ProbePacketSize (0), m_MaxProbePacketSize (m_MaxPacketSize),
+		m_NumLostProbes (0), m_NumFailedProbeSizes (0), m_LastMessageReceivedTime (0)
 	{
 	}
 
@@ -42,14 +51,37 @@ namespace transport
 	void SSUData::Start ()
 	{
 		ScheduleIncompleteMessagesCleanup ();
+		// start from size probed before or from base, then search up to peer's MTU
+		int packetSize = m_Session.m_Server.FindPathPacketSize (m_Session.m_RemoteEndpoint.address ());
+		m_PacketSize = packetSize ? std::max (packetSize, m_MinPacketSize) : m_MinPacketSize;
+		if (m_PacketSize > m_MaxPacketSize) m_PacketSize = m_MaxPacketSize;
+		m_ProbePacketSize = 0;
+		m_MaxProbePacketSize = packetSize ? m_PacketSize : m_MaxPacketSize;
+		m_NumLostProbes = 0; m_NumFailedProbeSizes = 0;
+		if (m_PacketSize < m_MaxPacketSize)
+		{
+			if (packetSize)
+				ScheduleProbe (boost::posix_time::seconds (SSU_PMTU_RAISE_INTERVAL));
+			else
+				ScheduleProbe (boost::posix_time::milliseconds (SSU_PMTU_FIRST_PROBE_DELAY));
+		}
 	}	
 		
 	void SSUData::Stop ()
 	{
 		m_ResendTimer.cancel ();
 		m_IncompleteMessagesCleanupTimer.cancel ();
+		m_DelayedAckTimer.cancel ();
+		m_ProbeTimer.cancel ();
+		m_ProbePacketSize = 0;
+		m_IsDelayedAckScheduled = false;
+		m_PendingMsgAcks.clear ();
+		m_PendingFragmentAcks.clear ();
+		m_NextResendTime = 0;
 		m_IncompleteMessages.clear ();
-		m_SentMessages.clear ();
+		for (auto& it: m_SentMessages)
+			if (it.isActive) ReleaseSentMessage (it);
+		m_SentMessagesHead = m_SentMessagesTail = 0;
 		m_ReceivedMessages.clear ();
 	}	
 		
@@ -59,23 +91,27 @@ namespace transport
 		auto ssuAddress = remoteRouter->GetSSUAddress ();
 		if (ssuAddress && ssuAddress->ssu->mtu)
 		{
+			int packetSize;
 			if (m_Session.IsV6 ())
-				m_PacketSize = ssuAddress->ssu->mtu - IPV6_HEADER_SIZE - UDP_HEADER_SIZE;
+				packetSize = ssuAddress->ssu->mtu - IPV6_HEADER_SIZE - UDP_HEADER_SIZE;
 			else
-				m_PacketSize = ssuAddress->ssu->mtu - IPV4_HEADER_SIZE - UDP_HEADER_SIZE;
-			if (m_PacketSize > 0)
+				packetSize = ssuAddress->ssu->mtu - IPV4_HEADER_SIZE - UDP_HEADER_SIZE;
+			if (packetSize > 0)
 			{
 				// make sure packet size multiple of 16
-				m_PacketSize >>= 4;
-				m_PacketSize <<= 4;
+				packetSize >>= 4;
+				packetSize <<= 4;
+				int maxPacketSize = m_Session.IsV6 () ? SSU_V6_MAX_PACKET_SIZE : SSU_V4_MAX_PACKET_SIZE;
+				if (packetSize > maxPacketSize) packetSize = maxPacketSize;
+				// path MTU search never goes beyond peer's MTU
+				m_MaxPacketSize = packetSize;
+				if (m_MinPacketSize > m_MaxPacketSize) m_MinPacketSize = m_MaxPacketSize;
 				if (m_PacketSize > m_MaxPacketSize) m_PacketSize = m_MaxPacketSize;
-				LogPrint (eLogDebug, "SSU: MTU=", ssuAddress->ssu->mtu, " packet size=", m_PacketSize);
+				if (m_MaxProbePacketSize > m_MaxPacketSize) m_MaxProbePacketSize = m_MaxPacketSize;
+				LogPrint (eLogDebug, "SSU: MTU=", ssuAddress->ssu->mtu, " max packet size=", m_MaxPacketSize);
 			}
 			else
-			{	
 				LogPrint (eLogWarning, "SSU: Unexpected MTU ", ssuAddress->ssu->mtu);
-				m_PacketSize = m_MaxPacketSize;
-			}	
 		}		
 	}
 
@@ -86,17 +122,162 @@ namespace transport
 			AdjustPacketSize (routerInfo);
 	}
 
+	SentMessage * SSUData::FindSentMessage (uint32_t msgID)
+	{
+		// window is small, linear scan is cheaper than maintaining an index
+		for (uint32_t i = m_SentMessagesHead; i != m_SentMessagesTail; i++)
+		{
+			auto& sentMessage = m_SentMessages[i & (SSU_SENT_MESSAGES_RING_SIZE - 1)];
+			if (sentMessage.isActive && sentMessage.msgID == msgID)
+				return &sentMessage;
+		}
+		return nullptr;
+	}
+
+	void SSUData::ReleaseSentMessage (SentMessage& sentMessage)
+	{
+		sentMessage.isActive = false;
+		sentMessage.fragments.clear ();
+		if (sentMessage.buf.capacity () > SSU_SENT_MESSAGE_MAX_KEPT_BUFFER_SIZE)
+			std::vector<uint8_t>().swap (sentMessage.buf);
+		m_NumSentMessages--;
+		while (m_SentMessagesHead != m_SentMessagesTail &&
+			!m_SentMessages[m_SentMessagesHead & (SSU_SENT_MESSAGES_RING_SIZE - 1)].isActive)
+			m_SentMessagesHead++;
+		if (!m_NumSentMessages && m_NextResendTime)
+		{
+			m_ResendTimer.cancel ();
+			m_NextResendTime = 0;
+		}
+	}
+
 	void SSUData::ProcessSentMessageAck (uint32_t msgID)
 	{
-		auto it = m_SentMessages.find (msgID);
-		if (it != m_SentMessages.end ())
+		auto sentMessage = FindSentMessage (msgID);
+		if (sentMessage)
 		{
-			m_SentMessages.erase (it);	
-			if (m_SentMessages.empty ())
-				m_ResendTimer.cancel ();
+			if (sentMessage->isProbe)
+			{
+				ProcessProbeAck (*sentMessage);
+				return;
+			}
+			if (!sentMessage->isRetransmitted && !sentMessage->numAckedFragments) // Karn's algorithm
+				UpdateRTT (i2p::util::GetMillisecondsSinceEpoch () - sentMessage->sendTime);
+			ReleaseSentMessage (*sentMessage);
+			IncreaseWindow ();
 		}
 	}		
 
+	void SSUData::ProcessSentFragmentsAck (SentMessage& sentMessage, const std::vector<int>& ackedFragments)
+	{
+		if (sentMessage.isProbe)
+		{
+			// one fragment only
+			if (std::find (ackedFragments.begin (), ackedFragments.end (), 0) != ackedFragments.end ())
+				ProcessProbeAck (sentMessage);
+			return;
+		}
+		if (!sentMessage.isRetransmitted && !sentMessage.numAckedFragments)
+			UpdateRTT (i2p::util::GetMillisecondsSinceEpoch () - sentMessage.sendTime);
+		int numFragments = sentMessage.fragments.size (), maxAcked = -1;
+		for (auto fragmentNum: ackedFragments)
+		{
+			if (fragmentNum >= numFragments) continue;
+			auto& fragment = sentMessage.fragments[fragmentNum];
+			if (!fragment.isAcked)
+			{
+				fragment.isAcked = true;
+				sentMessage.numAckedFragments++;
+			}
+			if (fragmentNum > maxAcked) maxAcked = fragmentNum;
+		}
+		if (sentMessage.numAckedFragments >= numFragments)
+		{
+			// all fragments acked
+			ReleaseSentMessage (sentMessage);
+			IncreaseWindow ();
+			return;
+		}
+		// fragments are sent in order, so unacked fragments before acked one are likely lost
+		bool isLost = false;
+		for (int i = 0; i < maxAcked; i++)
+		{
+			auto& fragment = sentMessage.fragments[i];
+			if (!fragment.isAcked && !fragment.isResent)
+			{
+				ResendFragment (sentMessage, fragment);
+				fragment.isResent = true;
+				isLost = true;
+			}
+		}
+		if (isLost)
+		{
+			LogPrint (eLogDebug, "SSU: Selective retransmit of message ", sentMessage.msgID);
+			DecreaseWindow (i2p::util::GetMillisecondsSinceEpoch ());
+		}
+	}
+
+	void SSUData::ResendFragment (SentMessage& sentMessage, SentFragment& fragment)
+	{
+		sentMessage.isRetransmitted = true;
+		try
+		{
+			m_Session.Send (sentMessage.buf.data () + fragment.offset, fragment.len);
+		}
+		catch (boost::system::system_error& ec)
+		{
+			LogPrint (eLogWarning, "SSU: Can't resend data fragment ", ec.what ());
+		}
+	}
+
+	void SSUData::UpdateRTT (int rtt)
+	{
+		if (rtt < 0) return;
+		// RFC 6298
+		if (!m_SRTT && !m_RTTVar)
+		{
+			m_SRTT = rtt;
+			m_RTTVar = rtt/2;
+		}
+		else
+		{
+			m_RTTVar = (3*m_RTTVar + std::abs (m_SRTT - rtt))/4;
+			m_SRTT = (7*m_SRTT + rtt)/8;
+		}
+		m_Session.SetRTT (m_SRTT ? m_SRTT : 1); // 0 means not measured
+		m_RTO = m_SRTT + 4*m_RTTVar;
+		if (m_RTO < SSU_MIN_RTO) m_RTO = SSU_MIN_RTO;
+		if (m_RTO > SSU_MAX_RTO) m_RTO = SSU_MAX_RTO;
+	}
+
+	void SSUData::IncreaseWindow ()
+	{
+		if (m_WindowSize < m_SlowStartThreshold)
+			m_WindowSize++; // slow start
+		else
+		{
+			// congestion avoidance, one message per window
+			m_NumAckedInWindow++;
+			if (m_NumAckedInWindow >= m_WindowSize)
+			{
+				m_WindowSize++;
+				m_NumAckedInWindow = 0;
+			}
+		}
+		if (m_WindowSize > MAX_OUTGOING_WINDOW_SIZE) m_WindowSize = MAX_OUTGOING_WINDOW_SIZE;
+	}
+
+	void SSUData::DecreaseWindow (uint64_t ts)
+	{
+		// once per round trip
+		if (ts < m_LastWindowDecreaseTime + (m_SRTT ? m_SRTT : m_RTO)) return;
+		m_SlowStartThreshold = m_WindowSize/2;
+		if (m_SlowStartThreshold < SSU_MIN_WINDOW_SIZE) m_SlowStartThreshold = SSU_MIN_WINDOW_SIZE;
+		m_WindowSize = m_SlowStartThreshold;
+		m_NumAckedInWindow = 0;
+		m_LastWindowDecreaseTime = ts;
+	}
+
 	void SSUData::ProcessAcks (uint8_t *& buf, uint8_t flag)
 	{
 		if (flag & DATA_FLAG_EXPLICIT_ACKS_INCLUDED)
@@ -113,38 +294,40 @@ namespace transport
 			// explicit ACK bitfields
 			uint8_t numBitfields =*buf;
 			buf++;
+			std::vector<int> ackedFragments;
 			for (int i = 0; i < numBitfields; i++)
 			{
 				uint32_t msgID = bufbe32toh (buf);
 				buf += 4; // msgID
-				auto it = m_SentMessages.find (msgID);		
+				auto sentMessage = FindSentMessage (msgID);		
 				// process individual Ack bitfields
 				bool isNonLast = false;
 				int fragment = 0;
+				ackedFragments.clear ();
 				do
 				{
 					uint8_t bitfield = *buf;
 					isNonLast = bitfield & 0x80;
 					bitfield &= 0x7F; // clear MSB
-					if (bitfield && it != m_SentMessages.end ())
+					if (bitfield && sentMessage)
 					{	
-						int numSentFragments = it->second->fragments.size ();		
 						// process bits
 						uint8_t mask = 0x01;
 						for (int j = 0; j < 7; j++)
 						{			
 							if (bitfield & mask)
-							{
-								if (fragment < numSentFragments)
-									it->second->fragments[fragment].reset (nullptr);
-							}				
+								ackedFragments.push_back (fragment);
 							fragment++;
 							mask <<= 1;
 						}
 					}	
+					else
+						fragment += 7;
 					buf++;
 				}
 				while (isNonLast); 
+				if (sentMessage && !ackedFragments.empty ())
+					ProcessSentFragmentsAck (*sentMessage, ackedFragments);
 			}	
 		}		
 	}
@@ -231,7 +414,7 @@ namespace transport
 				incompleteMessage->msg = nullptr;
 				m_IncompleteMessages.erase (msgID);				
 				// process message
-				SendMsgAck (msgID);
+				AddMsgAck (msgID);
 				msg->FromSSU (msgID);
 				if (m_Session.GetState () == eSessionStateEstablished)
 				{
@@ -265,7 +448,7 @@ namespace transport
 				}	
 			}	
 			else
-				SendFragmentAck (msgID, fragmentNum);			
+				AddFragmentAck (msgID);			
 			buf += fragmentSize;
 		}	
 	}
@@ -273,6 +456,12 @@ namespace transport
 	void SSUData::FlushReceivedMessage ()
 	{
 		m_Handler.Flush ();
+		// acks of whole batch go with next outgoing data or in one packet after short delay
+		if (m_PendingMsgAcks.size () + m_PendingFragmentAcks.size () > 
+			(m_PacketSize - sizeof (SSUHeader))/8) // doesn't fit to one packet anyway
+			SendAcks ();
+		else if (!m_PendingMsgAcks.empty () || !m_PendingFragmentAcks.empty ())
+			ScheduleDelayedAck ();
 	}	
 		
 	void SSUData::ProcessMessage (uint8_t * buf, size_t len)
@@ -283,7 +472,10 @@ namespace transport
 		LogPrint (eLogDebug, "SSU: Process data, flags=", (int)flag, ", len=", len);
 		// process acks if presented
 		if (flag & (DATA_FLAG_ACK_BITFIELDS_INCLUDED | DATA_FLAG_EXPLICIT_ACKS_INCLUDED))
+		{	
 			ProcessAcks (buf, flag);
+			m_Session.SendQueuedMessages (); // window might be open now
+		}
 		// extended data if presented
 		if (flag & DATA_FLAG_EXTENDED_DATA_INCLUDED)
 		{
@@ -299,41 +491,62 @@ namespace transport
 	void SSUData::Send (std::shared_ptr<i2p::I2NPMessage> msg)
 	{
 		uint32_t msgID = msg->ToSSU ();
-		if (m_SentMessages.count (msgID) > 0)
+		if (FindSentMessage (msgID))
 		{
 			LogPrint (eLogWarning, "SSU: message ", msgID, " already sent");
 			return;
 		}	
-		if (m_SentMessages.empty ()) // schedule resend at first message only
-			ScheduleResend ();
-		
-		auto ret = m_SentMessages.insert (std::make_pair (msgID, std::unique_ptr<SentMessage>(new SentMessage))); 
-		std::unique_ptr<SentMessage>& sentMessage = ret.first->second;
-		if (ret.second)	
+		if (m_SentMessagesTail - m_SentMessagesHead >= SSU_SENT_MESSAGES_RING_SIZE)
 		{
-			sentMessage->nextResendTime = i2p::util::GetSecondsSinceEpoch () + RESEND_INTERVAL;
-			sentMessage->numResends = 0;
-		}	
-		auto& fragments = sentMessage->fragments;
+			LogPrint (eLogWarning, "SSU: too many messages in flight, message ", msgID, " dropped");
+			return;
+		}
+		auto& sentMessage = m_SentMessages[m_SentMessagesTail & (SSU_SENT_MESSAGES_RING_SIZE - 1)];
+		m_SentMessagesTail++; m_NumSentMessages++;
+		auto ts = i2p::util::GetMillisecondsSinceEpoch ();
+		sentMessage.msgID = msgID;
+		sentMessage.isActive = true;
+		sentMessage.isRetransmitted = false;
+		sentMessage.isProbe = false;
+		sentMessage.sendTime = ts;
+		sentMessage.nextResendTime = ts + m_RTO;
+		sentMessage.numResends = 0;
+		sentMessage.numAckedFragments = 0;
+
+		auto& fragments = sentMessage.fragments;
 		size_t payloadSize = m_PacketSize - sizeof (SSUHeader) - 9; // 9  =  flag + #frg(1) + messageID(4) + frag info (3) 
 		size_t len = msg->GetLength ();
 		uint8_t * msgBuf = msg->GetSSUHeader ();
+		// pending acks go to the first fragment
+		uint8_t acks[SSU_MAX_PIGGYBACKED_ACKS_SIZE], acksFlag = 0;
+		size_t acksLen = 0;
+		if (!m_PendingMsgAcks.empty () || !m_PendingFragmentAcks.empty ())
+			acksLen = FillAcks (acks, std::min (SSU_MAX_PIGGYBACKED_ACKS_SIZE, payloadSize/2), acksFlag);
+		// each fragment is at most m_PacketSize, 18 more bytes are used by encryption of the last one
+		sentMessage.buf.resize ((len + acksLen + payloadSize - 1)/payloadSize*m_PacketSize + 18);
 
 		uint32_t fragmentNum = 0;
+		size_t offset = 0;
 		while (len > 0)
 		{	
-			Fragment * fragment = new Fragment;
-			fragment->fragmentNum = fragmentNum;
-			uint8_t * buf = fragment->buf;
+			uint8_t * buf = sentMessage.buf.data () + offset;
 			uint8_t	* payload = buf + sizeof (SSUHeader);
 			*payload = DATA_FLAG_WANT_REPLY; // for compatibility
 			payload++;
+			size_t fragmentPayloadSize = payloadSize;
+			if (!fragmentNum && acksLen)
+			{
+				buf[sizeof (SSUHeader)] |= acksFlag;
+				memcpy (payload, acks, acksLen);
+				payload += acksLen;
+				fragmentPayloadSize -= acksLen;
+			}
 			*payload = 1; // always 1 message fragment per message
 			payload++;
 			htobe32buf (payload, msgID);
 			payload += 4;
-			bool isLast = (len <= payloadSize);
-			size_t size = isLast ? len : payloadSize;
+			bool isLast = (len <= fragmentPayloadSize);
+			size_t size = isLast ? len : fragmentPayloadSize;
 			uint32_t fragmentInfo = (fragmentNum << 17);
 			if (isLast)
 				fragmentInfo |= 0x010000;
@@ -347,8 +560,8 @@ namespace transport
 			size += payload - buf;
 			if (size & 0x0F) // make sure 16 bytes boundary
 				size = ((size >> 4) + 1) << 4; // (/16 + 1)*16
-			fragment->len = size; 
-			fragments.push_back (std::unique_ptr<Fragment> (fragment));
+			fragments.push_back ({ (uint16_t)offset, (uint16_t)size, false, false });
+			offset += size;
 			
 			// encrypt message with session key
 			m_Session.FillHeaderAndEncrypt (PAYLOAD_TYPE_DATA, buf, size);
@@ -362,65 +575,281 @@ namespace transport
 			}	
 			if (!isLast)
 			{	
-				len -= payloadSize;
-				msgBuf += payloadSize;
+				len -= fragmentPayloadSize;
+				msgBuf += fragmentPayloadSize;
 			}	
 			else
 				len = 0;
 			fragmentNum++;
 		}	
+		ScheduleResend (sentMessage.nextResendTime);
 	}		
 
-	void SSUData::SendMsgAck (uint32_t msgID)
+	void SSUData::AddMsgAck (uint32_t msgID)
 	{
-		uint8_t buf[48 + 18] = {0}; // actual length is 44 = 37 + 7 but pad it to multiple of 16
-		uint8_t * payload = buf + sizeof (SSUHeader);
-		*payload = DATA_FLAG_EXPLICIT_ACKS_INCLUDED; // flag
-		payload++;
-		*payload = 1; // number of ACKs
-		payload++;
-		htobe32buf (payload, msgID); // msgID
-		payload += 4;
-		*payload = 0; // number of fragments
+		if (std::find (m_PendingMsgAcks.begin (), m_PendingMsgAcks.end (), msgID) == m_PendingMsgAcks.end ())
+			m_PendingMsgAcks.push_back (msgID);
+		// message is complete, fragments ack is not needed anymore
+		auto it = std::find (m_PendingFragmentAcks.begin (), m_PendingFragmentAcks.end (), msgID);
+		if (it != m_PendingFragmentAcks.end ()) m_PendingFragmentAcks.erase (it);
+	}
+
+	void SSUData::AddFragmentAck (uint32_t msgID)
+	{
+		// bitfield is built from received fragments at the time of sending
+		if (std::find (m_PendingFragmentAcks.begin (), m_PendingFragmentAcks.end (), msgID) == m_PendingFragmentAcks.end ())
+			m_PendingFragmentAcks.push_back (msgID);
+	}
+
+	size_t SSUData::FillAcks (uint8_t * buf, size_t maxLen, uint8_t& flag)
+	{
+		uint8_t * start = buf, * end = buf + maxLen;
+		if (!m_PendingMsgAcks.empty () && maxLen >= 5)
+		{
+			// explicit ACKs
+			size_t numAcks = std::min (m_PendingMsgAcks.size (), (maxLen - 1)/4);
+			if (numAcks > 255) numAcks = 255;
+			*buf = numAcks;
+			buf++;
+			for (size_t i = 0; i < numAcks; i++)
+			{
+				htobe32buf (buf, m_PendingMsgAcks[i]);
+				buf += 4;
+			}
+			m_PendingMsgAcks.erase (m_PendingMsgAcks.begin (), m_PendingMsgAcks.begin () + numAcks);
+			flag |= DATA_FLAG_EXPLICIT_ACKS_INCLUDED;
+		}
+		if (!m_PendingFragmentAcks.empty () && end - buf >= 6)
+		{
+			// ACK bitfields
+			uint8_t * numBitfields = buf;
+			*numBitfields = 0;
+			buf++;
+			auto it = m_PendingFragmentAcks.begin ();
+			for (; it != m_PendingFragmentAcks.end () && *numBitfields < 255; ++it)
+			{
+				auto it1 = m_IncompleteMessages.find (*it);
+				if (it1 == m_IncompleteMessages.end ()) continue; // completed or deleted
+				auto& incompleteMessage = it1->second;
+				int maxFragmentNum = incompleteMessage->nextFragmentNum - 1;
+				if (!incompleteMessage->savedFragments.empty ())
+					maxFragmentNum = std::max (maxFragmentNum, (*incompleteMessage->savedFragments.rbegin ())->fragmentNum);
+				if (maxFragmentNum < 0) continue;
+				int numBytes = maxFragmentNum/7 + 1;
+				if (end - buf < 4 + numBytes) break;
+				htobe32buf (buf, *it);
+				buf += 4;
+				memset (buf, 0, numBytes);
+				for (int i = 0; i < incompleteMessage->nextFragmentNum; i++)
+					buf[i/7] |= 0x01 << (i%7);
+				for (const auto& f: incompleteMessage->savedFragments)
+					if (f->fragmentNum < SSU_MAX_NUM_FRAGMENTS)
+						buf[f->fragmentNum/7] |= 0x01 << (f->fragmentNum%7);
+				for (int i = 0; i < numBytes - 1; i++)
+					buf[i] |= 0x80; // non-last
+				buf += numBytes;
+				(*numBitfields)++;
+			}
+			m_PendingFragmentAcks.erase (m_PendingFragmentAcks.begin (), it);
+			if (*numBitfields)
+				flag |= DATA_FLAG_ACK_BITFIELDS_INCLUDED;
+			else
+				buf--;
+		}
+		return buf - start;
+	}
+
+	void SSUData::SendAcks ()
+	{
+		while (!m_PendingMsgAcks.empty () || !m_PendingFragmentAcks.empty ())
+		{
+			uint8_t buf[SSU_V4_MAX_PACKET_SIZE + 18] = {0};
+			uint8_t * payload = buf + sizeof (SSUHeader);
+			uint8_t flag = 0;
+			// flag + acks + number of fragments
+			size_t len = FillAcks (payload + 1, m_PacketSize - sizeof (SSUHeader) - 2, flag);
+			if (!flag) break; // nothing to send
+			*payload = flag;
+			payload[len + 1] = 0; // number of fragments
+			len += sizeof (SSUHeader) + 2;
+			if (len & 0x0F) // make sure 16 bytes boundary
+				len = ((len >> 4) + 1) << 4;
+			// encrypt message with session key
+			m_Session.FillHeaderAndEncrypt (PAYLOAD_TYPE_DATA, buf, len);
+			try
+			{
+				m_Session.Send (buf, len);
+			}
+			catch (boost::system::system_error& ec)
+			{
+				LogPrint (eLogWarning, "SSU: Can't send acks ", ec.what ());
+			}
+		}
+	}
 
-		// encrypt message with session key
-		m_Session.FillHeaderAndEncrypt (PAYLOAD_TYPE_DATA, buf, 48);
-		m_Session.Send (buf, 48);
+	void SSUData::ScheduleDelayedAck ()
+	{
+		if (m_IsDelayedAckScheduled) return;
+		m_IsDelayedAckScheduled = true;
+		m_DelayedAckTimer.expires_from_now (boost::posix_time::milliseconds(SSU_DELAYED_ACK_INTERVAL));
+		auto s = m_Session.shared_from_this();
+		m_DelayedAckTimer.async_wait ([s](const boost::system::error_code& ecode)
+			{ s->m_Data.HandleDelayedAckTimer (ecode); });
 	}
 
-	void SSUData::SendFragmentAck (uint32_t msgID, int fragmentNum)
+	void SSUData::HandleDelayedAckTimer (const boost::system::error_code& ecode)
 	{
-		if (fragmentNum > 64)
+		if (ecode != boost::asio::error::operation_aborted)
 		{
-			LogPrint (eLogWarning, "SSU: Fragment number ", fragmentNum, " exceeds 64");
+			m_IsDelayedAckScheduled = false;
+			SendAcks (); // whatever has not been sent with data
+		}
+	}
+
+	int SSUData::GetNextProbePacketSize () const
+	{
+		if (m_MaxProbePacketSize < m_PacketSize + 16) return 0; // nothing in between
+		if (!m_NumFailedProbeSizes) return m_MaxProbePacketSize; // most paths take full size
+		// binary search, packet sizes are multiple of 16
+		int packetSize = ((m_PacketSize + m_MaxProbePacketSize)/2 + 15) & ~0x0F;
+		return std::min (packetSize, m_MaxProbePacketSize);
+	}
+
+	void SSUData::SendProbe ()
+	{
+		if (m_ProbePacketSize) return; // in flight
+		int packetSize = GetNextProbePacketSize ();
+		if (!packetSize)
+		{
+			LogPrint (eLogDebug, "SSU: packet size for ", m_Session.m_RemoteEndpoint, " is ", m_PacketSize);
+			if (m_PacketSize < m_MaxPacketSize) // path might change
+				ScheduleProbe (boost::posix_time::seconds (SSU_PMTU_RAISE_INTERVAL));
+			return;
+		}
+		if (m_SentMessagesTail - m_SentMessagesHead >= SSU_SENT_MESSAGES_RING_SIZE)
+		{
+			ScheduleProbe (boost::posix_time::milliseconds (m_RTO));
 			return;
 		}
-		uint8_t buf[64 + 18] = {0};
+		// padded DeliveryStatus, ignored by peer but acked
+		auto msg = CreateDeliveryStatusMsg (0);
+		uint32_t msgID = msg->ToSSU ();
+		auto& probe = m_SentMessages[m_SentMessagesTail & (SSU_SENT_MESSAGES_RING_SIZE - 1)];
+		m_SentMessagesTail++; m_NumSentMessages++;
+		auto ts = i2p::util::GetMillisecondsSinceEpoch ();
+		probe.msgID = msgID;
+		probe.isActive = true;
+		probe.isRetransmitted = false;
+		probe.isProbe = true;
+		probe.sendTime = ts;
+		probe.nextResendTime = ts + m_RTO;
+		probe.numResends = 0;
+		probe.numAckedFragments = 0;
+		probe.buf.assign (packetSize + 18, 0); // zeroes are padding
+		uint8_t * buf = probe.buf.data ();
 		uint8_t * payload = buf + sizeof (SSUHeader);
-		*payload = DATA_FLAG_ACK_BITFIELDS_INCLUDED; // flag
-		payload++;	
-		*payload = 1; // number of ACK bitfields
+		*payload = DATA_FLAG_WANT_REPLY; // for compatibility
 		payload++;
-		// one ack
-		*(uint32_t *)(payload) = htobe32 (msgID); // msgID	
-		payload += 4;
-		div_t d = div (fragmentNum, 7);
-		memset (payload, 0x80, d.quot); // 0x80 means non-last
-		payload += d.quot;		
-		*payload = 0x01 << d.rem; // set corresponding bit
+		*payload = 1; // 1 fragment
 		payload++;
-		*payload = 0; // number of fragments
+		htobe32buf (payload, msgID);
+		payload += 4;
+		size_t len = msg->GetLength ();
+		uint32_t fragmentInfo = htobe32 (0x010000 | len); // first and last
+		memcpy (payload, (uint8_t *)(&fragmentInfo) + 1, 3);
+		payload += 3;
+		memcpy (payload, msg->GetSSUHeader (), len);
+		probe.fragments.push_back ({ 0, (uint16_t)packetSize, false, false });
+		m_Session.FillHeaderAndEncrypt (PAYLOAD_TYPE_DATA, buf, packetSize);
+		try
+		{
+			m_Session.Send (buf, packetSize);
+		}
+		catch (boost::system::system_error& ec)
+		{
+			LogPrint (eLogWarning, "SSU: Can't send probe ", ec.what ());
+		}
+		m_ProbePacketSize = packetSize;
+		ScheduleResend (probe.nextResendTime);
+	}
 
-		size_t len = d.quot < 4 ? 48 : 64; // 48 = 37 + 7 + 4 (3+1)			
-		// encrypt message with session key
-		m_Session.FillHeaderAndEncrypt (PAYLOAD_TYPE_DATA, buf, len);
-		m_Session.Send (buf, len);
-	}	
+	void SSUData::ProcessProbeAck (SentMessage& probe)
+	{
+		int packetSize = probe.fragments[0].len;
+		UpdateRTT (i2p::util::GetMillisecondsSinceEpoch () - probe.sendTime);
+		ReleaseSentMessage (probe);
+		m_ProbePacketSize = 0;
+		m_NumLostProbes = 0;
+		if (packetSize > m_PacketSize)
+		{
+			LogPrint (eLogDebug, "SSU: packet size for ", m_Session.m_RemoteEndpoint, " raised to ", packetSize);
+			m_PacketSize = packetSize;
+			m_Session.m_Server.UpdatePathPacketSize (m_Session.m_RemoteEndpoint.address (), m_PacketSize);
+		}
+		SendProbe (); // next step
+	}
+
+	void SSUData::ProcessLostProbe (SentMessage& probe)
+	{
+		int packetSize = probe.fragments[0].len;
+		ReleaseSentMessage (probe);
+		m_ProbePacketSize = 0;
+		m_NumLostProbes++;
+		if (m_NumLostProbes >= SSU_PMTU_MAX_NUM_PROBES)
+		{
+			// doesn't pass, search below
+			LogPrint (eLogDebug, "SSU: packet size ", packetSize, " doesn't pass to ", m_Session.m_RemoteEndpoint);
+			m_MaxProbePacketSize = packetSize - 16;
+			m_NumFailedProbeSizes++;
+			m_NumLostProbes = 0;
+		}
+		if (GetNextProbePacketSize ())
+			ScheduleProbe (boost::posix_time::milliseconds (0)); // out of resend timer's loop
+		else
+			SendProbe (); // search is done
+	}
+
+	void SSUData::FallBackPacketSize ()
+	{
+		LogPrint (eLogInfo, "SSU: messages to ", m_Session.m_RemoteEndpoint, " are lost, packet size falls back from ", m_PacketSize, " to ", m_MinPacketSize);
+		m_MaxProbePacketSize = m_PacketSize - 16;
+		m_NumFailedProbeSizes = 1; // binary search from base
+		m_PacketSize = m_MinPacketSize;
+		m_Session.m_Server.UpdatePathPacketSize (m_Session.m_RemoteEndpoint.address (), 0);
+		if (!m_ProbePacketSize)
+			ScheduleProbe (boost::posix_time::milliseconds (m_RTO));
+	}
+
+	void SSUData::ScheduleProbe (const boost::posix_time::time_duration& delay)
+	{
+		m_ProbeTimer.cancel ();
+		m_ProbeTimer.expires_from_now (delay);
+		auto s = m_Session.shared_from_this();
+		m_ProbeTimer.async_wait ([s](const boost::system::error_code& ecode)
+			{ s->m_Data.HandleProbeTimer (ecode); });
+	}
 
-	void SSUData::ScheduleResend()
+	void SSUData::HandleProbeTimer (const boost::system::error_code& ecode)
+	{
+		if (ecode != boost::asio::error::operation_aborted)
+		{
+			if (!GetNextProbePacketSize ())
+			{
+				// search again up to peer's MTU
+				m_MaxProbePacketSize = m_MaxPacketSize;
+				m_NumFailedProbeSizes = 0;
+			}
+			SendProbe ();
+		}
+	}
+
+	void SSUData::ScheduleResend (uint64_t resendTime)
 	{		
+		if (m_NextResendTime && m_NextResendTime <= resendTime) return; // already scheduled earlier
+		m_NextResendTime = resendTime;
+		auto ts = i2p::util::GetMillisecondsSinceEpoch ();
 		m_ResendTimer.cancel ();
-		m_ResendTimer.expires_from_now (boost::posix_time::seconds(RESEND_INTERVAL));
+		m_ResendTimer.expires_from_now (boost::posix_time::milliseconds(resendTime > ts ? resendTime - ts : 0));
 		auto s = m_Session.shared_from_this();
 		m_ResendTimer.async_wait ([s](const boost::system::error_code& ecode)
 			{ s->m_Data.HandleResendTimer (ecode); });
@@ -430,49 +859,62 @@ namespace transport
 	{
 		if (ecode != boost::asio::error::operation_aborted)
 		{
-			uint32_t ts = i2p::util::GetSecondsSinceEpoch ();
-			int numResent = 0;
-			for (auto it = m_SentMessages.begin (); it != m_SentMessages.end ();)
+			m_NextResendTime = 0;
+			auto ts = i2p::util::GetMillisecondsSinceEpoch ();
+			int numResent = 0, numDeleted = 0;
+			bool isTimeout = false;
+			uint64_t nextResendTime = 0;
+			for (uint32_t i = m_SentMessagesHead; i != m_SentMessagesTail; i++)
 			{
-				if (ts >= it->second->nextResendTime)
+				auto& sentMessage = m_SentMessages[i & (SSU_SENT_MESSAGES_RING_SIZE - 1)];
+				if (!sentMessage.isActive) continue;
+				if (ts >= sentMessage.nextResendTime)
 				{	
-					if (it->second->numResends < MAX_NUM_RESENDS)
+					if (sentMessage.isProbe)
+					{
+						ProcessLostProbe (sentMessage); // too big, not congestion
+						continue;
+					}
+					if (sentMessage.numResends < MAX_NUM_RESENDS)
 					{
-						for (auto& f: it->second->fragments)
-							if (f)
+						if (!isTimeout)
+						{
+							// back off once per timeout
+							isTimeout = true;
+							m_RTO *= 2;
+							if (m_RTO > SSU_MAX_RTO) m_RTO = SSU_MAX_RTO;
+							DecreaseWindow (ts);
+						}
+						for (auto& f: sentMessage.fragments)
+						{
+							if (!f.isAcked)
 							{
-								try
-								{
-									m_Session.Send (f->buf, f->len); // resend
-									numResent++;
-								}
-								catch (boost::system::system_error& ec)
-								{
-									LogPrint (eLogWarning, "SSU: Can't resend data fragment ", ec.what ());
-								}
+								ResendFragment (sentMessage, f);
+								numResent++;
 							}
-
-						it->second->numResends++;
-						it->second->nextResendTime += it->second->numResends*RESEND_INTERVAL;
-						++it;
+							f.isResent = false;
+						}
+						sentMessage.numResends++;
+						sentMessage.nextResendTime = ts + m_RTO;
+						if (sentMessage.numResends == SSU_PMTU_BLACK_HOLE_NUM_RESENDS && m_PacketSize > m_MinPacketSize &&
+							std::any_of (sentMessage.fragments.begin (), sentMessage.fragments.end (),
+								[this](const SentFragment& f) { return !f.isAcked && f.len > m_MinPacketSize; }))
+							FallBackPacketSize ();
 					}	
 					else
 					{
 						LogPrint (eLogInfo, "SSU: message has not been ACKed after ", MAX_NUM_RESENDS, " attempts, deleted");
-						it = m_SentMessages.erase (it);
+						ReleaseSentMessage (sentMessage);
+						numDeleted++;
+						continue;
 					}	
 				}	
-				else
-					++it;
+				if (!nextResendTime || sentMessage.nextResendTime < nextResendTime)
+					nextResendTime = sentMessage.nextResendTime;
 			}
-			if (m_SentMessages.empty ()) return; // nothing to resend
-			if (numResent < MAX_OUTGOING_WINDOW_SIZE)
-				ScheduleResend ();
-			else
-			{
-				LogPrint (eLogError, "SSU: resend window exceeds max size. Session terminated");
-				m_Session.Close ();
-			}	
+			if (numResent) LogPrint (eLogDebug, "SSU: ", numResent, " fragments resent, RTO=", m_RTO);
+			if (numDeleted) m_Session.SendQueuedMessages ();
+			if (nextResendTime) ScheduleResend (nextResendTime);
 		}	
 	}	
 
@@ -28,12 +28,27 @@ namespace transport
 	const size_t UDP_HEADER_SIZE = 8;
 	const size_t SSU_V4_MAX_PACKET_SIZE = SSU_MTU_V4 - IPV4_HEADER_SIZE - UDP_HEADER_SIZE; // 1456
 	const size_t SSU_V6_MAX_PACKET_SIZE = SSU_MTU_V6 - IPV6_HEADER_SIZE - UDP_HEADER_SIZE; // 1440
-	const int RESEND_INTERVAL = 3; // in seconds
+	const size_t SSU_V4_MIN_PACKET_SIZE = 620 - IPV4_HEADER_SIZE - UDP_HEADER_SIZE; // 592, base of path MTU search
+	const size_t SSU_V6_MIN_PACKET_SIZE = 1280 - IPV6_HEADER_SIZE - UDP_HEADER_SIZE; // 1232, IPv6 minimum MTU
+	const int SSU_INITIAL_RTO = 1000; // in milliseconds
+	const int SSU_MIN_RTO = 100; // in milliseconds
+	const int SSU_MAX_RTO = 3000; // in milliseconds
 	const int MAX_NUM_RESENDS = 5;
 	const int DECAY_INTERVAL = 20; // in seconds
 	const int INCOMPLETE_MESSAGES_CLEANUP_TIMEOUT = 30; // in seconds
 	const unsigned int MAX_NUM_RECEIVED_MESSAGES = 1000; // how many msgID we store for duplicates check
 	const int MAX_OUTGOING_WINDOW_SIZE = 200; // how many unacked message we can store
+	const int SSU_INITIAL_WINDOW_SIZE = 8; // in messages
+	const int SSU_MIN_WINDOW_SIZE = 2; // in messages
+	const uint32_t SSU_SENT_MESSAGES_RING_SIZE = 256; // power of 2, not less than MAX_OUTGOING_WINDOW_SIZE
+	const size_t SSU_SENT_MESSAGE_MAX_KEPT_BUFFER_SIZE = 4*SSU_V4_MAX_PACKET_SIZE; // release bigger buffers after ack
+	const int SSU_DELAYED_ACK_INTERVAL = 5; // in milliseconds
+	const size_t SSU_MAX_PIGGYBACKED_ACKS_SIZE = 256; // in bytes, attached to outgoing data
+	const int SSU_MAX_NUM_FRAGMENTS = 128; // fragment number is 7 bits
+	const int SSU_PMTU_FIRST_PROBE_DELAY = 100; // in milliseconds, after session is established
+	const int SSU_PMTU_MAX_NUM_PROBES = 2; // lost probes of the same size before search goes down
+	const int SSU_PMTU_RAISE_INTERVAL = 600; // in seconds, search for bigger size again
+	const int SSU_PMTU_BLACK_HOLE_NUM_RESENDS = 2; // falls back to base packet size
 	// data flags
 	const uint8_t DATA_FLAG_EXTENDED_DATA_INCLUDED = 0x02;
 	const uint8_t DATA_FLAG_WANT_REPLY = 0x04;
@@ -73,12 +88,24 @@ namespace transport
 		void AttachNextFragment (const uint8_t * fragment, size_t fragmentSize);	
 	};
 
+	struct SentFragment
+	{
+		uint16_t offset, len; // in SentMessage::buf
+		bool isAcked, isResent; // isResent is set by selective retransmit until next timeout
+	};
+
 	struct SentMessage
 	{
-		std::vector<std::unique_ptr<Fragment> > fragments;
-		uint32_t nextResendTime; // in seconds
-		int numResends;
-	};	
+		uint32_t msgID;
+		bool isActive, isRetransmitted, isProbe; // probe is never resent
+		std::vector<SentFragment> fragments;
+		std::vector<uint8_t> buf; // encrypted fragments back to back
+		uint64_t sendTime, nextResendTime; // in milliseconds
+		int numResends, numAckedFragments;
+
+		SentMessage (): msgID (0), isActive (false), isRetransmitted (false), isProbe (false),
+			sendTime (0), nextResendTime (0), numResends (0), numAckedFragments (0) {};
+	};
 	
 	class SSUSession;
 	class SSUData
@@ -94,19 +121,53 @@ namespace transport
 			void ProcessMessage (uint8_t * buf, size_t len);
 			void FlushReceivedMessage ();
 			void Send (std::shared_ptr<i2p::I2NPMessage> msg);
+			size_t GetNumSentMessages () const { return m_NumSentMessages; }; // not acked yet
+			bool IsWindowFull () const
+			{
+				return m_NumSentMessages >= (size_t)m_WindowSize ||
+					m_SentMessagesTail - m_SentMessagesHead >= SSU_SENT_MESSAGES_RING_SIZE;
+			};
+			int GetRTO () const { return m_RTO; }; // in milliseconds
+			int GetPacketSize () const { return m_PacketSize; };
 
 			void AdjustPacketSize (std::shared_ptr<const i2p::data::RouterInfo> remoteRouter);	
 			void UpdatePacketSize (const i2p::data::IdentHash& remoteIdent);
 
 		private:
 
-			void SendMsgAck (uint32_t msgID);
-			void SendFragmentAck (uint32_t msgID, int fragmentNum);
+			// acks
+			void AddMsgAck (uint32_t msgID);
+			void AddFragmentAck (uint32_t msgID);
+			size_t FillAcks (uint8_t * buf, size_t maxLen, uint8_t& flag); // returns filled length
+			void SendAcks ();
+			void ScheduleDelayedAck ();
+			void HandleDelayedAckTimer (const boost::system::error_code& ecode);
+
 			void ProcessAcks (uint8_t *& buf, uint8_t flag);
 			void ProcessFragments (uint8_t * buf);
 			void ProcessSentMessageAck (uint32_t msgID);	
-
-			void ScheduleResend ();
+			void ProcessSentFragmentsAck (SentMessage& sentMessage, const std::vector<int>& ackedFragments);
+
+			// in-flight messages ring
+			SentMessage * FindSentMessage (uint32_t msgID);
+			void ReleaseSentMessage (SentMessage& sentMessage);
+			void ResendFragment (SentMessage& sentMessage, SentFragment& fragment);
+
+			// RTT and congestion window
+			void UpdateRTT (int rtt);
+			void IncreaseWindow ();
+			void DecreaseWindow (uint64_t ts);
+
+			// path MTU
+			int GetNextProbePacketSize () const; // 0 if search is done
+			void SendProbe ();
+			void ProcessProbeAck (SentMessage& probe);
+			void ProcessLostProbe (SentMessage& probe);
+			void FallBackPacketSize (); // black hole detected
+			void ScheduleProbe (const boost::posix_time::time_duration& delay);
+			void HandleProbeTimer (const boost::system::error_code& ecode);
+
+			void ScheduleResend (uint64_t resendTime);
 			void HandleResendTimer (const boost::system::error_code& ecode);	
 
 			void ScheduleIncompleteMessagesCleanup ();
@@ -117,10 +178,20 @@ namespace transport
 
 			SSUSession& m_Session;
 			std::map<uint32_t, std::unique_ptr<IncompleteMessage> > m_IncompleteMessages;
-			std::map<uint32_t, std::unique_ptr<SentMessage> > m_SentMessages;
+			std::vector<SentMessage> m_SentMessages; // ring of SSU_SENT_MESSAGES_RING_SIZE
+			uint32_t m_SentMessagesHead, m_SentMessagesTail; // sequence numbers, head is oldest
+			size_t m_NumSentMessages;
 			std::unordered_set<uint32_t> m_ReceivedMessages;
-			boost::asio::deadline_timer m_ResendTimer, m_IncompleteMessagesCleanupTimer;
-			int m_MaxPacketSize, m_PacketSize;
+			std::vector<uint32_t> m_PendingMsgAcks, m_PendingFragmentAcks; // not sent yet
+			boost::asio::deadline_timer m_ResendTimer, m_IncompleteMessagesCleanupTimer, m_DelayedAckTimer, m_ProbeTimer;
+			bool m_IsDelayedAckScheduled;
+			uint64_t m_NextResendTime; // in milliseconds, 0 if resend timer is not set
+			int m_SRTT, m_RTTVar, m_RTO; // in milliseconds
+			int m_WindowSize, m_SlowStartThreshold, m_NumAckedInWindow;
+			uint64_t m_LastWindowDecreaseTime; // in milliseconds
+			int m_MinPacketSize, m_MaxPacketSize, m_PacketSize; // current size is confirmed by probe or base
+			int m_ProbePacketSize, m_MaxProbePacketSize; // of probe in flight and upper bound of search
+			int m_NumLostProbes, m_NumFailedProbeSizes; // at current probe size and in current search
 			i2p::I2NPMessagesHandler m_Handler;
 			uint32_t m_LastMessageReceivedTime; // in second
 	};	
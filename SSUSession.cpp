@@ -41,7 +41,7 @@ namespace transport
 
 	boost::asio::io_service& SSUSession::GetService () 
 	{ 
-		return IsV6 () ? m_Server.GetServiceV6 () : m_Server.GetService (); 
+		return m_Server.GetSessionService (m_RemoteEndpoint); 
 	}
 	
 	void SSUSession::CreateAESandMacKey (const uint8_t * pubKey)
@@ -83,7 +83,8 @@ namespace transport
 		m_SessionKeyDecryption.SetKey (m_SessionKey);
 	}		
 
-	void SSUSession::ProcessNextMessage (uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& senderEndpoint)
+	void SSUSession::ProcessNextMessage (uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& senderEndpoint,
+		bool isMACVerified)
 	{
 		m_NumReceivedBytes += len;
 		i2p::transport::transports.UpdateReceivedBytes (len);
@@ -100,9 +101,18 @@ namespace transport
 			if (m_State == eSessionStateEstablished)
 				m_LastActivityTimestamp = i2p::util::GetSecondsSinceEpoch ();	
 			
-			if (m_IsSessionKey && Validate (buf, len, m_MacKey)) // try session key first
-				DecryptSessionKey (buf, len);	
-			else 
+			bool isSessionKey = false; // try session key first
+			if (m_IsSessionKey)
+			{
+				if (isMACVerified)
+				{
+					DecryptSessionKey (buf, len);
+					isSessionKey = true;
+				}
+				else
+					isSessionKey = ValidateAndDecryptSessionKey (buf, len);
+			}
+			if (!isSessionKey)
 			{
 				if (m_State == eSessionStateEstablished) Reset (); // new session key required 
 				// try intro key depending on side
@@ -806,6 +816,23 @@ namespace transport
 		return !memcmp (header->mac, digest, 16);
 	}
 
+	bool SSUSession::ValidateAndDecryptSessionKey (uint8_t * buf, size_t len)
+	{
+		if (len < sizeof (SSUHeader))
+		{
+			LogPrint (eLogError, "SSU: Unexpected packet length ", len);
+			return false;
+		}		
+		SSUHeader * header = (SSUHeader *)buf;
+		uint8_t * encrypted = &header->flag;
+		uint16_t encryptedLen = len - (encrypted - buf);
+		// assume actual buffer size is 18 (16 + 2) bytes more
+		memcpy (buf + len, header->iv, 16);
+		htobe16buf (buf + len + 16, encryptedLen);
+		return i2p::crypto::HMACMD5DecryptIfValid (encrypted, encryptedLen, 18, m_MacKey, header->mac, header->iv,
+			m_SessionKeyDecryption, m_SessionKeyEncryption);
+	}
+
 	void SSUSession::Connect ()
 	{
 		if (m_State == eSessionStateUnknown)
@@ -880,6 +907,7 @@ namespace transport
 		m_State = eSessionStateUnknown;
 		transports.PeerDisconnected (shared_from_this ());
 		m_Data.Stop ();
+		m_SendQueue.Clear ();
 		m_ConnectTimer.cancel ();
 		if (m_SentRelayTag)
 		{	
@@ -921,18 +949,44 @@ namespace transport
 
 	void SSUSession::SendI2NPMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs)
 	{
-		GetService ().post (std::bind (&SSUSession::PostI2NPMessages, shared_from_this (), msgs));    
+		if (PostMessages (msgs)) // otherwise session's thread is woken up already
+			GetService ().post (std::bind (&SSUSession::HandlePostedMessages, shared_from_this ()));
+	}
+
+	void SSUSession::HandlePostedMessages ()
+	{
+		if (TakePostedMessages (m_TakenMessages)) // more were posted while we were taking
+			GetService ().post (std::bind (&SSUSession::HandlePostedMessages, shared_from_this ()));
+		PostI2NPMessages (m_TakenMessages);
+		m_TakenMessages.clear ();
 	}
 
-	void SSUSession::PostI2NPMessages (std::vector<std::shared_ptr<I2NPMessage> > msgs)
+	void SSUSession::PostI2NPMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs)
 	{
 		if (m_State == eSessionStateEstablished)
 		{
 			for (const auto& it: msgs)
-				if (it) m_Data.Send (it);
+				if (it && !m_SendQueue.Push (it))
+				{
+					LogPrint (eLogWarning, "SSU: outgoing messages queue size exceeds ", SEND_QUEUE_MAX_TOTAL_SIZE);
+					Close ();
+					return;
+				}
+			SendQueuedMessages ();
 		}
 	}	
 
+	void SSUSession::SendQueuedMessages ()
+	{
+		// in priority order while outgoing window is not full
+		while (!m_Data.IsWindowFull ())
+		{
+			auto msg = m_SendQueue.Pop ();
+			if (!msg) break;
+			m_Data.Send (msg);
+		}
+	}
+
 	void SSUSession::ProcessData (uint8_t * buf, size_t len)
 	{
 		m_Data.ProcessMessage (buf, len);
@@ -1000,7 +1054,14 @@ namespace transport
 				LogPrint (eLogDebug, "SSU: peer test from Charlie. We are Bob");
 				auto session = m_Server.GetPeerTestSession (nonce); // session with Alice from PeerTest
 				if (session && session->m_State == eSessionStateEstablished)
-					session->Send (PAYLOAD_TYPE_PEER_TEST, buf, len); // back to Alice
+				{
+					// in thread of Alice's session
+					std::vector<uint8_t> msg (buf, buf + len);
+					session->GetService ().post ([session, msg]()
+						{
+							session->Send (PAYLOAD_TYPE_PEER_TEST, msg.data (), msg.size ()); // back to Alice
+						});
+				}
 				m_Server.RemovePeerTest (nonce); // nonce has been used
 				break;
 			}
@@ -1044,7 +1105,14 @@ namespace transport
 						if (session)
 						{
 							m_Server.NewPeerTest (nonce, ePeerTestParticipantBob, shared_from_this ());
-							session->SendPeerTest (nonce, senderEndpoint.address (), senderEndpoint.port (), introKey, false); // to Charlie with Alice's actual address 	
+							// in thread of Charlie's session
+							std::vector<uint8_t> key (introKey, introKey + 32);
+							auto address = senderEndpoint.address ();
+							auto port = senderEndpoint.port ();
+							session->GetService ().post ([session, nonce, address, port, key]()
+								{
+									session->SendPeerTest (nonce, address, port, key.data (), false); // to Charlie with Alice's actual address
+								});
 						}	
 					}
 				}
@@ -1193,6 +1261,7 @@ namespace transport
 	{
 		m_NumSentBytes += size;
 		i2p::transport::transports.UpdateSentBytes (size);
+		UpdateStats ();
 		m_Server.Send (buf, size, m_RemoteEndpoint);
 	}	
 }
@@ -68,7 +68,8 @@ namespace transport
 
 			SSUSession (SSUServer& server, boost::asio::ip::udp::endpoint& remoteEndpoint,
 				std::shared_ptr<const i2p::data::RouterInfo> router = nullptr, bool peerTest = false);
-			void ProcessNextMessage (uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& senderEndpoint);		
+			void ProcessNextMessage (uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& senderEndpoint,
+				bool isMACVerified = false); // MAC verified with session key already		
 			~SSUSession ();
 			
 			void Connect ();
@@ -81,7 +82,10 @@ namespace transport
 			void Failed ();
 			boost::asio::ip::udp::endpoint& GetRemoteEndpoint () { return m_RemoteEndpoint; };
 			bool IsV6 () const { return m_RemoteEndpoint.address ().is_v6 (); };
+			bool IsSessionKey () const { return m_IsSessionKey; };
+			const i2p::crypto::MACKey& GetMacKey () const { return m_MacKey; };
 			void SendI2NPMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs);
+			TransportType GetTransportType () const { return eTransportSSU; };
 			void SendPeerTest (); // Alice			
 
 			SessionState GetState () const  { return m_State; };
@@ -100,7 +104,9 @@ namespace transport
 			boost::asio::io_service& GetService ();
 			void CreateAESandMacKey (const uint8_t * pubKey); 
 			size_t GetSSUHeaderSize (const uint8_t * buf) const;
-			void PostI2NPMessages (std::vector<std::shared_ptr<I2NPMessage> > msgs);
+			void HandlePostedMessages ();
+			void PostI2NPMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs);
+			void SendQueuedMessages ();
 			void ProcessMessage (uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& senderEndpoint); // call for established session
 			void ProcessSessionRequest (const uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& senderEndpoint);
 			void SendSessionRequest ();
@@ -130,7 +136,8 @@ namespace transport
 			void FillHeaderAndEncrypt (uint8_t payloadType, uint8_t * buf, size_t len); // with session key 
 			void Decrypt (uint8_t * buf, size_t len, const i2p::crypto::AESKey& aesKey);
 			void DecryptSessionKey (uint8_t * buf, size_t len);
-			bool Validate (uint8_t * buf, size_t len, const i2p::crypto::MACKey& macKey);			
+			bool Validate (uint8_t * buf, size_t len, const i2p::crypto::MACKey& macKey);
+			bool ValidateAndDecryptSessionKey (uint8_t * buf, size_t len); // one pass, unchanged if MAC doesn't match			
 
 			void Reset ();
 			
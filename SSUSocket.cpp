@@ -0,0 +1,300 @@
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#ifdef __linux__
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#endif
+#include "Log.h"
+#include "SSUSocket.h"
+
+namespace i2p
+{
+namespace transport
+{
+#ifdef __linux__
+	static void SetEndpoint (boost::asio::ip::udp::endpoint& ep, const sockaddr_storage& addr, socklen_t len)
+	{
+		if (len > sizeof (addr)) len = sizeof (addr);
+		memcpy (ep.data (), &addr, std::min ((size_t)len, (size_t)ep.capacity ()));
+		ep.resize (len);
+	}
+
+	SSUSocketBatch::SSUSocketBatch (boost::asio::ip::udp::socket& socket, i2p::util::MemoryPoolMt<SSUPacket>& packetsPool):
+		m_Socket (socket), m_PacketsPool (packetsPool), m_IsGRO (false), m_IsGSO (false), m_GROBuffers (nullptr),
+		m_SendQueue (new SSUPacket[SSU_MAX_NUM_SENT_PACKETS]), m_SendQueueSize (0), m_IsWaitingForWritable (false)
+	{
+	}
+
+	SSUSocketBatch::~SSUSocketBatch ()
+	{
+		m_PacketsPool.ReleaseMt (m_ReceivePackets);
+		delete[] m_GROBuffers;
+		delete[] m_SendQueue;
+	}
+
+	void SSUSocketBatch::Init (bool offload)
+	{
+		int fd = m_Socket.native_handle ();
+		int on = 1;
+		m_IsGRO = offload && !setsockopt (fd, SOL_UDP, UDP_GRO, &on, sizeof (on));
+		if (m_IsGRO && !m_GROBuffers)
+			m_GROBuffers = new uint8_t[SSU_MAX_NUM_GRO_BUFFERS*SSU_GRO_BUFFER_SIZE];
+		int segSize = 0; // probe only, segment size is set per message
+		m_IsGSO = offload && !setsockopt (fd, SOL_UDP, UDP_SEGMENT, &segSize, sizeof (segSize));
+		LogPrint (eLogInfo, "SSU: recvmmsg/sendmmsg batching", m_IsGRO ? ", GRO" : "", m_IsGSO ? ", GSO" : "");
+	}
+
+	bool SSUSocketBatch::Receive (std::vector<SSUPacket *>& packets, size_t mtu, boost::system::error_code& ecode)
+	{
+		if (m_IsGRO) return ReceiveAggregated (packets, mtu, ecode);
+		while (m_ReceivePackets.size () < SSU_MAX_NUM_RECEIVED_PACKETS)
+			m_ReceivePackets.push_back (m_PacketsPool.AcquireMt ());
+		mmsghdr msgs[SSU_MAX_NUM_RECEIVED_PACKETS];
+		iovec iovs[SSU_MAX_NUM_RECEIVED_PACKETS];
+		sockaddr_storage addrs[SSU_MAX_NUM_RECEIVED_PACKETS];
+		memset (msgs, 0, sizeof (msgs));
+		for (size_t i = 0; i < SSU_MAX_NUM_RECEIVED_PACKETS; i++)
+		{
+			iovs[i].iov_base = m_ReceivePackets[i]->buf;
+			iovs[i].iov_len = mtu;
+			msgs[i].msg_hdr.msg_name = &addrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof (addrs[i]);
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		int n = recvmmsg (m_Socket.native_handle (), msgs, SSU_MAX_NUM_RECEIVED_PACKETS, MSG_DONTWAIT, nullptr);
+		if (n <= 0)
+		{
+			if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				ecode.assign (errno, boost::system::system_category ());
+			return false;
+		}
+		for (int i = 0; i < n; i++)
+		{
+			if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) continue; // bigger than MTU, packet is reused
+			auto packet = m_ReceivePackets[i];
+			packet->len = msgs[i].msg_len;
+			SetEndpoint (packet->from, addrs[i], msgs[i].msg_hdr.msg_namelen);
+			packets.push_back (packet);
+			m_ReceivePackets[i] = nullptr;
+		}
+		m_ReceivePackets.erase (std::remove (m_ReceivePackets.begin (), m_ReceivePackets.end (), nullptr), m_ReceivePackets.end ());
+		return !packets.empty ();
+	}
+
+	bool SSUSocketBatch::ReceiveAggregated (std::vector<SSUPacket *>& packets, size_t mtu, boost::system::error_code& ecode)
+	{
+		const size_t controlLen = CMSG_SPACE (sizeof (int));
+		mmsghdr msgs[SSU_MAX_NUM_GRO_BUFFERS];
+		iovec iovs[SSU_MAX_NUM_GRO_BUFFERS];
+		sockaddr_storage addrs[SSU_MAX_NUM_GRO_BUFFERS];
+		uint64_t controls[SSU_MAX_NUM_GRO_BUFFERS][(controlLen + 7)/8];
+		memset (msgs, 0, sizeof (msgs));
+		for (size_t i = 0; i < SSU_MAX_NUM_GRO_BUFFERS; i++)
+		{
+			iovs[i].iov_base = m_GROBuffers + i*SSU_GRO_BUFFER_SIZE;
+			iovs[i].iov_len = SSU_GRO_BUFFER_SIZE;
+			msgs[i].msg_hdr.msg_name = &addrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof (addrs[i]);
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control = controls[i];
+			msgs[i].msg_hdr.msg_controllen = controlLen;
+		}
+		int n = recvmmsg (m_Socket.native_handle (), msgs, SSU_MAX_NUM_GRO_BUFFERS, MSG_DONTWAIT, nullptr);
+		if (n <= 0)
+		{
+			if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				ecode.assign (errno, boost::system::system_category ());
+			return false;
+		}
+		for (int i = 0; i < n; i++)
+		{
+			auto& hdr = msgs[i].msg_hdr;
+			if (hdr.msg_flags & MSG_TRUNC) continue;
+			size_t len = msgs[i].msg_len, segSize = len;
+			for (auto cmsg = CMSG_FIRSTHDR (&hdr); cmsg; cmsg = CMSG_NXTHDR (&hdr, cmsg))
+				if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+				{
+					int gsoSize; memcpy (&gsoSize, CMSG_DATA (cmsg), sizeof (gsoSize));
+					if (gsoSize > 0) segSize = gsoSize;
+				}
+			if (!segSize) segSize = 1; // empty datagram
+			// split aggregate to datagrams of segSize, last might be shorter
+			const uint8_t * buf = (const uint8_t *)iovs[i].iov_base;
+			for (size_t offset = 0; offset < len || !len; offset += segSize)
+			{
+				size_t l = std::min (segSize, len - offset);
+				if (l > mtu) break;
+				auto packet = m_PacketsPool.AcquireMt ();
+				memcpy (packet->buf, buf + offset, l);
+				packet->len = l;
+				SetEndpoint (packet->from, addrs[i], hdr.msg_namelen);
+				packets.push_back (packet);
+				if (!len) break;
+			}
+		}
+		return !packets.empty ();
+	}
+
+	bool SSUSocketBatch::Send (const uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& to)
+	{
+		std::unique_lock<std::mutex> l(m_SendMutex);
+		if (m_SendQueueSize >= SSU_MAX_NUM_SENT_PACKETS)
+		{
+			// still full, waiting for writable socket
+			LogPrint (eLogDebug, "SSU: send queue is full, packet dropped");
+			return false;
+		}
+		auto& packet = m_SendQueue[m_SendQueueSize];
+		if (len > sizeof (packet.buf))
+		{
+			LogPrint (eLogError, "SSU: can't send packet of ", len, " bytes");
+			return false;
+		}
+		memcpy (packet.buf, buf, len);
+		packet.len = len;
+		packet.from = to;
+		m_SendQueueSize++;
+		if (m_IsWaitingForWritable) return false;
+		if (m_SendQueueSize >= SSU_MAX_NUM_SENT_PACKETS)
+		{
+			FlushQueue ();
+			return false;
+		}
+		return m_SendQueueSize == 1;
+	}
+
+	void SSUSocketBatch::Flush ()
+	{
+		std::unique_lock<std::mutex> l(m_SendMutex);
+		if (!m_IsWaitingForWritable)
+			FlushQueue ();
+	}
+
+	void SSUSocketBatch::FlushQueue ()
+	{
+		const size_t controlLen = CMSG_SPACE (sizeof (uint16_t));
+		mmsghdr msgs[SSU_MAX_NUM_SENT_PACKETS];
+		iovec iovs[SSU_MAX_NUM_SENT_PACKETS];
+		uint64_t controls[SSU_MAX_NUM_SENT_PACKETS][(controlLen + 7)/8];
+		size_t numSegments[SSU_MAX_NUM_SENT_PACKETS];
+		size_t ind = 0; // first packet not sent yet
+		while (ind < m_SendQueueSize)
+		{
+			// same destination bursts of equal size packets go to one message if GSO
+			size_t numMsgs = 0, i = ind;
+			memset (msgs, 0, sizeof (msgs));
+			while (i < m_SendQueueSize)
+			{
+				auto& hdr = msgs[numMsgs].msg_hdr;
+				const auto& first = m_SendQueue[i];
+				hdr.msg_name = const_cast<sockaddr *>(first.from.data ());
+				hdr.msg_namelen = first.from.size ();
+				hdr.msg_iov = iovs + i;
+				size_t segSize = first.len, numSegs = 0, total = 0;
+				do
+				{
+					iovs[i].iov_base = m_SendQueue[i].buf;
+					iovs[i].iov_len = m_SendQueue[i].len;
+					total += m_SendQueue[i].len;
+					numSegs++; i++;
+				}
+				while (m_IsGSO && segSize > 0 && i < m_SendQueueSize && numSegs < SSU_MAX_NUM_GSO_SEGMENTS &&
+					m_SendQueue[i - 1].len == segSize && m_SendQueue[i].len <= segSize &&
+					total + m_SendQueue[i].len <= SSU_MAX_GSO_SIZE && m_SendQueue[i].from == first.from);
+				hdr.msg_iovlen = numSegs;
+				if (numSegs > 1)
+				{
+					hdr.msg_control = controls[numMsgs];
+					hdr.msg_controllen = controlLen;
+					auto cmsg = CMSG_FIRSTHDR (&hdr);
+					cmsg->cmsg_level = SOL_UDP;
+					cmsg->cmsg_type = UDP_SEGMENT;
+					cmsg->cmsg_len = CMSG_LEN (sizeof (uint16_t));
+					uint16_t gsoSize = segSize;
+					memcpy (CMSG_DATA (cmsg), &gsoSize, sizeof (gsoSize));
+				}
+				numSegments[numMsgs] = numSegs;
+				numMsgs++;
+			}
+			// send messages
+			size_t k = 0;
+			while (k < numMsgs)
+			{
+				int n = sendmmsg (m_Socket.native_handle (), msgs + k, numMsgs - k, MSG_DONTWAIT);
+				if (n > 0)
+				{
+					for (int j = 0; j < n; j++) ind += numSegments[k + j];
+					k += n;
+					continue;
+				}
+				if (n < 0 && errno == EINTR) continue;
+				if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				{
+					// send buffer is full, the rest is sent when socket gets writable
+					WaitForWritable (ind);
+					return;
+				}
+				if (n < 0 && errno == EIO && numSegments[k] > 1)
+				{
+					// device doesn't support segmentation offload, regroup rest without GSO
+					LogPrint (eLogWarning, "SSU: GSO is not supported, disabled");
+					m_IsGSO = false;
+					break;
+				}
+				LogPrint (eLogWarning, "SSU: sendmmsg error: ", boost::system::error_code (errno, boost::system::system_category ()).message ());
+				ind += numSegments[k]; k++; // drop it
+			}
+		}
+		m_SendQueueSize = 0;
+	}
+
+	void SSUSocketBatch::WaitForWritable (size_t numSent)
+	{
+		for (size_t i = numSent; i < m_SendQueueSize; i++)
+		{
+			auto& packet = m_SendQueue[i - numSent];
+			memcpy (packet.buf, m_SendQueue[i].buf, m_SendQueue[i].len);
+			packet.len = m_SendQueue[i].len;
+			packet.from = m_SendQueue[i].from;
+		}
+		m_SendQueueSize -= numSent;
+		if (m_IsWaitingForWritable) return;
+		m_IsWaitingForWritable = true;
+#if BOOST_VERSION >= 106600
+		m_Socket.async_wait (boost::asio::socket_base::wait_write,
+#else
+		m_Socket.async_send (boost::asio::null_buffers (),
+#endif
+			std::bind (&SSUSocketBatch::HandleWritable, this, std::placeholders::_1));
+	}
+
+	void SSUSocketBatch::HandleWritable (const boost::system::error_code& ecode)
+	{
+		std::unique_lock<std::mutex> l(m_SendMutex);
+		m_IsWaitingForWritable = false;
+		if (ecode)
+		{
+			if (ecode != boost::asio::error::operation_aborted)
+				LogPrint (eLogWarning, "SSU: wait for writable socket error: ", ecode.message ());
+			m_SendQueueSize = 0;
+			return;
+		}
+		FlushQueue ();
+	}
+#endif
+}
+}
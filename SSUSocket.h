@@ -0,0 +1,71 @@
+#ifndef SSU_SOCKET_H__
+#define SSU_SOCKET_H__
+
+#include <inttypes.h>
+#include <vector>
+#include <mutex>
+#include <boost/asio.hpp>
+#include "Crypto.h"
+#include "util.h"
+#include "SSUData.h"
+
+namespace i2p
+{
+namespace transport
+{
+	struct SSUPacket
+	{
+		i2p::crypto::AESAlignedBuffer<SSU_MTU_V6 + 18> buf; // max MTU + iv + size
+		boost::asio::ip::udp::endpoint from;
+		size_t len;
+		bool isMACVerified; // with session key, by batch
+	};
+
+#ifdef __linux__
+	const size_t SSU_MAX_NUM_RECEIVED_PACKETS = 64; // per recvmmsg
+	const size_t SSU_MAX_NUM_SENT_PACKETS = 64; // per sendmmsg
+	const size_t SSU_GRO_BUFFER_SIZE = 65535; // max aggregate
+	const size_t SSU_MAX_NUM_GRO_BUFFERS = 16; // per recvmmsg if GRO, 1M total
+	const size_t SSU_MAX_NUM_GSO_SEGMENTS = 64; // kernel's UDP_MAX_SEGMENTS
+	const size_t SSU_MAX_GSO_SIZE = 65000; // all segments of one message, must fit IP packet
+
+	// recvmmsg/sendmmsg for one socket, UDP GRO/GSO if supported by kernel
+	class SSUSocketBatch
+	{
+		public:
+
+			SSUSocketBatch (boost::asio::ip::udp::socket& socket, i2p::util::MemoryPoolMt<SSUPacket>& packetsPool);
+			~SSUSocketBatch ();
+			void Init (bool offload = true); // after socket is open, GRO/GSO are not used if offload is false
+
+			bool Receive (std::vector<SSUPacket *>& packets, size_t mtu, boost::system::error_code& ecode); // non-blocking, false if nothing received
+			bool Send (const uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& to); // true if flush must be scheduled
+			void Flush ();
+
+			bool IsGRO () const { return m_IsGRO; }
+			bool IsGSO () const { return m_IsGSO; }
+
+		private:
+
+			bool ReceiveAggregated (std::vector<SSUPacket *>& packets, size_t mtu, boost::system::error_code& ecode);
+			void FlushQueue (); // m_SendMutex must be locked
+			void WaitForWritable (size_t numSent); // m_SendMutex must be locked, keeps the rest of queue
+			void HandleWritable (const boost::system::error_code& ecode);
+
+		private:
+
+			boost::asio::ip::udp::socket& m_Socket;
+			i2p::util::MemoryPoolMt<SSUPacket>& m_PacketsPool;
+			bool m_IsGRO, m_IsGSO;
+			std::vector<SSUPacket *> m_ReceivePackets; // preallocated, for next recvmmsg
+			uint8_t * m_GROBuffers; // SSU_MAX_NUM_GRO_BUFFERS*SSU_GRO_BUFFER_SIZE
+			std::mutex m_SendMutex;
+			SSUPacket * m_SendQueue; // SSU_MAX_NUM_SENT_PACKETS
+			size_t m_SendQueueSize;
+			bool m_IsWaitingForWritable; // send buffer is full, queue is flushed by HandleWritable
+	};
+#endif
+}
+}
+
+#endif
@@ -1,11 +1,236 @@
 #include <memory>
 #include "Log.h"
+#include "I2PEndian.h"
 #include "Signature.h"
 
 namespace i2p
 {
 namespace crypto
 {
+	// 2^255-19 field arithmetic with 51 bits limbs, products are accumulated in 128 bits
+#if defined(__SIZEOF_INT128__)
+	__extension__ typedef unsigned __int128 EDDSAAccumulator;
+	inline EDDSAAccumulator Mul64 (uint64_t a, uint64_t b) { return (EDDSAAccumulator)a*b; }
+	inline uint64_t Low64 (const EDDSAAccumulator& a) { return (uint64_t)a; }
+	inline uint64_t Shr51 (const EDDSAAccumulator& a) { return (uint64_t)(a >> 51); }
+#else
+	struct EDDSAAccumulator
+	{
+		uint64_t lo, hi;
+
+		EDDSAAccumulator& operator+= (const EDDSAAccumulator& other)
+		{
+			lo += other.lo;
+			hi += other.hi + (lo < other.lo);
+			return *this;
+		}
+
+		EDDSAAccumulator& operator+= (uint64_t other)
+		{
+			lo += other;
+			hi += (lo < other);
+			return *this;
+		}
+	};
+
+	inline EDDSAAccumulator Mul64 (uint64_t a, uint64_t b)
+	{
+		uint64_t a0 = (uint32_t)a, a1 = a >> 32, b0 = (uint32_t)b, b1 = b >> 32;
+		uint64_t p00 = a0*b0, p01 = a0*b1, p10 = a1*b0, p11 = a1*b1;
+		uint64_t mid = (p00 >> 32) + (uint32_t)p01 + (uint32_t)p10;
+		return { (mid << 32) | (uint32_t)p00, p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32) };
+	}
+	inline uint64_t Low64 (const EDDSAAccumulator& a) { return a.lo; }
+	inline uint64_t Shr51 (const EDDSAAccumulator& a) { return (a.lo >> 51) | (a.hi << 13); }
+#endif
+
+	const uint64_t EDDSA_LIMB_MASK = 0x7FFFFFFFFFFFFULL; // 2^51-1
+
+	// limbs of inputs must not exceed 2^54, results of Mul, Sqr, Sub and Carry are below 2^52
+	static inline void FieldCarry (EDDSAFieldElement& h)
+	{
+		uint64_t c;
+		c = h.v[0] >> 51; h.v[0] &= EDDSA_LIMB_MASK; h.v[1] += c;
+		c = h.v[1] >> 51; h.v[1] &= EDDSA_LIMB_MASK; h.v[2] += c;
+		c = h.v[2] >> 51; h.v[2] &= EDDSA_LIMB_MASK; h.v[3] += c;
+		c = h.v[3] >> 51; h.v[3] &= EDDSA_LIMB_MASK; h.v[4] += c;
+		c = h.v[4] >> 51; h.v[4] &= EDDSA_LIMB_MASK; h.v[0] += 19*c; // 2^255 = 19
+	}
+
+	static inline void FieldAdd (EDDSAFieldElement& h, const EDDSAFieldElement& f, const EDDSAFieldElement& g)
+	{
+		for (int i = 0; i < 5; i++)
+			h.v[i] = f.v[i] + g.v[i];
+	}
+
+	static inline void FieldSub (EDDSAFieldElement& h, const EDDSAFieldElement& f, const EDDSAFieldElement& g)
+	{
+		// add 4*q to stay positive, g's limbs must not exceed 2^53
+		h.v[0] = f.v[0] + 0x1FFFFFFFFFFFB4ULL - g.v[0];
+		for (int i = 1; i < 5; i++)
+			h.v[i] = f.v[i] + 0x1FFFFFFFFFFFFCULL - g.v[i];
+		FieldCarry (h);
+	}
+
+	static inline void FieldNeg (EDDSAFieldElement& h, const EDDSAFieldElement& f)
+	{
+		const EDDSAFieldElement zero = {{ 0, 0, 0, 0, 0 }};
+		FieldSub (h, zero, f);
+	}
+
+	static inline void FieldReduce (EDDSAFieldElement& h, EDDSAAccumulator t0, EDDSAAccumulator t1,
+		EDDSAAccumulator t2, EDDSAAccumulator t3, EDDSAAccumulator t4)
+	{
+		h.v[0] = Low64 (t0) & EDDSA_LIMB_MASK; t1 += Shr51 (t0);
+		h.v[1] = Low64 (t1) & EDDSA_LIMB_MASK; t2 += Shr51 (t1);
+		h.v[2] = Low64 (t2) & EDDSA_LIMB_MASK; t3 += Shr51 (t2);
+		h.v[3] = Low64 (t3) & EDDSA_LIMB_MASK; t4 += Shr51 (t3);
+		h.v[4] = Low64 (t4) & EDDSA_LIMB_MASK;
+		h.v[0] += 19*Shr51 (t4);
+		h.v[1] += h.v[0] >> 51; h.v[0] &= EDDSA_LIMB_MASK;
+	}
+
+	static inline void FieldMul (EDDSAFieldElement& h, const EDDSAFieldElement& f, const EDDSAFieldElement& g)
+	{
+		uint64_t f0 = f.v[0], f1 = f.v[1], f2 = f.v[2], f3 = f.v[3], f4 = f.v[4];
+		uint64_t g0 = g.v[0], g1 = g.v[1], g2 = g.v[2], g3 = g.v[3], g4 = g.v[4];
+		uint64_t g1_19 = 19*g1, g2_19 = 19*g2, g3_19 = 19*g3, g4_19 = 19*g4;
+		EDDSAAccumulator t0 = Mul64 (f0, g0), t1 = Mul64 (f0, g1), t2 = Mul64 (f0, g2), t3 = Mul64 (f0, g3), t4 = Mul64 (f0, g4);
+		t0 += Mul64 (f1, g4_19); t1 += Mul64 (f1, g0);    t2 += Mul64 (f1, g1);    t3 += Mul64 (f1, g2);    t4 += Mul64 (f1, g3);
+		t0 += Mul64 (f2, g3_19); t1 += Mul64 (f2, g4_19); t2 += Mul64 (f2, g0);    t3 += Mul64 (f2, g1);    t4 += Mul64 (f2, g2);
+		t0 += Mul64 (f3, g2_19); t1 += Mul64 (f3, g3_19); t2 += Mul64 (f3, g4_19); t3 += Mul64 (f3, g0);    t4 += Mul64 (f3, g1);
+		t0 += Mul64 (f4, g1_19); t1 += Mul64 (f4, g2_19); t2 += Mul64 (f4, g3_19); t3 += Mul64 (f4, g4_19); t4 += Mul64 (f4, g0);
+		FieldReduce (h, t0, t1, t2, t3, t4);
+	}
+
+	static inline void FieldSqr (EDDSAFieldElement& h, const EDDSAFieldElement& f)
+	{
+		uint64_t f0 = f.v[0], f1 = f.v[1], f2 = f.v[2], f3 = f.v[3], f4 = f.v[4];
+		uint64_t f0_2 = 2*f0, f1_2 = 2*f1, f1_38 = 38*f1, f2_38 = 38*f2, f3_38 = 38*f3, f3_19 = 19*f3, f4_19 = 19*f4;
+		EDDSAAccumulator t0 = Mul64 (f0, f0), t1 = Mul64 (f0_2, f1), t2 = Mul64 (f0_2, f2), t3 = Mul64 (f0_2, f3), t4 = Mul64 (f0_2, f4);
+		t0 += Mul64 (f1_38, f4); t1 += Mul64 (f2_38, f4); t2 += Mul64 (f1, f1); t3 += Mul64 (f1_2, f2); t4 += Mul64 (f1_2, f3);
+		t0 += Mul64 (f2_38, f3); t1 += Mul64 (f3_19, f3); t2 += Mul64 (f3_38, f4); t3 += Mul64 (f4_19, f4); t4 += Mul64 (f2, f2);
+		FieldReduce (h, t0, t1, t2, t3, t4);
+	}
+
+	static inline void FieldSqrN (EDDSAFieldElement& h, const EDDSAFieldElement& f, int n) // f^(2^n)
+	{
+		FieldSqr (h, f);
+		for (int i = 1; i < n; i++)
+			FieldSqr (h, h);
+	}
+
+	static void FieldPow2523 (EDDSAFieldElement& h, const EDDSAFieldElement& z, bool invert)
+	{
+		// invert ? z^(2^255-21) = 1/z : z^(2^252-3)
+		EDDSAFieldElement z2, z9, z11, z2_5_0, z2_10_0, z2_20_0, z2_50_0, z2_100_0, t;
+		FieldSqr (z2, z);
+		FieldSqrN (t, z2, 2);
+		FieldMul (z9, t, z);
+		FieldMul (z11, z9, z2);
+		FieldSqr (t, z11);
+		FieldMul (z2_5_0, t, z9); // 2^5 - 2^0
+		FieldSqrN (t, z2_5_0, 5);
+		FieldMul (z2_10_0, t, z2_5_0);
+		FieldSqrN (t, z2_10_0, 10);
+		FieldMul (z2_20_0, t, z2_10_0);
+		FieldSqrN (t, z2_20_0, 20);
+		FieldMul (t, t, z2_20_0); // 2^40 - 2^0
+		FieldSqrN (t, t, 10);
+		FieldMul (z2_50_0, t, z2_10_0);
+		FieldSqrN (t, z2_50_0, 50);
+		FieldMul (z2_100_0, t, z2_50_0);
+		FieldSqrN (t, z2_100_0, 100);
+		FieldMul (t, t, z2_100_0); // 2^200 - 2^0
+		FieldSqrN (t, t, 50);
+		FieldMul (t, t, z2_50_0); // 2^250 - 2^0
+		if (invert)
+		{
+			FieldSqrN (t, t, 5);
+			FieldMul (h, t, z11);
+		}
+		else
+		{
+			FieldSqrN (t, t, 2);
+			FieldMul (h, t, z);
+		}
+	}
+
+	static void FieldFromBytes (EDDSAFieldElement& h, const uint8_t * s) // 32 bytes Little Endian, highest bit ignored
+	{
+		h.v[0] = bufle64toh (s) & EDDSA_LIMB_MASK;
+		h.v[1] = (bufle64toh (s + 6) >> 3) & EDDSA_LIMB_MASK;
+		h.v[2] = (bufle64toh (s + 12) >> 6) & EDDSA_LIMB_MASK;
+		h.v[3] = (bufle64toh (s + 19) >> 1) & EDDSA_LIMB_MASK;
+		h.v[4] = (bufle64toh (s + 24) >> 12) & EDDSA_LIMB_MASK;
+	}
+
+	static void FieldToBytes (uint8_t * s, const EDDSAFieldElement& h) // fully reduced
+	{
+		EDDSAFieldElement t = h;
+		FieldCarry (t);
+		FieldCarry (t);
+		// subtract q if t >= q, that is t + 19 >= 2^255
+		uint64_t c = (t.v[0] + 19) >> 51;
+		c = (t.v[1] + c) >> 51;
+		c = (t.v[2] + c) >> 51;
+		c = (t.v[3] + c) >> 51;
+		c = (t.v[4] + c) >> 51;
+		t.v[0] += 19*c;
+		c = t.v[0] >> 51; t.v[0] &= EDDSA_LIMB_MASK; t.v[1] += c;
+		c = t.v[1] >> 51; t.v[1] &= EDDSA_LIMB_MASK; t.v[2] += c;
+		c = t.v[2] >> 51; t.v[2] &= EDDSA_LIMB_MASK; t.v[3] += c;
+		c = t.v[3] >> 51; t.v[3] &= EDDSA_LIMB_MASK; t.v[4] += c;
+		t.v[4] &= EDDSA_LIMB_MASK; // drop 2^255
+		htole64buf (s, t.v[0] | (t.v[1] << 51));
+		htole64buf (s + 8, (t.v[1] >> 13) | (t.v[2] << 38));
+		htole64buf (s + 16, (t.v[2] >> 26) | (t.v[3] << 25));
+		htole64buf (s + 24, (t.v[3] >> 39) | (t.v[4] << 12));
+	}
+
+	static bool FieldIsEqual (const EDDSAFieldElement& f, const EDDSAFieldElement& g)
+	{
+		uint8_t s1[32], s2[32];
+		FieldToBytes (s1, f);
+		FieldToBytes (s2, g);
+		return !memcmp (s1, s2, 32);
+	}
+
+	static bool FieldIsOdd (const EDDSAFieldElement& f)
+	{
+		uint8_t s[32];
+		FieldToBytes (s, f);
+		return s[0] & 1;
+	}
+
+	static inline void FieldMove (EDDSAFieldElement& f, const EDDSAFieldElement& g, uint64_t b) // f = g if b is 1, constant time
+	{
+		uint64_t mask = -b;
+		for (int i = 0; i < 5; i++)
+			f.v[i] ^= mask & (f.v[i] ^ g.v[i]);
+	}
+
+	// intermediate point representations
+	struct EDDSAProjectivePoint // x = X/Z, y = Y/Z
+	{
+		EDDSAFieldElement x, y, z;
+	};
+
+	struct EDDSACompletedPoint // x = X/Z, y = Y/T
+	{
+		EDDSAFieldElement x, y, z, t;
+	};
+
+	struct EDDSACachedPoint // Y+X, Y-X, Z, 2*d*T of extended point, to add
+	{
+		EDDSAFieldElement yPlusX, yMinusX, z, t2d;
+	};
+
+	struct EDDSAPrecomputedPoint // y+x, y-x, 2*d*x*y of affine point, to add with Z = 1
+	{
+		EDDSAFieldElement yPlusX, yMinusX, xy2d;
+	};
+
 	class Ed25519
 	{
 		public:
@@ -15,116 +240,131 @@ namespace crypto
 				BN_CTX * ctx = BN_CTX_new ();
 				BIGNUM * tmp = BN_new ();
 
-				q = BN_new ();
-				// 2^255-19				
-				BN_set_bit (q, 255); // 2^255 
+				BIGNUM * q = BN_new ();
+				// 2^255-19
+				BN_set_bit (q, 255); // 2^255
 				BN_sub_word (q, 19);
-				
+
 				l = BN_new ();
 				// 2^252 + 27742317777372353535851937790883648493
 				BN_set_bit (l, 252);
-				two_252_2 = BN_dup (l);
 				BN_dec2bn (&tmp, "27742317777372353535851937790883648493");
-				BN_add (l, l, tmp);		
-				BN_sub_word (two_252_2, 2); // 2^252 - 2		
+				BN_add (l, l, tmp);
 
 				 // -121665*inv(121666)
-				d = BN_new ();
+				BIGNUM * bn = BN_new ();
 				BN_set_word (tmp, 121666);
-				BN_mod_inverse (tmp, tmp, q, ctx);	
-				BN_set_word (d, 121665);
-				BN_set_negative (d, 1);							
-				BN_mul (d, d, tmp, ctx);
+				BN_mod_inverse (tmp, tmp, q, ctx);
+				BN_set_word (bn, 121665);
+				BN_mod_mul (bn, bn, tmp, q, ctx);
+				BN_sub (bn, q, bn);
+				FromBN (bn, d);
+				FieldAdd (d2, d, d);
+				FieldCarry (d2);
 
 				// 2^((q-1)/4)
-				I = BN_new ();
-				BN_free (tmp);
-				tmp = BN_dup (q);
+				BN_copy (tmp, q);
 				BN_sub_word (tmp, 1);
-				BN_div_word (tmp, 4);	
-				BN_set_word (I, 2);
-				BN_mod_exp (I, I, tmp, q, ctx);
-				BN_free (tmp);	
-				
-				// 4*inv(5)	
-				BIGNUM * By = BN_new ();		
-				BN_set_word (By, 5);
-				BN_mod_inverse (By, By, q, ctx);	
-				BN_mul_word (By, 4);
-				BIGNUM * Bx = RecoverX (By, ctx);	
-				BN_mod (Bx, Bx, q, ctx); // % q
-				BN_mod (By, By, q, ctx); // % q										
-			
-				// precalculate Bi256 table
-				Bi256Carry = { Bx, By };  // B
-				for (int i = 0; i < 32; i++)
-				{
-					Bi256[i][0] = Bi256Carry; // first point
-					for (int j = 1; j < 128; j++)
-						Bi256[i][j] = Sum (Bi256[i][j-1], Bi256[i][0], ctx); // (256+j+1)^i*B
-					Bi256Carry = Bi256[i][127];
-					for (int j = 0; j < 128; j++) // add first point 128 more times
-						Bi256Carry = Sum (Bi256Carry, Bi256[i][0], ctx);
-				}
-
+				BN_div_word (tmp, 4);
+				BN_set_word (bn, 2);
+				BN_mod_exp (bn, bn, tmp, q, ctx);
+				FromBN (bn, I);
+
+				// B = (x, 4*inv(5)), x is even
+				BN_set_word (bn, 5);
+				BN_mod_inverse (bn, bn, q, ctx);
+				BN_mul_word (bn, 4);
+				BN_mod (bn, bn, q, ctx);
+				uint8_t By[32];
+				EncodeBN (bn, By, 32);
+				EDDSAPoint B;
+				DecodePoint (By, B);
+				BN_free (bn); BN_free (tmp); BN_free (q);
 				BN_CTX_free (ctx);
-			}
 
-			Ed25519 (const Ed25519& other): q (BN_dup (other.q)), l (BN_dup (other.l)), 
-				d (BN_dup (other.d)), I (BN_dup (other.I)), two_252_2 (BN_dup (other.two_252_2)),
-				Bi256Carry (other.Bi256Carry)
-			{
+				// precalculate tables
+				EDDSAPoint P = B, Q;
+				EDDSACompletedPoint r;
 				for (int i = 0; i < 32; i++)
-					for (int j = 0; j < 128; j++)
-						Bi256[i][j] = other.Bi256[i][j];
+				{
+					// Bi256[i][j] = (j+1)*256^i*B
+					Q = P;
+					for (int j = 0; j < 8; j++)
+					{
+						ToPrecomputed (Q, Bi256[i][j]);
+						Add (r, Q, ToCached (P));
+						ToExtended (r, Q);
+					}
+					for (int j = 0; j < 8; j++) // P*256
+					{
+						Double (r, P);
+						ToExtended (r, P);
+					}
+				}
+				// Bodd[i] = (2*i+1)*B
+				Double (r, B);
+				ToExtended (r, Q);
+				auto B2 = ToCached (Q);
+				P = B;
+				for (int i = 0; i < 8; i++)
+				{
+					ToPrecomputed (P, Bodd[i]);
+					Add (r, P, B2);
+					ToExtended (r, P);
+				}
 			}
 
 			~Ed25519 ()
 			{
-				BN_free (q);
 				BN_free (l);
-				BN_free (d);
-				BN_free (I);
-				BN_free (two_252_2);
 			}
 
 
-			EDDSAPoint GeneratePublicKey (const uint8_t * expandedPrivateKey, BN_CTX * ctx) const
+			void GeneratePublicKey (const uint8_t * expandedPrivateKey, EDDSAPoint& publicKey) const
 			{
-				return MulB (expandedPrivateKey, ctx); // left half of expanded key, considered as Little Endian
+				MulB (expandedPrivateKey, publicKey); // left half of expanded key, considered as Little Endian, highest bit is clear
 			}
 
-			EDDSAPoint DecodePublicKey (const uint8_t * buf, BN_CTX * ctx) const
+			void DecodePublicKey (const uint8_t * buf, EDDSAPoint& publicKey) const
 			{
-				return DecodePoint (buf, ctx);
+				DecodePoint (buf, publicKey);
 			}
 
-			void EncodePublicKey (const EDDSAPoint& publicKey, uint8_t * buf, BN_CTX * ctx) const
+			void EncodePublicKey (const EDDSAPoint& publicKey, uint8_t * buf) const
 			{
-				EncodePoint (Normalize (publicKey, ctx), buf);
+				EncodePoint (publicKey.x, publicKey.y, publicKey.z, buf);
 			}
 
 			bool Verify (const EDDSAPoint& publicKey, const uint8_t * digest, const uint8_t * signature) const
 			{
-				BN_CTX * ctx = BN_CTX_new ();	
-				BIGNUM * h = DecodeBN<64> (digest);
-				// signature 0..31 - R, 32..63 - S 
+				BN_CTX * ctx = BN_CTX_new ();
+				// signature 0..31 - R, 32..63 - S
 				// B*S = R + PK*h => R = B*S - PK*h
 				// we don't decode R, but encode (B*S - PK*h)
-				auto Bs = MulB (signature + EDDSA25519_SIGNATURE_LENGTH/2, ctx); // B*S;
-				BN_mod (h, h, l, ctx); // public key is multiple of B, but B%l = 0
-				auto PKh = Mul (publicKey, h, ctx); // PK*h
+				// public key is multiple of B, but B*l = 0, so both scalars are taken %l
+				BIGNUM * h = DecodeBN<64> (digest);
+				BN_mod (h, h, l, ctx);
+				BIGNUM * s = DecodeBN<32> (signature + EDDSA25519_SIGNATURE_LENGTH/2);
+				BN_mod (s, s, l, ctx);
+				uint8_t hs[32], ss[32];
+				EncodeBN (h, hs, 32);
+				EncodeBN (s, ss, 32);
+				BN_free (h); BN_free (s);
+				BN_CTX_free (ctx);
+				EDDSAPoint minusPK = publicKey;
+				FieldNeg (minusPK.x, publicKey.x);
+				FieldNeg (minusPK.t, publicKey.t);
+				EDDSAProjectivePoint R;
+				DoubleMul (minusPK, hs, ss, R); // -PK*h + B*S
 				uint8_t diff[32];
-				EncodePoint (Normalize (Sum (Bs, -PKh, ctx), ctx), diff); // Bs - PKh encoded
+				EncodePoint (R.x, R.y, R.z, diff);
 				bool passed = !memcmp (signature, diff, 32); // R
-				BN_free (h); 
-				BN_CTX_free (ctx);
 				if (!passed)
 					LogPrint (eLogError, "25519 signature verification failed");
-				return passed; 
+				return passed;
 			}
 
-			void Sign (const uint8_t * expandedPrivateKey, const uint8_t * publicKeyEncoded, const uint8_t * buf, size_t len, 
+			void Sign (const uint8_t * expandedPrivateKey, const uint8_t * publicKeyEncoded, const uint8_t * buf, size_t len,
 				uint8_t * signature) const
 			{
 				BN_CTX * bnCtx = BN_CTX_new ();
@@ -136,16 +376,20 @@ namespace crypto
 				uint8_t digest[64];
 				SHA512_Final (digest, &ctx);
 				BIGNUM * r = DecodeBN<32> (digest); // DecodeBN<64> (digest); // for test vectors
+				BN_mod (r, r, l, bnCtx); // B*l = 0
 				// calculate R
 				uint8_t R[EDDSA25519_SIGNATURE_LENGTH/2]; // we must use separate buffer because signature might be inside buf
-				EncodePoint (Normalize (MulB (digest, bnCtx), bnCtx), R); // EncodePoint (Mul (B, r, bnCtx), R); // for test vectors 
+				EncodeBN (r, R, 32);
+				EDDSAPoint Br;
+				MulB (R, Br);
+				EncodePoint (Br.x, Br.y, Br.z, R);
 				// calculate S
 				SHA512_Init (&ctx);
 				SHA512_Update (&ctx, R, EDDSA25519_SIGNATURE_LENGTH/2); // R
 				SHA512_Update (&ctx, publicKeyEncoded, EDDSA25519_PUBLIC_KEY_LENGTH); // public key
 				SHA512_Update (&ctx, buf, len); // data
 				SHA512_Final (digest, &ctx);
-				BIGNUM * h = DecodeBN<64> (digest);			
+				BIGNUM * h = DecodeBN<64> (digest);
 				// S = (r + h*a) % l
 				BIGNUM * a = DecodeBN<EDDSA25519_PRIVATE_KEY_LENGTH> (expandedPrivateKey); // left half of expanded key
 				BN_mod_mul (h, h, a, l, bnCtx); // %l
@@ -156,238 +400,303 @@ namespace crypto
 				BN_CTX_free (bnCtx);
 			}
 
-		private:		
+		private:
 
-			EDDSAPoint Sum (const EDDSAPoint& p1, const EDDSAPoint& p2, BN_CTX * ctx) const
+			// twisted Edwards -x^2 + y^2 = 1 + d*x^2*y^2, formulas of Hisil, Wong, Carter, Dawson 2008
+			void Add (EDDSACompletedPoint& r, const EDDSAPoint& p, const EDDSACachedPoint& q, bool sub = false) const // p + q or p - q
 			{
-				// x3 = (x1*y2+y1*x2)*(z1*z2-d*t1*t2)
-				// y3 = (y1*y2+x1*x2)*(z1*z2+d*t1*t2)
-				// z3 = (z1*z2-d*t1*t2)*(z1*z2+d*t1*t2)
-				// t3 = (y1*y2+x1*x2)*(x1*y2+y1*x2)
-				BIGNUM * x3 = BN_new (), * y3 = BN_new (), * z3 = BN_new (), * t3 = BN_new ();
-				
-				BN_mul (x3, p1.x, p2.x, ctx); // A = x1*x2		
-				BN_mul (y3, p1.y, p2.y, ctx); // B = y1*y2	
-
-				BN_CTX_start (ctx);
-				BIGNUM * t1 = p1.t, * t2 = p2.t;
-				if (!t1) { t1 = BN_CTX_get (ctx); BN_mul (t1, p1.x, p1.y, ctx); }
-				if (!t2) { t2 = BN_CTX_get (ctx); BN_mul (t2, p2.x, p2.y, ctx); }
-				BN_mul (t3, t1, t2, ctx);
-				BN_mul (t3, t3, d, ctx);  // C = d*t1*t2
-
-				if (p1.z)
+				EDDSAFieldElement t0;
+				FieldAdd (r.x, p.y, p.x);
+				FieldSub (r.y, p.y, p.x);
+				FieldMul (r.z, r.x, sub ? q.yMinusX : q.yPlusX);
+				FieldMul (r.y, r.y, sub ? q.yPlusX : q.yMinusX);
+				FieldMul (r.t, q.t2d, p.t);
+				FieldMul (r.x, p.z, q.z);
+				FieldAdd (t0, r.x, r.x);
+				FieldSub (r.x, r.z, r.y);
+				FieldAdd (r.y, r.z, r.y);
+				if (sub)
 				{
-					if (p2.z)
-						BN_mul (z3, p1.z, p2.z, ctx); // D = z1*z2
-					else
-						BN_copy (z3, p1.z); // D = z1
+					FieldSub (r.z, t0, r.t);
+					FieldAdd (r.t, t0, r.t);
 				}
 				else
 				{
-					if (p2.z)
-						BN_copy (z3, p2.z); // D = z2
-					else
-						BN_one (z3); // D = 1
-				}	
-
-				BIGNUM * E = BN_CTX_get (ctx), * F = BN_CTX_get (ctx), * G = BN_CTX_get (ctx), * H = BN_CTX_get (ctx);
-				BN_add (E, p1.x, p1.y);				
-				BN_add (F, p2.x, p2.y);
-				BN_mul (E, E, F, ctx); // (x1 + y1)*(x2 + y2)
-				BN_sub (E, E, x3);
-				BN_sub (E, E, y3); // E = (x1 + y1)*(x2 + y2) - A - B
-				BN_sub (F, z3, t3); // F = D - C
-				BN_add (G, z3, t3); // G = D + C
-				BN_add (H, y3, x3); // H = B + A
-
-				BN_mod_mul (x3, E, F, q, ctx); // x3 = E*F
-				BN_mod_mul (y3, G, H, q, ctx); // y3 = G*H	
-				BN_mod_mul (z3, F, G, q, ctx); // z3 = F*G	
-				BN_mod_mul (t3, E, H, q, ctx); // t3 = E*H	
-
-				BN_CTX_end (ctx);
-
-				return EDDSAPoint {x3, y3, z3, t3};
+					FieldAdd (r.z, t0, r.t);
+					FieldSub (r.t, t0, r.t);
+				}
 			}
 
-			void Double (EDDSAPoint& p, BN_CTX * ctx) const
+			void Add (EDDSACompletedPoint& r, const EDDSAPoint& p, const EDDSAPrecomputedPoint& q, bool sub = false) const // q has Z = 1
 			{
-				BN_CTX_start (ctx);
-				BIGNUM * x2 = BN_CTX_get (ctx), * y2 = BN_CTX_get (ctx), * z2 = BN_CTX_get (ctx), * t2 = BN_CTX_get (ctx);
-				
-				BN_sqr (x2, p.x, ctx); // x2 = A = x^2		
-				BN_sqr (y2, p.y, ctx); // y2 = B = y^2	
-				if (p.t)
-					BN_sqr (t2, p.t, ctx); // t2 = t^2
-				else
+				EDDSAFieldElement t0;
+				FieldAdd (r.x, p.y, p.x);
+				FieldSub (r.y, p.y, p.x);
+				FieldMul (r.z, r.x, sub ? q.yMinusX : q.yPlusX);
+				FieldMul (r.y, r.y, sub ? q.yPlusX : q.yMinusX);
+				FieldMul (r.t, q.xy2d, p.t);
+				FieldAdd (t0, p.z, p.z);
+				FieldSub (r.x, r.z, r.y);
+				FieldAdd (r.y, r.z, r.y);
+				if (sub)
 				{
-					BN_mul (t2, p.x, p.y, ctx); // t = x*y
-					BN_sqr (t2, t2, ctx);  // t2 = t^2
-				}	
-				BN_mul (t2, t2, d, ctx);  // t2 = C = d*t^2 	
-				if (p.z)
-					BN_sqr (z2, p.z, ctx); // z2 = D = z^2 		
+					FieldSub (r.z, t0, r.t);
+					FieldAdd (r.t, t0, r.t);
+				}
 				else
-					BN_one (z2); // z2 = 1
-
-				BIGNUM * E = BN_CTX_get (ctx), * F = BN_CTX_get (ctx), * G = BN_CTX_get (ctx), * H = BN_CTX_get (ctx);
-				// E = (x+y)*(x+y)-A-B = x^2+y^2+2xy-A-B = 2xy
-				BN_mul (E, p.x, p.y, ctx);
-				BN_lshift1 (E, E);	// E =2*x*y							
-				BN_sub (F, z2, t2); // F = D - C
-				BN_add (G, z2, t2); // G = D + C 
-				BN_add (H, y2, x2); // H = B + A
-
-				BN_mod_mul (p.x, E, F, q, ctx); // x2 = E*F
-				BN_mod_mul (p.y, G, H, q, ctx); // y2 = G*H	
-				if (!p.z) p.z = BN_new ();
-				BN_mod_mul (p.z, F, G, q, ctx); // z2 = F*G	
-				if (!p.t) p.t = BN_new ();
-				BN_mod_mul (p.t, E, H, q, ctx); // t2 = E*H	
-
-				BN_CTX_end (ctx);
+				{
+					FieldAdd (r.z, t0, r.t);
+					FieldSub (r.t, t0, r.t);
+				}
 			}
-			
-			EDDSAPoint Mul (const EDDSAPoint& p, const BIGNUM * e, BN_CTX * ctx) const
+
+			template<typename Point>
+			void Double (EDDSACompletedPoint& r, const Point& p) const // T is not used
 			{
-				BIGNUM * zero = BN_new (), * one = BN_new ();
-				BN_zero (zero); BN_one (one);
-				EDDSAPoint res {zero, one};
-				if (!BN_is_zero (e))
-				{
-					int bitCount = BN_num_bits (e);
-					for (int i = bitCount - 1; i >= 0; i--)
-					{
-						Double (res, ctx);
-						if (BN_is_bit_set (e, i)) res = Sum (res, p, ctx);
-					}
-				}	
-				return res;
-			} 
-			
-			EDDSAPoint MulB (const uint8_t * e, BN_CTX * ctx) const // B*e, e is 32 bytes Little Endian
+				EDDSAFieldElement t0;
+				FieldSqr (r.x, p.x);
+				FieldSqr (r.z, p.y);
+				FieldSqr (r.t, p.z);
+				FieldAdd (r.t, r.t, r.t);
+				FieldAdd (r.y, p.x, p.y);
+				FieldSqr (t0, r.y);
+				FieldAdd (r.y, r.z, r.x);
+				FieldSub (r.z, r.z, r.x);
+				FieldSub (r.x, t0, r.y);
+				FieldSub (r.t, r.t, r.z);
+			}
+
+			void ToExtended (const EDDSACompletedPoint& p, EDDSAPoint& r) const
+			{
+				FieldMul (r.x, p.x, p.t);
+				FieldMul (r.y, p.y, p.z);
+				FieldMul (r.z, p.z, p.t);
+				FieldMul (r.t, p.x, p.y);
+			}
+
+			void ToProjective (const EDDSACompletedPoint& p, EDDSAProjectivePoint& r) const
+			{
+				FieldMul (r.x, p.x, p.t);
+				FieldMul (r.y, p.y, p.z);
+				FieldMul (r.z, p.z, p.t);
+			}
+
+			EDDSACachedPoint ToCached (const EDDSAPoint& p) const
+			{
+				EDDSACachedPoint r;
+				FieldAdd (r.yPlusX, p.y, p.x);
+				FieldSub (r.yMinusX, p.y, p.x);
+				r.z = p.z;
+				FieldMul (r.t2d, p.t, d2);
+				return r;
+			}
+
+			void ToPrecomputed (const EDDSAPoint& p, EDDSAPrecomputedPoint& r) const
+			{
+				EDDSAFieldElement zi, x, y;
+				FieldPow2523 (zi, p.z, true);
+				FieldMul (x, p.x, zi);
+				FieldMul (y, p.y, zi);
+				FieldAdd (r.yPlusX, y, x);
+				FieldCarry (r.yPlusX);
+				FieldSub (r.yMinusX, y, x);
+				FieldMul (r.xy2d, x, y);
+				FieldMul (r.xy2d, r.xy2d, d2);
+			}
+
+			void MulB (const uint8_t * e, EDDSAPoint& r) const // B*e, e is 32 bytes Little Endian, e < 2^255, constant time
 			{
-				BIGNUM * zero = BN_new (), * one = BN_new ();
-				BN_zero (zero); BN_one (one);
-				EDDSAPoint res {zero, one};
-				bool carry = false;
+				// signed radix 16 digits, -8..8
+				int8_t digits[64];
 				for (int i = 0; i < 32; i++)
 				{
-					uint8_t x = e[i];
-					if (carry) 
-					{ 
-						if (x < 255) 
-						{ 
-							x++; 
-							carry = false;
-						} 
-						else 
-							x = 0; 
-					}
-					if (x > 0)
-					{
-						if (x <= 128)
-							res = Sum (res, Bi256[i][x-1], ctx);
-						else
-						{
-							res = Sum (res, -Bi256[i][255-x], ctx); // -Bi[256-x]
-							carry = true;
-						}		
-					}
+					digits[2*i] = e[i] & 0x0F;
+					digits[2*i + 1] = e[i] >> 4;
+				}
+				int8_t carry = 0;
+				for (int i = 0; i < 63; i++)
+				{
+					digits[i] += carry;
+					carry = (digits[i] + 8) >> 4;
+					digits[i] -= carry << 4;
+				}
+				digits[63] += carry;
+				// sum of digits[i]*16^i*B, odd i first, then multiply by 16 and add even i
+				const EDDSAFieldElement zero = {{ 0, 0, 0, 0, 0 }}, one = {{ 1, 0, 0, 0, 0 }};
+				r.x = zero; r.y = one; r.z = one; r.t = zero;
+				EDDSACompletedPoint c;
+				EDDSAPrecomputedPoint p;
+				for (int i = 1; i < 64; i += 2)
+				{
+					Select (p, i/2, digits[i]);
+					Add (c, r, p);
+					ToExtended (c, r);
+				}
+				EDDSAProjectivePoint s;
+				Double (c, r);
+				for (int i = 0; i < 3; i++)
+				{
+					ToProjective (c, s);
+					Double (c, s);
+				}
+				ToExtended (c, r);
+				for (int i = 0; i < 64; i += 2)
+				{
+					Select (p, i/2, digits[i]);
+					Add (c, r, p);
+					ToExtended (c, r);
 				}
-				if (carry) res = Sum (res, Bi256Carry, ctx);
-				return res;
 			}
 
-			EDDSAPoint Normalize (const EDDSAPoint& p, BN_CTX * ctx) const
+			void Select (EDDSAPrecomputedPoint& r, int pos, int8_t b) const // r = b*256^pos*B, constant time
 			{
-				if (p.z)
+				uint64_t negative = (uint8_t)b >> 7;
+				uint8_t babs = b - (((-negative) & b) << 1); // |b|
+				const EDDSAFieldElement zero = {{ 0, 0, 0, 0, 0 }}, one = {{ 1, 0, 0, 0, 0 }};
+				r.yPlusX = one; r.yMinusX = one; r.xy2d = zero;
+				for (int j = 0; j < 8; j++)
 				{
-					BIGNUM * x = BN_new (), * y = BN_new ();
-					BN_mod_inverse (y, p.z, q, ctx);
-					BN_mod_mul (x, p.x, y, q, ctx); // x = x/z
-					BN_mod_mul (y, p.y, y, q, ctx); // y = y/z
-					return  EDDSAPoint{x, y};
+					uint64_t equal = ((uint64_t)(babs ^ (j + 1)) - 1) >> 63;
+					FieldMove (r.yPlusX, Bi256[pos][j].yPlusX, equal);
+					FieldMove (r.yMinusX, Bi256[pos][j].yMinusX, equal);
+					FieldMove (r.xy2d, Bi256[pos][j].xy2d, equal);
 				}
-				else
-					return EDDSAPoint{BN_dup (p.x), BN_dup (p.y)};
+				// -(x, y) = (-x, y)
+				EDDSAFieldElement yPlusX = r.yPlusX, minusXY2d;
+				FieldNeg (minusXY2d, r.xy2d);
+				FieldMove (r.yPlusX, r.yMinusX, negative);
+				FieldMove (r.yMinusX, yPlusX, negative);
+				FieldMove (r.xy2d, minusXY2d, negative);
 			}
 
-			bool IsOnCurve (const EDDSAPoint& p, BN_CTX * ctx) const
+			void Slide (int8_t * r, const uint8_t * e) const // sliding window, odd digits -15..15, e < 2^255
 			{
-				BN_CTX_start (ctx);
-				BIGNUM * x2 = BN_CTX_get (ctx), * y2 = BN_CTX_get (ctx), * tmp = BN_CTX_get (ctx);
-				BN_sqr (x2, p.x, ctx); // x^2
-				BN_sqr (y2, p.y, ctx); // y^2
-				// y^2 - x^2 - 1 - d*x^2*y^2 			
-				BN_mul (tmp, d, x2, ctx);
-				BN_mul (tmp, tmp, y2, ctx);	
-				BN_sub (tmp, y2, tmp);
-				BN_sub (tmp, tmp, x2);
-				BN_sub_word (tmp, 1);
-				BN_mod (tmp, tmp, q, ctx); // % q
-				bool ret = BN_is_zero (tmp);
-				BN_CTX_end (ctx);
-				return ret;
-			}	
+				for (int i = 0; i < 256; i++)
+					r[i] = 1 & (e[i >> 3] >> (i & 7));
+				for (int i = 0; i < 256; i++)
+				{
+					if (!r[i]) continue;
+					for (int b = 1; b <= 6 && i + b < 256; b++)
+					{
+						if (!r[i + b]) continue;
+						if (r[i] + (r[i + b] << b) <= 15)
+						{
+							r[i] += r[i + b] << b;
+							r[i + b] = 0;
+						}
+						else if (r[i] - (r[i + b] << b) >= -15)
+						{
+							r[i] -= r[i + b] << b;
+							for (int k = i + b; k < 256; k++)
+							{
+								if (!r[k])
+								{
+									r[k] = 1;
+									break;
+								}
+								r[k] = 0;
+							}
+						}
+						else
+							break;
+					}
+				}
+			}
 
-			BIGNUM * RecoverX (const BIGNUM * y, BN_CTX * ctx) const
+			void DoubleMul (const EDDSAPoint& p, const uint8_t * a, const uint8_t * b, EDDSAProjectivePoint& r) const
 			{
-				BN_CTX_start (ctx);
-				BIGNUM * y2 = BN_CTX_get (ctx), * xx = BN_CTX_get (ctx);
-				BN_sqr (y2, y, ctx); // y^2
-				// xx = (y^2 -1)*inv(d*y^2 +1) 
-				BN_mul (xx, d, y2, ctx);
-				BN_add_word (xx, 1);
-				BN_mod_inverse (xx, xx, q, ctx);
-				BN_sub_word (y2, 1);
-				BN_mul (xx, y2, xx, ctx);
-				// x = srqt(xx) = xx^(2^252-2)		
-				BIGNUM * x = BN_new ();
-				BN_mod_exp (x, xx, two_252_2, q, ctx);
-				// check (x^2 -xx) % q	
-				BN_sqr (y2, x, ctx);
-				BN_mod_sub (y2, y2, xx, q, ctx); 
-				if (!BN_is_zero (y2))
-					BN_mod_mul (x, x, I, q, ctx);
-				if (BN_is_odd (x))
-					BN_sub (x, q, x);
-				return x;
+				// p*a + B*b, Straus-Shamir with sliding windows, variable time
+				int8_t aSlide[256], bSlide[256];
+				Slide (aSlide, a);
+				Slide (bSlide, b);
+				EDDSACachedPoint pi[8]; // (2*i+1)*p
+				EDDSACompletedPoint c;
+				EDDSAPoint u;
+				Double (c, p);
+				ToExtended (c, u);
+				auto p2 = ToCached (u);
+				pi[0] = ToCached (p);
+				u = p;
+				for (int i = 1; i < 8; i++)
+				{
+					Add (c, u, p2);
+					ToExtended (c, u);
+					pi[i] = ToCached (u);
+				}
+				const EDDSAFieldElement zero = {{ 0, 0, 0, 0, 0 }}, one = {{ 1, 0, 0, 0, 0 }};
+				r.x = zero; r.y = one; r.z = one;
+				int i = 255;
+				while (i >= 0 && !aSlide[i] && !bSlide[i]) i--;
+				for (; i >= 0; i--)
+				{
+					Double (c, r);
+					if (aSlide[i])
+					{
+						ToExtended (c, u);
+						Add (c, u, pi[(aSlide[i] > 0 ? aSlide[i] : -aSlide[i])/2], aSlide[i] < 0);
+					}
+					if (bSlide[i])
+					{
+						ToExtended (c, u);
+						Add (c, u, Bodd[(bSlide[i] > 0 ? bSlide[i] : -bSlide[i])/2], bSlide[i] < 0);
+					}
+					ToProjective (c, r);
+				}
 			}
 
-			EDDSAPoint DecodePoint (const uint8_t * buf, BN_CTX * ctx) const
+			void DecodePoint (const uint8_t * buf, EDDSAPoint& p) const
 			{
-				// buf is 32 bytes Little Endian, convert it to Big Endian
-				uint8_t buf1[EDDSA25519_PUBLIC_KEY_LENGTH];
-				for (size_t i = 0; i < EDDSA25519_PUBLIC_KEY_LENGTH/2; i++) // invert bytes
+				// x^2 = (y^2 - 1)/(d*y^2 + 1), x = sqrt (u/v) = u*v^3*(u*v^7)^((q-5)/8)
+				const EDDSAFieldElement one = {{ 1, 0, 0, 0, 0 }};
+				EDDSAFieldElement u, v, v3, vxx, check;
+				FieldFromBytes (p.y, buf);
+				p.z = one;
+				FieldSqr (u, p.y);
+				FieldMul (v, u, d);
+				FieldSub (u, u, p.z); // y^2 - 1
+				FieldAdd (v, v, p.z); // d*y^2 + 1
+				FieldSqr (v3, v);
+				FieldMul (v3, v3, v); // v^3
+				FieldSqr (p.x, v3);
+				FieldMul (p.x, p.x, v);
+				FieldMul (p.x, p.x, u); // u*v^7
+				FieldPow2523 (p.x, p.x, false);
+				FieldMul (p.x, p.x, v3);
+				FieldMul (p.x, p.x, u);
+				FieldSqr (vxx, p.x);
+				FieldMul (vxx, vxx, v);
+				bool isOnCurve = true;
+				if (!FieldIsEqual (vxx, u))
 				{
-					buf1[i] = buf[EDDSA25519_PUBLIC_KEY_LENGTH -1 - i];
-					buf1[EDDSA25519_PUBLIC_KEY_LENGTH -1 - i] = buf[i];
+					FieldNeg (check, u);
+					isOnCurve = FieldIsEqual (vxx, check); // -u, multiply by sqrt(-1)
+					FieldMul (p.x, p.x, I);
 				}
-				bool isHighestBitSet = buf1[0] & 0x80;
-				if (isHighestBitSet)
-					buf1[0] &= 0x7f; // clear highest bit
-				BIGNUM * y = BN_new ();
-				BN_bin2bn (buf1, EDDSA25519_PUBLIC_KEY_LENGTH, y);
-				auto x = RecoverX (y, ctx);
-				if (BN_is_bit_set (x, 0) != isHighestBitSet)
-					BN_sub (x, q, x); // x = q - x 
-				BIGNUM * z = BN_new (), * t = BN_new (); 
-				BN_one (z); BN_mod_mul (t, x, y, q, ctx); // pre-calculate t
-				EDDSAPoint p {x, y, z, t};
-				if (!IsOnCurve (p, ctx)) 
+				if (FieldIsOdd (p.x) != (bool)(buf[EDDSA25519_PUBLIC_KEY_LENGTH - 1] & 0x80))
+					FieldNeg (p.x, p.x); // x = q - x
+				FieldMul (p.t, p.x, p.y); // pre-calculate t
+				if (!isOnCurve)
 					LogPrint (eLogError, "Decoded point is not on 25519");
-				return p;
 			}
-			
-			void EncodePoint (const EDDSAPoint& p, uint8_t * buf) const
+
+			void EncodePoint (const EDDSAFieldElement& x, const EDDSAFieldElement& y, const EDDSAFieldElement& z, uint8_t * buf) const
 			{
-				EncodeBN (p.y, buf,EDDSA25519_PUBLIC_KEY_LENGTH); 
-				if (BN_is_bit_set (p.x, 0)) // highest bit
+				EDDSAFieldElement zi, x1, y1;
+				FieldPow2523 (zi, z, true);
+				FieldMul (x1, x, zi);
+				FieldMul (y1, y, zi);
+				FieldToBytes (buf, y1);
+				if (FieldIsOdd (x1))
 					buf[EDDSA25519_PUBLIC_KEY_LENGTH - 1] |= 0x80; // set highest bit
 			}
 
+			void FromBN (const BIGNUM * bn, EDDSAFieldElement& f) const
+			{
+				uint8_t buf[32];
+				EncodeBN (bn, buf, 32);
+				FieldFromBytes (f, buf);
+			}
+
 			template<int len>
 			BIGNUM * DecodeBN (const uint8_t * buf) const
 			{
@@ -412,18 +721,15 @@ namespace crypto
 					uint8_t tmp = buf[i];
 					buf[i] = buf[len -1 - i];
 					buf[len -1 - i] = tmp;
-				}	
+				}
 			}
 
 		private:
-			
-			BIGNUM * q, * l, * d, * I; 
-			// transient values
-			BIGNUM * two_252_2; // 2^252-2
-			EDDSAPoint Bi256[32][128]; // per byte, Bi256[i][j] = (256+j+1)^i*B, we don't store zeroes
-			// if j > 128 we use 256 - j and carry 1 to next byte
-			// Bi256[0][0] = B, base point
-			EDDSAPoint Bi256Carry; // Bi256[32][0]
+
+			BIGNUM * l; // scalars are reduced with BIGNUM, points are native
+			EDDSAFieldElement d, d2, I; // d, 2*d, sqrt(-1)
+			EDDSAPrecomputedPoint Bi256[32][8]; // Bi256[i][j] = (j+1)*256^i*B, B is base point
+			EDDSAPrecomputedPoint Bodd[8]; // Bodd[i] = (2*i+1)*B
 	};
 
 	static std::unique_ptr<Ed25519> g_Ed25519;
@@ -444,9 +750,7 @@ namespace crypto
 	EDDSA25519Verifier::EDDSA25519Verifier (const uint8_t * signingKey)
 	{
 		memcpy (m_PublicKeyEncoded, signingKey, EDDSA25519_PUBLIC_KEY_LENGTH); 
-		BN_CTX * ctx = BN_CTX_new ();
-		m_PublicKey = GetEd25519 ()->DecodePublicKey (m_PublicKeyEncoded, ctx);
-		BN_CTX_free (ctx);
+		GetEd25519 ()->DecodePublicKey (m_PublicKeyEncoded, m_PublicKey);
 	}
 
 	bool EDDSA25519Verifier::Verify (const uint8_t * buf, size_t len, const uint8_t * signature) const
@@ -471,19 +775,18 @@ namespace crypto
 		m_ExpandedPrivateKey[EDDSA25519_PRIVATE_KEY_LENGTH - 1] |= 0x40; // set second bit
 		
 		// generate and encode public key
-		BN_CTX * ctx = BN_CTX_new ();	
-		auto publicKey = GetEd25519 ()->GeneratePublicKey (m_ExpandedPrivateKey, ctx);
-		GetEd25519 ()->EncodePublicKey (publicKey, m_PublicKeyEncoded, ctx);	
+		EDDSAPoint publicKey;
+		GetEd25519 ()->GeneratePublicKey (m_ExpandedPrivateKey, publicKey);
+		GetEd25519 ()->EncodePublicKey (publicKey, m_PublicKeyEncoded);	
 		
 		if (signingPublicKey && memcmp (m_PublicKeyEncoded, signingPublicKey, EDDSA25519_PUBLIC_KEY_LENGTH))
 		{
 			// keys don't match, it means older key with 0x1F
 			LogPrint (eLogWarning, "Older EdDSA key detected");
 			m_ExpandedPrivateKey[EDDSA25519_PRIVATE_KEY_LENGTH - 1] &= 0xDF; // drop third bit 
-			publicKey = GetEd25519 ()->GeneratePublicKey (m_ExpandedPrivateKey, ctx);
-			GetEd25519 ()->EncodePublicKey (publicKey, m_PublicKeyEncoded, ctx);	
+			GetEd25519 ()->GeneratePublicKey (m_ExpandedPrivateKey, publicKey);
+			GetEd25519 ()->EncodePublicKey (publicKey, m_PublicKeyEncoded);	
 		}
-		BN_CTX_free (ctx);
 	} 
 		
 	void EDDSA25519Signer::Sign (const uint8_t * buf, int len, uint8_t * signature) const
@@ -361,46 +361,15 @@ namespace crypto
 	typedef RSASigner<SHA512Hash, NID_sha512, RSASHA5124096_KEY_LENGTH> RSASHA5124096Signer;
 
 	// EdDSA
-	struct EDDSAPoint
+	struct EDDSAFieldElement // mod 2^255-19, 5 limbs of 51 bits, Little Endian
 	{
-		BIGNUM * x, * y;
-		BIGNUM * z, * t; // projective coordinates
-		EDDSAPoint (): x(nullptr), y(nullptr), z(nullptr), t(nullptr) {};
-		EDDSAPoint (const EDDSAPoint& other): x(nullptr), y(nullptr), z(nullptr), t(nullptr) 
-		{ *this = other; };	
-		EDDSAPoint (EDDSAPoint&& other): x(nullptr), y(nullptr), z(nullptr), t(nullptr)  
-		{ *this = std::move (other); };	
-		EDDSAPoint (BIGNUM * x1, BIGNUM * y1, BIGNUM * z1 = nullptr, BIGNUM * t1 = nullptr): x(x1), y(y1), z(z1), t(t1) {};	
-		~EDDSAPoint () { BN_free (x); BN_free (y); BN_free(z); BN_free(t); };
-
-		EDDSAPoint& operator=(EDDSAPoint&& other) 
-		{
-			if (x) BN_free (x); x = other.x; other.x = nullptr;
-			if (y) BN_free (y); y = other.y; other.y = nullptr;
-			if (z) BN_free (z); z = other.z; other.z = nullptr;
-			if (t) BN_free (t); t = other.t; other.t = nullptr;
-			return *this;
-		} 	
-
-		EDDSAPoint& operator=(const EDDSAPoint& other) 
-		{
-			if (x) BN_free (x); x = other.x ? BN_dup (other.x) : nullptr;
-			if (y) BN_free (y); y = other.y ? BN_dup (other.y) : nullptr;
-			if (z) BN_free (z); z = other.z ? BN_dup (other.z) : nullptr;
-			if (t) BN_free (t); t = other.t ? BN_dup (other.t) : nullptr;
-			return *this;
-		}
+		uint64_t v[5];
+	};
 
-		EDDSAPoint operator-() const
-		{
-			BIGNUM * x1 = NULL, * y1 = NULL, * z1 = NULL, * t1 = NULL;
-			if (x) { x1 = BN_dup (x); BN_set_negative (x1, !BN_is_negative (x)); };
-			if (y) y1 = BN_dup (y);
-			if (z) z1 = BN_dup (z);
-			if (t) { t1 = BN_dup (t); BN_set_negative (t1, !BN_is_negative (t)); };
-			return EDDSAPoint {x1, y1, z1, t1};
-		}
-	};	
+	struct EDDSAPoint // extended coordinates, x = X/Z, y = Y/Z, x*y = T/Z
+	{
+		EDDSAFieldElement x, y, z, t;
+	};
 
 	const size_t EDDSA25519_PUBLIC_KEY_LENGTH = 32;
 	const size_t EDDSA25519_SIGNATURE_LENGTH = 64;
@@ -1,6 +1,8 @@
 #include <string.h>
+#include <algorithm>
 #include "I2PEndian.h"
 #include "Log.h"
+#include "Timestamp.h"
 #include "RouterContext.h"
 #include "I2NPProtocol.h"
 #include "Tunnel.h"
@@ -24,23 +26,67 @@ namespace tunnel
 		m_Encryption.Encrypt (in->GetPayload () + 4, out->GetPayload () + 4); 
 	}	
 
+	void TransitTunnel::EncryptTunnelMsgs (const std::vector<std::shared_ptr<const I2NPMessage> >& in, 
+		const std::vector<std::shared_ptr<I2NPMessage> >& out)
+	{
+		i2p::crypto::TunnelEncryption * encryptions[TUNNEL_DATA_MAX_NUM_PENDING_MSGS];
+		const uint8_t * inPayloads[TUNNEL_DATA_MAX_NUM_PENDING_MSGS];
+		uint8_t * outPayloads[TUNNEL_DATA_MAX_NUM_PENDING_MSGS];
+		for (size_t i = 0; i < in.size (); i += TUNNEL_DATA_MAX_NUM_PENDING_MSGS)
+		{
+			size_t num = std::min (in.size () - i, TUNNEL_DATA_MAX_NUM_PENDING_MSGS);
+			for (size_t j = 0; j < num; j++)
+			{
+				encryptions[j] = &m_Encryption;
+				inPayloads[j] = in[i + j]->GetPayload () + 4;
+				outPayloads[j] = out[i + j]->GetPayload () + 4;
+			}
+			i2p::crypto::TunnelEncryption::Encrypt (num, encryptions, inPayloads, outPayloads);
+		}
+	}
+
 	TransitTunnelParticipant::~TransitTunnelParticipant ()
 	{
 	}	
 		
 	void TransitTunnelParticipant::HandleTunnelDataMsg (std::shared_ptr<const i2p::I2NPMessage> tunnelMsg)
 	{
-		auto newMsg = CreateEmptyTunnelDataMsg ();
-		EncryptTunnelMsg (tunnelMsg, newMsg);
-		
+		// we encrypt messages of the same tunnel at once
 		m_NumTransmittedBytes += tunnelMsg->GetLength ();
-		htobe32buf (newMsg->GetPayload (), GetNextTunnelID ());
-		newMsg->FillI2NPMessageHeader (eI2NPTunnelData); 
-		m_TunnelDataMsgs.push_back (newMsg);
+		m_PendingTunnelDataMsgs.push_back (std::move (tunnelMsg));
+		if (m_PendingTunnelDataMsgs.size () >= TUNNEL_DATA_MAX_NUM_PENDING_MSGS)
+			HandlePendingTunnelDataMsgs ();
+	}
+
+	void TransitTunnelParticipant::HandlePendingTunnelDataMsgs ()
+	{
+		if (m_PendingTunnelDataMsgs.empty ()) return;
+		std::vector<std::shared_ptr<i2p::I2NPMessage> > newMsgs;
+		newMsgs.reserve (m_PendingTunnelDataMsgs.size ());
+		for (auto& msg: m_PendingTunnelDataMsgs)
+			newMsgs.push_back (GetWritableTunnelDataMsg (msg));
+		EncryptTunnelMsgs (m_PendingTunnelDataMsgs, newMsgs);
+		auto expiration = i2p::util::GetMillisecondsSinceEpoch () + I2NP_MESSAGE_EXPIRATION_TIMEOUT;
+		for (size_t i = 0; i < newMsgs.size (); i++)
+		{
+			auto& newMsg = newMsgs[i];
+			htobe32buf (newMsg->GetPayload (), GetNextTunnelID ());
+			if (newMsg == m_PendingTunnelDataMsgs[i])
+			{
+				// re-encrypted in place, keep msgID
+				newMsg->SetExpiration (expiration);
+				newMsg->UpdateChks (); // NTCP peers verify it
+			}
+			else	
+				newMsg->FillI2NPMessageHeader (eI2NPTunnelData); 
+			m_TunnelDataMsgs.push_back (newMsg);
+		}
+		m_PendingTunnelDataMsgs.clear ();
 	}
 
 	void TransitTunnelParticipant::FlushTunnelDataMsgs ()
 	{
+		HandlePendingTunnelDataMsgs ();
 		if (!m_TunnelDataMsgs.empty ())
 		{	
 			auto num = m_TunnelDataMsgs.size ();
@@ -78,11 +124,23 @@ namespace tunnel
 		
 	void TransitTunnelEndpoint::HandleTunnelDataMsg (std::shared_ptr<const i2p::I2NPMessage> tunnelMsg)
 	{
-		auto newMsg = CreateEmptyTunnelDataMsg ();
-		EncryptTunnelMsg (tunnelMsg, newMsg);
-		
-		LogPrint (eLogDebug, "TransitTunnel: handle msg for endpoint ", GetTunnelID ());
-		m_Endpoint.HandleDecryptedTunnelDataMsg (newMsg); 
+		m_PendingTunnelDataMsgs.push_back (std::move (tunnelMsg));
+		if (m_PendingTunnelDataMsgs.size () >= TUNNEL_DATA_MAX_NUM_PENDING_MSGS)
+			FlushTunnelDataMsgs ();
+	}
+
+	void TransitTunnelEndpoint::FlushTunnelDataMsgs ()
+	{
+		if (m_PendingTunnelDataMsgs.empty ()) return;
+		LogPrint (eLogDebug, "TransitTunnel: handle ", m_PendingTunnelDataMsgs.size (), " msgs for endpoint ", GetTunnelID ());
+		std::vector<std::shared_ptr<i2p::I2NPMessage> > newMsgs;
+		newMsgs.reserve (m_PendingTunnelDataMsgs.size ());
+		for (auto& msg: m_PendingTunnelDataMsgs)
+			newMsgs.push_back (GetWritableTunnelDataMsg (msg));
+		EncryptTunnelMsgs (m_PendingTunnelDataMsgs, newMsgs);
+		m_PendingTunnelDataMsgs.clear ();
+		for (auto& newMsg: newMsgs)
+			m_Endpoint.HandleDecryptedTunnelDataMsg (newMsg); 
 	}
 		
 	std::shared_ptr<TransitTunnel> CreateTransitTunnel (uint32_t receiveTunnelID,
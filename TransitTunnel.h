@@ -29,6 +29,9 @@ namespace tunnel
 			void SendTunnelDataMsg (std::shared_ptr<i2p::I2NPMessage> msg);
 			void HandleTunnelDataMsg (std::shared_ptr<const i2p::I2NPMessage> tunnelMsg);
 			void EncryptTunnelMsg (std::shared_ptr<const I2NPMessage> in, std::shared_ptr<I2NPMessage> out); 			
+			void EncryptTunnelMsgs (const std::vector<std::shared_ptr<const I2NPMessage> >& in, 
+				const std::vector<std::shared_ptr<I2NPMessage> >& out); 
+
 		private:
 			
 			i2p::crypto::TunnelEncryption m_Encryption;
@@ -49,9 +52,14 @@ namespace tunnel
 			void HandleTunnelDataMsg (std::shared_ptr<const i2p::I2NPMessage> tunnelMsg);
 			void FlushTunnelDataMsgs ();
 
+		private:
+
+			void HandlePendingTunnelDataMsgs ();
+
 		private:
 
 			size_t m_NumTransmittedBytes;
+			std::vector<std::shared_ptr<const i2p::I2NPMessage> > m_PendingTunnelDataMsgs; // not encrypted yet
 			std::vector<std::shared_ptr<i2p::I2NPMessage> > m_TunnelDataMsgs;
 	};	
 	
@@ -88,11 +96,13 @@ namespace tunnel
 			void Cleanup () { m_Endpoint.Cleanup (); }
 			
 			void HandleTunnelDataMsg (std::shared_ptr<const i2p::I2NPMessage> tunnelMsg);
+			void FlushTunnelDataMsgs ();
 			size_t GetNumTransmittedBytes () const { return m_Endpoint.GetNumReceivedBytes (); }
 			
 		private:
 
 			TunnelEndpoint m_Endpoint;
+			std::vector<std::shared_ptr<const i2p::I2NPMessage> > m_PendingTunnelDataMsgs; // not decrypted yet
 	};
 	
 	std::shared_ptr<TransitTunnel> CreateTransitTunnel (uint32_t receiveTunnelID,
@@ -5,11 +5,19 @@
 #include <iostream>
 #include <memory>
 #include <vector>
+#include <deque>
+#include <atomic>
+#ifdef __linux__
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
 #include "Identity.h"
 #include "Crypto.h"
 #include "RouterInfo.h"
 #include "I2NPProtocol.h"
 #include "Timestamp.h"
+#include "Queue.h"
 
 namespace i2p
 {
@@ -50,13 +58,139 @@ namespace transport
 			std::stringstream m_Stream;
 	};		
 
+	enum SendQueueClass
+	{
+		eSendQueueControl = 0, // DeliveryStatus
+		eSendQueueBuild, // tunnel build requests and replies
+		eSendQueueNetDb, // DatabaseStore, DatabaseLookup, DatabaseSearchReply
+		eSendQueueData, // tunnel data and the rest
+		eNumSendQueueClasses
+	};
+
+	const size_t SEND_QUEUE_MAX_SIZES[eNumSendQueueClasses] = { 64, 0, 64, 200 }; // 0 means never drop
+	const int SEND_QUEUE_WEIGHTS[eNumSendQueueClasses] = { 4, 4, 2, 1 }; // messages per round
+	const size_t SEND_QUEUE_MAX_TOTAL_SIZE = 1024; // peer doesn't read, session should be closed
+
+	inline SendQueueClass GetSendQueueClass (uint8_t typeID)
+	{
+		switch (typeID)
+		{
+			case eI2NPDeliveryStatus:
+				return eSendQueueControl;
+			case eI2NPTunnelBuild:
+			case eI2NPTunnelBuildReply:
+			case eI2NPVariableTunnelBuild:
+			case eI2NPVariableTunnelBuildReply:
+				return eSendQueueBuild;
+			case eI2NPDatabaseStore:
+			case eI2NPDatabaseLookup:
+			case eI2NPDatabaseSearchReply:
+				return eSendQueueNetDb;
+			default:
+				return eSendQueueData;
+		}
+	}
+
+	// outgoing messages of a session, accessed from session's thread only, size from any
+	class TransportSendQueue
+	{
+		public:
+
+			TransportSendQueue (): m_Size (0), m_Current (0), m_Credits (SEND_QUEUE_WEIGHTS[0])
+			{
+				for (int i = 0; i < eNumSendQueueClasses; i++) m_NumDropped[i] = 0;
+			}
+
+			bool Push (std::shared_ptr<I2NPMessage> msg) // false if total size exceeded
+			{
+				auto c = GetSendQueueClass (msg->GetTypeID ());
+				auto& q = m_Queues[c];
+				if (SEND_QUEUE_MAX_SIZES[c] && q.size () >= SEND_QUEUE_MAX_SIZES[c])
+				{
+					m_NumDropped[c]++;
+					if (c == eSendQueueControl) return true; // drop newest
+					q.pop_front (); // drop oldest
+					m_Size--;
+				}
+				q.push_back (msg);
+				m_Size++;
+				return m_Size <= SEND_QUEUE_MAX_TOTAL_SIZE;
+			}
+
+			std::shared_ptr<I2NPMessage> Peek () // next message to send, weighted round robin
+			{
+				if (!m_Size) return nullptr;
+				while (!m_Credits || m_Queues[m_Current].empty ())
+				{
+					m_Current = (m_Current + 1) % eNumSendQueueClasses;
+					m_Credits = SEND_QUEUE_WEIGHTS[m_Current];
+				}
+				return m_Queues[m_Current].front ();
+			}
+
+			std::shared_ptr<I2NPMessage> Pop ()
+			{
+				auto msg = Peek ();
+				if (msg)
+				{
+					m_Queues[m_Current].pop_front ();
+					m_Size--;
+					m_Credits--;
+				}
+				return msg;
+			}
+
+			void Clear ()
+			{
+				for (auto& q: m_Queues) q.clear ();
+				m_Size = 0;
+			}
+
+			bool IsEmpty () const { return !m_Size; };
+			size_t GetSize () const { return m_Size; };
+			size_t GetSize (SendQueueClass c) const { return m_Queues[c].size (); };
+			uint64_t GetNumDropped (SendQueueClass c) const { return m_NumDropped[c]; };
+
+		private:
+
+			std::deque<std::shared_ptr<I2NPMessage> > m_Queues[eNumSendQueueClasses];
+			uint64_t m_NumDropped[eNumSendQueueClasses];
+			std::atomic<size_t> m_Size; // for session selection
+			int m_Current, m_Credits;
+	};
+
+	enum TransportType
+	{
+		eTransportNTCP2 = 0,
+		eTransportNTCP,
+		eTransportSSU,
+		eNumTransportTypes // default order of connection attempts
+	};
+
+	const int TRANSPORT_SESSION_STATS_INTERVAL = 1000; // in milliseconds
+	const int TRANSPORT_SESSION_DEFAULT_RTT = 250; // in milliseconds, until measured
+	const uint32_t TRANSPORT_SESSION_MIN_THROUGHPUT = 16*1024; // in bytes per second, new or idle session
+	const size_t TRANSPORT_SESSION_MESSAGE_SIZE = 1024; // typical queued message, tunnel data
+	const size_t TRANSPORT_SESSION_BACKLOG_SIZE = 32; // queued messages, spill over to next session
+	const size_t TRANSPORT_SESSION_POSTED_QUEUE_SIZE = 256; // messages from other threads before overflow list, power of 2
+
+	// expected delivery time of next message, in milliseconds
+	// while messages are queued session sends as fast as it can, so recent throughput is the rate the queue drains at
+	inline int GetTransportCost (int rtt, uint32_t throughput = 0, size_t backlog = 0)
+	{
+		if (rtt <= 0) rtt = TRANSPORT_SESSION_DEFAULT_RTT;
+		if (throughput < TRANSPORT_SESSION_MIN_THROUGHPUT) throughput = TRANSPORT_SESSION_MIN_THROUGHPUT;
+		return rtt + (uint64_t)backlog*TRANSPORT_SESSION_MESSAGE_SIZE*1000/throughput;
+	}
+
 	class TransportSession
 	{
 		public:
 
 			TransportSession (std::shared_ptr<const i2p::data::RouterInfo> router, int terminationTimeout): 
 				m_DHKeysPair (nullptr), m_NumSentBytes (0), m_NumReceivedBytes (0), m_IsOutgoing (router), m_TerminationTimeout (terminationTimeout), 
-				m_LastActivityTimestamp (i2p::util::GetSecondsSinceEpoch ())
+				m_LastActivityTimestamp (i2p::util::GetSecondsSinceEpoch ()), m_RTT (0), m_Throughput (0),
+				m_StatsUpdateTime (0), m_StatsNumSentBytes (0)
 			{
 				if (router)
 					m_RemoteIdentity = router->GetRouterIdentity ();
@@ -80,7 +214,51 @@ namespace transport
 			{ return ts >= m_LastActivityTimestamp + GetTerminationTimeout (); };	
 
 			virtual void SendI2NPMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs) = 0;
+			virtual TransportType GetTransportType () const = 0;
+
+			const TransportSendQueue& GetSendQueue () const { return m_SendQueue; };
+
+			// for session selection, from any thread
+			int GetRTT () const { return m_RTT; }; // smoothed, in milliseconds, 0 if not measured yet
+			uint32_t GetThroughput () const { return m_Throughput; }; // sent bytes per second, recent
+			size_t GetBacklog () const { return m_SendQueue.GetSize (); };
+			bool IsBacklogged () const { return GetBacklog () >= TRANSPORT_SESSION_BACKLOG_SIZE; };
+			int GetCost () const { return GetTransportCost (m_RTT, m_Throughput, GetBacklog ()); };
 			
+		protected:
+
+			// messages from other threads, session's thread is woken up only if none are pending
+			bool PostMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs) { return m_PostedMessages.Put (msgs); }; // true if wake up needed
+			bool TakePostedMessages (std::vector<std::shared_ptr<I2NPMessage> >& msgs) // in session's thread, true if more were posted meanwhile
+			{
+				m_PostedMessages.GetAll (msgs);
+				return !m_PostedMessages.IsEmpty ();
+			}
+
+			void SetRTT (int rtt) { m_RTT = rtt; };
+			bool UpdateStats () // after bytes are sent, true if new interval has started
+			{
+				auto ts = i2p::util::GetMillisecondsSinceEpoch ();
+				if (ts < m_StatsUpdateTime + TRANSPORT_SESSION_STATS_INTERVAL) return false;
+				if (m_StatsUpdateTime && ts < m_StatsUpdateTime + 2*TRANSPORT_SESSION_STATS_INTERVAL) // idle gaps don't tell capacity
+				{
+					uint32_t throughput = (m_NumSentBytes - m_StatsNumSentBytes)*1000/(ts - m_StatsUpdateTime);
+					m_Throughput = m_Throughput ? (3*m_Throughput + throughput)/4 : throughput;
+				}
+				m_StatsUpdateTime = ts;
+				m_StatsNumSentBytes = m_NumSentBytes;
+				return true;
+			}
+#ifdef __linux__
+			void UpdateTCPRTT (int fd) // from kernel
+			{
+				tcp_info info;
+				socklen_t len = sizeof (info);
+				if (!getsockopt (fd, IPPROTO_TCP, TCP_INFO, &info, &len) && info.tcpi_rtt)
+					m_RTT = info.tcpi_rtt/1000 + 1; // in microseconds
+			}
+#endif
+
 		protected:
 
 			std::shared_ptr<const i2p::data::IdentityEx> m_RemoteIdentity; 
@@ -89,7 +267,39 @@ namespace transport
 			bool m_IsOutgoing;
 			int m_TerminationTimeout;
 			uint64_t m_LastActivityTimestamp;
+			TransportSendQueue m_SendQueue;
+			i2p::util::MPSCQueue<std::shared_ptr<I2NPMessage>, TRANSPORT_SESSION_POSTED_QUEUE_SIZE> m_PostedMessages;
+			std::vector<std::shared_ptr<I2NPMessage> > m_TakenMessages; // session's thread only, keeps capacity
+			std::atomic<int> m_RTT;
+			std::atomic<uint32_t> m_Throughput;
+			uint64_t m_StatsUpdateTime; // in milliseconds
+			size_t m_StatsNumSentBytes;
 	};	
+
+	// best by cost, next best if the best one is backlogged and next has shorter queue
+	template<typename Sessions>
+	typename Sessions::value_type SelectTransportSession (const Sessions& sessions)
+	{
+		if (sessions.size () <= 1) return sessions.empty () ? nullptr : sessions.front ();
+		typename Sessions::value_type best, next;
+		int bestCost = 0, nextCost = 0;
+		for (const auto& it: sessions)
+		{
+			int cost = it->GetCost ();
+			if (!best || cost < bestCost)
+			{
+				next = best; nextCost = bestCost;
+				best = it; bestCost = cost;
+			}
+			else if (!next || cost < nextCost)
+			{
+				next = it; nextCost = cost;
+			}
+		}
+		if (best->IsBacklogged () && next->GetBacklog () < best->GetBacklog ())
+			return next; // spill over
+		return best;
+	}
 }
 }
 
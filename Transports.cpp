@@ -1,3 +1,4 @@
+#include <algorithm>
 #include "Log.h"
 #include "Crypto.h"
 #include "RouterContext.h"
@@ -17,7 +18,8 @@ namespace i2p
 namespace transport
 {
 	DHKeysPairSupplier::DHKeysPairSupplier (int size):
-		m_QueueSize (size), m_IsRunning (false), m_Thread (nullptr)
+		m_MinSize (size), m_NumThreads (1), m_TargetSize (size), m_NumInProgress (0), m_IsRunning (false),
+		m_LastRateUpdateTime (0), m_NumAcquiredSinceUpdate (0), m_NumHits (0), m_NumMisses (0)
 	{
 	}	
 
@@ -29,71 +31,87 @@ namespace transport
 	void DHKeysPairSupplier::Start ()
 	{
 		m_IsRunning = true;
-		m_Thread = new std::thread (std::bind (&DHKeysPairSupplier::Run, this));
+		m_LastRateUpdateTime = i2p::util::GetSecondsSinceEpoch ();
+		i2p::crypto::PrecalculateDHTable (); // fixed-base table for GenerateKeys
+		int numThreads = m_NumThreads;
+		if (numThreads < 1) numThreads = 1;
+		if (numThreads > DH_KEYS_MAX_NUM_THREADS) numThreads = DH_KEYS_MAX_NUM_THREADS;
+		for (int i = 0; i < numThreads; i++)
+			m_Threads.push_back (new std::thread (std::bind (&DHKeysPairSupplier::Run, this, i)));
 	}
 
 	void DHKeysPairSupplier::Stop ()
 	{
-		m_IsRunning = false;
-		m_Acquired.notify_one ();	
-		if (m_Thread)
+		{
+			std::unique_lock<std::mutex> l(m_AcquiredMutex);
+			m_IsRunning = false;
+		}
+		m_Acquired.notify_all ();	
+		for (auto thread: m_Threads)
 		{	
-			m_Thread->join (); 
-			delete m_Thread;
-			m_Thread = 0;
-		}	
+			thread->join (); 
+			delete thread;
+		}
+		m_Threads.clear ();
 	}
 
-	void DHKeysPairSupplier::Run ()
+	void DHKeysPairSupplier::Run (int threadNum)
 	{
+		// first thread keeps the pool filled, others help if it's behind
+		std::unique_lock<std::mutex> l(m_AcquiredMutex);
 		while (m_IsRunning)
 		{
-			int num, total = 0;
-			while ((num = m_QueueSize - (int)m_Queue.size ()) > 0 && total < 20)
-			{	
-				CreateDHKeysPairs (num);
-				total += num;
-			}
-			if (total >= 20)
+			if ((int)m_Queue.size () + m_NumInProgress < m_TargetSize && (!threadNum || IsBehind ()))
 			{
-				LogPrint (eLogWarning, "Transports: ", total, " DH keys generated at the time");
-				std::this_thread::sleep_for (std::chrono::seconds(1)); // take a break
+				m_NumInProgress++;
+				l.unlock ();
+				auto pair = std::make_shared<i2p::crypto::DHKeys> ();
+				pair->GenerateKeys ();
+				l.lock ();
+				m_NumInProgress--;
+				m_Queue.push (pair);
 			}
 			else
-			{
-				std::unique_lock<std::mutex>	l(m_AcquiredMutex);
 				m_Acquired.wait (l); // wait for element gets aquired
-			}	
 		}
 	}		
 
-	void DHKeysPairSupplier::CreateDHKeysPairs (int num)
+	void DHKeysPairSupplier::UpdateTargetSize (uint64_t ts)
 	{
-		if (num > 0)
-		{
-			for (int i = 0; i < num; i++)
-			{
-				auto pair = std::make_shared<i2p::crypto::DHKeys> ();
-				pair->GenerateKeys ();
-				std::unique_lock<std::mutex>	l(m_AcquiredMutex);
-				m_Queue.push (pair);
-			}
-		}
+		// called under lock
+		if (ts < m_LastRateUpdateTime + DH_KEYS_RATE_INTERVAL) return;
+		int target = m_NumAcquiredSinceUpdate*DH_KEYS_POOL_TIME/(ts - m_LastRateUpdateTime);
+		if (target < m_TargetSize) target = (target + m_TargetSize)/2; // shrink slowly
+		if (target < m_MinSize) target = m_MinSize;
+		if (target > DH_KEYS_MAX_POOL_SIZE) target = DH_KEYS_MAX_POOL_SIZE;
+		if (target != m_TargetSize)
+			LogPrint (eLogDebug, "Transports: DH keys pool size changed from ", (int)m_TargetSize, " to ", target);
+		m_TargetSize = target;
+		m_NumAcquiredSinceUpdate = 0;
+		m_LastRateUpdateTime = ts;
 	}
 
 	std::shared_ptr<i2p::crypto::DHKeys> DHKeysPairSupplier::Acquire ()
 	{
 		{
 			std::unique_lock<std::mutex>	l(m_AcquiredMutex);
+			m_NumAcquiredSinceUpdate++;
+			UpdateTargetSize (i2p::util::GetSecondsSinceEpoch ());
 			if (!m_Queue.empty ())
 			{
 				auto pair = m_Queue.front ();
 				m_Queue.pop ();
-				m_Acquired.notify_one ();
+				m_NumHits++;
+				m_Acquired.notify_all (); // helpers recheck IsBehind, first thread must not miss it
 				return pair;
-			}	
+			}
+			// pool is drained, grow it at once
+			int target = m_TargetSize + m_MinSize;
+			m_TargetSize = target < DH_KEYS_MAX_POOL_SIZE ? target : DH_KEYS_MAX_POOL_SIZE;
+			m_Acquired.notify_all ();
 		}	
 		// queue is empty, create new
+		m_NumMisses++;
 		auto pair = std::make_shared<i2p::crypto::DHKeys> ();
 		pair->GenerateKeys ();
 		return pair;
@@ -102,8 +120,15 @@ namespace transport
 	void DHKeysPairSupplier::Return (std::shared_ptr<i2p::crypto::DHKeys> pair)
 	{
 		std::unique_lock<std::mutex>l(m_AcquiredMutex);
-		if ((int)m_Queue.size () < 2*m_QueueSize)
+		if ((int)m_Queue.size () < 2*m_TargetSize)
 			m_Queue.push (pair);
+		m_Acquired.notify_all ();
+	}
+
+	int DHKeysPairSupplier::GetPoolSize () const
+	{
+		std::unique_lock<std::mutex>l(m_AcquiredMutex);
+		return m_Queue.size ();
 	}
 
 	Transports transports;	
@@ -111,7 +136,7 @@ namespace transport
 	Transports::Transports (): 
 		m_IsOnline (true), m_IsRunning (false), m_Thread (nullptr), m_Service (nullptr),
 		m_Work (nullptr), m_PeerCleanupTimer (nullptr), m_PeerTestTimer (nullptr),
-		m_NTCPServer (nullptr), m_SSUServer (nullptr), m_DHKeysPairSupplier (5), // 5 pre-generated keys
+		m_NTCPServer (nullptr), m_NumNTCPThreads (1), m_SSUServer (nullptr), m_NumSSUThreads (1), m_NTCP2Server (nullptr), m_DHKeysPairSupplier (5), // 5 pre-generated keys
 		m_TotalSentBytes(0), m_TotalReceivedBytes(0), m_InBandwidth (0), m_OutBandwidth (0),
 		m_LastInBandwidthUpdateBytes (0), m_LastOutBandwidthUpdateBytes (0), m_LastBandwidthUpdateTime (0)	
 	{		
@@ -129,7 +154,7 @@ namespace transport
 		}	
 	}	
 
-	void Transports::Start (bool enableNTCP, bool enableSSU)
+	void Transports::Start (bool enableNTCP, bool enableSSU, bool enableNTCP2)
 	{
 		if (!m_Service)
 		{
@@ -149,7 +174,7 @@ namespace transport
 			if (!address) continue;
 			if (m_NTCPServer == nullptr && enableNTCP)
 			{
-				m_NTCPServer = new NTCPServer ();
+				m_NTCPServer = new NTCPServer (m_NumNTCPThreads);
 				m_NTCPServer->Start ();
 				if (!(m_NTCPServer->IsBoundV6() || m_NTCPServer->IsBoundV4())) {
 					/** failed to bind to NTCP */
@@ -160,14 +185,34 @@ namespace transport
 				}
 			}	
 			
-			if (address->transportStyle == RouterInfo::eTransportSSU)
+			if (address->transportStyle == RouterInfo::eTransportNTCP2)
+			{
+#ifdef NTCP2_SUPPORTED
+				if (m_NTCP2Server == nullptr && enableNTCP2)
+				{
+					m_NTCP2Server = new NTCP2Server ();
+					m_NTCP2Server->Start ();
+					if (!(m_NTCP2Server->IsBoundV6() || m_NTCP2Server->IsBoundV4()))
+					{
+						LogPrint(eLogError, "Transports: failed to bind to NTCP2 port");
+						m_NTCP2Server->Stop();
+						delete m_NTCP2Server;
+						m_NTCP2Server = nullptr;
+					}
+				}
+#else
+				if (enableNTCP2)
+					LogPrint(eLogError, "Transports: NTCP2 requires OpenSSL 1.1.1");
+#endif
+			}
+			else if (address->transportStyle == RouterInfo::eTransportSSU)
 			{
 				if (m_SSUServer == nullptr && enableSSU)
 				{
 					if (address->host.is_v4())
-						m_SSUServer = new SSUServer (address->port);
+						m_SSUServer = new SSUServer (address->port, m_NumSSUThreads);
 					else
-						m_SSUServer = new SSUServer (address->host, address->port);
+						m_SSUServer = new SSUServer (address->host, address->port, m_NumSSUThreads);
 					LogPrint (eLogInfo, "Transports: Start listening UDP port ", address->port);
 					try {
 						m_SSUServer->Start ();
@@ -193,7 +238,11 @@ namespace transport
 	{	
 		if (m_PeerCleanupTimer) m_PeerCleanupTimer->cancel ();	
 		if (m_PeerTestTimer) m_PeerTestTimer->cancel ();
-		m_Peers.clear ();
+		for (auto& shard: m_PeersShards)
+		{
+			std::unique_lock<std::mutex> l(shard.mutex);
+			shard.peers.clear ();
+		}
 		if (m_SSUServer)
 		{
 			m_SSUServer->Stop ();
@@ -206,6 +255,14 @@ namespace transport
 			delete m_NTCPServer;
 			m_NTCPServer = nullptr;
 		}	
+#ifdef NTCP2_SUPPORTED
+		if (m_NTCP2Server)
+		{
+			m_NTCP2Server->Stop ();
+			delete m_NTCP2Server;
+			m_NTCP2Server = nullptr;
+		}
+#endif
 
 		m_DHKeysPairSupplier.Stop ();
 		m_IsRunning = false;
@@ -267,139 +324,244 @@ namespace transport
 #ifdef WITH_EVENTS
 		QueueIntEvent("transport.send", ident.ToBase64(), msgs.size());
 #endif
-		m_Service->post (std::bind (&Transports::PostMessages, this, ident, msgs));
-	}	
-
-	void Transports::PostMessages (i2p::data::IdentHash ident, std::vector<std::shared_ptr<i2p::I2NPMessage> > msgs)
-	{
+		if (!m_Service) return; // not started, drop
 		if (ident == i2p::context.GetRouterInfo ().GetIdentHash ())
-		{	
+		{
 			// we send it to ourself
-			for (auto& it: msgs)
-				m_LoopbackHandler.PutNextMessage (it);
-			m_LoopbackHandler.Flush ();
+			m_Service->post (std::bind (&Transports::PostLoopbackMessages, this, msgs));
 			return;
 		}
+		std::shared_ptr<TransportSession> session;
+		{
+			auto& shard = GetPeersShard (ident);
+			std::unique_lock<std::mutex> l(shard.mutex);
+			auto it = shard.peers.find (ident);
+			if (it != shard.peers.end ())
+				session = it->second.SelectSession ();
+		}
+		if (session)
+			session->SendI2NPMessages (msgs); // established, directly to session's thread
+		else
+			QueueMessages (ident, msgs);
+	}
+
+	void Transports::PostLoopbackMessages (std::vector<std::shared_ptr<i2p::I2NPMessage> > msgs)
+	{
+		for (auto& it: msgs)
+			m_LoopbackHandler.PutNextMessage (it);
+		m_LoopbackHandler.Flush ();
+	}
+
+	void Transports::QueueMessages (const i2p::data::IdentHash& ident, const std::vector<std::shared_ptr<i2p::I2NPMessage> >& msgs)
+	{
 		if(RoutesRestricted() && ! IsRestrictedPeer(ident)) return;
-		auto it = m_Peers.find (ident);
-		if (it == m_Peers.end ())
+		bool isNew = false;
 		{
-			bool connected = false; 
-			try
+			auto& shard = GetPeersShard (ident);
+			std::unique_lock<std::mutex> l(shard.mutex);
+			auto it = shard.peers.find (ident);
+			if (it == shard.peers.end ())
+			{
+				// messages wait for connection made by transports thread
+				it = shard.peers.insert (std::pair<i2p::data::IdentHash, Peer>(ident,
+					Peer (nullptr, i2p::util::GetSecondsSinceEpoch ()))).first;
+				isNew = true;
+			}
+			auto session = it->second.SelectSession ();
+			if (session)
+				session->SendI2NPMessages (msgs);
+			else
 			{
-				auto r = netdb.FindRouter (ident);
+				if (it->second.delayedMessages.size () < MAX_NUM_DELAYED_MESSAGES)
+				{
+					for (auto& it1: msgs)
+						it->second.delayedMessages.push_back (it1);
+				}
+				else
 				{
-					std::unique_lock<std::mutex>	l(m_PeersMutex);	
-					it = m_Peers.insert (std::pair<i2p::data::IdentHash, Peer>(ident, { 0, r, {},
-						i2p::util::GetSecondsSinceEpoch (), {} })).first;
+					LogPrint (eLogWarning, "Transports: delayed messages queue size exceeds ", MAX_NUM_DELAYED_MESSAGES);
+					shard.peers.erase (it);
+					return;
 				}
-				connected = ConnectToPeer (ident, it->second);
 			}
-			catch (std::exception& ex)
+		}
+		if (isNew)
+			m_Service->post ([this, ident]()
+				{
+					try
+					{
+						ConnectToPeer (ident);
+					}
+					catch (std::exception& ex)
+					{
+						LogPrint (eLogError, "Transports: ConnectToPeer exception:", ex.what ());
+					}
+				});
+	}
+
+	bool Transports::ConnectToPeer (const i2p::data::IdentHash& ident)
+	{
+		// peer's state is changed under shard lock, sessions are created without it
+		auto& shard = GetPeersShard (ident);
+		std::shared_ptr<const i2p::data::RouterInfo> router;
+		for (;;)
+		{
+			TransportType transport;
 			{
-				LogPrint (eLogError, "Transports: PostMessages exception:", ex.what ());
-			}
-			if (!connected) return;
-		}	
-		if (!it->second.sessions.empty ())
-			it->second.sessions.front ()->SendI2NPMessages (msgs);
-		else
-		{	
-			if (it->second.delayedMessages.size () < MAX_NUM_DELAYED_MESSAGES)
-			{	
-				for (auto& it1: msgs)
-					it->second.delayedMessages.push_back (it1);
+				std::unique_lock<std::mutex> l(shard.mutex);
+				auto it = shard.peers.find (ident);
+				if (it == shard.peers.end ()) return false; // dropped meanwhile
+				auto& peer = it->second;
+				if (!peer.sessions.empty ()) return true; // incoming connection meanwhile
+				if (!peer.router) peer.router = router; // found in netdb
+				if (!peer.router)
+				{
+					l.unlock ();
+					router = i2p::data::netdb.FindRouter (ident);
+					if (router) continue;
+					LogPrint (eLogInfo, "Transports: RouterInfo for ", ident.ToBase64 (), " not found, requested");
+					i2p::data::netdb.RequestDestination (ident, std::bind (
+						&Transports::RequestComplete, this, std::placeholders::_1, ident));
+					return true;
+				}
+				if (!peer.numAttempts) SortTransports (peer);
+				if (peer.numAttempts >= eNumTransportTypes)
+				{
+					LogPrint (eLogInfo, "Transports: No NTCP or SSU addresses available");
+					peer.Done ();
+					shard.peers.erase (it);
+					return false;
+				}
+				transport = peer.transports[peer.numAttempts];
+				peer.numAttempts++;
+				router = peer.router;
 			}
-			else
+			bool connected = false;
+			switch (transport)
 			{
-				LogPrint (eLogWarning, "Transports: delayed messages queue size exceeds ", MAX_NUM_DELAYED_MESSAGES);
-				std::unique_lock<std::mutex> l(m_PeersMutex);	
-				m_Peers.erase (it);
-			}	
-		}	
+				case eTransportNTCP2:
+					connected = ConnectNTCP2 (router);
+				break;
+				case eTransportNTCP:
+					connected = ConnectNTCP (ident, router);
+				break;
+				case eTransportSSU:
+					connected = ConnectSSU (ident, router);
+				break;
+				default: ;
+			}
+			if (connected) return true;
+		}
 	}	
-		
-	bool Transports::ConnectToPeer (const i2p::data::IdentHash& ident, Peer& peer)
+	
+	void Transports::SortTransports (Peer& peer) const
 	{
-		if (peer.router) // we have RI already
-		{	
-			if (!peer.numAttempts) // NTCP
+		// default order, transports used before are reordered among themselves by measured cost
+		for (int i = 0; i < eNumTransportTypes; i++)
+			peer.transports[i] = (TransportType)i;
+		auto profile = peer.router->GetLoadedProfile (); // don't read disk with shard locked
+		if (!profile) return;
+		std::vector<std::pair<int, TransportType> > used; // cost, transport
+		std::vector<int> positions;
+		for (int i = 0; i < eNumTransportTypes; i++)
+		{
+			int rtt = profile->GetTransportRTT (i);
+			if (rtt)
 			{
-				peer.numAttempts++;
-				auto address = peer.router->GetNTCPAddress (!context.SupportsV6 ());
-				if (address && m_NTCPServer)
-				{
+				used.push_back (std::make_pair (GetTransportCost (rtt), (TransportType)i));
+				positions.push_back (i);
+			}
+		}
+		std::stable_sort (used.begin (), used.end (),
+			[](const std::pair<int, TransportType>& l, const std::pair<int, TransportType>& r)
+			{ return l.first < r.first; });
+		for (size_t i = 0; i < used.size (); i++)
+			peer.transports[positions[i]] = used[i].second;
+	}
+
+	bool Transports::ConnectNTCP2 (std::shared_ptr<const i2p::data::RouterInfo> router)
+	{
+#ifdef NTCP2_SUPPORTED
+		if (m_NTCP2Server && router->IsNTCP2 (!context.SupportsV6 ()) && !router->IsUnreachable ())
+		{
+			auto address = router->GetNTCP2Address (true, !context.SupportsV6 ());
+			if (!address->host.is_unspecified ()) // we don't resolve hosts for NTCP2
+			{
+				auto s = std::make_shared<NTCP2Session> (*m_NTCP2Server, router);
+				m_NTCP2Server->Connect (address->host, address->port, s);
+				return true;
+			}
+		}
+#else
+		(void) router;
+#endif
+		return false;
+	}
+
+	bool Transports::ConnectNTCP (const i2p::data::IdentHash& ident, std::shared_ptr<const i2p::data::RouterInfo> router)
+	{
+		auto address = router->GetNTCPAddress (!context.SupportsV6 ());
+		if (address && m_NTCPServer)
+		{
 #if BOOST_VERSION >= 104900
-					if (!address->host.is_unspecified ()) // we have address now
+			if (!address->host.is_unspecified ()) // we have address now
 #else
-					boost::system::error_code ecode;
-					address->host.to_string (ecode);
-					if (!ecode)
+			boost::system::error_code ecode;
+			address->host.to_string (ecode);
+			if (!ecode)
 #endif
-					{
-						if (!peer.router->UsesIntroducer () && !peer.router->IsUnreachable ())
-						{	
-							auto s = std::make_shared<NTCPSession> (*m_NTCPServer, peer.router);
-							m_NTCPServer->Connect (address->host, address->port, s);
-							return true;
-						}
-					}
-					else // we don't have address
-					{
-						if (address->addressString.length () > 0) // trying to resolve
-						{
-							LogPrint (eLogDebug, "Transports: Resolving NTCP ", address->addressString);
-							NTCPResolve (address->addressString, ident);
-							return true;
-						}
-					}
-				}	
-				else
-					LogPrint (eLogDebug, "Transports: NTCP address is not present for ", i2p::data::GetIdentHashAbbreviation (ident), ", trying SSU");
+			{
+				if (!router->UsesIntroducer () && !router->IsUnreachable ())
+				{	
+					auto s = std::make_shared<NTCPSession> (*m_NTCPServer, router);
+					m_NTCPServer->Connect (address->host, address->port, s);
+					return true;
+				}
 			}
-			if (peer.numAttempts == 1)// SSU
+			else // we don't have address
 			{
-				peer.numAttempts++;
-				if (m_SSUServer && peer.router->IsSSU (!context.SupportsV6 ()))
+				if (address->addressString.length () > 0) // trying to resolve
 				{
-					auto address = peer.router->GetSSUAddress (!context.SupportsV6 ());
+					LogPrint (eLogDebug, "Transports: Resolving NTCP ", address->addressString);
+					NTCPResolve (address->addressString, ident);
+					return true;
+				}
+			}
+		}	
+		else
+			LogPrint (eLogDebug, "Transports: NTCP address is not present for ", i2p::data::GetIdentHashAbbreviation (ident), ", trying next transport");
+		return false;
+	}
+
+	bool Transports::ConnectSSU (const i2p::data::IdentHash& ident, std::shared_ptr<const i2p::data::RouterInfo> router)
+	{
+		if (m_SSUServer && router->IsSSU (!context.SupportsV6 ()))
+		{
+			auto address = router->GetSSUAddress (!context.SupportsV6 ());
 #if BOOST_VERSION >= 104900
-					if (!address->host.is_unspecified ()) // we have address now
+			if (!address->host.is_unspecified ()) // we have address now
 #else
-					boost::system::error_code ecode;
-					address->host.to_string (ecode);
-					if (!ecode)
+			boost::system::error_code ecode;
+			address->host.to_string (ecode);
+			if (!ecode)
 #endif
-					{
-						m_SSUServer->CreateSession (peer.router, address->host, address->port);
-						return true;
-					}
-					else // we don't have address
-					{
-						if (address->addressString.length () > 0) // trying to resolve
-						{
-							LogPrint (eLogDebug, "Transports: Resolving SSU ", address->addressString);
-							SSUResolve (address->addressString, ident);
-							return true;
-						}
-					}
+			{
+				m_SSUServer->CreateSession (router, address->host, address->port);
+				return true;
+			}
+			else // we don't have address
+			{
+				if (address->addressString.length () > 0) // trying to resolve
+				{
+					LogPrint (eLogDebug, "Transports: Resolving SSU ", address->addressString);
+					SSUResolve (address->addressString, ident);
+					return true;
 				}
-			}	
-			LogPrint (eLogInfo, "Transports: No NTCP or SSU addresses available");
-			peer.Done ();
-			std::unique_lock<std::mutex> l(m_PeersMutex);	
-			m_Peers.erase (ident);
-			return false;
-		}	
-		else // otherwise request RI
-		{
-			LogPrint (eLogInfo, "Transports: RouterInfo for ", ident.ToBase64 (), " not found, requested");
-			i2p::data::netdb.RequestDestination (ident, std::bind (
-				&Transports::RequestComplete, this, std::placeholders::_1, ident));
-		}	
-		return true;
-	}	
-	
+			}
+		}
+		return false;
+	}
+
 	void Transports::RequestComplete (std::shared_ptr<const i2p::data::RouterInfo> r, const i2p::data::IdentHash& ident)
 	{
 		m_Service->post (std::bind (&Transports::HandleRequestComplete, this, r, ident));
@@ -407,22 +569,21 @@ namespace transport
 	
 	void Transports::HandleRequestComplete (std::shared_ptr<const i2p::data::RouterInfo> r, i2p::data::IdentHash ident)
 	{
-		auto it = m_Peers.find (ident);
-		if (it != m_Peers.end ())
-		{	
-			if (r)
-			{
-				LogPrint (eLogDebug, "Transports: RouterInfo for ", ident.ToBase64 (), " found, Trying to connect");
-				it->second.router = r;
-				ConnectToPeer (ident, it->second);
-			}	
-			else
+		{
+			auto& shard = GetPeersShard (ident);
+			std::unique_lock<std::mutex> l(shard.mutex);
+			auto it = shard.peers.find (ident);
+			if (it == shard.peers.end ()) return;
+			if (!r)
 			{
 				LogPrint (eLogWarning, "Transports: RouterInfo not found, Failed to send messages");
-				std::unique_lock<std::mutex> l(m_PeersMutex);	
-				m_Peers.erase (it);
-			}	
-		}	
+				shard.peers.erase (it);
+				return;
+			}
+			LogPrint (eLogDebug, "Transports: RouterInfo for ", ident.ToBase64 (), " found, Trying to connect");
+			it->second.router = r;
+		}
+		ConnectToPeer (ident);
 	}	
 
 	void Transports::NTCPResolve (const std::string& addr, const i2p::data::IdentHash& ident)
@@ -436,8 +597,10 @@ namespace transport
 	void Transports::HandleNTCPResolve (const boost::system::error_code& ecode, boost::asio::ip::tcp::resolver::iterator it, 
 		i2p::data::IdentHash ident, std::shared_ptr<boost::asio::ip::tcp::resolver> resolver)
 	{
-		auto it1 = m_Peers.find (ident);
-		if (it1 != m_Peers.end ())
+		auto& shard = GetPeersShard (ident);
+		std::unique_lock<std::mutex> l(shard.mutex);
+		auto it1 = shard.peers.find (ident);
+		if (it1 != shard.peers.end ())
 		{
 			auto& peer = it1->second;
 			if (!ecode && peer.router)
@@ -463,8 +626,7 @@ namespace transport
 				}	
 			}
 			LogPrint (eLogError, "Transports: Unable to resolve NTCP address: ", ecode.message ());
-			std::unique_lock<std::mutex> l(m_PeersMutex);		
-			m_Peers.erase (it1);
+			shard.peers.erase (it1);
 		}
 	}
 
@@ -479,8 +641,10 @@ namespace transport
 	void Transports::HandleSSUResolve (const boost::system::error_code& ecode, boost::asio::ip::tcp::resolver::iterator it, 
 		i2p::data::IdentHash ident, std::shared_ptr<boost::asio::ip::tcp::resolver> resolver)
 	{
-		auto it1 = m_Peers.find (ident);
-		if (it1 != m_Peers.end ())
+		auto& shard = GetPeersShard (ident);
+		std::unique_lock<std::mutex> l(shard.mutex);
+		auto it1 = shard.peers.find (ident);
+		if (it1 != shard.peers.end ())
 		{
 			auto& peer = it1->second;
 			if (!ecode && peer.router)
@@ -505,8 +669,7 @@ namespace transport
 				}	
 			}
 			LogPrint (eLogError, "Transports: Unable to resolve SSU address: ", ecode.message ());
-			std::unique_lock<std::mutex> l(m_PeersMutex);	
-			m_Peers.erase (it1);
+			shard.peers.erase (it1);
 		}
 	}
 
@@ -530,6 +693,14 @@ namespace transport
 			ntcpSession->Terminate ();
 			LogPrint(eLogDebug, "Transports: NTCP session closed");
 		}
+#ifdef NTCP2_SUPPORTED
+		auto ntcp2Session = m_NTCP2Server ? m_NTCP2Server->FindNTCP2Session (router->GetIdentHash ()) : nullptr;
+		if (ntcp2Session)
+		{
+			ntcp2Session->Done ();
+			LogPrint(eLogDebug, "Transports: NTCP2 session closed");
+		}
+#endif
 	}	
 		
 	void Transports::DetectExternalIP ()
@@ -605,8 +776,10 @@ namespace transport
 			auto remoteIdentity = session->GetRemoteIdentity (); 
 			if (!remoteIdentity) return;
 			auto ident = remoteIdentity->GetIdentHash ();
-			auto it = m_Peers.find (ident);
-			if (it != m_Peers.end ())
+			auto& shard = GetPeersShard (ident);
+			std::unique_lock<std::mutex> l(shard.mutex);
+			auto it = shard.peers.find (ident);
+			if (it != shard.peers.end ())
 			{
 #ifdef WITH_EVENTS
 				EmitEvent({{"type" , "transport.connected"}, {"ident", ident.ToBase64()}, {"inbound", "false"}});
@@ -630,6 +803,7 @@ namespace transport
 			}
 			else // incoming connection
 			{
+				l.unlock ();
 				if(RoutesRestricted() && ! IsRestrictedPeer(ident)) {
 					// not trusted
 					LogPrint(eLogWarning, "Transports: closing untrusted inbound connection from ", ident.ToBase64());
@@ -640,8 +814,16 @@ namespace transport
 				EmitEvent({{"type" , "transport.connected"}, {"ident", ident.ToBase64()}, {"inbound", "true"}});
 #endif
 				session->SendI2NPMessages ({ CreateDatabaseStoreMsg () }); // send DatabaseStore
-				std::unique_lock<std::mutex>	l(m_PeersMutex);	
-				m_Peers.insert (std::make_pair (ident, Peer{ 0, nullptr, { session }, i2p::util::GetSecondsSinceEpoch (), {} }));
+				l.lock ();
+				Peer peer (nullptr, i2p::util::GetSecondsSinceEpoch ());
+				peer.sessions.push_back (session);
+				auto ret = shard.peers.insert (std::make_pair (ident, peer));
+				if (!ret.second) // we started connecting meanwhile
+				{
+					ret.first->second.sessions.push_back (session);
+					session->SendI2NPMessages (ret.first->second.delayedMessages);
+					ret.first->second.delayedMessages.clear ();
+				}
 			}
 		});
 	}
@@ -656,52 +838,84 @@ namespace transport
 #ifdef WITH_EVENTS
 			EmitEvent({{"type" , "transport.disconnected"}, {"ident", ident.ToBase64()}});
 #endif
-			auto it = m_Peers.find (ident);
-			if (it != m_Peers.end ())
+			int rtt = session->GetRTT ();
+			if (rtt) // for next connection, profile might be loaded from disk
 			{
-				it->second.sessions.remove (session);
-				if (it->second.sessions.empty ()) // TODO: why?
-				{	
-					if (it->second.delayedMessages.size () > 0)
-						ConnectToPeer (ident, it->second);
-					else
+				auto transport = session->GetTransportType ();
+				i2p::data::netdb.PostTask ([ident, transport, rtt]()
 					{
-						std::unique_lock<std::mutex> l(m_PeersMutex);	
-						m_Peers.erase (it);
+						auto r = i2p::data::netdb.FindRouter (ident);
+						if (r) r->GetProfile ()->TransportSessionClosed (transport, rtt);
+					});
+			}
+			bool reconnect = false;
+			{
+				auto& shard = GetPeersShard (ident);
+				std::unique_lock<std::mutex> l(shard.mutex);
+				auto it = shard.peers.find (ident);
+				if (it != shard.peers.end ())
+				{
+					it->second.sessions.remove (session);
+					if (it->second.sessions.empty ()) // TODO: why?
+					{	
+						if (it->second.delayedMessages.size () > 0)
+							reconnect = true;
+						else
+							shard.peers.erase (it);
 					}
 				}
 			}
+			if (reconnect) ConnectToPeer (ident);
 		});	
 	}	
 
 	bool Transports::IsConnected (const i2p::data::IdentHash& ident) const
 	{	
-		std::unique_lock<std::mutex> l(m_PeersMutex);		
-		auto it = m_Peers.find (ident);
-		return it != m_Peers.end ();
-	}	
+		auto& shard = GetPeersShard (ident);
+		std::unique_lock<std::mutex> l(shard.mutex);
+		return shard.peers.count (ident) > 0;
+	}
+
+	size_t Transports::GetNumPeers () const
+	{
+		size_t num = 0;
+		for (auto& shard: m_PeersShards)
+		{
+			std::unique_lock<std::mutex> l(shard.mutex);
+			num += shard.peers.size ();
+		}
+		return num;
+	}
 		
 	void Transports::HandlePeerCleanupTimer (const boost::system::error_code& ecode)
 	{
 		if (ecode != boost::asio::error::operation_aborted)
 		{
 			auto ts = i2p::util::GetSecondsSinceEpoch ();
-			for (auto it = m_Peers.begin (); it != m_Peers.end (); )
+			std::vector<i2p::data::IdentHash> expired;
+			for (auto& shard: m_PeersShards)
 			{
-				if (it->second.sessions.empty () && ts > it->second.creationTime + SESSION_CREATION_TIMEOUT)
+				std::unique_lock<std::mutex> l(shard.mutex);
+				for (auto it = shard.peers.begin (); it != shard.peers.end (); )
 				{
-					LogPrint (eLogWarning, "Transports: Session to peer ", it->first.ToBase64 (), " has not been created in ", SESSION_CREATION_TIMEOUT, " seconds");
-					auto profile = i2p::data::GetRouterProfile(it->first);
-					if (profile)
+					if (it->second.sessions.empty () && ts > it->second.creationTime + SESSION_CREATION_TIMEOUT)
 					{
-						profile->TunnelNonReplied();
-						profile->Save(it->first);
+						LogPrint (eLogWarning, "Transports: Session to peer ", it->first.ToBase64 (), " has not been created in ", SESSION_CREATION_TIMEOUT, " seconds");
+						expired.push_back (it->first);
+						it = shard.peers.erase (it);
 					}
-					std::unique_lock<std::mutex>	l(m_PeersMutex);	
-					it = m_Peers.erase (it);
+					else
+						++it;
+				}
+			}
+			for (auto& ident: expired) // profiles are saved to disk, not under lock
+			{
+				auto profile = i2p::data::GetRouterProfile(ident);
+				if (profile)
+				{
+					profile->TunnelNonReplied();
+					profile->Save(ident);
 				}
-				else
-					++it;
 			}
 			UpdateBandwidth (); // TODO: use separate timer(s) for it
 			if (i2p::context.GetStatus () == eRouterStatusTesting) // if still testing,	 repeat peer test
@@ -723,11 +937,17 @@ namespace transport
 		
 	std::shared_ptr<const i2p::data::RouterInfo> Transports::GetRandomPeer () const
 	{
-		if (m_Peers.empty ()) return nullptr;
-		std::unique_lock<std::mutex> l(m_PeersMutex);	
-		auto it = m_Peers.begin ();
-		std::advance (it, rand () % m_Peers.size ());	
-		return it != m_Peers.end () ? it->second.router : nullptr;
+		int ind = rand () % TRANSPORTS_NUM_PEERS_SHARDS;
+		for (int i = 0; i < TRANSPORTS_NUM_PEERS_SHARDS; i++) // start from random shard, skip empty
+		{
+			auto& shard = m_PeersShards[(ind + i) % TRANSPORTS_NUM_PEERS_SHARDS];
+			std::unique_lock<std::mutex> l(shard.mutex);
+			if (shard.peers.empty ()) continue;
+			auto it = shard.peers.begin ();
+			std::advance (it, rand () % shard.peers.size ());
+			return it->second.router;
+		}
+		return nullptr;
 	}
 	void Transports::RestrictRoutesToFamilies(std::set<std::string> families)
 	{
@@ -14,6 +14,7 @@
 #include <boost/asio.hpp>
 #include "TransportSession.h"
 #include "NTCPSession.h"
+#include "NTCP2.h"
 #include "SSU.h"
 #include "RouterInfo.h"
 #include "I2NPProtocol.h"
@@ -23,31 +24,50 @@ namespace i2p
 {
 namespace transport
 {
+	const int DH_KEYS_MAX_POOL_SIZE = 128;
+	const int DH_KEYS_POOL_TIME = 5; // in seconds, how many keys we keep for session establishment rate 
+	const int DH_KEYS_RATE_INTERVAL = 10; // in seconds
+	const int DH_KEYS_MAX_NUM_THREADS = 4;
 	class DHKeysPairSupplier
 	{
 		public:
 
 			DHKeysPairSupplier (int size);
 			~DHKeysPairSupplier ();
+			void SetNumThreads (int numThreads) { m_NumThreads = numThreads; }; // before Start
 			void Start ();
 			void Stop ();
 			std::shared_ptr<i2p::crypto::DHKeys> Acquire ();
 			void Return (std::shared_ptr<i2p::crypto::DHKeys> pair);
 
+			// stats
+			int GetPoolSize () const;
+			int GetTargetPoolSize () const { return m_TargetSize; };
+			size_t GetNumThreads () const { return m_Threads.size (); };
+			uint64_t GetNumHits () const { return m_NumHits; };
+			uint64_t GetNumMisses () const { return m_NumMisses; }; // generated synchronously
+
 		private:
 
-			void Run ();
-			void CreateDHKeysPairs (int num);
+			void Run (int threadNum);
+			bool IsBehind () const { return (int)m_Queue.size () + m_NumInProgress < m_TargetSize/2; };
+			void UpdateTargetSize (uint64_t ts);
 
 		private:
 
-			const int m_QueueSize;
+			const int m_MinSize;
+			int m_NumThreads;
+			std::atomic<int> m_TargetSize;
+			int m_NumInProgress;
 			std::queue<std::shared_ptr<i2p::crypto::DHKeys> > m_Queue;
 
 			bool m_IsRunning;
-			std::thread * m_Thread;	
+			std::vector<std::thread *> m_Threads;	
 			std::condition_variable m_Acquired;
-			std::mutex m_AcquiredMutex;
+			mutable std::mutex m_AcquiredMutex;
+			uint64_t m_LastRateUpdateTime; // in seconds
+			int m_NumAcquiredSinceUpdate;
+			std::atomic<uint64_t> m_NumHits, m_NumMisses;
 	};
 
 	struct Peer
@@ -57,14 +77,31 @@ namespace transport
 		std::list<std::shared_ptr<TransportSession> > sessions;
 		uint64_t creationTime;
 		std::vector<std::shared_ptr<i2p::I2NPMessage> > delayedMessages;
+		TransportType transports[eNumTransportTypes]; // order of connection attempts, set before first one
+
+		Peer (std::shared_ptr<const i2p::data::RouterInfo> r, uint64_t ts):
+			numAttempts (0), router (r), creationTime (ts)
+		{
+			for (int i = 0; i < eNumTransportTypes; i++)
+				transports[i] = (TransportType)i;
+		}
 
 		void Done ()
 		{
 			for (auto& it: sessions)
 				it->Done ();
 		}	
+
+		std::shared_ptr<TransportSession> SelectSession () const { return SelectTransportSession (sessions); }
 	};	
 	
+	const int TRANSPORTS_NUM_PEERS_SHARDS = 16; // power of 2
+	struct PeersShard
+	{
+		mutable std::mutex mutex;
+		std::map<i2p::data::IdentHash, Peer> peers;
+	};
+
 	const size_t SESSION_CREATION_TIMEOUT = 10; // in seconds
 	const int PEER_TEST_INTERVAL = 71; // in minutes
 	const int MAX_NUM_DELAYED_MESSAGES = 50; 
@@ -75,11 +112,15 @@ namespace transport
 			Transports ();
 			~Transports ();
 
-			void Start (bool enableNTCP=true, bool enableSSU=true);
+			void Start (bool enableNTCP=true, bool enableSSU=true, bool enableNTCP2=false);
 			void Stop ();
 
 			bool IsBoundNTCP() const { return m_NTCPServer != nullptr; }
 			bool IsBoundSSU() const { return m_SSUServer != nullptr; }
+			bool IsBoundNTCP2() const { return m_NTCP2Server != nullptr; }
+			void SetNumNTCPThreads (int numThreads) { m_NumNTCPThreads = numThreads; }; // before Start
+			void SetNumSSUThreads (int numThreads) { m_NumSSUThreads = numThreads; }; // before Start
+			void SetNumDHKeysThreads (int numThreads) { m_DHKeysPairSupplier.SetNumThreads (numThreads); }; // before Start
 			
 			bool IsOnline() const { return m_IsOnline; };
 			void SetOnline (bool online) { m_IsOnline = online; };
@@ -103,7 +144,7 @@ namespace transport
 			uint32_t GetInBandwidth  () const { return m_InBandwidth; };
 			uint32_t GetOutBandwidth () const { return m_OutBandwidth; };
 			bool IsBandwidthExceeded () const;
-			size_t GetNumPeers () const { return m_Peers.size (); };
+			size_t GetNumPeers () const;
 			std::shared_ptr<const i2p::data::RouterInfo> GetRandomPeer () const;
 
     /** get a trusted first hop for restricted routes */
@@ -124,9 +165,18 @@ namespace transport
 			void Run ();
 			void RequestComplete (std::shared_ptr<const i2p::data::RouterInfo> r, const i2p::data::IdentHash& ident);
 			void HandleRequestComplete (std::shared_ptr<const i2p::data::RouterInfo> r, i2p::data::IdentHash ident);
-			void PostMessages (i2p::data::IdentHash ident, std::vector<std::shared_ptr<i2p::I2NPMessage> > msgs);
+			void PostLoopbackMessages (std::vector<std::shared_ptr<i2p::I2NPMessage> > msgs);
+			void QueueMessages (const i2p::data::IdentHash& ident, const std::vector<std::shared_ptr<i2p::I2NPMessage> >& msgs);
 			void PostCloseSession (std::shared_ptr<const i2p::data::RouterInfo> router);
-			bool ConnectToPeer (const i2p::data::IdentHash& ident, Peer& peer);
+			bool ConnectToPeer (const i2p::data::IdentHash& ident); // in transports thread, shard of ident must not be locked
+			void SortTransports (Peer& peer) const; // by history in profile
+			bool ConnectNTCP2 (std::shared_ptr<const i2p::data::RouterInfo> router);
+			bool ConnectNTCP (const i2p::data::IdentHash& ident, std::shared_ptr<const i2p::data::RouterInfo> router);
+			bool ConnectSSU (const i2p::data::IdentHash& ident, std::shared_ptr<const i2p::data::RouterInfo> router);
+			PeersShard& GetPeersShard (const i2p::data::IdentHash& ident)
+			{ return m_PeersShards[ident.GetLL ()[0] & (TRANSPORTS_NUM_PEERS_SHARDS - 1)]; };
+			const PeersShard& GetPeersShard (const i2p::data::IdentHash& ident) const
+			{ return m_PeersShards[ident.GetLL ()[0] & (TRANSPORTS_NUM_PEERS_SHARDS - 1)]; };
 			void HandlePeerCleanupTimer (const boost::system::error_code& ecode);			
 			void HandlePeerTestTimer (const boost::system::error_code& ecode);
 			
@@ -149,9 +199,11 @@ namespace transport
 			boost::asio::deadline_timer * m_PeerCleanupTimer, * m_PeerTestTimer;
 
 			NTCPServer * m_NTCPServer;
+			int m_NumNTCPThreads;
 			SSUServer * m_SSUServer;
-			mutable std::mutex m_PeersMutex;
-			std::map<i2p::data::IdentHash, Peer> m_Peers;
+			int m_NumSSUThreads;
+			NTCP2Server * m_NTCP2Server;
+			PeersShard m_PeersShards[TRANSPORTS_NUM_PEERS_SHARDS]; // by ident hash
 			
 			DHKeysPairSupplier m_DHKeysPairSupplier;
 
@@ -175,7 +227,8 @@ namespace transport
 			// for HTTP only
 			const NTCPServer * GetNTCPServer () const { return m_NTCPServer; };
 			const SSUServer * GetSSUServer () const { return m_SSUServer; };
-			const decltype(m_Peers)& GetPeers () const { return m_Peers; };
+			const NTCP2Server * GetNTCP2Server () const { return m_NTCP2Server; };
+			const DHKeysPairSupplier& GetDHKeysPairSupplier () const { return m_DHKeysPairSupplier; };
 	};	
 
 	extern Transports transports;
@@ -182,6 +182,29 @@ namespace tunnel
 		}
 	}
 
+	void Tunnel::EncryptTunnelMsgs (const std::vector<std::shared_ptr<const I2NPMessage> >& in, 
+		const std::vector<std::shared_ptr<I2NPMessage> >& out)
+	{
+		i2p::crypto::TunnelDecryption * decryptions[TUNNEL_DATA_MAX_NUM_PENDING_MSGS];
+		const uint8_t * inPayloads[TUNNEL_DATA_MAX_NUM_PENDING_MSGS];
+		uint8_t * outPayloads[TUNNEL_DATA_MAX_NUM_PENDING_MSGS];
+		for (size_t i = 0; i < in.size (); i += TUNNEL_DATA_MAX_NUM_PENDING_MSGS)
+		{
+			size_t num = std::min (in.size () - i, TUNNEL_DATA_MAX_NUM_PENDING_MSGS);
+			for (size_t j = 0; j < num; j++)
+			{
+				inPayloads[j] = in[i + j]->GetPayload () + 4;
+				outPayloads[j] = out[i + j]->GetPayload () + 4;
+			}
+			for (auto& it: m_Hops)
+			{
+				for (size_t j = 0; j < num; j++) decryptions[j] = &it->decryption;
+				i2p::crypto::TunnelDecryption::Decrypt (num, decryptions, inPayloads, outPayloads);
+				for (size_t j = 0; j < num; j++) inPayloads[j] = outPayloads[j];
+			}
+		}
+	}
+
 	void Tunnel::SendTunnelDataMsg (std::shared_ptr<i2p::I2NPMessage> msg)
 	{
 		LogPrint (eLogWarning, "Tunnel: Can't send I2NP messages without delivery instructions");
@@ -225,10 +248,27 @@ namespace tunnel
 	void InboundTunnel::HandleTunnelDataMsg (std::shared_ptr<const I2NPMessage> msg)
 	{
 		if (IsFailed ()) SetState (eTunnelStateEstablished); // incoming messages means a tunnel is alive
-		auto newMsg = CreateEmptyTunnelDataMsg ();
-		EncryptTunnelMsg (msg, newMsg);
-		newMsg->from = shared_from_this ();
-		m_Endpoint.HandleDecryptedTunnelDataMsg (newMsg);
+		// we decrypt messages of the same tunnel at once
+		m_PendingTunnelDataMsgs.push_back (std::move (msg));
+		if (m_PendingTunnelDataMsgs.size () >= TUNNEL_DATA_MAX_NUM_PENDING_MSGS)
+			FlushTunnelDataMsgs ();
+	}
+
+	void InboundTunnel::FlushTunnelDataMsgs ()
+	{
+		if (m_PendingTunnelDataMsgs.empty ()) return;
+		std::vector<std::shared_ptr<I2NPMessage> > newMsgs;
+		newMsgs.reserve (m_PendingTunnelDataMsgs.size ());
+		for (auto& msg: m_PendingTunnelDataMsgs)
+			newMsgs.push_back (GetWritableTunnelDataMsg (msg));
+		EncryptTunnelMsgs (m_PendingTunnelDataMsgs, newMsgs);
+		m_PendingTunnelDataMsgs.clear ();
+		auto from = shared_from_this ();
+		for (auto& newMsg: newMsgs)
+		{
+			newMsg->from = from;
+			m_Endpoint.HandleDecryptedTunnelDataMsg (newMsg);
+		}
 	}
 
 	void InboundTunnel::Print (std::stringstream& s) const
@@ -331,23 +371,271 @@ namespace tunnel
 		s << GetTunnelID () << ":me &#8658; ";
 	}
 
+	TunnelsShard::TunnelsShard (int index): m_Index (index), m_IsRunning (false), m_Thread (nullptr)
+	{
+	}
+
+	TunnelsShard::~TunnelsShard ()
+	{
+		Stop ();
+	}
+
+	void TunnelsShard::Start ()
+	{
+		m_IsRunning = true;
+		m_Thread = new std::thread (std::bind (&TunnelsShard::Run, this));
+	}
+
+	void TunnelsShard::Stop ()
+	{
+		m_IsRunning = false;
+		m_Queue.WakeUp ();
+		if (m_Thread)
+		{
+			m_Thread->join ();
+			delete m_Thread;
+			m_Thread = 0;
+		}
+	}
+
+	void TunnelsShard::PostTunnelData (std::shared_ptr<I2NPMessage> msg)
+	{
+		if (msg) m_Queue.Put (msg);
+	}
+
+	void TunnelsShard::PostTunnelData (const std::vector<std::shared_ptr<I2NPMessage> >& msgs)
+	{
+		m_Queue.Put (msgs);
+	}
+
+	std::shared_ptr<TunnelBase> TunnelsShard::GetTunnel (uint32_t tunnelID)
+	{
+		std::unique_lock<std::mutex> l(m_TunnelsMutex);
+		auto it = m_Tunnels.find (tunnelID);
+		if (it != m_Tunnels.end ())
+			return it->second;
+		return nullptr;
+	}
+
+	bool TunnelsShard::AddTunnel (std::shared_ptr<TunnelBase> tunnel)
+	{
+		std::unique_lock<std::mutex> l(m_TunnelsMutex);
+		return m_Tunnels.emplace (tunnel->GetTunnelID (), tunnel).second;
+	}
+
+	void TunnelsShard::RemoveTunnel (uint32_t tunnelID)
+	{
+		std::unique_lock<std::mutex> l(m_TunnelsMutex);
+		m_Tunnels.erase (tunnelID);
+	}
+
+	void TunnelsShard::Run ()
+	{
+		uint64_t lastTs = i2p::util::GetSecondsSinceEpoch ();
+		while (m_IsRunning)
+		{
+			try
+			{
+				auto msg = m_Queue.GetNextWithTimeout (1000); // 1 sec
+				if (msg)
+				{
+					uint32_t prevTunnelID = 0, tunnelID = 0;
+					std::shared_ptr<TunnelBase> prevTunnel;
+					do
+					{
+						std::shared_ptr<TunnelBase> tunnel;
+						uint8_t typeID = msg->GetTypeID ();
+						tunnelID = bufbe32toh (msg->GetPayload ());
+						if (tunnelID == prevTunnelID)
+							tunnel = prevTunnel;
+						else if (prevTunnel)
+							prevTunnel->FlushTunnelDataMsgs ();
+
+						if (!tunnel)
+							tunnel = GetTunnel (tunnelID);
+						if (tunnel)
+						{
+							if (typeID == eI2NPTunnelData)
+								tunnel->HandleTunnelDataMsg (std::move (msg)); // leave it uniquely owned for in-place re-encryption
+							else // tunnel gateway assumed
+								HandleTunnelGatewayMsg (tunnel, msg);
+						}
+						else
+							LogPrint (eLogWarning, "Tunnel: tunnel not found, tunnelID=", tunnelID, " previousTunnelID=", prevTunnelID, " type=", (int)typeID);
+
+						msg = m_Queue.Get ();
+						if (msg)
+						{
+							prevTunnelID = tunnelID;
+							prevTunnel = tunnel;
+						}
+						else if (tunnel)
+							tunnel->FlushTunnelDataMsgs ();
+					}
+					while (msg);
+				}
+
+				uint64_t ts = i2p::util::GetSecondsSinceEpoch ();
+				if (ts - lastTs >= TUNNELS_SHARD_CLEANUP_INTERVAL)
+				{
+					CleanupTunnels ();
+					lastTs = ts;
+				}
+			}
+			catch (std::exception& ex)
+			{
+				LogPrint (eLogError, "Tunnel: shard ", m_Index, " runtime exception: ", ex.what ());
+			}
+		}
+	}
+
+	void TunnelsShard::HandleTunnelGatewayMsg (std::shared_ptr<TunnelBase> tunnel, std::shared_ptr<I2NPMessage> msg)
+	{
+		if (!tunnel)
+		{
+			LogPrint (eLogError, "Tunnel: missing tunnel for gateway");
+			return;
+		}
+		const uint8_t * payload = msg->GetPayload ();
+		uint16_t len = bufbe16toh(payload + TUNNEL_GATEWAY_HEADER_LENGTH_OFFSET);
+		// we make payload as new I2NP message to send
+		msg->offset += I2NP_HEADER_SIZE + TUNNEL_GATEWAY_HEADER_SIZE;
+		if (msg->offset + len > msg->len)
+		{
+			LogPrint (eLogError, "Tunnel: gateway payload ", (int)len, " exceeds message length ", (int)msg->len);
+			return;
+		}
+		msg->len = msg->offset + len;
+		auto typeID = msg->GetTypeID ();
+		LogPrint (eLogDebug, "Tunnel: gateway of ", (int) len, " bytes for tunnel ", tunnel->GetTunnelID (), ", msg type ", (int)typeID);
+
+		if (IsRouterInfoMsg (msg) || typeID == eI2NPDatabaseSearchReply)
+			// transit DatabaseStore my contain new/updated RI 
+			// or DatabaseSearchReply with new routers
+			i2p::data::netdb.PostI2NPMsg (CopyI2NPMessage (msg));	
+		tunnel->SendTunnelDataMsg (msg);
+	}
+
+	void TunnelsShard::CleanupTunnels ()
+	{
+		// endpoints are accessed from shard's thread only, so we cleanup them here
+		std::vector<std::shared_ptr<TunnelBase> > shardTunnels;
+		{
+			std::unique_lock<std::mutex> l(m_TunnelsMutex);
+			shardTunnels.reserve (m_Tunnels.size ());
+			for (const auto& it: m_Tunnels)
+				shardTunnels.push_back (it.second);
+		}
+		for (auto& it: shardTunnels)
+			it->Cleanup ();
+	}
+
 	Tunnels tunnels;
 
+	TunnelBuildWorkers::TunnelBuildWorkers (): m_IsRunning (false), m_NumWorkers (1), m_NumDropped (0)
+	{
+	}
+
+	TunnelBuildWorkers::~TunnelBuildWorkers ()
+	{
+		Stop ();
+	}
+
+	void TunnelBuildWorkers::Start ()
+	{
+		m_IsRunning = true;
+		for (int i = 0; i < m_NumWorkers; i++)
+			m_Threads.push_back (new std::thread (std::bind (&TunnelBuildWorkers::Run, this)));
+	}
+
+	void TunnelBuildWorkers::Stop ()
+	{
+		m_IsRunning = false;
+		m_Queue.WakeUp ();
+		for (auto it: m_Threads)
+		{
+			it->join ();
+			delete it;
+		}
+		m_Threads.clear ();
+	}
+
+	bool TunnelBuildWorkers::PostBuildRequest (std::shared_ptr<I2NPMessage> msg)
+	{
+		// we can't even reject without decryption, because reply key is inside the record
+		if (m_Queue.GetSize () >= TUNNEL_BUILD_MAX_BACKLOG)
+		{
+			m_NumDropped++;
+			return false;
+		}
+		m_Queue.Put (msg);
+		return true;
+	}
+
+	void TunnelBuildWorkers::Run ()
+	{
+		BN_CTX * ctx = BN_CTX_new (); // reused for every ElGamal decryption of this worker
+		while (m_IsRunning)
+		{
+			try
+			{
+				auto msg = m_Queue.GetNextWithTimeout (1000); // 1 sec
+				if (msg)
+					// still accept tunnels if backlog is not large
+					HandleTunnelBuildRequestMsg (msg, ctx, m_Queue.GetSize () >= TUNNEL_BUILD_REJECT_BACKLOG);
+			}
+			catch (std::exception& ex)
+			{
+				LogPrint (eLogError, "Tunnel: build worker exception: ", ex.what ());
+			}
+		}
+		BN_CTX_free (ctx);
+	}
+
 	Tunnels::Tunnels (): m_IsRunning (false), m_Thread (nullptr),
 		m_NumSuccesiveTunnelCreations (0), m_NumFailedTunnelCreations (0)
 	{
+		m_Shards.emplace_back (new TunnelsShard (0));
 	}
 
 	Tunnels::~Tunnels ()
 	{
 	}
 
+	void Tunnels::SetNumShards (int numShards)
+	{
+		if (m_IsRunning)
+		{
+			LogPrint (eLogError, "Tunnel: can't change number of shards while running");
+			return;
+		}
+		if (numShards < 1) numShards = 1;
+		if (numShards > MAX_NUM_TUNNELS_SHARDS) numShards = MAX_NUM_TUNNELS_SHARDS;
+		if ((size_t)numShards != m_Shards.size ())
+		{
+			LogPrint (eLogInfo, "Tunnel: number of tunnel data shards set to ", numShards);
+			m_Shards.clear ();
+			for (int i = 0; i < numShards; i++)
+				m_Shards.emplace_back (new TunnelsShard (i));
+		}
+	}
+
+	void Tunnels::SetNumBuildWorkers (int numWorkers)
+	{
+		if (m_IsRunning)
+		{
+			LogPrint (eLogError, "Tunnel: can't change number of build workers while running");
+			return;
+		}
+		if (numWorkers < 1) numWorkers = 1;
+		if (numWorkers > MAX_NUM_TUNNEL_BUILD_WORKERS) numWorkers = MAX_NUM_TUNNEL_BUILD_WORKERS;
+		LogPrint (eLogInfo, "Tunnel: number of tunnel build workers set to ", numWorkers);
+		m_BuildWorkers.SetNumWorkers (numWorkers);
+	}
+
 	std::shared_ptr<TunnelBase> Tunnels::GetTunnel (uint32_t tunnelID)
 	{
-		auto it = m_Tunnels.find(tunnelID);
-		if (it != m_Tunnels.end ())
-			return it->second;
-		return nullptr;
+		return GetShard (tunnelID).GetTunnel (tunnelID);
 	}
 
 	std::shared_ptr<InboundTunnel> Tunnels::GetPendingInboundTunnel (uint32_t replyMsgID)
@@ -437,8 +725,11 @@ namespace tunnel
 	
 	void Tunnels::AddTransitTunnel (std::shared_ptr<TransitTunnel> tunnel)
 	{
-		if (m_Tunnels.emplace (tunnel->GetTunnelID (), tunnel).second)
+		if (AddTunnel (tunnel))
+		{
+			std::unique_lock<std::mutex> l(m_TransitTunnelsMutex);
 			m_TransitTunnels.push_back (tunnel);
+		}
 		else
 			LogPrint (eLogError, "Tunnel: tunnel with id ", tunnel->GetTunnelID (), " already exists");
 	}
@@ -446,6 +737,9 @@ namespace tunnel
 	void Tunnels::Start ()
 	{
 		m_IsRunning = true;
+		for (auto& it: m_Shards)
+			it->Start ();
+		m_BuildWorkers.Start ();
 		m_Thread = new std::thread (std::bind (&Tunnels::Run, this));
 	}
 
@@ -459,6 +753,9 @@ namespace tunnel
 			delete m_Thread;
 			m_Thread = 0;
 		}
+		m_BuildWorkers.Stop ();
+		for (auto& it: m_Shards)
+			it->Stop ();
 	}
 
 	void Tunnels::Run ()
@@ -470,60 +767,25 @@ namespace tunnel
 		{
 			try
 			{
+				// tunnel data and gateway messages are handled by shards, only tunnel build messages are here
 				auto msg = m_Queue.GetNextWithTimeout (1000); // 1 sec
-				if (msg)
+				while (msg)
 				{
-					uint32_t prevTunnelID = 0, tunnelID = 0;
-					std::shared_ptr<TunnelBase> prevTunnel;
-					do
+					uint8_t typeID = msg->GetTypeID ();
+					switch (typeID)
 					{
-						std::shared_ptr<TunnelBase> tunnel;
-						uint8_t typeID = msg->GetTypeID ();
-						switch (typeID)
-						{
-							case eI2NPTunnelData:
-							case eI2NPTunnelGateway:
-							{
-								tunnelID = bufbe32toh (msg->GetPayload ()); 
-								if (tunnelID == prevTunnelID)
-									tunnel = prevTunnel;
-								else if (prevTunnel)
-									prevTunnel->FlushTunnelDataMsgs (); 
-
-								if (!tunnel)
-									tunnel = GetTunnel (tunnelID);
-								if (tunnel)
-								{
-									if (typeID == eI2NPTunnelData)
-										tunnel->HandleTunnelDataMsg (msg);
-									else // tunnel gateway assumed
-										HandleTunnelGatewayMsg (tunnel, msg);
-								}
-								else
-									LogPrint (eLogWarning, "Tunnel: tunnel not found, tunnelID=", tunnelID, " previousTunnelID=", prevTunnelID, " type=", (int)typeID);
-
-								break;
-							}
-							case eI2NPVariableTunnelBuild:
-							case eI2NPVariableTunnelBuildReply:
-							case eI2NPTunnelBuild:
-							case eI2NPTunnelBuildReply:
-								HandleI2NPMessage (msg->GetBuffer (), msg->GetLength ());
-							break;
-							default:
-								LogPrint (eLogWarning, "Tunnel: unexpected messsage type ", (int) typeID);
-						}
-
-						msg = m_Queue.Get ();
-						if (msg)
-						{
-							prevTunnelID = tunnelID;
-							prevTunnel = tunnel;
-						}
-						else if (tunnel)
-							tunnel->FlushTunnelDataMsgs ();
+						case eI2NPVariableTunnelBuild:
+						case eI2NPTunnelBuild:
+							HandleTunnelBuildMsg (msg);
+						break;
+						case eI2NPVariableTunnelBuildReply:
+						case eI2NPTunnelBuildReply:
+							HandleI2NPMessage (msg->GetBuffer (), msg->GetLength ());
+						break;
+						default:
+							LogPrint (eLogWarning, "Tunnel: unexpected messsage type ", (int) typeID);
 					}
-					while (msg);
+					msg = m_Queue.Get ();
 				}
 
 				uint64_t ts = i2p::util::GetSecondsSinceEpoch ();
@@ -540,31 +802,13 @@ namespace tunnel
 		}
 	}
 
-	void Tunnels::HandleTunnelGatewayMsg (std::shared_ptr<TunnelBase> tunnel, std::shared_ptr<I2NPMessage> msg)
+	void Tunnels::HandleTunnelBuildMsg (std::shared_ptr<I2NPMessage> msg)
 	{
-		if (!tunnel)
-		{
-			LogPrint (eLogError, "Tunnel: missing tunnel for gateway");
-			return;
-		}
-		const uint8_t * payload = msg->GetPayload ();
-		uint16_t len = bufbe16toh(payload + TUNNEL_GATEWAY_HEADER_LENGTH_OFFSET);
-		// we make payload as new I2NP message to send
-		msg->offset += I2NP_HEADER_SIZE + TUNNEL_GATEWAY_HEADER_SIZE;
-		if (msg->offset + len > msg->len)
-		{
-			LogPrint (eLogError, "Tunnel: gateway payload ", (int)len, " exceeds message length ", (int)msg->len);
-			return;
-		}
-		msg->len = msg->offset + len;
-		auto typeID = msg->GetTypeID ();
-		LogPrint (eLogDebug, "Tunnel: gateway of ", (int) len, " bytes for tunnel ", tunnel->GetTunnelID (), ", msg type ", (int)typeID);
-
-		if (IsRouterInfoMsg (msg) || typeID == eI2NPDatabaseSearchReply)
-			// transit DatabaseStore my contain new/updated RI 
-			// or DatabaseSearchReply with new routers
-			i2p::data::netdb.PostI2NPMsg (CopyI2NPMessage (msg));	
-		tunnel->SendTunnelDataMsg (msg);
+		if (msg->GetTypeID () == eI2NPVariableTunnelBuild && GetPendingInboundTunnel (msg->GetMsgID ()))
+			// reply for our inbound tunnel, handle it here
+			HandleI2NPMessage (msg->GetBuffer (), msg->GetLength ());
+		else if (!m_BuildWorkers.PostBuildRequest (msg))
+			LogPrint (eLogWarning, "Tunnel: too many tunnel build requests, dropped");
 	}
 
 	void Tunnels::ManageTunnels ()
@@ -712,7 +956,7 @@ namespace tunnel
 					auto pool = tunnel->GetTunnelPool ();
 					if (pool)
 						pool->TunnelExpired (tunnel);
-					m_Tunnels.erase (tunnel->GetTunnelID ());
+					RemoveTunnel (tunnel->GetTunnelID ());
 					it = m_InboundTunnels.erase (it);
 				}
 				else 
@@ -729,8 +973,7 @@ namespace tunnel
 
 						if (ts + TUNNEL_EXPIRATION_THRESHOLD > tunnel->GetCreationTime () + TUNNEL_EXPIRATION_TIMEOUT)
 							tunnel->SetState (eTunnelStateExpiring);
-						else // we don't need to cleanup expiring tunnels
-							tunnel->Cleanup ();
+						// cleanup is done by tunnel's shard
 					}
 					it++;
 				}
@@ -774,20 +1017,18 @@ namespace tunnel
 	void Tunnels::ManageTransitTunnels ()
 	{
 		uint32_t ts = i2p::util::GetSecondsSinceEpoch ();
+		std::unique_lock<std::mutex> l(m_TransitTunnelsMutex);
 		for (auto it = m_TransitTunnels.begin (); it != m_TransitTunnels.end ();)
 		{
 			auto tunnel = *it;
 			if (ts > tunnel->GetCreationTime () + TUNNEL_EXPIRATION_TIMEOUT)
 			{
 				LogPrint (eLogDebug, "Tunnel: Transit tunnel with id ", tunnel->GetTunnelID (), " expired");
-				m_Tunnels.erase (tunnel->GetTunnelID ());
+				RemoveTunnel (tunnel->GetTunnelID ());
 				it = m_TransitTunnels.erase (it);
 			}
-			else 
-			{
-				tunnel->Cleanup ();
+			else // cleanup is done by tunnel's shard
 				it++;
-			}
 		}
 	}
 
@@ -806,12 +1047,51 @@ namespace tunnel
 
 	void Tunnels::PostTunnelData (std::shared_ptr<I2NPMessage> msg)
 	{
-		if (msg) m_Queue.Put (msg);
+		if (!msg) return;
+		switch (msg->GetTypeID ())
+		{
+			case eI2NPTunnelData:
+			case eI2NPTunnelGateway:
+				GetShard (bufbe32toh (msg->GetPayload ())).PostTunnelData (msg);
+			break;
+			default:
+				m_Queue.Put (msg);
+		}
 	}
 
 	void Tunnels::PostTunnelData (const std::vector<std::shared_ptr<I2NPMessage> >& msgs)
 	{
-		m_Queue.Put (msgs);
+		if (m_Shards.size () == 1)
+		{
+			// no need to split, but build messages must still go to control thread
+			bool dataOnly = true;
+			for (const auto& it: msgs)
+			{
+				auto typeID = it->GetTypeID ();
+				if (typeID != eI2NPTunnelData && typeID != eI2NPTunnelGateway)
+				{
+					dataOnly = false;
+					break;
+				}
+			}
+			if (dataOnly)
+			{
+				m_Shards[0]->PostTunnelData (msgs);
+				return;
+			}
+		}
+		// split by shard preserving order of messages for the same tunnel
+		std::vector<std::vector<std::shared_ptr<I2NPMessage> > > shardMsgs (m_Shards.size ());
+		for (const auto& it: msgs)
+		{
+			auto typeID = it->GetTypeID ();
+			if (typeID == eI2NPTunnelData || typeID == eI2NPTunnelGateway)
+				shardMsgs[bufbe32toh (it->GetPayload ()) % m_Shards.size ()].push_back (it);
+			else
+				m_Queue.Put (it);
+		}
+		for (size_t i = 0; i < m_Shards.size (); i++)
+			m_Shards[i]->PostTunnelData (shardMsgs[i]); // empty vectors are ignored
 	}
 
 	template<class TTunnel>
@@ -864,7 +1144,7 @@ namespace tunnel
 
 	void Tunnels::AddInboundTunnel (std::shared_ptr<InboundTunnel> newTunnel)
 	{
-		if (m_Tunnels.emplace (newTunnel->GetTunnelID (), newTunnel).second)
+		if (AddTunnel (newTunnel))
 		{
 			m_InboundTunnels.push_back (newTunnel);
 			auto pool = newTunnel->GetTunnelPool ();
@@ -893,7 +1173,7 @@ namespace tunnel
 		auto inboundTunnel = std::make_shared<ZeroHopsInboundTunnel> ();
 		inboundTunnel->SetState (eTunnelStateEstablished);
 		m_InboundTunnels.push_back (inboundTunnel);
-		m_Tunnels[inboundTunnel->GetTunnelID ()] = inboundTunnel;
+		AddTunnel (inboundTunnel);
 		return inboundTunnel;
 	}
 
@@ -910,7 +1190,7 @@ namespace tunnel
 	{
 		int timeout = 0;
 		uint32_t ts = i2p::util::GetSecondsSinceEpoch ();
-		// TODO: possible race condition with I2PControl
+		std::unique_lock<std::mutex> l(m_TransitTunnelsMutex);
 		for (const auto& it : m_TransitTunnels)
 		{
 			int t = it->GetCreationTime () + TUNNEL_EXPIRATION_TIMEOUT - ts;
@@ -919,9 +1199,15 @@ namespace tunnel
 		return timeout;
 	}
 
+	std::list<std::shared_ptr<TransitTunnel> > Tunnels::GetTransitTunnels () const
+	{
+		std::unique_lock<std::mutex> l(m_TransitTunnelsMutex);
+		return m_TransitTunnels;
+	}
+
 	size_t Tunnels::CountTransitTunnels() const
 	{
-		// TODO: locking
+		std::unique_lock<std::mutex> l(m_TransitTunnelsMutex);
 		return m_TransitTunnels.size();
 	}
 
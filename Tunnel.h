@@ -9,6 +9,7 @@
 #include <string>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <memory>
 #include "Queue.h"
 #include "Crypto.h"
@@ -67,6 +68,11 @@ namespace tunnel
 	const int TUNNEL_RECREATION_THRESHOLD = 90; // 1.5 minutes	
 	const int TUNNEL_CREATION_TIMEOUT = 30; // 30 seconds
 	const int STANDARD_NUM_RECORDS = 5; // in VariableTunnelBuild message
+	const int TUNNELS_SHARD_CLEANUP_INTERVAL = 15; // in seconds
+	const int MAX_NUM_TUNNELS_SHARDS = 64;
+	const int MAX_NUM_TUNNEL_BUILD_WORKERS = 16;
+	const int TUNNEL_BUILD_MAX_BACKLOG = 256; // requests waiting for decryption, drop above
+	const int TUNNEL_BUILD_REJECT_BACKLOG = 128; // decrypt but reject with bandwidth code above
 
 	enum TunnelState
 	{
@@ -117,6 +123,8 @@ namespace tunnel
 			// implements TunnelBase
 			void SendTunnelDataMsg (std::shared_ptr<i2p::I2NPMessage> msg);
 			void EncryptTunnelMsg (std::shared_ptr<const I2NPMessage> in, std::shared_ptr<I2NPMessage> out); 
+			void EncryptTunnelMsgs (const std::vector<std::shared_ptr<const I2NPMessage> >& in, 
+				const std::vector<std::shared_ptr<I2NPMessage> >& out); 
 
 			/** @brief add latency sample */
 			void AddLatencySample(const uint64_t ms) { m_Latency = (m_Latency + ms) >> 1; }
@@ -171,6 +179,7 @@ namespace tunnel
 
 			InboundTunnel (std::shared_ptr<const TunnelConfig> config): Tunnel (config), m_Endpoint (true) {};
 			void HandleTunnelDataMsg (std::shared_ptr<const I2NPMessage> msg);
+			void FlushTunnelDataMsgs ();
 			virtual size_t GetNumReceivedBytes () const { return m_Endpoint.GetNumReceivedBytes (); };
 			void Print (std::stringstream& s) const;
 			bool IsInbound() const { return true; }
@@ -181,6 +190,7 @@ namespace tunnel
 		private:
 
 			TunnelEndpoint m_Endpoint; 
+			std::vector<std::shared_ptr<const I2NPMessage> > m_PendingTunnelDataMsgs; // not decrypted yet
 	};	
 	
 	class ZeroHopsInboundTunnel: public InboundTunnel
@@ -211,6 +221,67 @@ namespace tunnel
 			size_t m_NumSentBytes;
 	};	
 
+	class TunnelsShard
+	{
+		public:
+
+			TunnelsShard (int index);
+			~TunnelsShard ();
+			void Start ();
+			void Stop ();
+
+			void PostTunnelData (std::shared_ptr<I2NPMessage> msg);
+			void PostTunnelData (const std::vector<std::shared_ptr<I2NPMessage> >& msgs);
+			std::shared_ptr<TunnelBase> GetTunnel (uint32_t tunnelID);
+			bool AddTunnel (std::shared_ptr<TunnelBase> tunnel);
+			void RemoveTunnel (uint32_t tunnelID);
+
+			int GetIndex () const { return m_Index; };
+			int GetQueueSize () { return m_Queue.GetSize (); };
+
+		private:
+
+			void Run ();
+			void HandleTunnelGatewayMsg (std::shared_ptr<TunnelBase> tunnel, std::shared_ptr<I2NPMessage> msg);
+			void CleanupTunnels ();
+
+		private:
+
+			int m_Index;
+			bool m_IsRunning;
+			std::thread * m_Thread;
+			std::mutex m_TunnelsMutex;
+			std::unordered_map<uint32_t, std::shared_ptr<TunnelBase> > m_Tunnels; // tunnelID->tunnel, only tunnels of this shard
+			i2p::util::MPSCQueue<std::shared_ptr<I2NPMessage> > m_Queue; // TunnelData and TunnelGateway
+	};
+
+	class TunnelBuildWorkers
+	{
+		public:
+
+			TunnelBuildWorkers ();
+			~TunnelBuildWorkers ();
+			void Start ();
+			void Stop ();
+			void SetNumWorkers (int numWorkers) { m_NumWorkers = numWorkers; }; // must be called before Start
+
+			bool PostBuildRequest (std::shared_ptr<I2NPMessage> msg); // false if backlog is full
+			int GetBacklogSize () { return m_Queue.GetSize (); };
+			int GetNumDropped () const { return m_NumDropped; };
+
+		private:
+
+			void Run ();
+
+		private:
+
+			bool m_IsRunning;
+			int m_NumWorkers;
+			std::vector<std::thread *> m_Threads;
+			std::atomic<int> m_NumDropped;
+			i2p::util::Queue<std::shared_ptr<I2NPMessage> > m_Queue; // (Variable)TunnelBuild requests to decrypt
+	};
+
 	class Tunnels
 	{	
 		public:
@@ -240,6 +311,8 @@ namespace tunnel
 				int numOuboundHops, int numInboundTunnels, int numOutboundTunnels);
 			void DeleteTunnelPool (std::shared_ptr<TunnelPool> pool);
 			void StopTunnelPool (std::shared_ptr<TunnelPool> pool);
+			void SetNumShards (int numShards); // must be called before Start
+			void SetNumBuildWorkers (int numWorkers); // must be called before Start
 			
 		private:
 		
@@ -249,9 +322,12 @@ namespace tunnel
 			template<class TTunnel>
 			std::shared_ptr<TTunnel> GetPendingTunnel (uint32_t replyMsgID, const std::map<uint32_t, std::shared_ptr<TTunnel> >& pendingTunnels);			
 
-			void HandleTunnelGatewayMsg (std::shared_ptr<TunnelBase> tunnel, std::shared_ptr<I2NPMessage> msg);
+			TunnelsShard& GetShard (uint32_t tunnelID) { return *m_Shards[tunnelID % m_Shards.size ()]; };
+			bool AddTunnel (std::shared_ptr<TunnelBase> tunnel) { return GetShard (tunnel->GetTunnelID ()).AddTunnel (tunnel); };
+			void RemoveTunnel (uint32_t tunnelID) { GetShard (tunnelID).RemoveTunnel (tunnelID); };
 
 			void Run ();	
+			void HandleTunnelBuildMsg (std::shared_ptr<I2NPMessage> msg);
 			void ManageTunnels ();
 			void ManageOutboundTunnels ();
 			void ManageInboundTunnels ();
@@ -272,12 +348,14 @@ namespace tunnel
 			std::map<uint32_t, std::shared_ptr<OutboundTunnel> > m_PendingOutboundTunnels; // by replyMsgID
 			std::list<std::shared_ptr<InboundTunnel> > m_InboundTunnels;
 			std::list<std::shared_ptr<OutboundTunnel> > m_OutboundTunnels;
+			mutable std::mutex m_TransitTunnelsMutex; // transit tunnels are added by build workers
 			std::list<std::shared_ptr<TransitTunnel> > m_TransitTunnels;
-			std::unordered_map<uint32_t, std::shared_ptr<TunnelBase> > m_Tunnels; // tunnelID->tunnel known by this id
+			std::vector<std::unique_ptr<TunnelsShard> > m_Shards; // tunnels known by tunnelID, sharded by tunnelID
 			std::mutex m_PoolsMutex;
 			std::list<std::shared_ptr<TunnelPool>> m_Pools;
 			std::shared_ptr<TunnelPool> m_ExploratoryPool;
-			i2p::util::Queue<std::shared_ptr<I2NPMessage> > m_Queue;
+			i2p::util::MPSCQueue<std::shared_ptr<I2NPMessage> > m_Queue; // tunnel build messages
+			TunnelBuildWorkers m_BuildWorkers;
 
 			// some stats
 			int m_NumSuccesiveTunnelCreations, m_NumFailedTunnelCreations;
@@ -287,13 +365,17 @@ namespace tunnel
 			// for HTTP only
 			const decltype(m_OutboundTunnels)& GetOutboundTunnels () const { return m_OutboundTunnels; };
 			const decltype(m_InboundTunnels)& GetInboundTunnels () const { return m_InboundTunnels; };
-			const decltype(m_TransitTunnels)& GetTransitTunnels () const { return m_TransitTunnels; };
+			decltype(m_TransitTunnels) GetTransitTunnels () const; // copy, taken under lock
 
 			size_t CountTransitTunnels() const;
 			size_t CountInboundTunnels() const;
 			size_t CountOutboundTunnels() const;
 			
-			int GetQueueSize () { return m_Queue.GetSize (); };
+			int GetQueueSize () { return m_Queue.GetSize (); }; // control thread only
+			size_t GetNumShards () const { return m_Shards.size (); };
+			int GetBuildBacklogSize () { return m_BuildWorkers.GetBacklogSize (); };
+			int GetNumDroppedBuildRequests () const { return m_BuildWorkers.GetNumDropped (); };
+			int GetShardQueueSize (size_t shard) { return shard < m_Shards.size () ? m_Shards[shard]->GetQueueSize () : 0; };
 			int GetTunnelCreationSuccessRate () const // in percents
 			{ 
 				int totalNum = m_NumSuccesiveTunnelCreations + m_NumFailedTunnelCreations;
@@ -3,6 +3,7 @@
 
 #include <inttypes.h>
 #include <memory>
+#include <vector>
 #include "Timestamp.h"
 #include "I2NPProtocol.h"
 #include "Identity.h"
@@ -14,6 +15,7 @@ namespace tunnel
 	const size_t TUNNEL_DATA_MSG_SIZE = 1028;
 	const size_t TUNNEL_DATA_ENCRYPTED_SIZE = 1008;
 	const size_t TUNNEL_DATA_MAX_PAYLOAD_SIZE = 1003;
+	const size_t TUNNEL_DATA_MAX_NUM_PENDING_MSGS = 64; // handle batch before flush if reached
 	
 	enum TunnelDeliveryType 
 	{ 
@@ -43,6 +45,12 @@ namespace tunnel
 			virtual void SendTunnelDataMsg (std::shared_ptr<i2p::I2NPMessage> msg) = 0;
 			virtual void FlushTunnelDataMsgs () {};
 			virtual void EncryptTunnelMsg (std::shared_ptr<const I2NPMessage> in, std::shared_ptr<I2NPMessage> out) = 0;
+			virtual void EncryptTunnelMsgs (const std::vector<std::shared_ptr<const I2NPMessage> >& in, 
+				const std::vector<std::shared_ptr<I2NPMessage> >& out) // in and out have the same size
+			{
+				for (size_t i = 0; i < in.size (); i++)
+					EncryptTunnelMsg (in[i], out[i]);
+			};
 			uint32_t GetNextTunnelID () const { return m_NextTunnelID; };
 			const i2p::data::IdentHash& GetNextIdentHash () const { return m_NextIdent; };
 			virtual uint32_t GetTunnelID () const { return m_TunnelID; }; // as known at our side
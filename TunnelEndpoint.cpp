@@ -13,6 +13,12 @@ namespace i2p
 {
 namespace tunnel
 {
+	TunnelEndpoint::TunnelEndpoint (bool isInbound): m_Table (TUNNEL_ENDPOINT_INITIAL_TABLE_SIZE, {0, -1}),
+		m_NumIncompleteMessages (0), m_OldestIncompleteMessage (-1), m_NewestIncompleteMessage (-1),
+		m_IsInbound (isInbound), m_NumReceivedBytes (0) 
+	{
+	}
+
 	TunnelEndpoint::~TunnelEndpoint ()
 	{
 	}	
@@ -36,7 +42,9 @@ namespace tunnel
 				return;
 			}	
 			// process fragments
-			while (fragment < decrypted + TUNNEL_DATA_ENCRYPTED_SIZE)
+			const uint8_t * end = decrypted + TUNNEL_DATA_ENCRYPTED_SIZE;
+			bool isShared = false; // some fragments of this message are kept by reference
+			while (fragment < end)
 			{
 				uint8_t flag = fragment[0];
 				fragment++;
@@ -44,7 +52,7 @@ namespace tunnel
 				bool isFollowOnFragment = flag & 0x80, isLastFragment = true;		
 				uint32_t msgID = 0;
 				int fragmentNum = 0;
-				TunnelMessageBlockEx m;
+				TunnelMessageBlock m;
 				if (!isFollowOnFragment)
 				{	
 					// first fragment
@@ -89,49 +97,37 @@ namespace tunnel
 				uint16_t size = bufbe16toh (fragment);
 				fragment += 2;
 
-				msg->offset = fragment - msg->buf;
-				msg->len = msg->offset + size;
-				if (msg->len > msg->maxLen)
+				if (fragment + size > end)
 				{
 					LogPrint (eLogError, "TunnelMessage: fragment is too long ", (int)size);
 					return;
 				}
-				if (fragment + size < decrypted + TUNNEL_DATA_ENCRYPTED_SIZE)
-				{
-					// this is not last message. we have to copy it
-					m.data = NewI2NPTunnelMessage ();
-					m.data->offset += TUNNEL_GATEWAY_HEADER_SIZE; // reserve room for TunnelGateway header
-					m.data->len += TUNNEL_GATEWAY_HEADER_SIZE;
-					*(m.data) = *msg;
-				}
-				else
-					m.data = msg;
 				
 				if (!isFollowOnFragment && isLastFragment)
-					HandleNextMessage (m);
-				else
 				{
-					if (msgID) // msgID is presented, assume message is fragmented
+					// unfragmented message
+					msg->offset = fragment - msg->buf;
+					msg->len = msg->offset + size;
+					if (isShared || fragment + size < end)
 					{
-						if (!isFollowOnFragment) // create new incomlete message
-						{
-							m.nextFragmentNum = 1;
-							m.receiveTime = i2p::util::GetMillisecondsSinceEpoch ();
-							auto ret = m_IncompleteMessages.insert (std::pair<uint32_t, TunnelMessageBlockEx>(msgID, m));
-							if (ret.second)
-								HandleOutOfSequenceFragments (msgID, ret.first->second);
-							else
-								LogPrint (eLogError, "TunnelMessage: Incomplete message ", msgID, " already exists");
-						}
-						else
-						{
-							m.nextFragmentNum = fragmentNum;
-							HandleFollowOnFragment (msgID, isLastFragment, m);
-						}	
+						// this is not last message or buffer is used by other fragments. we have to copy it
+						m.data = NewI2NPTunnelMessage ();
+						m.data->offset += TUNNEL_GATEWAY_MSG_HEADROOM; // reserve room for TunnelGateway header
+						m.data->len += TUNNEL_GATEWAY_MSG_HEADROOM;
+						*(m.data) = *msg;
 					}
-					else	
-						LogPrint (eLogError, "TunnelMessage: Message is fragmented, but msgID is not presented");
+					else
+						m.data = msg;
+					HandleNextMessage (m);
 				}	
+				else if (msgID) // msgID is presented, assume message is fragmented
+				{
+					HandleFragment (msgID, fragmentNum, isLastFragment, { msg, fragment, size }, 
+						isFollowOnFragment ? nullptr : &m);
+					isShared = true;
+				}
+				else	
+					LogPrint (eLogError, "TunnelMessage: Message is fragmented, but msgID is not presented");
 					
 				fragment += size;
 			}	
@@ -140,104 +136,66 @@ namespace tunnel
 			LogPrint (eLogError, "TunnelMessage: zero not found");
 	}	
 
-	void TunnelEndpoint::HandleFollowOnFragment (uint32_t msgID, bool isLastFragment, const TunnelMessageBlockEx& m)
+	void TunnelEndpoint::HandleFragment (uint32_t msgID, int fragmentNum, bool isLastFragment, 
+		const Fragment& fragment, const TunnelMessageBlock * first)
 	{
-		auto fragment = m.data->GetBuffer ();
-		auto size = m.data->GetLength ();
-		auto it = m_IncompleteMessages.find (msgID);
-		if (it != m_IncompleteMessages.end())
+		int index = FindIncompleteMessage (msgID);
+		if (index < 0)
 		{
-			auto& msg = it->second;
-			if (m.nextFragmentNum == msg.nextFragmentNum)
-			{
-				if (msg.data->len + size < I2NP_MAX_MESSAGE_SIZE) // check if message is not too long
-				{	
-					if (msg.data->len + size > msg.data->maxLen)
-					{
-					//	LogPrint (eLogWarning, "TunnelMessage: I2NP message size ", msg.data->maxLen, " is not enough");
-						auto newMsg = NewI2NPMessage ();
-						*newMsg = *(msg.data);
-						msg.data = newMsg;
-					}
-					if (msg.data->Concat (fragment, size) < size) // concatenate fragment
-						LogPrint (eLogError, "TunnelMessage: I2NP buffer overflow ", msg.data->maxLen);
-					if (isLastFragment)
-					{
-						// message complete
-						HandleNextMessage (msg);	
-						m_IncompleteMessages.erase (it); 
-					}	
-					else
-					{	
-						msg.nextFragmentNum++;
-						HandleOutOfSequenceFragments (msgID, msg);
-					}	
-				}
-				else
-				{
-					LogPrint (eLogError, "TunnelMessage: Fragment ", m.nextFragmentNum, " of message ", msgID, "exceeds max I2NP message size, message dropped");
-					m_IncompleteMessages.erase (it);
-				}
-			}
+			if (first)
+				LogPrint (eLogDebug, "TunnelMessage: First fragment of message ", msgID);
 			else
-			{	
-				LogPrint (eLogWarning, "TunnelMessage: Unexpected fragment ", (int)m.nextFragmentNum, " instead ", (int)msg.nextFragmentNum, " of message ", msgID, ", saved");
-				AddOutOfSequenceFragment (msgID, m.nextFragmentNum, isLastFragment, m.data);
-			}
-		}
-		else
-		{	
-			LogPrint (eLogWarning, "TunnelMessage: First fragment of message ", msgID, " not found, saved");
-			AddOutOfSequenceFragment (msgID, m.nextFragmentNum, isLastFragment, m.data);
+				LogPrint (eLogDebug, "TunnelMessage: Fragment ", fragmentNum, " of message ", msgID, " came before first, saved");
+			index = CreateIncompleteMessage (msgID);
+		}	
+		auto& m = m_IncompleteMessages[index];
+		uint64_t bit = 1ULL << fragmentNum;
+		if (m.receivedFragments & bit)
+		{
+			LogPrint (eLogInfo, "TunnelMessage: duplicate fragment ", fragmentNum, " of message ", msgID);
+			return;
+		}	
+		// reserve room for NTCP and TunnelGateway headers
+		if (m.size + fragment.size + TUNNEL_GATEWAY_MSG_HEADROOM + 2 >= I2NP_MAX_MESSAGE_SIZE) 
+		{
+			LogPrint (eLogError, "TunnelMessage: Fragment ", fragmentNum, " of message ", msgID, " exceeds max I2NP message size, message dropped");
+			DeleteIncompleteMessage (index);
+			return;
+		}	
+		if (first)
+			m.block = *first;
+		if (isLastFragment)
+			m.lastFragmentNum = fragmentNum;
+		if ((int)m.fragments.size () <= fragmentNum)
+			m.fragments.resize (fragmentNum + 1);
+		m.fragments[fragmentNum] = fragment;
+		m.receivedFragments |= bit;
+		m.size += fragment.size;
+		if (m.lastFragmentNum >= 0)
+		{
+			uint64_t all = (m.lastFragmentNum < TUNNEL_ENDPOINT_MAX_NUM_FRAGMENTS - 1) ? 
+				(1ULL << (m.lastFragmentNum + 1)) - 1 : ~0ULL;
+			if (m.receivedFragments == all)
+				HandleCompleteMessage (index);
 		}	
 	}	
 
-	void TunnelEndpoint::AddOutOfSequenceFragment (uint32_t msgID, uint8_t fragmentNum, bool isLastFragment, std::shared_ptr<I2NPMessage> data)
+	void TunnelEndpoint::HandleCompleteMessage (int index)
 	{
-		if (!m_OutOfSequenceFragments.insert ({{msgID, fragmentNum}, {isLastFragment, data, i2p::util::GetMillisecondsSinceEpoch () }}).second)
-			LogPrint (eLogInfo, "TunnelMessage: duplicate out-of-sequence fragment ", fragmentNum, " of message ", msgID);
+		auto& m = m_IncompleteMessages[index];
+		auto msg = NewI2NPMessage (m.size + TUNNEL_GATEWAY_MSG_HEADROOM);
+		msg->offset += TUNNEL_GATEWAY_MSG_HEADROOM; // reserve room for TunnelGateway header
+		msg->len = msg->offset;
+		msg->from = m.fragments[0].buf->from;
+		for (int i = 0; i <= m.lastFragmentNum; i++) // the only copy of fragments
+			if (msg->Concat (m.fragments[i].data, m.fragments[i].size) < m.fragments[i].size)
+				LogPrint (eLogError, "TunnelMessage: I2NP buffer overflow ", msg->maxLen);
+		TunnelMessageBlock block = m.block;
+		block.data = msg;
+		DeleteIncompleteMessage (index);
+		HandleNextMessage (block);
 	}	
 
-	void TunnelEndpoint::HandleOutOfSequenceFragments (uint32_t msgID, TunnelMessageBlockEx& msg)
-	{
-		while (ConcatNextOutOfSequenceFragment (msgID, msg)) 
-		{
-			if (!msg.nextFragmentNum) // message complete
-			{
-				HandleNextMessage (msg);	
-				m_IncompleteMessages.erase (msgID);
-				break;
-			}
-		}
-	}
-
-	bool TunnelEndpoint::ConcatNextOutOfSequenceFragment (uint32_t msgID, TunnelMessageBlockEx& msg)
-	{
-		auto it = m_OutOfSequenceFragments.find ({msgID, msg.nextFragmentNum});
-		if (it != m_OutOfSequenceFragments.end ())
-		{					
-			LogPrint (eLogDebug, "TunnelMessage: Out-of-sequence fragment ", (int)msg.nextFragmentNum, " of message ", msgID, " found");
-			size_t size = it->second.data->GetLength ();
-			if (msg.data->len + size > msg.data->maxLen)
-			{
-				LogPrint (eLogWarning, "TunnelMessage: Tunnel endpoint I2NP message size ", msg.data->maxLen, " is not enough");
-				auto newMsg = NewI2NPMessage ();
-				*newMsg = *(msg.data);
-				msg.data = newMsg;
-			}
-			if (msg.data->Concat (it->second.data->GetBuffer (), size) < size) // concatenate out-of-sync fragment
-				LogPrint (eLogError, "TunnelMessage: Tunnel endpoint I2NP buffer overflow ", msg.data->maxLen);
-			if (it->second.isLastFragment)
-				// message complete
-				msg.nextFragmentNum = 0;
-			else
-				msg.nextFragmentNum++;
-			m_OutOfSequenceFragments.erase (it);
-			return true;		
-		}	
-		return false;
-	}	
-	
 	void TunnelEndpoint::HandleNextMessage (const TunnelMessageBlock& msg)
 	{
 		if (!m_IsInbound && msg.data->IsExpired ())
@@ -277,22 +235,117 @@ namespace tunnel
 	void TunnelEndpoint::Cleanup ()
 	{
 		auto ts = i2p::util::GetMillisecondsSinceEpoch ();
-		// out-of-sequence fragments
-		for (auto it = m_OutOfSequenceFragments.begin (); it != m_OutOfSequenceFragments.end ();)
+		// oldest first, stop at first not expired
+		while (m_OldestIncompleteMessage >= 0 && 
+			ts > m_IncompleteMessages[m_OldestIncompleteMessage].receiveTime + i2p::I2NP_MESSAGE_EXPIRATION_TIMEOUT)
 		{
-			if (ts > it->second.receiveTime + i2p::I2NP_MESSAGE_EXPIRATION_TIMEOUT)
-				it = m_OutOfSequenceFragments.erase (it);
-			else
-				++it;
-		}
-		// incomplete messages
-		for (auto it = m_IncompleteMessages.begin (); it != m_IncompleteMessages.end ();)
+			LogPrint (eLogDebug, "TunnelMessage: Incomplete message ", m_IncompleteMessages[m_OldestIncompleteMessage].msgID, " expired");
+			DeleteIncompleteMessage (m_OldestIncompleteMessage);
+		}	
+	}	
+
+	int TunnelEndpoint::FindIncompleteMessage (uint32_t msgID) const
+	{
+		size_t mask = m_Table.size () - 1;
+		for (size_t i = Hash (msgID) & mask;; i = (i + 1) & mask)
 		{
-			if (ts > it->second.receiveTime + i2p::I2NP_MESSAGE_EXPIRATION_TIMEOUT)
-				it = m_IncompleteMessages.erase (it);
-			else
-				++it;
-		}
+			const auto& slot = m_Table[i];
+			if (slot.index < 0) return -1;
+			if (slot.msgID == msgID) return slot.index;
+		}	
+	}	
+
+	int TunnelEndpoint::CreateIncompleteMessage (uint32_t msgID)
+	{
+		int index;
+		if (!m_FreeIncompleteMessages.empty ())
+		{
+			index = m_FreeIncompleteMessages.back ();
+			m_FreeIncompleteMessages.pop_back ();
+		}	
+		else
+		{
+			index = m_IncompleteMessages.size ();
+			m_IncompleteMessages.emplace_back ();
+		}	
+		auto& m = m_IncompleteMessages[index];
+		m.msgID = msgID;
+		m.receiveTime = i2p::util::GetMillisecondsSinceEpoch ();
+		m.block.deliveryType = eDeliveryTypeLocal;
+		m.receivedFragments = 0;
+		m.lastFragmentNum = -1;
+		m.size = 0;
+		// append to time-ordered list
+		m.prev = m_NewestIncompleteMessage; 
+		m.next = -1;
+		if (m_NewestIncompleteMessage >= 0)
+			m_IncompleteMessages[m_NewestIncompleteMessage].next = index;
+		else
+			m_OldestIncompleteMessage = index;
+		m_NewestIncompleteMessage = index;
+		// keep load factor below 1/2
+		if ((m_NumIncompleteMessages + 1)*2 > m_Table.size ())
+		{
+			std::vector<TableSlot> table (m_Table.size ()*2, {0, -1});
+			m_Table.swap (table);
+			for (const auto& it: table)
+				if (it.index >= 0) InsertIntoTable (it.msgID, it.index);
+		}	
+		InsertIntoTable (msgID, index);
+		m_NumIncompleteMessages++;
+		return index;
+	}	
+
+	void TunnelEndpoint::DeleteIncompleteMessage (int index)
+	{
+		auto& m = m_IncompleteMessages[index];
+		RemoveFromTable (m.msgID);
+		m_NumIncompleteMessages--;
+		if (m.prev >= 0) m_IncompleteMessages[m.prev].next = m.next; else m_OldestIncompleteMessage = m.next;
+		if (m.next >= 0) m_IncompleteMessages[m.next].prev = m.prev; else m_NewestIncompleteMessage = m.prev;
+		m.block.data = nullptr;
+		m.fragments.clear (); // release tunnel messages, keep capacity
+		m_FreeIncompleteMessages.push_back (index);
+	}	
+
+	void TunnelEndpoint::InsertIntoTable (uint32_t msgID, int index)
+	{
+		size_t mask = m_Table.size () - 1;
+		size_t i = Hash (msgID) & mask;
+		while (m_Table[i].index >= 0) i = (i + 1) & mask;
+		m_Table[i] = { msgID, index };
+	}	
+
+	void TunnelEndpoint::RemoveFromTable (uint32_t msgID)
+	{
+		size_t mask = m_Table.size () - 1;
+		size_t i = Hash (msgID) & mask;
+		for (;; i = (i + 1) & mask)
+		{
+			if (m_Table[i].index < 0) return; // not found
+			if (m_Table[i].msgID == msgID) break;
+		}	
+		// shift following entries back, so no tombstones needed
+		for (size_t j = (i + 1) & mask; m_Table[j].index >= 0; j = (j + 1) & mask)
+		{
+			size_t k = Hash (m_Table[j].msgID) & mask; // preferred slot of entry j
+			bool stays = (i < j) ? (i < k && k <= j) : (i < k || k <= j); 
+			if (!stays)
+			{
+				m_Table[i] = m_Table[j];
+				i = j;
+			}	
+		}	
+		m_Table[i].index = -1;
+	}	
+
+	size_t TunnelEndpoint::Hash (uint32_t msgID)
+	{
+		// msgIDs are chosen by remote side, mix them
+		msgID ^= msgID >> 16; 
+		msgID *= 0x45d9f3b; 
+		msgID ^= msgID >> 16;
+		return msgID;
 	}	
 }		
 }
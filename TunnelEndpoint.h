@@ -2,7 +2,8 @@
 #define TUNNEL_ENDPOINT_H__
 
 #include <inttypes.h>
-#include <map>
+#include <vector>
+#include <memory>
 #include <string>
 #include "I2NPProtocol.h"
 #include "TunnelBase.h"
@@ -11,24 +12,39 @@ namespace i2p
 {
 namespace tunnel
 {
+	const int TUNNEL_ENDPOINT_MAX_NUM_FRAGMENTS = 64; // first + up to 63 follow-on
+	const size_t TUNNEL_ENDPOINT_INITIAL_TABLE_SIZE = 64; // must be power of 2
+
 	class TunnelEndpoint
 	{	
-		struct TunnelMessageBlockEx: public TunnelMessageBlock
+		struct Fragment
 		{
-			uint64_t receiveTime; // milliseconds since epoch
-			uint8_t nextFragmentNum;
+			std::shared_ptr<I2NPMessage> buf; // tunnel message fragment belongs to, not copied
+			const uint8_t * data;
+			uint16_t size;
 		};	
 
-		struct Fragment
+		struct IncompleteMessage
 		{
-			bool isLastFragment;
-			std::shared_ptr<I2NPMessage> data;
+			uint32_t msgID;
 			uint64_t receiveTime; // milliseconds since epoch
+			TunnelMessageBlock block; // delivery instructions, from first fragment
+			uint64_t receivedFragments; // bitmap by fragment number, bit 0 - first fragment
+			int lastFragmentNum; // -1 if not received yet
+			size_t size; // of all received fragments
+			std::vector<Fragment> fragments; // by fragment number
+			int prev, next; // time-ordered list, -1 if none
+		};	
+
+		struct TableSlot
+		{
+			uint32_t msgID;
+			int index; // in m_IncompleteMessages, -1 if slot is empty
 		};	
 		
 		public:
 
-			TunnelEndpoint (bool isInbound): m_IsInbound (isInbound), m_NumReceivedBytes (0) {};
+			TunnelEndpoint (bool isInbound);
 			~TunnelEndpoint ();
 			size_t GetNumReceivedBytes () const { return m_NumReceivedBytes; };
 			void Cleanup ();			
@@ -37,17 +53,26 @@ namespace tunnel
 
 		private:
 
-			void HandleFollowOnFragment (uint32_t msgID, bool isLastFragment, const TunnelMessageBlockEx& m);
+			void HandleFragment (uint32_t msgID, int fragmentNum, bool isLastFragment, 
+				const Fragment& fragment, const TunnelMessageBlock * first); // first is null for follow-on fragment
+			void HandleCompleteMessage (int index);
 			void HandleNextMessage (const TunnelMessageBlock& msg);
 
-			void AddOutOfSequenceFragment (uint32_t msgID, uint8_t fragmentNum, bool isLastFragment, std::shared_ptr<I2NPMessage> data);
-			bool ConcatNextOutOfSequenceFragment (uint32_t msgID, TunnelMessageBlockEx& msg); // true if something added
-			void HandleOutOfSequenceFragments (uint32_t msgID, TunnelMessageBlockEx& msg);			
+			// incomplete messages by msgID, open addressing with linear probing
+			int FindIncompleteMessage (uint32_t msgID) const; // index or -1
+			int CreateIncompleteMessage (uint32_t msgID);
+			void DeleteIncompleteMessage (int index);
+			void InsertIntoTable (uint32_t msgID, int index);
+			void RemoveFromTable (uint32_t msgID);
+			static size_t Hash (uint32_t msgID);
 
 		private:			
 
-			std::map<uint32_t, TunnelMessageBlockEx> m_IncompleteMessages;
-			std::map<std::pair<uint32_t, uint8_t>, Fragment> m_OutOfSequenceFragments; // (msgID, fragment#)->fragment
+			std::vector<IncompleteMessage> m_IncompleteMessages; // deleted are reused
+			std::vector<int> m_FreeIncompleteMessages;
+			std::vector<TableSlot> m_Table;
+			size_t m_NumIncompleteMessages;
+			int m_OldestIncompleteMessage, m_NewestIncompleteMessage; // head and tail of time-ordered list
 			bool m_IsInbound;
 			size_t m_NumReceivedBytes;
 	};	
@@ -204,13 +204,14 @@ namespace tunnel
 		m_Buffer.CompleteCurrentTunnelDataMessage ();
 		std::vector<std::shared_ptr<I2NPMessage> > newTunnelMsgs;
 		const auto& tunnelDataMsgs = m_Buffer.GetTunnelDataMsgs ();
-		for (auto& tunnelMsg : tunnelDataMsgs)
+		newTunnelMsgs.reserve (tunnelDataMsgs.size ());
+		for (size_t i = 0; i < tunnelDataMsgs.size (); i++)
+			newTunnelMsgs.push_back (CreateEmptyTunnelDataMsg ());
+		m_Tunnel->EncryptTunnelMsgs (tunnelDataMsgs, newTunnelMsgs); 
+		for (auto& newMsg : newTunnelMsgs)
 		{	
-			auto newMsg = CreateEmptyTunnelDataMsg ();
-			m_Tunnel->EncryptTunnelMsg (tunnelMsg, newMsg); 
 			htobe32buf (newMsg->GetPayload (), m_Tunnel->GetNextTunnelID ());
 			newMsg->FillI2NPMessageHeader (eI2NPTunnelData); 
-			newTunnelMsgs.push_back (newMsg);
 			m_NumSentBytes += TUNNEL_DATA_MSG_SIZE;
 		}	
 		m_Buffer.ClearTunnelDataMsgs ();
@@ -188,6 +188,7 @@ namespace transport
 		switch (address->transportStyle)
 		{
 			case i2p::data::RouterInfo::eTransportNTCP:
+			case i2p::data::RouterInfo::eTransportNTCP2:
 			return "TCP";
 			break;
 			case i2p::data::RouterInfo::eTransportSSU:
@@ -40,6 +40,8 @@ LOCAL_SRC_FILES := DaemonAndroid.cpp i2pd_android.cpp \
     ../../NetDb.cpp \
     ../../NetDbRequests.cpp \
     ../../NTCPSession.cpp \
+    ../../NTCP2.cpp \
+    ../../NTCP2Establisher.cpp \
     ../../Profiling.cpp \
     ../../Reseed.cpp \
     ../../RouterContext.cpp \
@@ -50,6 +52,7 @@ LOCAL_SRC_FILES := DaemonAndroid.cpp i2pd_android.cpp \
     ../../SSU.cpp \
     ../../SSUData.cpp \
     ../../SSUSession.cpp \
+    ../../SSUSocket.cpp \
     ../../Streaming.cpp \
     ../../TransitTunnel.cpp \
     ../../Transports.cpp \
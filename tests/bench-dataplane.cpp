@@ -0,0 +1,314 @@
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <memory>
+#include <random>
+#include <algorithm>
+#include <iostream>
+#include <new>
+
+#include "../Crypto.h"
+#include "../Log.h"
+#include "../I2NPProtocol.h"
+#include "../TunnelBase.h"
+#include "../TunnelGateway.h"
+#include "../TunnelEndpoint.h"
+#include "../TransitTunnel.h"
+#include "../Tunnel.h"
+
+/*
+ * Data plane microbenchmarks, synthetic keys, no network.
+ * Build: cmake -DWITH_BENCH=ON -DCMAKE_BUILD_TYPE=Release ../build && make bench
+ * Usage: bench [-n msgs] [-r repeats] [name-filter]
+ * Prints JSON to stdout. Every benchmark runs once for warm-up, then
+ * 'repeats' times; ns_per_msg is the median, ns_per_msg_min the best run.
+ * Transports are not started, so messages handed to them are dropped.
+ */
+
+using namespace i2p;
+using namespace i2p::tunnel;
+
+static std::atomic<uint64_t> g_NumAllocs(0);
+
+void * operator new(size_t size) {
+  g_NumAllocs.fetch_add(1, std::memory_order_relaxed);
+  void * p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void * p) noexcept {
+  free(p);
+}
+
+struct Result {
+  std::string name, unit;
+  uint64_t msgs;
+  double nsPerMsg, nsPerMsgMin, allocsPerMsg;
+};
+
+static std::vector<Result> g_Results;
+static std::string g_Filter;
+static int g_Repeats = 5;
+
+/* setup prepares input outside of measurement, body returns number of messages processed */
+template<typename Setup, typename Body>
+static void Run(const std::string& name, const std::string& unit, Setup setup, Body body) {
+  if (!g_Filter.empty() && name.find(g_Filter) == std::string::npos) return;
+  std::vector<double> samples;
+  Result r{name, unit, 0, 0, 0, 0};
+  for (int i = 0; i <= g_Repeats; i++) {
+    setup();
+    uint64_t allocs = g_NumAllocs.load();
+    auto start = std::chrono::steady_clock::now();
+    uint64_t num = body();
+    auto end = std::chrono::steady_clock::now();
+    allocs = g_NumAllocs.load() - allocs;
+    if (!i || !num) continue; // warm-up
+    samples.push_back(std::chrono::duration<double, std::nano>(end - start).count() / num);
+    r.msgs = num;
+    r.allocsPerMsg = (double)allocs / num;
+  }
+  if (samples.empty()) return;
+  std::sort(samples.begin(), samples.end());
+  r.nsPerMsg = samples[samples.size() / 2];
+  r.nsPerMsgMin = samples[0];
+  g_Results.push_back(r);
+}
+
+static void PrintResults(size_t numMsgs) {
+  std::cout << "{\n  \"msgs\": " << numMsgs << ",\n  \"repeats\": " << g_Repeats << ",\n  \"benchmarks\": [";
+  for (size_t i = 0; i < g_Results.size(); i++) {
+    const auto& r = g_Results[i];
+    std::cout << (i ? ",\n" : "\n") << "    {\"name\": \"" << r.name << "\", \"unit\": \"" << r.unit
+      << "\", \"msgs\": " << r.msgs << ", \"msgs_per_sec\": " << (uint64_t)(1e9 / r.nsPerMsg)
+      << ", \"ns_per_msg\": " << r.nsPerMsg << ", \"ns_per_msg_min\": " << r.nsPerMsgMin
+      << ", \"allocs_per_msg\": " << r.allocsPerMsg << "}";
+  }
+  std::cout << "\n  ]\n}" << std::endl;
+}
+
+static std::mt19937 g_Rnd(12345); // fixed seed, same input every run
+
+static void RandomBytes(uint8_t * buf, size_t len) {
+  for (size_t i = 0; i < len; i++) buf[i] = g_Rnd();
+}
+
+static i2p::crypto::AESKey RandomKey() {
+  i2p::crypto::AESKey key;
+  RandomBytes(key, 32);
+  return key;
+}
+
+static std::shared_ptr<I2NPMessage> CreateDataMsg(size_t len) {
+  std::vector<uint8_t> payload(len);
+  RandomBytes(payload.data(), len);
+  return CreateI2NPMessage(eI2NPData, payload.data(), len);
+}
+
+static std::shared_ptr<I2NPMessage> CreateTunnelDataMsg(uint32_t tunnelID) {
+  auto msg = CreateEmptyTunnelDataMsg();
+  RandomBytes(msg->GetPayload(), TUNNEL_DATA_MSG_SIZE);
+  htobe32buf(msg->GetPayload(), tunnelID);
+  msg->FillI2NPMessageHeader(eI2NPTunnelData);
+  return msg;
+}
+
+/* mix of small control and large data messages */
+static const size_t MSG_SIZES[] = { 64, 300, 900, 1500, 2800, 4500 };
+static const size_t NUM_MSG_SIZES = sizeof(MSG_SIZES) / sizeof(MSG_SIZES[0]);
+
+/* unencrypted tunnel data messages as produced by gateway, as endpoint sees them after decryption */
+static std::vector<std::shared_ptr<I2NPMessage> > CreateFragmentedMsgs(size_t numMsgs) {
+  std::vector<std::shared_ptr<I2NPMessage> > tunnelMsgs;
+  TunnelGatewayBuffer buffer;
+  TunnelMessageBlock block;
+  block.deliveryType = eDeliveryTypeTunnel;
+  block.tunnelID = 1;
+  RandomBytes(block.hash, 32);
+  for (size_t i = 0; i < numMsgs; i++) {
+    block.data = CreateDataMsg(MSG_SIZES[i % NUM_MSG_SIZES]);
+    buffer.PutI2NPMsg(block);
+    if (i % 4 == 3 || i == numMsgs - 1) {
+      buffer.CompleteCurrentTunnelDataMessage();
+      for (auto& it: buffer.GetTunnelDataMsgs())
+        tunnelMsgs.push_back(std::const_pointer_cast<I2NPMessage>(it));
+      buffer.ClearTunnelDataMsgs();
+    }
+  }
+  return tunnelMsgs;
+}
+
+static void BenchCrypto(size_t numMsgs) {
+  std::vector<std::vector<uint8_t> > bufs(TUNNEL_DATA_MAX_NUM_PENDING_MSGS, std::vector<uint8_t>(1024));
+  for (auto& it: bufs) RandomBytes(it.data(), it.size());
+  uint8_t * ptrs[TUNNEL_DATA_MAX_NUM_PENDING_MSGS];
+  for (size_t i = 0; i < TUNNEL_DATA_MAX_NUM_PENDING_MSGS; i++) ptrs[i] = bufs[i].data();
+  auto layerKey = RandomKey(), ivKey = RandomKey();
+
+  i2p::crypto::TunnelEncryption encryption;
+  encryption.SetKeys(layerKey, ivKey);
+  Run("tunnel_encryption", "tunnel_msg", []{}, [&]() -> uint64_t {
+    for (size_t i = 0; i < numMsgs; i++)
+      encryption.Encrypt(ptrs[i % TUNNEL_DATA_MAX_NUM_PENDING_MSGS], ptrs[i % TUNNEL_DATA_MAX_NUM_PENDING_MSGS]);
+    return numMsgs;
+  });
+  Run("tunnel_encryption_batch", "tunnel_msg", []{}, [&]() -> uint64_t {
+    i2p::crypto::TunnelEncryption * encryptions[TUNNEL_DATA_MAX_NUM_PENDING_MSGS];
+    std::fill(encryptions, encryptions + TUNNEL_DATA_MAX_NUM_PENDING_MSGS, &encryption);
+    size_t num = 0;
+    for (; num < numMsgs; num += TUNNEL_DATA_MAX_NUM_PENDING_MSGS)
+      i2p::crypto::TunnelEncryption::Encrypt(TUNNEL_DATA_MAX_NUM_PENDING_MSGS, encryptions, ptrs, ptrs);
+    return num;
+  });
+
+  i2p::crypto::TunnelDecryption decryption;
+  decryption.SetKeys(layerKey, ivKey);
+  Run("tunnel_decryption", "tunnel_msg", []{}, [&]() -> uint64_t {
+    for (size_t i = 0; i < numMsgs; i++)
+      decryption.Decrypt(ptrs[i % TUNNEL_DATA_MAX_NUM_PENDING_MSGS], ptrs[i % TUNNEL_DATA_MAX_NUM_PENDING_MSGS]);
+    return numMsgs;
+  });
+  Run("tunnel_decryption_batch", "tunnel_msg", []{}, [&]() -> uint64_t {
+    i2p::crypto::TunnelDecryption * decryptions[TUNNEL_DATA_MAX_NUM_PENDING_MSGS];
+    std::fill(decryptions, decryptions + TUNNEL_DATA_MAX_NUM_PENDING_MSGS, &decryption);
+    size_t num = 0;
+    for (; num < numMsgs; num += TUNNEL_DATA_MAX_NUM_PENDING_MSGS)
+      i2p::crypto::TunnelDecryption::Decrypt(TUNNEL_DATA_MAX_NUM_PENDING_MSGS, decryptions, ptrs, ptrs);
+    return num;
+  });
+}
+
+static void BenchGateway(size_t numMsgs) {
+  std::vector<std::shared_ptr<I2NPMessage> > msgs;
+  for (size_t i = 0; i < NUM_MSG_SIZES; i++) msgs.push_back(CreateDataMsg(MSG_SIZES[i]));
+  TunnelMessageBlock block;
+  block.deliveryType = eDeliveryTypeTunnel;
+  block.tunnelID = 1;
+  RandomBytes(block.hash, 32);
+  Run("gateway_fragmentation", "i2np_msg", []{}, [&]() -> uint64_t {
+    TunnelGatewayBuffer buffer;
+    for (size_t i = 0; i < numMsgs; i++) {
+      block.data = msgs[i % NUM_MSG_SIZES];
+      buffer.PutI2NPMsg(block);
+      if (i % 4 == 3) { // as sent by a pool's outbound tunnel
+        buffer.CompleteCurrentTunnelDataMessage();
+        buffer.ClearTunnelDataMsgs();
+      }
+    }
+    return numMsgs;
+  });
+}
+
+static void BenchEndpoint(size_t numMsgs, bool shuffle) {
+  std::vector<std::shared_ptr<I2NPMessage> > tunnelMsgs;
+  Run(shuffle ? "endpoint_reassembly_shuffled" : "endpoint_reassembly_inorder", "tunnel_msg",
+    [&] {
+      tunnelMsgs = CreateFragmentedMsgs(numMsgs);
+      if (shuffle) // reorder within a window, as after a few hops
+        for (size_t i = 0; i < tunnelMsgs.size(); i += 16)
+          std::shuffle(tunnelMsgs.begin() + i, tunnelMsgs.begin() + std::min(i + 16, tunnelMsgs.size()), g_Rnd);
+    },
+    [&]() -> uint64_t {
+      TunnelEndpoint endpoint(false); // outbound, delivers to transports
+      size_t num = tunnelMsgs.size();
+      for (auto& it: tunnelMsgs)
+        endpoint.HandleDecryptedTunnelDataMsg(std::move(it));
+      tunnelMsgs.clear();
+      return num;
+    });
+}
+
+static void BenchParticipant(size_t numMsgs) {
+  auto layerKey = RandomKey(), ivKey = RandomKey();
+  uint8_t nextIdent[32];
+  RandomBytes(nextIdent, 32);
+  auto tunnel = CreateTransitTunnel(1, nextIdent, 2, layerKey, ivKey, false, false);
+  std::vector<std::shared_ptr<I2NPMessage> > tunnelMsgs;
+  Run("transit_participant", "tunnel_msg",
+    [&] {
+      for (size_t i = 0; i < numMsgs; i++) tunnelMsgs.push_back(CreateTunnelDataMsg(1));
+    },
+    [&]() -> uint64_t {
+      for (size_t i = 0; i < tunnelMsgs.size(); i++) {
+        tunnel->HandleTunnelDataMsg(std::move(tunnelMsgs[i]));
+        if (i % 16 == 15) tunnel->FlushTunnelDataMsgs(); // burst ends
+      }
+      tunnel->FlushTunnelDataMsgs();
+      size_t num = tunnelMsgs.size();
+      tunnelMsgs.clear();
+      return num;
+    });
+}
+
+class SinkTunnel: public TunnelBase {
+  public:
+    SinkTunnel(uint32_t tunnelID, std::atomic<uint64_t>& numReceived):
+      TunnelBase(tunnelID, 0, i2p::data::IdentHash()), m_NumReceived(numReceived) {}
+    void HandleTunnelDataMsg(std::shared_ptr<const I2NPMessage>) { m_NumReceived++; }
+    void SendTunnelDataMsg(std::shared_ptr<I2NPMessage>) {}
+    void EncryptTunnelMsg(std::shared_ptr<const I2NPMessage>, std::shared_ptr<I2NPMessage>) {}
+  private:
+    std::atomic<uint64_t>& m_NumReceived;
+};
+
+static void BenchShard(size_t numMsgs, int numTunnels) {
+  std::atomic<uint64_t> numReceived(0);
+  TunnelsShard shard(0);
+  for (int i = 1; i <= numTunnels; i++)
+    shard.AddTunnel(std::make_shared<SinkTunnel>(i, numReceived));
+  shard.Start();
+  std::vector<std::shared_ptr<I2NPMessage> > tunnelMsgs;
+  Run("tunnels_shard_dispatch_" + std::to_string(numTunnels), "tunnel_msg",
+    [&] {
+      numReceived = 0;
+      while (tunnelMsgs.size() < numMsgs) { // bursts of 4 for random tunnels
+        uint32_t tunnelID = g_Rnd() % numTunnels + 1;
+        for (int i = 0; i < 4; i++) tunnelMsgs.push_back(CreateTunnelDataMsg(tunnelID));
+      }
+    },
+    [&]() -> uint64_t {
+      size_t num = tunnelMsgs.size();
+      std::vector<std::shared_ptr<I2NPMessage> > batch;
+      for (size_t i = 0; i < num; i += TUNNEL_DATA_MAX_NUM_PENDING_MSGS) { // as received from a transport session
+        batch.assign(tunnelMsgs.begin() + i, tunnelMsgs.begin() + std::min(i + TUNNEL_DATA_MAX_NUM_PENDING_MSGS, num));
+        shard.PostTunnelData(batch);
+      }
+      batch.clear();
+      tunnelMsgs.clear();
+      while (numReceived < num) std::this_thread::yield();
+      return num;
+    });
+  shard.Stop();
+}
+
+int main(int argc, char* argv[]) {
+  size_t numMsgs = 20000;
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "-n" && i + 1 < argc)
+      numMsgs = std::max(atoi(argv[++i]), 1);
+    else if (arg == "-r" && i + 1 < argc)
+      g_Repeats = std::max(atoi(argv[++i]), 1);
+    else
+      g_Filter = arg;
+  }
+  i2p::log::Logger().SetLogLevel("error");
+  i2p::crypto::InitCrypto(false);
+
+  BenchCrypto(numMsgs);
+  BenchGateway(numMsgs);
+  BenchEndpoint(numMsgs, false);
+  BenchEndpoint(numMsgs, true);
+  BenchParticipant(numMsgs);
+  BenchShard(numMsgs, 16);
+  BenchShard(numMsgs, 1024);
+  PrintResults(numMsgs);
+
+  i2p::crypto::TerminateCrypto();
+  return 0;
+}
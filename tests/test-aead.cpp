@@ -0,0 +1,59 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+
+#include "../Crypto.h"
+
+int main ()
+{
+#ifdef OPENSSL_AEAD_CHACHA20_POLY1305
+	// RFC 7539 2.8.2
+	static const char text[] = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+	static const uint8_t ad[12] = { 0x50, 0x51, 0x52, 0x53, 0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7 };
+	static const uint8_t nonce[12] = { 0x07, 0x00, 0x00, 0x00, 0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47 };
+	static const uint8_t encrypted[114 + 16] =
+	{
+		0xd3, 0x1a, 0x8d, 0x34, 0x64, 0x8e, 0x60, 0xdb, 0x7b, 0x86, 0xaf, 0xbc, 0x53, 0xef, 0x7e, 0xc2,
+		0xa4, 0xad, 0xed, 0x51, 0x29, 0x6e, 0x08, 0xfe, 0xa9, 0xe2, 0xb5, 0xa7, 0x36, 0xee, 0x62, 0xd6,
+		0x3d, 0xbe, 0xa4, 0x5e, 0x8c, 0xa9, 0x67, 0x12, 0x82, 0xfa, 0xfb, 0x69, 0xda, 0x92, 0x72, 0x8b,
+		0x1a, 0x71, 0xde, 0x0a, 0x9e, 0x06, 0x0b, 0x29, 0x05, 0xd6, 0xa5, 0xb6, 0x7e, 0xcd, 0x3b, 0x36,
+		0x92, 0xdd, 0xbd, 0x7f, 0x2d, 0x77, 0x8b, 0x8c, 0x98, 0x03, 0xae, 0xe3, 0x28, 0x09, 0x1b, 0x58,
+		0xfa, 0xb3, 0x24, 0xe4, 0xfa, 0xd6, 0x75, 0x94, 0x55, 0x85, 0x80, 0x8b, 0x48, 0x31, 0xd7, 0xbc,
+		0x3f, 0xf4, 0xde, 0xf0, 0x8e, 0x4b, 0x7a, 0x9d, 0xe5, 0x76, 0xd2, 0x65, 0x86, 0xce, 0xc6, 0x4b,
+		0x61, 0x16,
+		// tag
+		0x1a, 0xe1, 0x0b, 0x59, 0x4f, 0x09, 0xe2, 0x6a, 0x7e, 0x90, 0x2e, 0xcb, 0xd0, 0x60, 0x06, 0x91
+	};
+	uint8_t key[32];
+	for (size_t i = 0; i < 32; i++) key[i] = 0x80 + i;
+	const uint8_t * msg = (const uint8_t *)text;
+	size_t len = strlen (text);
+	assert (len == 114);
+
+	uint8_t buf[114 + 16];
+	assert (i2p::crypto::AEADChaCha20Poly1305 (msg, len, ad, 12, key, nonce, buf, len + 16, true));
+	assert (!memcmp (buf, encrypted, len + 16));
+
+	uint8_t decrypted[114];
+	assert (i2p::crypto::AEADChaCha20Poly1305 (encrypted, len + 16, ad, 12, key, nonce, decrypted, len, false));
+	assert (!memcmp (decrypted, msg, len));
+
+	// in place, as NTCP2 frames
+	memcpy (buf, encrypted, len + 16);
+	assert (i2p::crypto::AEADChaCha20Poly1305 (buf, len + 16, ad, 12, key, nonce, buf, len + 16, false));
+	assert (!memcmp (buf, msg, len));
+
+	// any modification of ciphertext, tag or ad must fail
+	memcpy (buf, encrypted, len + 16);
+	buf[57] ^= 0x01;
+	assert (!i2p::crypto::AEADChaCha20Poly1305 (buf, len + 16, ad, 12, key, nonce, decrypted, len, false));
+	memcpy (buf, encrypted, len + 16);
+	buf[len + 15] ^= 0x80;
+	assert (!i2p::crypto::AEADChaCha20Poly1305 (buf, len + 16, ad, 12, key, nonce, decrypted, len, false));
+	uint8_t ad1[12];
+	memcpy (ad1, ad, 12); ad1[0] ^= 0x01;
+	assert (!i2p::crypto::AEADChaCha20Poly1305 (encrypted, len + 16, ad1, 12, key, nonce, decrypted, len, false));
+	// too short for tag
+	assert (!i2p::crypto::AEADChaCha20Poly1305 (encrypted, 15, ad, 12, key, nonce, decrypted, len, false));
+#endif
+}
@@ -0,0 +1,63 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+
+#include "../Signature.h"
+
+// RFC 8032 test 1
+const uint8_t privateKey[32] =
+{
+	0x9d,0x61,0xb1,0x9d,0xef,0xfd,0x5a,0x60,0xba,0x84,0x4a,0xf4,0x92,0xec,0x2c,0xc4,
+	0x44,0x49,0xc5,0x69,0x7b,0x32,0x69,0x19,0x70,0x3b,0xac,0x03,0x1c,0xae,0x7f,0x60
+};
+
+const uint8_t publicKey[32] =
+{
+	0xd7,0x5a,0x98,0x01,0x82,0xb1,0x0a,0xb7,0xd5,0x4b,0xfe,0xd3,0xc9,0x64,0x07,0x3a,
+	0x0e,0xe1,0x72,0xf3,0xda,0xa6,0x23,0x25,0xaf,0x02,0x1a,0x68,0xf7,0x07,0x51,0x1a
+};
+
+const uint8_t rfcSignature[64] = // of empty message
+{
+	0xe5,0x56,0x43,0x00,0xc3,0x60,0xac,0x72,0x90,0x86,0xe2,0xcc,0x80,0x6e,0x82,0x8a,
+	0x84,0x87,0x7f,0x1e,0xb8,0xe5,0xd9,0x74,0xd8,0x73,0xe0,0x65,0x22,0x49,0x01,0x55,
+	0x5f,0xb8,0x82,0x15,0x90,0xa3,0x3b,0xac,0xc6,0x1e,0x39,0x70,0x1c,0xf9,0xb4,0x6b,
+	0xd2,0x5b,0xf5,0xf0,0x59,0x5b,0xbe,0x24,0x65,0x51,0x41,0x43,0x8e,0x7a,0x10,0x0b
+};
+
+// r is taken from first 32 bytes of digest, signatures differ from RFC's but must not change
+const uint8_t message[1] = { 0x72 };
+const uint8_t signature[64] =
+{
+	0xcb,0x64,0x4a,0x93,0xc2,0x56,0xcb,0x34,0xe9,0x9b,0xd6,0xa3,0x47,0xb3,0x7a,0xba,
+	0x1c,0x7c,0x36,0xa7,0x48,0x7b,0x8e,0x09,0x88,0x84,0x22,0x20,0x22,0xc7,0xb8,0xcf,
+	0x0a,0x78,0xef,0x1a,0x0d,0x6f,0x1a,0x41,0xc7,0x0e,0xa1,0x48,0xe3,0x30,0xe0,0xb2,
+	0xec,0xd8,0x34,0x72,0x9b,0x2f,0xc1,0x14,0x1b,0x34,0x5a,0x09,0x19,0x31,0xba,0x08
+};
+
+int main ()
+{
+	uint8_t sig[64];
+	i2p::crypto::EDDSA25519Signer signer (privateKey);
+	assert (!memcmp (signer.GetPublicKey (), publicKey, 32));
+	signer.Sign (message, 1, sig);
+	assert (!memcmp (sig, signature, 64));
+
+	i2p::crypto::EDDSA25519Verifier verifier (publicKey);
+	assert (verifier.Verify (message, 1, signature));
+	assert (verifier.Verify (nullptr, 0, rfcSignature));
+	sig[63] ^= 0x01;
+	assert (!verifier.Verify (message, 1, sig));
+
+	uint8_t priv[32], pub[32];
+	for (int i = 0; i < 16; i++)
+	{
+		i2p::crypto::CreateEDDSA25519RandomKeys (priv, pub);
+		i2p::crypto::EDDSA25519Signer signer1 (priv);
+		signer1.Sign (privateKey, 32, sig);
+		i2p::crypto::EDDSA25519Verifier verifier1 (pub);
+		assert (verifier1.Verify (privateKey, 32, sig));
+		sig[i] ^= 0x80;
+		assert (!verifier1.Verify (privateKey, 32, sig));
+	}
+}
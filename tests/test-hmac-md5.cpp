@@ -0,0 +1,40 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+
+#include "../Crypto.h"
+
+int main ()
+{
+	// multi-buffer and block by block HMAC-MD5 must match the one-shot version
+	const size_t num = 7;
+	uint8_t bufs[num][1600], digests[num][16], expected[16];
+	size_t lens[num] = { 0, 1, 55, 56, 64, 1000, 1456 + 18 };
+	i2p::crypto::MACKey keys[num];
+	const uint8_t * msgs[num];
+	const i2p::crypto::MACKey * keyPtrs[num];
+	uint8_t * digestPtrs[num];
+	for (size_t i = 0; i < num; i++)
+	{
+		RAND_bytes (bufs[i], lens[i] + 1);
+		RAND_bytes (keys[i], 32);
+		msgs[i] = bufs[i]; keyPtrs[i] = keys + i; digestPtrs[i] = digests[i];
+	}
+	i2p::crypto::HMACMD5Digest (num, msgs, lens, keyPtrs, digestPtrs);
+	for (size_t i = 0; i < num; i++)
+	{
+		i2p::crypto::HMACMD5Digest (bufs[i], lens[i], keys[i], expected);
+		assert (!memcmp (digests[i], expected, 16));
+
+		uint8_t digest[16];
+		i2p::crypto::HMACMD5 hmac (keys[i]);
+		size_t numBlocks = lens[i] >> 7;
+		hmac.Update (bufs[i], numBlocks);
+		hmac.Final (bufs[i] + numBlocks*64, lens[i] - numBlocks*64, digest);
+		assert (!memcmp (digest, expected, 16));
+	}
+	// single message
+	i2p::crypto::HMACMD5Digest (1, msgs + 5, lens + 5, keyPtrs + 5, digestPtrs);
+	i2p::crypto::HMACMD5Digest (bufs[5], lens[5], keys[5], expected);
+	assert (!memcmp (digests[0], expected, 16));
+}
@@ -0,0 +1,151 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+#include <memory>
+
+#include "../NTCP2Establisher.h"
+#include "../I2NPProtocol.h"
+
+using namespace i2p;
+using namespace i2p::transport;
+
+#ifdef NTCP2_SUPPORTED
+static std::shared_ptr<I2NPMessage> CreateMessage (uint8_t typeID, uint32_t msgID, const uint8_t * payload, size_t len)
+{
+	auto msg = std::make_shared<I2NPMessageBuffer<1024> >();
+	msg->SetTypeID (typeID);
+	msg->SetMsgID (msgID);
+	msg->SetExpiration (1234567000); // NTCP2 has seconds only
+	msg->len += len;
+	memcpy (msg->GetPayload (), payload, len);
+	msg->UpdateSize ();
+	return msg;
+}
+
+// I2NP block in one frame from sender to receiver, as NTCP2Session sends and receives it
+static void Exchange (NTCP2FrameCipher& sender, NTCP2FrameCipher& receiver, std::shared_ptr<I2NPMessage> msg)
+{
+	uint8_t frame[2 + 3 + 1024 + 16];
+	uint8_t * buf = frame + 2;
+	buf[0] = eNTCP2BlkI2NPMessage;
+	size_t size = msg->ToNTCP2 (buf + 3);
+	htobe16buf (buf + 1, size);
+	size_t len = size + 3;
+	sender.Encrypt (frame, len);
+	assert (memcmp (buf + 3 + I2NP_NTCP2_HEADER_SIZE, msg->GetPayload (), msg->GetPayloadLength ()));
+
+	uint16_t frameLen = receiver.DecryptLength (frame);
+	assert (frameLen == len + 16);
+	assert (receiver.Decrypt (buf, frameLen));
+	assert (buf[0] == eNTCP2BlkI2NPMessage);
+	assert (bufbe16toh (buf + 1) == size);
+	auto received = std::make_shared<I2NPMessageBuffer<1024> >();
+	received->len = received->offset + size + I2NP_HEADER_SIZE - I2NP_NTCP2_HEADER_SIZE;
+	memcpy (received->GetNTCP2Header (), buf + 3, size);
+	received->FromNTCP2 ();
+	assert (received->GetTypeID () == msg->GetTypeID ());
+	assert (received->GetMsgID () == msg->GetMsgID ());
+	assert (received->GetExpiration () == msg->GetExpiration ());
+	assert (received->GetPayloadLength () == msg->GetPayloadLength ());
+	assert (!memcmp (received->GetPayload (), msg->GetPayload (), msg->GetPayloadLength ()));
+}
+#endif
+
+int main ()
+{
+#ifdef NTCP2_SUPPORTED
+	const int netID = 2;
+	auto aliceStaticKeys = std::make_shared<i2p::crypto::X25519Keys> ();
+	aliceStaticKeys->GenerateKeys ();
+	auto bobStaticKeys = std::make_shared<i2p::crypto::X25519Keys> ();
+	bobStaticKeys->GenerateKeys ();
+	uint8_t aliceHash[32], bobHash[32], bobIV[16];
+	RAND_bytes (aliceHash, 32); RAND_bytes (bobHash, 32); RAND_bytes (bobIV, 16);
+
+	NTCP2Establisher alice (aliceStaticKeys, aliceHash, netID), bob (bobStaticKeys, bobHash, netID);
+	// Alice knows Bob's published static key and IV
+	alice.m_RemoteIdentHash = bobHash;
+	memcpy (alice.m_RemoteStaticKey, bobStaticKeys->GetPublicKey (), 32);
+	memcpy (alice.m_IV, bobIV, 16);
+	memcpy (bob.m_IV, bobIV, 16);
+
+	// SessionRequest
+	uint8_t ri[700]; // Alice's RouterInfo, not parsed by establisher
+	RAND_bytes (ri, sizeof (ri));
+	alice.m_EphemeralKeys.GenerateKeys ();
+	alice.CreateSessionRequestMessage (ri, sizeof (ri));
+	memcpy (bob.m_SessionRequestBuffer, alice.m_SessionRequestBuffer, alice.m_SessionRequestBufferLen);
+	uint16_t paddingLen = 0;
+	assert (bob.ProcessSessionRequestMessage (paddingLen));
+	assert (paddingLen + 64u == alice.m_SessionRequestBufferLen);
+	assert (bob.m3p2Len == alice.m3p2Len);
+	assert (!memcmp (bob.GetRemotePub (), alice.GetPub (), 32));
+
+	// SessionCreated
+	bob.m_EphemeralKeys.GenerateKeys ();
+	bob.CreateSessionCreatedMessage ();
+	memcpy (alice.m_SessionCreatedBuffer, bob.m_SessionCreatedBuffer, bob.m_SessionCreatedBufferLen);
+	assert (alice.ProcessSessionCreatedMessage (paddingLen));
+	assert (paddingLen + 64u == bob.m_SessionCreatedBufferLen);
+	assert (!memcmp (alice.GetRemotePub (), bob.GetPub (), 32));
+
+	// SessionConfirmed
+	uint8_t nonce[12];
+	CreateNTCP2Nonce (1, nonce);
+	alice.CreateSessionConfirmedMessagePart1 (nonce);
+	memset (nonce, 0, 12);
+	alice.CreateSessionConfirmedMessagePart2 (nonce);
+	bob.m_SessionConfirmedBuffer = new uint8_t[bob.m3p2Len + 48];
+	memcpy (bob.m_SessionConfirmedBuffer, alice.m_SessionConfirmedBuffer, alice.m3p2Len + 48);
+	CreateNTCP2Nonce (1, nonce);
+	assert (bob.ProcessSessionConfirmedMessagePart1 (nonce));
+	assert (!memcmp (bob.m_RemoteStaticKey, aliceStaticKeys->GetPublicKey (), 32));
+	uint8_t m3p2[sizeof (ri) + 4];
+	memset (nonce, 0, 12);
+	assert (bob.ProcessSessionConfirmedMessagePart2 (nonce, m3p2));
+	assert (m3p2[0] == eNTCP2BlkRouterInfo);
+	assert (bufbe16toh (m3p2 + 1) == sizeof (ri) + 1);
+	assert (!memcmp (m3p2 + 4, ri, sizeof (ri)));
+	assert (!memcmp (alice.GetH (), bob.GetH (), 32));
+	assert (!memcmp (alice.GetCK (), bob.GetCK (), 32));
+
+	// data phase, Alice sends with ab, Bob with ba
+	uint8_t aliceKab[33], aliceKba[32], aliceSipab[33], aliceSipba[32];
+	uint8_t bobKab[33], bobKba[32], bobSipab[33], bobSipba[32];
+	alice.KeyDerivationFunctionDataPhase (aliceKab, aliceKba, aliceSipab, aliceSipba);
+	bob.KeyDerivationFunctionDataPhase (bobKab, bobKba, bobSipab, bobSipba);
+	NTCP2FrameCipher aliceSend, aliceReceive, bobSend, bobReceive;
+	aliceSend.SetKeys (aliceKab, aliceSipab); aliceReceive.SetKeys (aliceKba, aliceSipba);
+	bobSend.SetKeys (bobKba, bobSipba); bobReceive.SetKeys (bobKab, bobSipab);
+	uint8_t payload[600];
+	RAND_bytes (payload, sizeof (payload));
+	Exchange (aliceSend, bobReceive, CreateMessage (eI2NPDeliveryStatus, 0x12345678, payload, 12));
+	Exchange (bobSend, aliceReceive, CreateMessage (eI2NPDatabaseStore, 0x9abcdef0, payload, sizeof (payload)));
+	Exchange (aliceSend, bobReceive, CreateMessage (eI2NPData, 1, payload + 1, 100)); // next nonce and IV
+	assert (aliceSend.GetSequenceNumber () == 2 && bobReceive.GetSequenceNumber () == 2);
+
+	// modified frame is rejected
+	uint8_t frame[2 + 32 + 16];
+	memset (frame + 2, 0, 32);
+	aliceSend.Encrypt (frame, 32);
+	frame[10] ^= 0x01;
+	assert (bobReceive.DecryptLength (frame) == 32 + 16);
+	assert (!bobReceive.Decrypt (frame + 2, 32 + 16));
+
+	// SessionRequest to another router or with corrupted options is rejected
+	NTCP2Establisher alice1 (aliceStaticKeys, aliceHash, netID), bob1 (bobStaticKeys, aliceHash, netID);
+	alice1.m_RemoteIdentHash = bobHash;
+	memcpy (alice1.m_RemoteStaticKey, bobStaticKeys->GetPublicKey (), 32);
+	memcpy (alice1.m_IV, bobIV, 16);
+	memcpy (bob1.m_IV, bobIV, 16);
+	alice1.m_EphemeralKeys.GenerateKeys ();
+	alice1.CreateSessionRequestMessage (ri, sizeof (ri));
+	memcpy (bob1.m_SessionRequestBuffer, alice1.m_SessionRequestBuffer, alice1.m_SessionRequestBufferLen);
+	assert (!bob1.ProcessSessionRequestMessage (paddingLen));
+	NTCP2Establisher bob2 (bobStaticKeys, bobHash, netID);
+	memcpy (bob2.m_IV, bobIV, 16);
+	memcpy (bob2.m_SessionRequestBuffer, alice1.m_SessionRequestBuffer, alice1.m_SessionRequestBufferLen);
+	bob2.m_SessionRequestBuffer[40] ^= 0x01;
+	assert (!bob2.ProcessSessionRequestMessage (paddingLen));
+#endif
+}
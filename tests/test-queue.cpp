@@ -0,0 +1,65 @@
+#include <cassert>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "../Queue.h"
+
+using namespace i2p::util;
+
+const int NUM_PRODUCERS = 4;
+const int NUM_MSGS = 100000;
+
+struct Msg
+{
+  int producer, seqn;
+};
+
+int main() {
+  /* single thread, small ring to hit overflow */
+  MPSCQueue<std::shared_ptr<Msg>, 4> q;
+  assert(q.IsEmpty());
+  assert(!q.Get());
+  for (int i = 0; i < 10; i++)
+    q.Put(std::make_shared<Msg>(Msg{0, i}));
+  assert(q.GetSize() == 10);
+  assert(q.Peek()->seqn == 0);
+  for (int i = 0; i < 10; i++)
+    assert(q.Get()->seqn == i);
+  assert(q.IsEmpty());
+
+  std::vector<std::shared_ptr<Msg> > batch;
+  for (int i = 0; i < 6; i++)
+    batch.push_back(std::make_shared<Msg>(Msg{0, i}));
+  q.Put(batch);
+  q.Put(std::make_shared<Msg>(Msg{0, 6}));
+  batch.clear();
+  assert(q.GetAll(batch) == 7);
+  for (int i = 0; i < 7; i++)
+    assert(batch[i]->seqn == i);
+  assert(q.GetSize() == 0);
+
+  /* several producers, order must be kept per producer */
+  MPSCQueue<std::shared_ptr<Msg>, 64> mq;
+  std::vector<std::thread> producers;
+  for (int p = 0; p < NUM_PRODUCERS; p++)
+    producers.emplace_back([&mq, p]() {
+      for (int i = 0; i < NUM_MSGS; i++)
+        mq.Put(std::make_shared<Msg>(Msg{p, i}));
+    });
+  int next[NUM_PRODUCERS] = {0};
+  int received = 0;
+  while (received < NUM_PRODUCERS * NUM_MSGS) {
+    auto msg = mq.GetNextWithTimeout(100);
+    if (!msg) continue;
+    assert(msg->seqn == next[msg->producer]);
+    next[msg->producer]++;
+    received++;
+  }
+  for (auto& it: producers)
+    it.join();
+  assert(mq.IsEmpty());
+  assert(!mq.Get());
+
+  return 0;
+}
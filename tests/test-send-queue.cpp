@@ -0,0 +1,80 @@
+#include <cassert>
+#include <memory>
+#include <vector>
+
+#include "../TransportSession.h"
+
+using namespace i2p;
+using namespace i2p::transport;
+
+std::shared_ptr<I2NPMessage> CreateMsg (uint8_t typeID, uint32_t msgID)
+{
+  auto msg = std::make_shared<I2NPMessageBuffer<64> >();
+  msg->SetTypeID (typeID);
+  msg->SetMsgID (msgID);
+  return msg;
+}
+
+int main() {
+  TransportSendQueue q;
+  assert(q.IsEmpty());
+  assert(!q.Peek());
+  assert(!q.Pop());
+
+  /* data is dropped oldest first */
+  for (uint32_t i = 0; i < SEND_QUEUE_MAX_SIZES[eSendQueueData] + 10; i++)
+    assert(q.Push(CreateMsg(eI2NPTunnelData, i)));
+  assert(q.GetSize(eSendQueueData) == SEND_QUEUE_MAX_SIZES[eSendQueueData]);
+  assert(q.GetNumDropped(eSendQueueData) == 10);
+  assert(q.Peek()->GetMsgID() == 10);
+
+  /* build messages are never dropped and go before data */
+  for (uint32_t i = 0; i < 300; i++)
+    assert(q.Push(CreateMsg(eI2NPVariableTunnelBuildReply, 1000 + i)));
+  assert(q.GetSize(eSendQueueBuild) == 300);
+  assert(q.GetNumDropped(eSendQueueBuild) == 0);
+  q.Push(CreateMsg(eI2NPDeliveryStatus, 5000));
+  assert(q.GetSize(eSendQueueControl) == 1);
+
+  /* weighted round robin: at most one data message ahead of control, data gets its share */
+  int numControl = 0, numBuild = 0, numData = 0;
+  for (int i = 0; i < 2; i++)
+    if (q.Pop()->GetTypeID() == eI2NPDeliveryStatus) numControl++;
+  assert(numControl == 1);
+  for (int i = 0; i < 50; i++)
+  {
+    auto msg = q.Pop();
+    if (msg->GetTypeID() == eI2NPVariableTunnelBuildReply) numBuild++;
+    else numData++;
+  }
+  assert(numBuild == 40 && numData == 10);
+
+  /* order within class is preserved */
+  uint32_t lastBuild = 0, lastData = 0;
+  while (auto msg = q.Pop())
+  {
+    uint32_t& last = msg->GetTypeID() == eI2NPTunnelData ? lastData : lastBuild;
+    assert(msg->GetMsgID() > last);
+    last = msg->GetMsgID();
+  }
+  assert(q.IsEmpty() && q.GetSize() == 0);
+
+  /* control drops newest, netdb drops oldest */
+  for (uint32_t i = 0; i < SEND_QUEUE_MAX_SIZES[eSendQueueControl] + 1; i++)
+    q.Push(CreateMsg(eI2NPDeliveryStatus, i));
+  for (uint32_t i = 0; i < SEND_QUEUE_MAX_SIZES[eSendQueueNetDb] + 1; i++)
+    q.Push(CreateMsg(eI2NPDatabaseStore, i));
+  assert(q.GetNumDropped(eSendQueueControl) == 1 && q.GetNumDropped(eSendQueueNetDb) == 1);
+  assert(q.Pop()->GetMsgID() == 0);
+  while (q.Peek()->GetTypeID() == eI2NPDeliveryStatus) q.Pop();
+  assert(q.Pop()->GetMsgID() == 1);
+
+  /* total size exceeded means the peer doesn't read */
+  q.Clear();
+  bool ok = true;
+  for (size_t i = 0; i <= SEND_QUEUE_MAX_TOTAL_SIZE; i++)
+    ok = q.Push(CreateMsg(eI2NPTunnelBuild, i));
+  assert(!ok);
+
+  return 0;
+}
@@ -0,0 +1,108 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+#include <poll.h>
+#include <vector>
+
+#include "../SSUSocket.h"
+
+using namespace i2p::transport;
+using boost::asio::ip::udp;
+
+struct Sent
+{
+	size_t len;
+	int to; // receiver
+};
+
+static void FillPacket (uint8_t * buf, size_t len, size_t num)
+{
+	for (size_t i = 0; i < len; i++) buf[i] = num + i;
+}
+
+static void ReceiveAll (SSUSocketBatch& batch, udp::socket& socket, const udp::endpoint& from,
+	const std::vector<std::pair<size_t, size_t> >& expectedPackets, i2p::util::MemoryPoolMt<SSUPacket>& pool) // len, index
+{
+	std::vector<SSUPacket *> packets;
+	while (packets.size () < expectedPackets.size ())
+	{
+		pollfd fd = { socket.native_handle (), POLLIN, 0 };
+		int r = poll (&fd, 1, 1000);
+		assert (r > 0); // nothing lost on loopback
+		boost::system::error_code ecode;
+		batch.Receive (packets, SSU_MTU_V4, ecode);
+		assert (!ecode);
+	}
+	assert (packets.size () == expectedPackets.size ());
+	// datagrams of one destination come in order, aggregates are split back
+	uint8_t expected[SSU_MTU_V4];
+	for (size_t i = 0; i < expectedPackets.size (); i++)
+	{
+		size_t len = expectedPackets[i].first;
+		assert (packets[i]->len == len);
+		assert (packets[i]->from == from);
+		FillPacket (expected, len, expectedPackets[i].second);
+		assert (!memcmp (packets[i]->buf, expected, len));
+	}
+	pool.ReleaseMt (packets);
+}
+
+static void Test (bool senderOffload, bool receiverOffload)
+{
+	boost::asio::io_service service;
+	i2p::util::MemoryPoolMt<SSUPacket> pool;
+	udp::endpoint local (boost::asio::ip::address::from_string ("127.0.0.1"), 0);
+	udp::socket sender (service, local), receiver1 (service, local), receiver2 (service, local);
+	receiver1.set_option (udp::socket::receive_buffer_size (0x100000));
+	receiver2.set_option (udp::socket::receive_buffer_size (0x100000));
+	SSUSocketBatch senderBatch (sender, pool), receiverBatch1 (receiver1, pool), receiverBatch2 (receiver2, pool);
+	senderBatch.Init (senderOffload);
+	receiverBatch1.Init (receiverOffload);
+	receiverBatch2.Init (receiverOffload);
+	if (!senderOffload) assert (!senderBatch.IsGSO () && !senderBatch.IsGRO ());
+	if (!receiverOffload) assert (!receiverBatch1.IsGSO () && !receiverBatch1.IsGRO ());
+
+	// bursts of equal size packets with shorter last one, size changes and destination changes break groups
+	const Sent sent[] =
+	{
+		{ 1000, 1 }, { 1000, 1 }, { 1000, 1 }, { 1000, 1 }, { 500, 1 },
+		{ 1200, 1 }, { 1200, 1 }, { 1200, 2 }, { 1200, 2 }, { 1200, 1 },
+		{ 100, 1 }, { 1484, 1 }, { 1, 2 }, { 1, 2 }
+	};
+	const size_t numSent = sizeof (sent)/sizeof (sent[0]);
+	udp::endpoint to[3] = { udp::endpoint (), receiver1.local_endpoint (), receiver2.local_endpoint () };
+	std::vector<std::pair<size_t, size_t> > packets1, packets2;
+	for (int round = 0; round < 10; round++) // 140 packets, more than queue
+		for (size_t i = 0; i < numSent; i++)
+		{
+			uint8_t buf[SSU_MTU_V4];
+			size_t num = round*numSent + i;
+			FillPacket (buf, sent[i].len, num);
+			senderBatch.Send (buf, sent[i].len, to[sent[i].to]);
+			(sent[i].to == 1 ? packets1 : packets2).push_back (std::make_pair (sent[i].len, num));
+		}
+	senderBatch.Flush ();
+	ReceiveAll (receiverBatch1, receiver1, sender.local_endpoint (), packets1, pool);
+	ReceiveAll (receiverBatch2, receiver2, sender.local_endpoint (), packets2, pool);
+
+	// more than one recvmmsg batch
+	std::vector<std::pair<size_t, size_t> > packets;
+	for (size_t i = 0; i < SSU_MAX_NUM_RECEIVED_PACKETS*2 + 3; i++)
+	{
+		uint8_t buf[SSU_MTU_V4];
+		size_t len = 100 + i;
+		FillPacket (buf, len, i);
+		if (senderBatch.Send (buf, len, to[1])) senderBatch.Flush ();
+		packets.push_back (std::make_pair (len, i));
+	}
+	senderBatch.Flush ();
+	ReceiveAll (receiverBatch1, receiver1, sender.local_endpoint (), packets, pool);
+}
+
+int main ()
+{
+	Test (false, false); // plain recvmmsg/sendmmsg
+	Test (true, false); // GSO if supported, kernel splits
+	Test (false, true); // GRO if supported
+	Test (true, true);
+}
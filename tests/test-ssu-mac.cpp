@@ -0,0 +1,49 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+
+#include "../Crypto.h"
+
+int main ()
+{
+	// fused MAC check and decryption must match HMAC-MD5 followed by CBC decryption
+	const size_t lens[] = { 16, 64, 112, 128, 144, 256, 304, 1440 };
+	i2p::crypto::AESKey aesKey;
+	i2p::crypto::MACKey macKey;
+	RAND_bytes (aesKey, 32);
+	RAND_bytes (macKey, 32);
+	i2p::crypto::CBCEncryption encryption;
+	i2p::crypto::CBCDecryption decryption, serialDecryption;
+	encryption.SetKey (aesKey);
+	decryption.SetKey (aesKey);
+	serialDecryption.SetKey (aesKey);
+	for (auto len: lens)
+	{
+		uint8_t iv[16], plainText[1500], cipherText[1500 + 18], buf[1500 + 18], mac[16], expected[1500];
+		RAND_bytes (iv, 16);
+		RAND_bytes (plainText, len);
+		encryption.SetIV (iv);
+		encryption.Encrypt (plainText, len, cipherText);
+		RAND_bytes (cipherText + len, 18); // iv and size in SSU
+		i2p::crypto::HMACMD5Digest (cipherText, len + 18, macKey, mac);
+
+		// serial Validate and Decrypt
+		uint8_t digest[16];
+		i2p::crypto::HMACMD5Digest (cipherText, len + 18, macKey, digest);
+		assert (!memcmp (digest, mac, 16));
+		serialDecryption.SetIV (iv);
+		serialDecryption.Decrypt (cipherText, len, expected);
+		assert (!memcmp (expected, plainText, len));
+
+		// matching MAC
+		memcpy (buf, cipherText, len + 18);
+		assert (i2p::crypto::HMACMD5DecryptIfValid (buf, len, 18, macKey, mac, iv, decryption, encryption));
+		assert (!memcmp (buf, expected, len));
+
+		// mismatching MAC, buffer must be restored
+		mac[len % 16] ^= 0x01;
+		memcpy (buf, cipherText, len + 18);
+		assert (!i2p::crypto::HMACMD5DecryptIfValid (buf, len, 18, macKey, mac, iv, decryption, encryption));
+		assert (!memcmp (buf, cipherText, len + 18));
+	}
+}
@@ -0,0 +1,75 @@
+#include <cassert>
+#include <memory>
+#include <list>
+
+#include "../TransportSession.h"
+
+using namespace i2p;
+using namespace i2p::transport;
+
+class TestSession: public TransportSession
+{
+	public:
+
+		TestSession (int rtt, uint32_t throughput, size_t backlog): TransportSession (nullptr, 0)
+		{
+			SetRTT (rtt);
+			m_Throughput = throughput;
+			for (size_t i = 0; i < backlog; i++)
+				m_SendQueue.Push (std::make_shared<I2NPMessageBuffer<64> >());
+		}
+
+		void Done () {}
+		void SendI2NPMessages (const std::vector<std::shared_ptr<I2NPMessage> >&) {}
+		TransportType GetTransportType () const { return eTransportNTCP; }
+};
+
+int main ()
+{
+	// idle session costs its RTT, new one default RTT
+	assert (GetTransportCost (100) == 100);
+	assert (GetTransportCost (0) == TRANSPORT_SESSION_DEFAULT_RTT);
+	assert (GetTransportCost (100, 1000000) == 100);
+	// queue drains at throughput, 1K messages
+	assert (GetTransportCost (100, 1024000, 32) == 132);
+	assert (GetTransportCost (100, 102400, 32) == 420);
+	// unknown or low throughput is not trusted above minimal
+	assert (GetTransportCost (100, 0, 16) == 100 + 16*1024*1000/TRANSPORT_SESSION_MIN_THROUGHPUT);
+	assert (GetTransportCost (100, 1, 16) == GetTransportCost (100, 0, 16));
+
+	typedef std::list<std::shared_ptr<TransportSession> > Sessions;
+	Sessions sessions;
+	assert (!SelectTransportSession (sessions));
+	auto slow = std::make_shared<TestSession> (300, 0, 0);
+	sessions.push_back (slow);
+	assert (SelectTransportSession (sessions) == slow);
+
+	// lower RTT wins if idle
+	auto fast = std::make_shared<TestSession> (50, 0, 0);
+	sessions.push_back (fast);
+	assert (SelectTransportSession (sessions) == fast);
+
+	// backlog on low throughput session costs more than RTT difference
+	sessions.clear ();
+	auto busy = std::make_shared<TestSession> (50, 20*1024, 10);
+	sessions.push_back (busy); sessions.push_back (slow);
+	assert (busy->GetCost () == 550);
+	assert (SelectTransportSession (sessions) == slow);
+
+	// high throughput drains its queue fast, stays the best until backlogged
+	sessions.clear ();
+	auto fat = std::make_shared<TestSession> (50, 10*1024*1024, TRANSPORT_SESSION_BACKLOG_SIZE - 1);
+	sessions.push_back (slow); sessions.push_back (fat);
+	assert (SelectTransportSession (sessions) == fat);
+	auto backlogged = std::make_shared<TestSession> (50, 10*1024*1024, TRANSPORT_SESSION_BACKLOG_SIZE);
+	assert (backlogged->IsBacklogged ());
+	sessions.clear ();
+	sessions.push_back (backlogged); sessions.push_back (slow);
+	assert (backlogged->GetCost () < slow->GetCost ());
+	assert (SelectTransportSession (sessions) == slow); // spill over
+	// no spill over to longer queue
+	auto other = std::make_shared<TestSession> (300, 0, TRANSPORT_SESSION_BACKLOG_SIZE + 1);
+	sessions.clear ();
+	sessions.push_back (backlogged); sessions.push_back (other);
+	assert (SelectTransportSession (sessions) == backlogged);
+}
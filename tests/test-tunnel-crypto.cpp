@@ -0,0 +1,55 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+
+#include "../Crypto.h"
+
+int main ()
+{
+	// interleaved layer encryption of num messages must match one by one encryption
+	const size_t maxNum = 8;
+	i2p::crypto::TunnelEncryption encryptions[maxNum];
+	i2p::crypto::TunnelDecryption decryptions[maxNum];
+	for (size_t i = 0; i < maxNum; i++)
+	{
+		i2p::crypto::AESKey layerKey, ivKey;
+		RAND_bytes (layerKey, 32);
+		RAND_bytes (ivKey, 32);
+		encryptions[i].SetKeys (layerKey, ivKey);
+		decryptions[i].SetKeys (layerKey, ivKey);
+	}
+	static uint8_t msgs[maxNum][1024], expected[maxNum][1024], batch[maxNum][1024];
+	for (size_t num = 1; num <= maxNum; num++)
+	{
+		i2p::crypto::TunnelEncryption * encs[maxNum];
+		i2p::crypto::TunnelDecryption * decs[maxNum];
+		const uint8_t * in[maxNum];
+		uint8_t * out[maxNum], * inPlace[maxNum];
+		for (size_t i = 0; i < num; i++)
+		{
+			RAND_bytes (msgs[i], 1024);
+			encs[i] = encryptions + i; decs[i] = decryptions + i;
+			in[i] = msgs[i]; out[i] = batch[i]; inPlace[i] = expected[i];
+		}
+
+		for (size_t i = 0; i < num; i++)
+			encryptions[i].Encrypt (msgs[i], expected[i]);
+		i2p::crypto::TunnelEncryption::Encrypt (num, encs, in, out);
+		for (size_t i = 0; i < num; i++)
+			assert (!memcmp (batch[i], expected[i], 1024));
+
+		for (size_t i = 0; i < num; i++)
+			decryptions[i].Decrypt (msgs[i], expected[i]);
+		i2p::crypto::TunnelDecryption::Decrypt (num, decs, in, out);
+		for (size_t i = 0; i < num; i++)
+			assert (!memcmp (batch[i], expected[i], 1024));
+
+		// in place, decryption restores original messages
+		for (size_t i = 0; i < num; i++)
+			memcpy (expected[i], msgs[i], 1024);
+		i2p::crypto::TunnelEncryption::Encrypt (num, encs, (const uint8_t * const *)inPlace, inPlace);
+		i2p::crypto::TunnelDecryption::Decrypt (num, decs, (const uint8_t * const *)inPlace, inPlace);
+		for (size_t i = 0; i < num; i++)
+			assert (!memcmp (expected[i], msgs[i], 1024));
+	}
+}
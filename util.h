@@ -5,6 +5,7 @@
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <atomic>
 #include <boost/asio.hpp>
 
 #ifdef ANDROID
@@ -116,6 +117,143 @@ namespace util
 			std::mutex m_Mutex;
 	};
 
+	struct MemoryPoolStats
+	{
+		size_t live, peak, recycled;
+	};
+
+	/** fixed size chunks, kept in per-thread free lists. Chunks released by other thread 
+		go to that thread's list and spill over to shared list, where they can be picked up by anybody */
+	template<size_t ChunkSize, size_t MaxCached, typename Tag = void>
+	class ThreadCachedMemoryPool
+	{
+		static_assert (ChunkSize >= sizeof (void *), "Chunk is too small");
+
+		struct FreeList
+		{
+			void * head = nullptr;
+			size_t num = 0;
+
+			void Push (void * p) { *(void * *)p = head; head = p; num++; }
+			void * Pop () { auto p = head; head = *(void * *)p; num--; return p; }
+		};
+
+		struct Shared: public FreeList
+		{
+			std::mutex mutex;
+			std::atomic<size_t> live, peak, recycled;
+
+			Shared (): live (0), peak (0), recycled (0) {}
+		};
+
+		struct Cache: public FreeList
+		{
+			~Cache () // thread exit
+			{
+				IsCacheDestroyed () = true;
+				ReleaseToShared (*this, this->num);
+			}
+		};
+
+		public:
+
+			static void * Acquire ()
+			{
+				auto& shared = GetShared ();
+				if (IsCacheDestroyed ())
+				{
+					// thread is exiting, static destructors might still allocate
+					shared.live++;
+					return ::operator new (ChunkSize);
+				}
+				auto& cache = GetCache ();
+				if (!cache.num)
+				{
+					// refill half of cache from shared list
+					std::unique_lock<std::mutex> l(shared.mutex);
+					while (shared.num && cache.num < MaxCached/2 + 1)
+						cache.Push (shared.Pop ());
+				}
+				auto live = ++shared.live, peak = shared.peak.load ();
+				while (live > peak && !shared.peak.compare_exchange_weak (peak, live));
+				if (cache.num)
+				{
+					shared.recycled++;
+					return cache.Pop ();
+				}
+				return ::operator new (ChunkSize);
+			}
+
+			static void Release (void * p)
+			{
+				if (!p) return;
+				GetShared ().live--;
+				if (IsCacheDestroyed ())
+				{
+					// released by static destructors at exit
+					::operator delete (p);
+					return;
+				}
+				auto& cache = GetCache ();
+				cache.Push (p);
+				if (cache.num > MaxCached)
+					ReleaseToShared (cache, MaxCached/2);
+			}
+
+			static MemoryPoolStats GetStats ()
+			{
+				auto& shared = GetShared ();
+				return { shared.live.load (), shared.peak.load (), shared.recycled.load () };
+			}
+
+		private:
+
+			static void ReleaseToShared (FreeList& cache, size_t num)
+			{
+				auto& shared = GetShared ();
+				std::unique_lock<std::mutex> l(shared.mutex);
+				for (size_t i = 0; i < num && cache.num; i++)
+				{
+					auto p = cache.Pop ();
+					if (shared.num < MaxCached*16)
+						shared.Push (p);
+					else
+						::operator delete (p); // don't keep more than 16 caches
+				}
+			}
+
+			static Shared& GetShared () { static Shared * shared = new Shared (); return *shared; } // never deleted, outlives all static owners of chunks
+			static Cache& GetCache () { static thread_local Cache cache; return cache; }
+			static bool& IsCacheDestroyed () { static thread_local bool destroyed = false; return destroyed; } // trivial, stays valid after Cache is gone
+	};
+
+	/** std allocator on top of ThreadCachedMemoryPool, for allocate_shared */
+	template<typename T, size_t ChunkSize, size_t MaxCached, typename Tag = void>
+	struct ThreadCachedAllocator
+	{
+		typedef T value_type;
+		typedef ThreadCachedMemoryPool<ChunkSize, MaxCached, Tag> Pool;
+		template<typename U> struct rebind { typedef ThreadCachedAllocator<U, ChunkSize, MaxCached, Tag> other; };
+
+		ThreadCachedAllocator () {}
+		template<typename U> ThreadCachedAllocator (const ThreadCachedAllocator<U, ChunkSize, MaxCached, Tag>&) {}
+
+		T * allocate (size_t n)
+		{
+			if (n*sizeof (T) <= ChunkSize) return static_cast<T *>(Pool::Acquire ());
+			return static_cast<T *>(::operator new (n*sizeof (T)));
+		}
+
+		void deallocate (T * p, size_t n)
+		{
+			if (n*sizeof (T) <= ChunkSize) Pool::Release (p);
+			else ::operator delete (p);
+		}
+
+		template<typename U> bool operator== (const ThreadCachedAllocator<U, ChunkSize, MaxCached, Tag>&) const { return true; }
+		template<typename U> bool operator!= (const ThreadCachedAllocator<U, ChunkSize, MaxCached, Tag>&) const { return false; }
+	};
+
 	namespace net
 	{
 		int GetMTU (const boost::asio::ip::address& localAddress);